@@ -23,6 +23,15 @@ namespace NktBtcIndex
         [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
         private static extern void destroy_index(IntPtr parser);
 
+        [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern IntPtr index_result_data(IntPtr result);
+
+        [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern IntPtr index_result_size(IntPtr result);
+
+        [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern void index_release_result(IntPtr result);
+
         [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
         private static extern IntPtr index_get_utxo(IntPtr dll, [MarshalAs(UnmanagedType.LPArray)] byte[] addresses);
 
@@ -38,15 +47,39 @@ namespace NktBtcIndex
         [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
         private static extern IntPtr index_get_history(IntPtr dll, [MarshalAs(UnmanagedType.LPArray)] byte[] addresses);
 
+        [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern IntPtr index_get_utxo_bin(IntPtr dll, [MarshalAs(UnmanagedType.LPArray)] byte[] request, IntPtr request_size);
+
+        [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern IntPtr index_get_balances_bin(IntPtr dll, [MarshalAs(UnmanagedType.LPArray)] byte[] request, IntPtr request_size);
+
+        [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern IntPtr index_get_history_bin(IntPtr dll, [MarshalAs(UnmanagedType.LPArray)] byte[] request, IntPtr request_size);
+
+        [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern IntPtr index_get_address_usage(IntPtr dll, [MarshalAs(UnmanagedType.LPArray)] byte[] addresses);
+
+        [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern IntPtr index_get_address_usage_bin(IntPtr dll, [MarshalAs(UnmanagedType.LPArray)] byte[] request, IntPtr request_size);
+
         [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
         private static extern long index_get_blockchain_height(IntPtr dll);
 
         [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
         private static extern IntPtr index_push_new_block(IntPtr dll, [MarshalAs(UnmanagedType.LPArray)] byte[] data, IntPtr data_size);
 
+        [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern IntPtr index_push_new_blocks(IntPtr dll, IntPtr[] blocks, IntPtr[] sizes, IntPtr count);
+
         [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
         private static extern IntPtr index_get_fees(IntPtr dll);
 
+        [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern IntPtr index_get_address_filter_stats(IntPtr dll);
+
+        [DllImport("libbtcindex", CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        private static extern IntPtr index_get_stats(IntPtr dll, [MarshalAs(UnmanagedType.LPArray)] byte[] format);
+
         private static readonly log4net.ILog Log = log4net.LogManager.GetLogger(System.Reflection.MethodBase.GetCurrentMethod().DeclaringType);
 
         private IntPtr _index = IntPtr.Zero;
@@ -89,14 +122,36 @@ namespace NktBtcIndex
             }
         }
         
+        private static byte[] ResultToBytes(IntPtr result)
+        {
+            if (result == IntPtr.Zero)
+                return null;
+            try
+            {
+                var buffer = new byte[(long)index_result_size(result)];
+                Marshal.Copy(index_result_data(result), buffer, 0, buffer.Length);
+                return buffer;
+            }
+            finally
+            {
+                index_release_result(result);
+            }
+        }
+
+        private static string ResultToString(IntPtr result)
+        {
+            var buffer = ResultToBytes(result);
+            return buffer == null ? null : Encoding.UTF8.GetString(buffer);
+        }
+
         public string GetUtxo(string jsonAddresses)
         {
-            return Utility.Utf8ToString(index_get_utxo(_index, Utility.StringToUtf8(jsonAddresses)));
+            return ResultToString(index_get_utxo(_index, Utility.StringToUtf8(jsonAddresses)));
         }
 
         public string GetUtxoInsight(string jsonAddresses)
         {
-            return Utility.Utf8ToString(index_get_utxo_insight(_index, Utility.StringToUtf8(jsonAddresses)));
+            return ResultToString(index_get_utxo_insight(_index, Utility.StringToUtf8(jsonAddresses)));
         }
 
         public string GetBalance(IEnumerable<string> addresses)
@@ -106,17 +161,44 @@ namespace NktBtcIndex
 
         public string GetBalance(string jsonAddresses)
         {
-            return Utility.Utf8ToString(index_get_balance(_index, Utility.StringToUtf8(jsonAddresses)));
+            return ResultToString(index_get_balance(_index, Utility.StringToUtf8(jsonAddresses)));
         }
 
         public string GetBalances(string jsonAddresses)
         {
-            return Utility.Utf8ToString(index_get_balances(_index, Utility.StringToUtf8(jsonAddresses)));
+            return ResultToString(index_get_balances(_index, Utility.StringToUtf8(jsonAddresses)));
         }
 
         public string GetHistory(string jsonParams)
         {
-            return Utility.Utf8ToString(index_get_history(_index, Utility.StringToUtf8(jsonParams)));
+            return ResultToString(index_get_history(_index, Utility.StringToUtf8(jsonParams)));
+        }
+
+        public string GetAddressUsage(string jsonAddresses)
+        {
+            return ResultToString(index_get_address_usage(_index, Utility.StringToUtf8(jsonAddresses)));
+        }
+
+        // The *Binary methods take and return the compact encoding described in
+        // libbtcindex/BinaryProtocol.h, so the REST layer can forward them as is.
+        public byte[] GetUtxoBinary(byte[] request)
+        {
+            return ResultToBytes(index_get_utxo_bin(_index, request, (IntPtr)request.Length));
+        }
+
+        public byte[] GetBalancesBinary(byte[] request)
+        {
+            return ResultToBytes(index_get_balances_bin(_index, request, (IntPtr)request.Length));
+        }
+
+        public byte[] GetHistoryBinary(byte[] request)
+        {
+            return ResultToBytes(index_get_history_bin(_index, request, (IntPtr)request.Length));
+        }
+
+        public byte[] GetAddressUsageBinary(byte[] request)
+        {
+            return ResultToBytes(index_get_address_usage_bin(_index, request, (IntPtr)request.Length));
         }
 
         public long GetLatestIndexedBlock()
@@ -134,6 +216,8 @@ namespace NktBtcIndex
             public long DbId;
             [JsonProperty("new_height")]
             public long NewHeight;
+            [JsonProperty("error")]
+            public string Error;
         }
 
         public PushNewBlockResult PushNewBlock(byte[] rawBlock)
@@ -145,15 +229,52 @@ namespace NktBtcIndex
                 length = (IntPtr) rawBlock.LongLength;
             else
                 throw new Exception("Unsupported platform. Must be 32- or 64-bit.");
-            var jsonString = Utility.Utf8ToString(index_push_new_block(_index, rawBlock, length));
+            var jsonString = ResultToString(index_push_new_block(_index, rawBlock, length));
             if (jsonString == null)
                 throw new Exception("libbtcindex threw an error.");
             return JsonConvert.DeserializeObject<PushNewBlockResult>(jsonString);
         }
 
+        public PushNewBlockResult[] PushNewBlocks(byte[][] rawBlocks)
+        {
+            var handles = new GCHandle[rawBlocks.Length];
+            var pointers = new IntPtr[rawBlocks.Length];
+            var sizes = new IntPtr[rawBlocks.Length];
+            try
+            {
+                for (int i = 0; i < rawBlocks.Length; i++)
+                {
+                    handles[i] = GCHandle.Alloc(rawBlocks[i], GCHandleType.Pinned);
+                    pointers[i] = handles[i].AddrOfPinnedObject();
+                    sizes[i] = (IntPtr)rawBlocks[i].LongLength;
+                }
+                var jsonString = ResultToString(index_push_new_blocks(_index, pointers, sizes, (IntPtr)rawBlocks.Length));
+                if (jsonString == null)
+                    throw new Exception("libbtcindex threw an error.");
+                return JsonConvert.DeserializeObject<PushNewBlockResult[]>(jsonString);
+            }
+            finally
+            {
+                foreach (var handle in handles)
+                    if (handle.IsAllocated)
+                        handle.Free();
+            }
+        }
+
         public string GetFees()
         {
-            return Utility.Utf8ToString(index_get_fees(_index));
+            return ResultToString(index_get_fees(_index));
+        }
+
+        public string GetAddressFilterStats()
+        {
+            return ResultToString(index_get_address_filter_stats(_index));
+        }
+
+        // format is "json" or "prometheus".
+        public string GetStats(string format)
+        {
+            return ResultToString(index_get_stats(_index, Utility.StringToUtf8(format)));
         }
 
         private long UpdateToHash(string hash)
@@ -169,6 +290,35 @@ namespace NktBtcIndex
             return result.NewHeight;
         }
 
+        private const long InitialUpdateBatchSize = 100;
+
+        // Pushes the blocks following latestBlock in a single call. If the
+        // batch can't be added as a whole (e.g. because the node reorganized
+        // while we were downloading), the first block that failed is retried
+        // through UpdateToHash().
+        private long UpdateBatch(long latestBlock, long count)
+        {
+            var hashes = new string[count];
+            var rawBlocks = new byte[count][];
+            for (long i = 0; i < count; i++)
+            {
+                hashes[i] = _rpc.GetBlockHash(latestBlock + 1 + i);
+                rawBlocks[i] = _rpc.GetRawBlock(hashes[i]);
+            }
+            var results = PushNewBlocks(rawBlocks);
+            foreach (var result in results)
+            {
+                if (result.Error != null)
+                    throw new Exception($"libbtcindex failed to add a block: {result.Error}");
+                if (result.BlockRequired != null)
+                    return UpdateToHash(hashes[results.Length - 1]);
+                if (result.BlocksReverted != 0)
+                    Log.Info($"Blocks reverted: {result.BlocksReverted}");
+                latestBlock = result.NewHeight;
+            }
+            return latestBlock;
+        }
+
         private void DoInitialUpdate()
         {
             Log.Info("Doing initial update.");
@@ -179,7 +329,10 @@ namespace NktBtcIndex
             {
                 Log.Info($"Updating to block height {latestBlock + 1} ({latestBlockInBlockChain - latestBlock} remaining).");
                 sw.Restart();
-                latestBlock = UpdateToHash(_rpc.GetBlockHash(latestBlock + 1));
+                if (latestBlockInBlockChain - latestBlock > 1)
+                    latestBlock = UpdateBatch(latestBlock, Math.Min(latestBlockInBlockChain - latestBlock, InitialUpdateBatchSize));
+                else
+                    latestBlock = UpdateToHash(_rpc.GetBlockHash(latestBlock + 1));
                 sw.Stop();
                 Log.Info($"Elapsed: {sw.ElapsedMilliseconds} ms");
                 latestBlockInBlockChain = _rpc.GetLatestBlock();
@@ -24,6 +24,8 @@ namespace NktBtcIndex
         private HttpListener _listener = new HttpListener();
         private delegate void RequestHandler(HttpListenerResponse response, HttpListenerRequest request, string requestBody);
         private Dictionary<string, RequestHandler> _handlers = new Dictionary<string, RequestHandler>();
+        private delegate void BinaryRequestHandler(HttpListenerResponse response, byte[] requestBody);
+        private Dictionary<string, BinaryRequestHandler> _binaryHandlers = new Dictionary<string, BinaryRequestHandler>();
         private BtcIndex _index;
 
         private void AddEndpoint(string method, string path, RequestHandler handler)
@@ -31,6 +33,11 @@ namespace NktBtcIndex
             _handlers.Add(method.ToUpper() + "+" + path, handler);
         }
 
+        private void AddBinaryEndpoint(string method, string path, BinaryRequestHandler handler)
+        {
+            _binaryHandlers.Add(method.ToUpper() + "+" + path, handler);
+        }
+
         public RestService(BtcIndex index)
         {
             _index = index;
@@ -41,9 +48,16 @@ namespace NktBtcIndex
             AddEndpoint("POST", "/api/balance", HandleBalance);
             AddEndpoint("POST", "/api/balances", HandleBalances);
             AddEndpoint("POST", "/api/history", HandleHistory);
+            AddEndpoint("POST", "/api/address_usage", HandleAddressUsage);
             AddEndpoint("GET", "/api/fees", HandleFees);
+            AddEndpoint("GET", "/api/stats", HandleStats);
+            AddEndpoint("GET", "/metrics", HandleMetrics);
             AddEndpoint("POST", "/web/utxo", HandleWebUtxo);
             AddEndpoint("GET", "/", HandleIndex);
+            AddBinaryEndpoint("POST", "/bin/utxo", (response, body) => response.WriteBytes(_index.GetUtxoBinary(body)));
+            AddBinaryEndpoint("POST", "/bin/balances", (response, body) => response.WriteBytes(_index.GetBalancesBinary(body)));
+            AddBinaryEndpoint("POST", "/bin/history", (response, body) => response.WriteBytes(_index.GetHistoryBinary(body)));
+            AddBinaryEndpoint("POST", "/bin/address_usage", (response, body) => response.WriteBytes(_index.GetAddressUsageBinary(body)));
         }
 
         public void Dispose()
@@ -109,7 +123,7 @@ namespace NktBtcIndex
             try
             {
                 var url = context.Request.RawUrl;
-                var body = context.Request.GetBody();
+                var bodyBytes = context.Request.GetBodyBytes();
                 //Log.Info($"Request URL: {url}");
                 //Log.Info($"Request headers: {context.Request.Headers}");
                 //Log.Info($"Request method: {context.Request.HttpMethod}");
@@ -119,14 +133,20 @@ namespace NktBtcIndex
                 Log.Info($"Handling {key}");
                 var sw = new Stopwatch();
                 sw.Start();
+                BinaryRequestHandler binaryHandler;
                 RequestHandler handler;
-                if (!_handlers.TryGetValue(key, out handler))
+                if (_binaryHandlers.TryGetValue(key, out binaryHandler))
+                {
+                    binaryHandler(context.Response, bodyBytes);
+                }
+                else if (_handlers.TryGetValue(key, out handler))
+                    handler(context.Response, context.Request, Encoding.UTF8.GetString(bodyBytes));
+                else
                 {
                     Log.Error($"Couldn't find handler for request {key}");
                     context.Response.WriteString(string.Empty);
                     return;
                 }
-                handler(context.Response, context.Request, body);
                 sw.Stop();
                 Log.Info($"{key} handled in {sw.ElapsedMilliseconds} ms.");
             }
@@ -158,11 +178,27 @@ namespace NktBtcIndex
             response.WriteString(_index.GetHistory(body));
         }
 
+        void HandleAddressUsage(HttpListenerResponse response, HttpListenerRequest request, string body)
+        {
+            response.WriteString(_index.GetAddressUsage(body));
+        }
+
         void HandleFees(HttpListenerResponse response, HttpListenerRequest request, string body)
         {
             response.WriteString(_index.GetFees());
         }
 
+        void HandleStats(HttpListenerResponse response, HttpListenerRequest request, string body)
+        {
+            response.WriteString(_index.GetStats("json"));
+        }
+
+        void HandleMetrics(HttpListenerResponse response, HttpListenerRequest request, string body)
+        {
+            response.ContentType = "text/plain; version=0.0.4";
+            response.WriteString(_index.GetStats("prometheus"));
+        }
+
         private void HandleIndex(HttpListenerResponse response, HttpListenerRequest request, string requestbody)
         {
             const string body = @"
@@ -201,18 +237,6 @@ Addresses (comma-separated): <input type=""text"" name=""addresses""></input><br
             foreach (var address in addressesString.Split(Utility.Comma, StringSplitOptions.RemoveEmptyEntries))
                 json.Add(address);
 
-            var result =
-                JsonConvert.DeserializeObject<Dictionary<string, List<UtxoResult>>>(
-                    _index.GetUtxo(json.ToString(Formatting.None)));
-
-            var sb = new StringBuilder();
-
-            sb.Append(@"<html>
-<head>
-<title>Utxo</title>
-</head>
-<body>");
-
             response.WriteString(_index.GetUtxo(json.ToString(Formatting.None)));
         }
         
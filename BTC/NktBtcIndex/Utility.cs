@@ -63,6 +63,15 @@ namespace NktBtcIndex
             return new StreamReader(request.InputStream).ReadToEnd();
         }
 
+        public static byte[] GetBodyBytes(this HttpListenerRequest request)
+        {
+            using (var stream = new MemoryStream())
+            {
+                request.InputStream.CopyTo(stream);
+                return stream.ToArray();
+            }
+        }
+
         public static void WriteString(this HttpListenerResponse response, string s)
         {
             var buffer = Encoding.UTF8.GetBytes(s);
@@ -71,6 +80,14 @@ namespace NktBtcIndex
             response.OutputStream.Close();
         }
 
+        public static void WriteBytes(this HttpListenerResponse response, byte[] buffer)
+        {
+            response.ContentType = "application/octet-stream";
+            response.ContentLength64 = buffer.Length;
+            response.OutputStream.Write(buffer, 0, buffer.Length);
+            response.OutputStream.Close();
+        }
+
         private static char[] Ampersand = { '&' };
         public static char[] Comma = { ',' };
         private static char[] EqualsChar = { '=' };
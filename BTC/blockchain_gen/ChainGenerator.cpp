@@ -0,0 +1,455 @@
+#include "ChainGenerator.h"
+#include <boost/filesystem.hpp>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <stdexcept>
+
+static const u32 magic_number = 0xD9B4BEF9;
+static const u32 magic_number_testnet = 0x0709110B;
+
+//Expands the seed with splitmix64, since xorshift needs a non-zero state.
+static xorshift128_state make_seed(u64 seed){
+	xorshift128_state ret;
+	for (auto &i : ret.data){
+		seed += 0x9e3779b97f4a7c15ULL;
+		auto z = seed;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		i = (std::uint32_t)(z ^ (z >> 31));
+	}
+	return ret;
+}
+
+static void write_varint(std::vector<u8> &dst, u64 n){
+	if (n < 0xFD){
+		dst.push_back((u8)n);
+		return;
+	}
+	int size;
+	if (n <= 0xFFFF){
+		dst.push_back(0xFD);
+		size = 2;
+	}else if (n <= 0xFFFFFFFF){
+		dst.push_back(0xFE);
+		size = 4;
+	}else{
+		dst.push_back(0xFF);
+		size = 8;
+	}
+	for (int i = 0; i < size; i++)
+		dst.push_back((u8)(n >> (i * 8)));
+}
+
+static void write_int(std::vector<u8> &dst, u64 n, int size){
+	for (int i = 0; i < size; i++)
+		dst.push_back((u8)(n >> (i * 8)));
+}
+
+static void write_bytes(std::vector<u8> &dst, const u8 *src, size_t n){
+	dst.insert(dst.end(), src, src + n);
+}
+
+static Hashes::Digests::SHA256 double_sha256(const std::vector<u8> &data){
+	return Hashes::Algorithms::SHA256::compute(data, 2);
+}
+
+ChainGenerator::ChainGenerator(const ChainGeneratorSettings &settings)
+	: settings(settings)
+	, rng(make_seed(settings.seed)){}
+
+void ChainGenerator::bytes(std::vector<u8> &dst, size_t n){
+	for (size_t i = 0; i < n; i++)
+		dst.push_back((u8)this->rng());
+}
+
+//Some addresses are reused much more than others, like those of exchanges
+//and pools, so reuses favor the addresses that were created first.
+const std::array<u8, 32> &ChainGenerator::pick_address(){
+	auto n = this->addresses.size();
+	if (n && this->uniform() < 0.4){
+		auto u = this->uniform();
+		return this->addresses[(size_t)(n * u * u * u)];
+	}
+	std::array<u8, 32> address;
+	for (auto &b : address)
+		b = (u8)this->rng();
+	this->addresses.push_back(address);
+	return this->addresses.back();
+}
+
+//The mix of script types shifts along the chain: P2PK early on, then P2PKH
+//and P2SH, and segwit programs in the second half.
+std::vector<u8> ChainGenerator::output_script(u64 height){
+	auto f = (double)height / this->settings.blocks;
+	auto segwit = std::max(0.0, (f - 0.5) * 2);
+	const double weights[] = {
+		30 * (1 - f) * (1 - f) * (1 - f) * (1 - f),
+		60,
+		15 * f,
+		1,
+		4 * f,
+		40 * segwit,
+		8 * segwit,
+	};
+	double total = 0;
+	for (auto w : weights)
+		total += w;
+	auto r = this->uniform() * total;
+	int kind = 0;
+	for (; kind < 6 && r >= weights[kind]; kind++)
+		r -= weights[kind];
+
+	std::vector<u8> ret;
+	auto &address = this->pick_address();
+	switch (kind){
+		case 0:
+			//P2PK
+			ret.push_back(33);
+			ret.push_back((u8)(2 + (address[0] & 1)));
+			write_bytes(ret, address.data(), 32);
+			ret.push_back(0xAC);
+			break;
+		case 1:
+			//P2PKH
+			ret = { 0x76, 0xA9, 20 };
+			write_bytes(ret, address.data(), 20);
+			ret.push_back(0x88);
+			ret.push_back(0xAC);
+			break;
+		case 2:
+			//P2SH
+			ret = { 0xA9, 20 };
+			write_bytes(ret, address.data(), 20);
+			ret.push_back(0x87);
+			break;
+		case 3:
+			//1-of-2 multisig
+			ret = { 0x51 };
+			for (int i = 0; i < 2; i++){
+				ret.push_back(33);
+				ret.push_back(2);
+				if (!i)
+					write_bytes(ret, address.data(), 32);
+				else
+					this->bytes(ret, 32);
+			}
+			ret.push_back(0x52);
+			ret.push_back(0xAE);
+			break;
+		case 4:
+			//OP_RETURN
+			ret = { 0x6A };
+			{
+				auto n = 1 + this->below(40);
+				ret.push_back((u8)n);
+				this->bytes(ret, n);
+			}
+			break;
+		case 5:
+			//P2WPKH
+			ret = { 0x00, 20 };
+			write_bytes(ret, address.data(), 20);
+			break;
+		default:
+			//P2WSH
+			ret = { 0x00, 32 };
+			write_bytes(ret, address.data(), 32);
+			break;
+	}
+	return ret;
+}
+
+//Most spends are of young outputs.
+ChainGenerator::Utxo ChainGenerator::take_utxo(){
+	auto n = this->utxos.size();
+	auto u = this->uniform();
+	auto i = n - 1 - (size_t)(n * u * u * u);
+	auto ret = this->utxos[i];
+	this->utxos[i] = this->utxos.back();
+	this->utxos.pop_back();
+	return ret;
+}
+
+std::vector<u8> ChainGenerator::coinbase(u64 height, u64 extra_nonce, SHA256 &hash){
+	std::vector<u8> ret;
+	write_int(ret, 1, 4);
+	write_varint(ret, 1);
+	ret.resize(ret.size() + 32);
+	write_int(ret, 0xFFFFFFFF, 4);
+	//BIP34 height followed by an extra nonce.
+	ret.push_back(1 + 4 + 1 + 8);
+	ret.push_back(4);
+	write_int(ret, height, 4);
+	ret.push_back(8);
+	write_int(ret, extra_nonce, 8);
+	write_int(ret, 0xFFFFFFFF, 4);
+	u64 value = 5000000000ULL >> std::min<u64>(height / 210000, 63);
+	write_varint(ret, 1);
+	write_int(ret, value, 8);
+	auto script = this->output_script(height);
+	write_varint(ret, script.size());
+	ret.insert(ret.end(), script.begin(), script.end());
+	write_int(ret, 0, 4);
+	hash = double_sha256(ret);
+	this->result.txs++;
+	this->result.inputs++;
+	this->result.outputs++;
+	return ret;
+}
+
+bool ChainGenerator::transaction(u64 height, std::vector<u8> &dst, SHA256 &hash){
+	if (!this->utxos.size())
+		return false;
+
+	auto r = this->uniform();
+	size_t input_count;
+	if (r < 0.68)
+		input_count = 1;
+	else if (r < 0.85)
+		input_count = 2;
+	else if (r < 0.92)
+		input_count = 3;
+	else if (r < 0.97)
+		input_count = 4 + this->below(6);
+	else
+		//Consolidations.
+		input_count = 10 + this->below(30);
+	input_count = std::min(input_count, this->utxos.size());
+
+	r = this->uniform();
+	size_t output_count;
+	if (r < 0.2)
+		output_count = 1;
+	else if (r < 0.85)
+		output_count = 2;
+	else if (r < 0.95)
+		output_count = 3 + this->below(3);
+	else
+		//Batched payouts.
+		output_count = 6 + this->below(95);
+
+	auto f = (double)height / this->settings.blocks;
+	bool segwit = this->uniform() < std::max(0.0, (f - 0.5) * 1.2);
+
+	//The txid covers everything but the witnesses, so the body is built
+	//separately.
+	std::vector<u8> body;
+	std::vector<u8> witnesses;
+	u64 total = 0;
+	write_varint(body, input_count);
+	for (size_t i = 0; i < input_count; i++){
+		auto utxo = this->take_utxo();
+		total += utxo.value;
+		write_bytes(body, utxo.tx_hash.to_array().data(), 32);
+		write_int(body, utxo.index, 4);
+		if (segwit){
+			body.push_back(0);
+			witnesses.push_back(2);
+			witnesses.push_back(72);
+			this->bytes(witnesses, 72);
+			witnesses.push_back(33);
+			this->bytes(witnesses, 33);
+		}else{
+			//Signature and compressed public key.
+			body.push_back(1 + 71 + 1 + 33);
+			body.push_back(71);
+			this->bytes(body, 71);
+			body.push_back(33);
+			this->bytes(body, 33);
+		}
+		write_int(body, 0xFFFFFFFE, 4);
+	}
+
+	auto fee = std::min(total / 2, 1000 + this->below(20000));
+	auto remaining = total - fee;
+	std::vector<std::vector<u8>> scripts(output_count);
+	std::vector<u64> values(output_count);
+	for (size_t i = 0; i < output_count; i++){
+		scripts[i] = this->output_script(height);
+		if (scripts[i][0] == 0x6A)
+			continue;
+		values[i] = i + 1 < output_count ? this->below(remaining + 1) : remaining;
+		remaining -= values[i];
+	}
+	write_varint(body, output_count);
+	for (size_t i = 0; i < output_count; i++){
+		write_int(body, values[i], 8);
+		write_varint(body, scripts[i].size());
+		body.insert(body.end(), scripts[i].begin(), scripts[i].end());
+	}
+
+	u32 version = segwit ? 2 : 1;
+	std::vector<u8> stripped;
+	write_int(stripped, version, 4);
+	stripped.insert(stripped.end(), body.begin(), body.end());
+	write_int(stripped, 0, 4);
+	hash = double_sha256(stripped);
+
+	if (segwit){
+		write_int(dst, version, 4);
+		dst.push_back(0);
+		dst.push_back(1);
+		dst.insert(dst.end(), body.begin(), body.end());
+		dst.insert(dst.end(), witnesses.begin(), witnesses.end());
+		write_int(dst, 0, 4);
+	}else
+		dst.insert(dst.end(), stripped.begin(), stripped.end());
+
+	for (size_t i = 0; i < output_count; i++)
+		if (scripts[i][0] != 0x6A)
+			this->utxos.push_back({ hash, (u32)i, values[i] });
+	this->result.txs++;
+	this->result.inputs += input_count;
+	this->result.outputs += output_count;
+	return true;
+}
+
+static Hashes::Digests::SHA256 merkle_root(std::vector<Hashes::Digests::SHA256> hashes){
+	while (hashes.size() > 1){
+		if (hashes.size() % 2)
+			hashes.push_back(hashes.back());
+		std::vector<Hashes::Digests::SHA256> next;
+		for (size_t i = 0; i < hashes.size(); i += 2){
+			std::vector<u8> pair;
+			write_bytes(pair, hashes[i].to_array().data(), 32);
+			write_bytes(pair, hashes[i + 1].to_array().data(), 32);
+			next.push_back(double_sha256(pair));
+		}
+		hashes = std::move(next);
+	}
+	return hashes.front();
+}
+
+//Orphans contain only a coinbase, so that nothing in the main chain can
+//spend their outputs.
+std::vector<u8> ChainGenerator::block(const SHA256 &previous, u64 height, bool orphan, SHA256 &hash){
+	std::vector<SHA256> hashes(1);
+	auto coinbase = this->coinbase(height, this->rng(), hashes[0]);
+	std::vector<u8> txs = coinbase;
+	if (!orphan){
+		this->utxos.push_back({ hashes[0], 0, 5000000000ULL >> std::min<u64>(height / 210000, 63) });
+		auto ramp = std::min(1.0, 2.0 * height / this->settings.blocks);
+		auto mean = (u64)(this->settings.transactions_per_block * ramp);
+		auto n = this->below(2 * mean + 1);
+		for (u64 i = 0; i < n; i++){
+			SHA256 tx_hash;
+			if (!this->transaction(height, txs, tx_hash))
+				break;
+			hashes.push_back(tx_hash);
+		}
+	}
+
+	std::vector<u8> ret;
+	write_int(ret, 0x20000000, 4);
+	write_bytes(ret, previous.to_array().data(), 32);
+	write_bytes(ret, merkle_root(hashes).to_array().data(), 32);
+	write_int(ret, 1231006505 + height * 600 + this->below(600), 4);
+	write_int(ret, 0x1d00ffff, 4);
+	write_int(ret, this->rng(), 4);
+	hash = Hashes::Algorithms::SHA256::compute(ret.data(), ret.size(), 2);
+	write_varint(ret, hashes.size());
+	ret.insert(ret.end(), txs.begin(), txs.end());
+	return ret;
+}
+
+namespace{
+
+class BlockFileWriter{
+	std::string directory;
+	const ChainGeneratorSettings &settings;
+	ChainGeneratorResult &result;
+	std::ofstream file;
+	u64 size = 0;
+	int index = 0;
+
+	void close(){
+		if (!this->file.is_open())
+			return;
+		auto chunk = this->settings.file_chunk_size;
+		if (chunk && this->size % chunk){
+			std::vector<char> zeros(chunk - this->size % chunk);
+			this->file.write(zeros.data(), zeros.size());
+			this->result.bytes += zeros.size();
+		}
+		this->file.close();
+		if (!this->file)
+			throw std::runtime_error("Error while writing block file.");
+	}
+public:
+	BlockFileWriter(const std::string &directory, const ChainGeneratorSettings &settings, ChainGeneratorResult &result)
+		: directory(directory)
+		, settings(settings)
+		, result(result){}
+	~BlockFileWriter(){
+		try{
+			this->close();
+		}catch (std::exception &){}
+	}
+	void write(const std::vector<u8> &block){
+		if (this->file.is_open() && this->size + block.size() + 8 > this->settings.max_file_size)
+			this->close();
+		if (!this->file.is_open()){
+			char name[32];
+			sprintf(name, "/blk%05d.dat", this->index++);
+			this->file.open(this->directory + name, std::ios::binary | std::ios::trunc);
+			if (!this->file)
+				throw std::runtime_error("Can't create block file in " + this->directory);
+			this->size = 0;
+			this->result.files++;
+		}
+		std::vector<u8> header;
+		write_int(header, !this->settings.testnet ? magic_number : magic_number_testnet, 4);
+		write_int(header, block.size(), 4);
+		this->file.write((const char *)header.data(), header.size());
+		this->file.write((const char *)block.data(), block.size());
+		this->size += header.size() + block.size();
+		this->result.bytes += header.size() + block.size();
+	}
+	void finish(){
+		this->close();
+	}
+};
+
+}
+
+ChainGeneratorResult ChainGenerator::generate(const std::string &directory){
+	auto blocks_directory = directory + "/blocks";
+	boost::filesystem::create_directories(blocks_directory);
+	this->result = ChainGeneratorResult();
+	this->utxos.clear();
+	this->addresses.clear();
+
+	BlockFileWriter writer(blocks_directory, this->settings, this->result);
+	//Blocks are held back for a while before they're written, and sometimes
+	//one is written ahead of those before it, the way blocks downloaded in
+	//parallel land in Core's files.
+	std::deque<std::vector<u8>> pending;
+	auto flush = [&](size_t keep){
+		while (pending.size() > keep){
+			size_t i = 0;
+			if (this->uniform() < this->settings.out_of_order_rate)
+				i = (size_t)this->below(pending.size());
+			writer.write(pending[i]);
+			pending.erase(pending.begin() + i);
+		}
+	};
+
+	SHA256 previous;
+	for (u64 height = 0; height < this->settings.blocks; height++){
+		SHA256 hash;
+		pending.push_back(this->block(previous, height, false, hash));
+		this->result.blocks++;
+		//An orphan at the tip would make the head ambiguous.
+		if (height + 1 < this->settings.blocks && this->uniform() < this->settings.orphan_rate){
+			SHA256 orphan_hash;
+			pending.push_back(this->block(previous, height, true, orphan_hash));
+			this->result.orphans++;
+		}
+		previous = hash;
+		flush(this->settings.out_of_order_window);
+	}
+	flush(0);
+	writer.finish();
+	return this->result;
+}
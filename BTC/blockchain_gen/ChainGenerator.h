@@ -0,0 +1,79 @@
+#pragma once
+
+#include <common/types.h>
+#include <common/XorShift128.h>
+#include <libhash/hash.h>
+#include <string>
+#include <vector>
+
+struct ChainGeneratorSettings{
+	//Length of the main chain, including the genesis block.
+	u64 blocks = 2000;
+	u64 seed = 1;
+	bool testnet = false;
+	//Average transaction count of the blocks at the tip. Blocks near the
+	//genesis contain little more than their coinbase, and the count grows
+	//over the first half of the chain.
+	u64 transactions_per_block = 100;
+	//A file is closed once it reaches this size, like Core's blk files.
+	u64 max_file_size = 128 << 20;
+	//Files are padded with zeros to a multiple of this size, as Core leaves
+	//them after preallocating.
+	u64 file_chunk_size = 16 << 20;
+	//Probability that a block gets a stale sibling that's never extended.
+	double orphan_rate = 0.005;
+	//Probability that a block is written before blocks that precede it in the
+	//chain, and how far back it can go.
+	double out_of_order_rate = 0.05;
+	unsigned out_of_order_window = 16;
+};
+
+struct ChainGeneratorResult{
+	u64 blocks = 0;
+	u64 orphans = 0;
+	u64 txs = 0;
+	u64 inputs = 0;
+	u64 outputs = 0;
+	u64 files = 0;
+	//Including magic numbers, size prefixes and padding.
+	u64 bytes = 0;
+};
+
+//Writes a synthetic chain as blk?????.dat files in the format of Core's
+//block directory, to be read by blockchain_parser. Transactions spend real
+//outputs of earlier transactions, so the resulting DB has the same shape as
+//one built from a real chain. Signatures, proof of work and amounts are not
+//valid. The output depends only on the settings.
+class ChainGenerator{
+	typedef Hashes::Digests::SHA256 SHA256;
+
+	struct Utxo{
+		SHA256 tx_hash;
+		u32 index;
+		u64 value;
+	};
+
+	ChainGeneratorSettings settings;
+	XorShift128_64 rng;
+	std::vector<Utxo> utxos;
+	std::vector<std::array<u8, 32>> addresses;
+	ChainGeneratorResult result;
+
+	u64 below(u64 n){
+		return n ? this->rng() % n : 0;
+	}
+	double uniform(){
+		return (this->rng() >> 11) * (1.0 / (1ULL << 53));
+	}
+	void bytes(std::vector<u8> &dst, size_t n);
+	const std::array<u8, 32> &pick_address();
+	std::vector<u8> output_script(u64 height);
+	Utxo take_utxo();
+	std::vector<u8> coinbase(u64 height, u64 extra_nonce, SHA256 &hash);
+	bool transaction(u64 height, std::vector<u8> &dst, SHA256 &hash);
+	std::vector<u8> block(const SHA256 &previous, u64 height, bool orphan, SHA256 &hash);
+public:
+	ChainGenerator(const ChainGeneratorSettings &settings);
+	//Writes the files to directory/blocks, which is created if needed.
+	ChainGeneratorResult generate(const std::string &directory);
+};
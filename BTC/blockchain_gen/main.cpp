@@ -0,0 +1,46 @@
+#include "ChainGenerator.h"
+#include <nlohmann/json.hpp>
+#include <iostream>
+
+static nlohmann::json to_json(const ChainGeneratorResult &result){
+	nlohmann::json ret;
+	ret["blocks"] = result.blocks;
+	ret["orphans"] = result.orphans;
+	ret["txs"] = result.txs;
+	ret["inputs"] = result.inputs;
+	ret["outputs"] = result.outputs;
+	ret["files"] = result.files;
+	ret["bytes"] = result.bytes;
+	return ret;
+}
+
+int main(int argc, char **argv){
+	if (argc < 3){
+		std::cerr <<
+			"Usage: blockchain_gen <config dir> <blocks> [<seed> [<testnet> [<txs per block>]]]\n"
+			"\n"
+			"Writes a synthetic chain of the given length to <config dir>/blocks, which\n"
+			"can then be passed to blockchain_parser. The same seed (by default, 1)\n"
+			"always produces the same files. The testnet argument must be a 0 or a 1.\n"
+			"If not provided, it defaults to 0. txs per block is the average size of\n"
+			"blocks past the first half of the chain (by default, 100).\n";
+		return -1;
+	}
+	try{
+		ChainGeneratorSettings settings;
+		settings.blocks = std::stoull(argv[2]);
+		if (argc >= 4)
+			settings.seed = std::stoull(argv[3]);
+		settings.testnet = argc >= 5 && atoi(argv[4]);
+		if (argc >= 6)
+			settings.transactions_per_block = std::stoull(argv[5]);
+		if (!settings.blocks)
+			throw std::runtime_error("The chain must have at least one block.");
+		ChainGenerator generator(settings);
+		std::cout << to_json(generator.generate(argv[1])).dump(1, '\t') << std::endl;
+	}catch (std::exception &e){
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+	return 0;
+}
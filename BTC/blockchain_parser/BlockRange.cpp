@@ -0,0 +1,48 @@
+#include "BlockRange.h"
+#include "ProgressDisplay.h"
+#include "SyncMetrics.h"
+#include <libbtcparser/Block.h>
+#include <common/serialization.h>
+#include <fstream>
+#include <memory>
+
+using namespace sqlite3pp;
+
+std::vector<BlockLocation> locate_blocks(DB &db, Blockchain &blockchain){
+	auto stmt = db << "select file_name, file_offset, size_in_file, transaction_count from blocks where id = ?;";
+	auto n = blockchain.get_height() + 1;
+	std::vector<BlockLocation> ret(n);
+	for (u64 i = 0; i < n; i++){
+		auto &location = ret[i];
+		stmt << Reset() << blockchain.get_block_by_height(i)->db_id << Step() >> location.file_name >> location.file_offset >> location.size >> location.transaction_count;
+	}
+	return ret;
+}
+
+void insert_blocks(DB &db, InsertState &nis, const std::vector<BlockLocation> &blocks, u64 begin, u64 end, const Paths &paths, bool testnet, TaskProgress &progress){
+	auto metrics = progress.get_metrics();
+	for (auto i = begin; continue_running && i < end;){
+		sqlite3pp::Transaction t(db);
+		for (int j = 100; j-- && continue_running && i < end; i++){
+			if (metrics)
+				metrics->set_queue_depth("blocks_uncommitted", 99 - j);
+			progress.report_progress(1);
+			auto &location = blocks[i];
+			auto path = paths.config_path + "/blocks/" + location.file_name;
+			std::ifstream file(path, std::ios::binary);
+			if (!file)
+				throw std::runtime_error("File not found: " + path);
+			file.seekg(location.file_offset);
+			std::unique_ptr<u8[]> buffer(new u8[location.size]);
+			file.read((char *)buffer.get(), location.size);
+			SerializedBuffer sb(buffer.get(), location.size);
+			::Block block(sb, testnet, location.file_name, location.file_offset);
+			block.insert(nis);
+			if (metrics){
+				metrics->add_block(block);
+				metrics->add_bytes_read(location.size);
+				metrics->set_height(i);
+			}
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Paths.h"
+#include <libbtcparser/Blockchain.h>
+#include <libbtcparser/InsertState.h>
+#include <sqlitepp/sqlitepp.h>
+#include <string>
+#include <vector>
+
+class TaskProgress;
+
+struct BlockLocation{
+	std::string file_name;
+	u64 file_offset;
+	u64 size;
+	u64 transaction_count;
+};
+
+//Returns where every block of the chain is stored, in height order.
+std::vector<BlockLocation> locate_blocks(sqlite3pp::DB &db, Blockchain &blockchain);
+//Parses the blocks with heights in [begin, end) and inserts them through
+//nis, in transactions of 100 blocks. Stops early if continue_running is
+//cleared.
+void insert_blocks(sqlite3pp::DB &db, InsertState &nis, const std::vector<BlockLocation> &blocks, u64 begin, u64 end, const Paths &paths, bool testnet, TaskProgress &progress);
@@ -0,0 +1,401 @@
+#include "BulkIngest.h"
+#include "BlockRange.h"
+#include "ExternalSort.h"
+#include "RadixSort.h"
+#include "ProgressDisplay.h"
+#include <libbtcparser/InsertState.h>
+#include <libbtcparser/PostingLists.h>
+#include <libbtcparser/SplitLayout.h>
+#include <sstream>
+
+using namespace sqlite3pp;
+using Hashes::Digests::SHA256;
+
+namespace{
+
+struct TxEntry{
+	SHA256 hash;
+	u64 tx_id;
+	u64 first_output_id;
+	u64 output_count;
+
+	bool operator<(const TxEntry &other) const{
+		auto c = this->hash.cmp(other.hash);
+		if (c)
+			return c < 0;
+		return this->tx_id < other.tx_id;
+	}
+};
+
+struct UnresolvedInput{
+	SHA256 previous_tx;
+	u64 input_id;
+	u64 tx_id;
+	u64 txo_index;
+
+	bool operator<(const UnresolvedInput &other) const{
+		auto c = this->previous_tx.cmp(other.previous_tx);
+		if (c)
+			return c < 0;
+		return this->input_id < other.input_id;
+	}
+};
+
+struct Spend{
+	u64 output_id;
+	u64 input_id;
+	u64 tx_id;
+	u64 previous_tx_id;
+
+	bool operator<(const Spend &other) const{
+		return this->output_id < other.output_id;
+	}
+};
+
+struct InputCompletion{
+	u64 input_id;
+	u64 previous_tx_id;
+	u64 output_id;
+
+	bool operator<(const InputCompletion &other) const{
+		return this->input_id < other.input_id;
+	}
+};
+
+//Ids of the phases recorded in bulk_state. See bulk_ingest().
+const u64 blocks_parsed = 1;
+const u64 spends_resolved = 2;
+
+//Names of the runs written by phase one and by phase two.
+const std::vector<const char *> parse_runs = { "output_addresses", "outputs_by_address", "txs_by_address" };
+const std::vector<const char *> resolve_runs = { "spending_txs_by_address", "txs", "unresolved", "spends", "inputs" };
+
+std::string get_run_prefix(const Paths &paths, const char *name){
+	return paths.output_path + "/bulk_" + name + ".run";
+}
+
+void remove_runs(const Paths &paths, const std::vector<const char *> &names){
+	for (auto name : names)
+		ExternalSorter<IdPair>::remove_runs(get_run_prefix(paths, name));
+}
+
+void set_phase(DB &db, u64 phase){
+	db.exec("create table if not exists bulk_state (phase integer);");
+	db.exec("delete from bulk_state;");
+	db << "insert into bulk_state (phase) values (?);" << phase << Step();
+}
+
+void radix_sort(std::vector<IdPair> &run){
+	parallel_radix_sort(run);
+}
+
+//Takes the address relations of phase one. The pairs keyed by address are
+//what addresses_outputs and the posting lists are loaded from; the pairs
+//keyed by output, which arrive already sorted, feed the spend join, which
+//adds the addresses of the txs' inputs.
+class RelationCollector : public RelationSink{
+	std::string output_path;
+public:
+	//(output, address)
+	ExternalSorter<IdPair> output_addresses;
+	//(address, output)
+	ExternalSorter<IdPair> outputs_by_address;
+	//(address, tx)
+	ExternalSorter<IdPair> txs_by_address;
+	//(address, tx), of the txs that spend the address's outputs. Written by
+	//phase two.
+	ExternalSorter<IdPair> spending_txs_by_address;
+
+	RelationCollector(const Paths &paths)
+		: output_path(paths.output_path)
+		, output_addresses(get_run_prefix(paths, "output_addresses"), radix_sort)
+		, outputs_by_address(get_run_prefix(paths, "outputs_by_address"), radix_sort)
+		, txs_by_address(get_run_prefix(paths, "txs_by_address"), radix_sort)
+		, spending_txs_by_address(get_run_prefix(paths, "spending_txs_by_address"), radix_sort){}
+	void save_parsed(){
+		this->output_addresses.save();
+		this->outputs_by_address.save();
+		this->txs_by_address.save();
+	}
+	//Takes the runs the phases up to the given one saved.
+	void open(u64 phase){
+		bool found = this->output_addresses.open();
+		found &= this->outputs_by_address.open();
+		found &= this->txs_by_address.open();
+		if (phase >= spends_resolved)
+			found &= this->spending_txs_by_address.open();
+		if (!found)
+			throw std::runtime_error("The sort runs of the interrupted bulk parse are missing from " + this->output_path + ". Delete the DB to start over.");
+	}
+	void add_output_address(u64 address_id, u64 output_id) override{
+		this->output_addresses.add({ output_id, address_id });
+		this->outputs_by_address.add({ address_id, output_id });
+	}
+	void add_tx_address(u64 address_id, u64 tx_id) override{
+		this->txs_by_address.add({ address_id, tx_id });
+	}
+};
+
+class SpendResolver{
+	DB &db;
+	const Paths &paths;
+	RelationCollector &relations;
+	TaskProgress &progress;
+
+	template <typename T>
+	std::unique_ptr<ExternalSorter<T>> make_sorter(const char *name){
+		return std::make_unique<ExternalSorter<T>>(get_run_prefix(this->paths, name));
+	}
+	std::unique_ptr<ExternalSorter<Spend>> join_txs();
+	void spend_outputs(ExternalSorter<Spend> &, ExternalSorter<InputCompletion> &);
+	void complete_inputs(ExternalSorter<InputCompletion> &);
+public:
+	SpendResolver(DB &db, const Paths &paths, RelationCollector &relations, TaskProgress &progress)
+		: db(db)
+		, paths(paths)
+		, relations(relations)
+		, progress(progress){}
+	void resolve();
+};
+
+void SpendResolver::resolve(){
+	auto spends = this->join_txs();
+	auto completions = this->make_sorter<InputCompletion>("inputs");
+	this->spend_outputs(*spends, *completions);
+	spends.reset();
+	this->complete_inputs(*completions);
+	this->db.exec("drop table unresolved_inputs;");
+}
+
+//Both tables are read in rowid order, which is the order they were written
+//in, and sorted by hash. Duplicate tx hashes resolve to the first tx, as
+//find_tx does during a normal parse.
+std::unique_ptr<ExternalSorter<Spend>> SpendResolver::join_txs(){
+	auto txs = this->make_sorter<TxEntry>("txs");
+	{
+		auto stmt = this->db << "select id, hash, output_count from txs order by id;";
+		u64 next_output_id;
+		this->db << "select coalesce(min(id), 1) from outputs;" << Step() >> next_output_id;
+		while (stmt.step() == SQLITE_ROW){
+			TxEntry entry;
+			boost::string_view hash;
+			stmt >> entry.tx_id >> hash >> entry.output_count;
+			entry.hash = SHA256(hash.data(), hash.size());
+			entry.first_output_id = next_output_id;
+			next_output_id += entry.output_count;
+			txs->add(entry);
+		}
+	}
+	auto inputs = this->make_sorter<UnresolvedInput>("unresolved");
+	{
+		auto stmt = this->db << "select inputs_id, txs_id, previous_tx_hash, txo_index from unresolved_inputs;";
+		while (stmt.step() == SQLITE_ROW){
+			UnresolvedInput input;
+			boost::string_view hash;
+			stmt >> input.input_id >> input.tx_id >> hash >> input.txo_index;
+			input.previous_tx = SHA256(hash.data(), hash.size());
+			inputs->add(input);
+		}
+	}
+	this->progress.start(inputs->size());
+	txs->finish();
+	inputs->finish();
+
+	auto ret = this->make_sorter<Spend>("spends");
+	TxEntry tx;
+	UnresolvedInput input;
+	bool more_txs = txs->next(tx);
+	for (bool more_inputs = inputs->next(input); more_inputs; more_inputs = inputs->next(input)){
+		while (more_txs && tx.hash < input.previous_tx)
+			more_txs = txs->next(tx);
+		if (!more_txs || tx.hash != input.previous_tx || tx.tx_id >= input.tx_id){
+			std::stringstream stream;
+			stream << "Input " << input.input_id << " references unknown tx " << input.previous_tx;
+			throw std::runtime_error(stream.str());
+		}
+		if (input.txo_index >= tx.output_count){
+			std::stringstream stream;
+			stream << "Input " << input.input_id << " references unknown txo " << input.previous_tx << ", " << input.txo_index;
+			throw std::runtime_error(stream.str());
+		}
+		Spend spend;
+		spend.output_id = tx.first_output_id + input.txo_index;
+		spend.input_id = input.input_id;
+		spend.tx_id = input.tx_id;
+		spend.previous_tx_id = tx.tx_id;
+		ret->add(spend);
+	}
+	ret->finish();
+	return ret;
+}
+
+//The addresses of the outputs become addresses of the txs that spend them.
+void SpendResolver::spend_outputs(ExternalSorter<Spend> &spends, ExternalSorter<InputCompletion> &completions){
+	auto &output_addresses = this->relations.output_addresses;
+	output_addresses.finish();
+
+	auto spend_output = this->db << "update outputs set spent_by = ? where id = ?;";
+	Spend spend;
+	IdPair output_address;
+	bool more_addresses = output_addresses.next(output_address);
+	while (spends.next(spend)){
+		spend_output << Reset() << spend.input_id << spend.output_id << Step();
+		completions.add({ spend.input_id, spend.previous_tx_id, spend.output_id });
+		while (more_addresses && output_address.first < spend.output_id)
+			more_addresses = output_addresses.next(output_address);
+		for (; more_addresses && output_address.first == spend.output_id; more_addresses = output_addresses.next(output_address))
+			this->relations.spending_txs_by_address.add({ output_address.second, spend.tx_id });
+		this->progress.report_progress(1);
+	}
+	completions.finish();
+}
+
+void SpendResolver::complete_inputs(ExternalSorter<InputCompletion> &completions){
+	auto stmt = this->db << "update inputs set previous_tx_id = ?, outputs_id = ? where id = ?;";
+	InputCompletion completion;
+	while (completions.next(completion))
+		stmt << Reset() << completion.previous_tx_id << completion.output_id << completion.input_id << Step();
+}
+
+//Reads two sorters as one.
+class MergedPairs{
+	ExternalSorter<IdPair> &a;
+	ExternalSorter<IdPair> &b;
+	IdPair head_a, head_b;
+	bool more_a, more_b;
+public:
+	MergedPairs(ExternalSorter<IdPair> &a, ExternalSorter<IdPair> &b): a(a), b(b){
+		this->more_a = a.next(this->head_a);
+		this->more_b = b.next(this->head_b);
+	}
+	bool next(IdPair &dst){
+		if (this->more_a && (!this->more_b || !(this->head_b < this->head_a))){
+			dst = this->head_a;
+			this->more_a = this->a.next(this->head_a);
+			return true;
+		}
+		if (!this->more_b)
+			return false;
+		dst = this->head_b;
+		this->more_b = this->b.next(this->head_b);
+		return true;
+	}
+};
+
+//addresses_outputs is written in address order, together with the posting
+//lists, whose rows then arrive in key order too. The relations between
+//addresses and txs only go to the lists. The index on outputs is dropped for
+//the load and built afterwards in one pass.
+void load_relations(DB &db, RelationCollector &relations, TaskProgress &progress){
+	auto &outputs = relations.outputs_by_address;
+	outputs.finish();
+	relations.txs_by_address.finish();
+	relations.spending_txs_by_address.finish();
+	progress.start(outputs.size() + relations.txs_by_address.size() + relations.spending_txs_by_address.size());
+	MergedPairs txs(relations.txs_by_address, relations.spending_txs_by_address);
+
+	db.exec("drop index if exists addresses_outputs_by_outputs_id;");
+	PostingLists postings(db);
+	BulkInserter<2> output_inserter(db, "insert into addresses_outputs (addresses_id, outputs_id)");
+	IdPair output, tx;
+	bool more_outputs = outputs.next(output);
+	bool more_txs = txs.next(tx);
+	std::vector<u64> ids;
+	while (more_outputs || more_txs){
+		auto address = !more_txs || (more_outputs && output.first < tx.first) ? output.first : tx.first;
+		ids.clear();
+		for (; more_outputs && output.first == address; more_outputs = outputs.next(output)){
+			ids.push_back(output.second);
+			output_inserter.add(address, output.second);
+		}
+		if (ids.size())
+			postings.append(address, PostingKind::Outputs, ids);
+		auto count = ids.size();
+		ids.clear();
+		//A tx can get the same address from its outputs and from the ones
+		//it spends.
+		for (; more_txs && tx.first == address; more_txs = txs.next(tx)){
+			count++;
+			if (ids.size() && ids.back() == tx.second)
+				continue;
+			ids.push_back(tx.second);
+		}
+		if (ids.size())
+			postings.append(address, PostingKind::Txs, ids);
+		if (output_inserter.size() >= 4096)
+			output_inserter.flush();
+		progress.report_progress(count);
+	}
+	output_inserter.flush();
+	//Unlike tables, indexes are created in main unless told otherwise.
+	auto schema = get_table_schema(db, "addresses_outputs");
+	db.exec(("create index " + schema + ".addresses_outputs_by_outputs_id on addresses_outputs (outputs_id);").c_str());
+}
+
+//Returns false if the process was stopped, in which case nothing is kept.
+bool parse_blocks(DB &db, Blockchain &blockchain, const Paths &paths, bool testnet, RelationCollector &relations){
+	auto blocks = locate_blocks(db, blockchain);
+	sqlite3pp::Transaction t(db);
+	{
+		InsertState nis(db);
+		nis.begin_bulk(relations);
+		TaskProgress progress("Parsing blocks (bulk)...", "parse_blocks");
+		progress.start(blocks.size());
+		insert_blocks(db, nis, blocks, 0, blocks.size(), paths, testnet, progress);
+	}
+	if (!continue_running){
+		t.rollback();
+		return false;
+	}
+	relations.save_parsed();
+	set_phase(db, blocks_parsed);
+	return true;
+}
+
+}
+
+bool bulk_ingest_pending(DB &db){
+	return db.table_exists("bulk_state");
+}
+
+void bulk_ingest(DB &db, Blockchain &blockchain, const Paths &paths, bool testnet){
+	u64 phase = 0;
+	if (bulk_ingest_pending(db))
+		db << "select phase from bulk_state;" << Step() >> phase;
+	else{
+		u64 txs;
+		db << "select count(*) from (select * from txs limit 1);" << Step() >> txs;
+		if (txs)
+			throw std::runtime_error("Bulk ingest needs a DB without txs.");
+		//Left behind by a process that was killed.
+		remove_runs(paths, parse_runs);
+	}
+
+	{
+		RelationCollector relations(paths);
+		if (phase < blocks_parsed){
+			if (!parse_blocks(db, blockchain, paths, testnet, relations))
+				return;
+		}else
+			relations.open(phase);
+		if (!continue_running)
+			return;
+		if (phase < spends_resolved){
+			remove_runs(paths, resolve_runs);
+			TaskProgress progress("Resolving spends...", "resolve_spends");
+			sqlite3pp::Transaction t(db);
+			SpendResolver(db, paths, relations, progress).resolve();
+			relations.spending_txs_by_address.save();
+			set_phase(db, spends_resolved);
+		}
+		if (!continue_running)
+			return;
+		TaskProgress progress("Loading address relations...", "load_relations");
+		sqlite3pp::Transaction t(db);
+		load_relations(db, relations, progress);
+		db.exec("drop table bulk_state;");
+	}
+	//The runs are closed by now.
+	remove_runs(paths, parse_runs);
+	remove_runs(paths, resolve_runs);
+}
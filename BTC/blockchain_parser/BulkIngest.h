@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Paths.h"
+#include <libbtcparser/Blockchain.h>
+#include <sqlitepp/sqlitepp.h>
+
+//Parses the whole chain into db, which must not have any txs yet, in phases
+//that avoid random lookups.
+//
+//Phase one appends blocks, txs, outputs and inputs sequentially, as a normal
+//parse would, except that inputs are only resolved when they spend a tx of
+//their own block. Every other input is stored without its previous tx and
+//output and recorded in unresolved_inputs (previous tx hash, output index,
+//spending input and tx). Address relations aren't written to their tables;
+//they're collected as (address, output) and (address, tx) pairs into sorted
+//runs (blockchain_parser/ExternalSort.h, sorted by
+//blockchain_parser/RadixSort.h).
+//
+//Phase two resolves the spends with external sorts and merge joins instead
+//of an index lookup per input:
+//1. The txs, with the id of their first output by prefix sum over their
+//   output counts, and the unresolved inputs are sorted by hash and joined.
+//2. The spends are sorted by output and joined with the output addresses.
+//   outputs.spent_by is written in output id order, and the addresses of
+//   the spent outputs are added to the spending txs, in runs of their own.
+//3. The spends are sorted by input and inputs is completed in input id
+//   order.
+//
+//Last, the runs of relation pairs are merged and addresses_outputs and the
+//posting lists are loaded from them in address order. The index on
+//addresses_outputs is built after the load, in one pass.
+//
+//Each of the three phases runs in a transaction of its own, and the last one
+//committed is recorded in the bulk_state table until the end. Sort runs are
+//written to output_dir; those a phase leaves for the next ones are saved
+//before it commits (see ExternalSorter::save()), and are deleted at the end.
+//If the process is stopped during phase one, db is left as it was and the
+//next run starts over. The other phases aren't interrupted, but if the
+//process dies during one, the next run resumes from it with the saved runs.
+//A DB left in between phases can only be finished by this function.
+void bulk_ingest(sqlite3pp::DB &db, Blockchain &blockchain, const Paths &paths, bool testnet);
+//Returns whether db is in the middle of a bulk parse, which must be resumed.
+bool bulk_ingest_pending(sqlite3pp::DB &db);
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <common/types.h>
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+//Sorts more records than fit in memory. Records are collected into runs of
+//a fixed size; each full run is sorted on a thread of its own while the next
+//one is being filled, and written to a file. Once finish() is called the
+//records can be read back in order, merging the runs. If everything fits in
+//a single run, nothing is written to disk.
+//Runs are deleted along with the sorter, unless they've been saved (see
+//save()), so that a process that is restarted can read them again.
+//T is written to the files as is, so it must be trivially copyable.
+template <typename T, typename Less = std::less<T>>
+class ExternalSorter{
+	static_assert(std::is_trivially_copyable<T>::value, "ExternalSorter needs trivially copyable records.");
+public:
+	//Sorts a run. It must order the records as Less does.
+	typedef std::function<void(std::vector<T> &)> RunSort;
+private:
+
+	class RunReader{
+		FILE *file;
+		std::vector<T> buffer;
+		size_t position = 0;
+	public:
+		RunReader(const std::string &path): buffer(1 << 16){
+			this->file = fopen(path.c_str(), "rb");
+			if (!this->file)
+				throw std::runtime_error("Can't open sort run " + path);
+			this->buffer.clear();
+		}
+		~RunReader(){
+			fclose(this->file);
+		}
+		RunReader(const RunReader &) = delete;
+		const RunReader &operator=(const RunReader &) = delete;
+		bool next(T &dst){
+			if (this->position == this->buffer.size()){
+				this->buffer.resize(this->buffer.capacity());
+				auto n = fread(this->buffer.data(), sizeof(T), this->buffer.size(), this->file);
+				this->buffer.resize(n);
+				this->position = 0;
+				if (!n)
+					return false;
+			}
+			dst = this->buffer[this->position++];
+			return true;
+		}
+	};
+
+	struct Head{
+		T value;
+		size_t run;
+	};
+
+	std::string path_prefix;
+	size_t run_size;
+	Less less;
+	RunSort sort;
+	std::vector<T> buffer;
+	std::vector<std::string> run_paths;
+	std::future<void> writing;
+	u64 count = 0;
+	bool finished = false;
+	bool saved = false;
+
+	//Only used while reading.
+	std::vector<std::unique_ptr<RunReader>> readers;
+	std::vector<Head> heads;
+	size_t position = 0;
+
+	void wait(){
+		if (this->writing.valid())
+			this->writing.get();
+	}
+	void spill(){
+		this->wait();
+		auto path = this->path_prefix + std::to_string(this->run_paths.size());
+		this->run_paths.push_back(path);
+		auto run = std::make_shared<std::vector<T>>(std::move(this->buffer));
+		this->buffer = std::vector<T>();
+		auto sort = this->sort;
+		this->writing = std::async(std::launch::async, [run, path, sort](){
+			sort(*run);
+			auto file = fopen(path.c_str(), "wb");
+			if (!file)
+				throw std::runtime_error("Can't create sort run " + path);
+			auto written = fwrite(run->data(), sizeof(T), run->size(), file);
+			auto closed = fclose(file);
+			if (written != run->size() || closed)
+				throw std::runtime_error("Error while writing sort run " + path);
+		});
+	}
+	bool heap_less(const Head &a, const Head &b) const{
+		return this->less(b.value, a.value);
+	}
+	void push_head(size_t run){
+		Head head;
+		head.run = run;
+		if (!this->readers[run]->next(head.value))
+			return;
+		this->heads.push_back(head);
+		std::push_heap(this->heads.begin(), this->heads.end(), [this](const Head &a, const Head &b){ return this->heap_less(a, b); });
+	}
+public:
+	//path_prefix is where runs are written, with the run number appended.
+	//Runs are sorted with std::sort unless sort is given.
+	//memory is roughly the size of a run in bytes. While a run is being
+	//sorted the next one is filled, so up to twice as much can be in use.
+	ExternalSorter(const std::string &path_prefix, RunSort sort = nullptr, size_t memory = 64 << 20, const Less &less = Less())
+			: path_prefix(path_prefix)
+			, run_size(std::max<size_t>(memory / sizeof(T), 1))
+			, less(less)
+			, sort(sort){
+		if (!this->sort)
+			this->sort = [less](std::vector<T> &run){ std::sort(run.begin(), run.end(), less); };
+	}
+	~ExternalSorter(){
+		try{
+			this->wait();
+		}catch (std::exception &){}
+		this->readers.clear();
+		if (this->saved)
+			return;
+		for (auto &path : this->run_paths)
+			remove(path.c_str());
+	}
+	ExternalSorter(const ExternalSorter &) = delete;
+	const ExternalSorter &operator=(const ExternalSorter &) = delete;
+
+	void add(const T &record){
+		this->buffer.push_back(record);
+		this->count++;
+		if (this->buffer.size() == this->run_size)
+			this->spill();
+	}
+	u64 size() const{
+		return this->count;
+	}
+	//Writes every record added so far to runs, even if they'd fit in one,
+	//and keeps the runs when the sorter is destroyed. There's always at least
+	//one run afterwards, even if it's empty. No more records may be added.
+	void save(){
+		if (this->buffer.size() || !this->run_paths.size())
+			this->spill();
+		this->wait();
+		this->saved = true;
+	}
+	//Takes the runs a sorter with the same path prefix saved, as if their
+	//records had just been added. They're kept when this sorter is destroyed.
+	//Returns false if there aren't any.
+	bool open(){
+		for (size_t i = 0;; i++){
+			auto path = this->path_prefix + std::to_string(i);
+			auto file = fopen(path.c_str(), "rb");
+			if (!file)
+				break;
+			fseek(file, 0, SEEK_END);
+			this->count += (u64)ftell(file) / sizeof(T);
+			fclose(file);
+			this->run_paths.push_back(path);
+		}
+		this->saved = true;
+		return this->run_paths.size() > 0;
+	}
+	//Deletes the runs with the given path prefix, such as the ones a sorter
+	//saved, or the ones left behind by a process that was killed.
+	static void remove_runs(const std::string &path_prefix){
+		for (size_t i = 0; !remove((path_prefix + std::to_string(i)).c_str()); i++);
+	}
+	//Must be called once every record has been added and before reading.
+	void finish(){
+		this->finished = true;
+		if (!this->run_paths.size()){
+			this->sort(this->buffer);
+			return;
+		}
+		if (this->buffer.size())
+			this->spill();
+		this->wait();
+		this->buffer = std::vector<T>();
+		for (size_t i = 0; i < this->run_paths.size(); i++){
+			this->readers.emplace_back(new RunReader(this->run_paths[i]));
+			this->push_head(i);
+		}
+	}
+	//Returns the records in order.
+	bool next(T &dst){
+		if (!this->finished)
+			throw std::runtime_error("ExternalSorter::next() called before finish().");
+		if (!this->readers.size()){
+			if (this->position == this->buffer.size())
+				return false;
+			dst = this->buffer[this->position++];
+			return true;
+		}
+		if (!this->heads.size())
+			return false;
+		auto cmp = [this](const Head &a, const Head &b){ return this->heap_less(a, b); };
+		std::pop_heap(this->heads.begin(), this->heads.end(), cmp);
+		auto head = this->heads.back();
+		this->heads.pop_back();
+		dst = head.value;
+		this->push_head(head.run);
+		return true;
+	}
+};
@@ -0,0 +1,26 @@
+#include "HistoryPrune.h"
+#include "ProgressDisplay.h"
+#include <libbtcparser/HistoryPruner.h>
+#include <libbtcparser/PostingLists.h>
+
+//Larger than the indexer's batches, since nothing waits on the lock here.
+static const u64 batch_txs = 20000;
+
+void prune_history(sqlite3pp::DB &db, const Blockchain &blockchain){
+	PostingLists postings(db);
+	auto pruner = HistoryPruner::open(db, postings);
+	if (!pruner || !pruner->update_horizon(blockchain))
+		return;
+
+	TaskProgress progress("Pruning history...", "prune");
+	progress.start((double)pruner->get_pending());
+	bool more = true;
+	while (more && continue_running){
+		auto pending = pruner->get_pending();
+		{
+			sqlite3pp::Transaction t(db);
+			more = pruner->prune_batch(batch_txs);
+		}
+		progress.report_progress((double)(pending - pruner->get_pending()));
+	}
+}
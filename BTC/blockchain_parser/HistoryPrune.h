@@ -0,0 +1,10 @@
+#pragma once
+
+#include <libbtcparser/Blockchain.h>
+#include <sqlitepp/sqlitepp.h>
+
+//Brings a DB that uses the pruned profile (libbtcparser/HistoryPruner.h) up
+//to the horizon of blockchain, committing after every batch. Stopping the
+//process keeps the batches already committed; the rest are pruned by the next
+//run, or by the indexer.
+void prune_history(sqlite3pp::DB &db, const Blockchain &blockchain);
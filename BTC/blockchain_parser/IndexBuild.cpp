@@ -0,0 +1,64 @@
+#include "IndexBuild.h"
+#include "ProgressDisplay.h"
+#include <libbtcparser/DeferredIndexes.h>
+#include <libbtcparser/SplitLayout.h>
+#include <algorithm>
+#include <exception>
+#include <map>
+#include <thread>
+
+namespace{
+
+void build_indexes(const std::string &path, const std::vector<DeferredIndex> &indexes, unsigned threads, TaskProgress &progress){
+	sqlite3pp::DB db(path.c_str());
+	db.exec(("pragma threads = " + std::to_string(threads) + ";").c_str());
+	sqlite3_progress_handler(db, 1 << 16, [](void *){ return continue_running ? 0 : 1; }, nullptr);
+	try{
+		for (auto &index : indexes){
+			if (!continue_running)
+				break;
+			db.exec(index.definition);
+			progress.report_progress(1);
+		}
+	}catch (std::exception &){
+		//An interrupted build fails with SQLITE_INTERRUPT.
+		if (continue_running)
+			throw;
+	}
+}
+
+}
+
+void build_deferred_indexes(sqlite3pp::DB &db, const std::string &db_path){
+	auto missing = get_missing_deferred_indexes(db);
+	if (!missing.size())
+		return;
+
+	std::map<std::string, std::vector<DeferredIndex>> files;
+	for (auto &index : missing)
+		files[get_schema_path(db_path, get_table_schema(db, index.table))].push_back(index);
+	auto threads = std::max(std::thread::hardware_concurrency(), 1U);
+	threads = std::max<unsigned>(threads / files.size(), 1);
+
+	TaskProgress progress("Building indexes...", "build_indexes");
+	progress.start(missing.size());
+	std::vector<std::exception_ptr> errors(files.size());
+	std::vector<std::thread> workers;
+	size_t i = 0;
+	for (auto &file : files){
+		workers.emplace_back([&, i](){
+			try{
+				build_indexes(file.first, file.second, threads, progress);
+			}catch (std::exception &){
+				errors[i] = std::current_exception();
+				continue_running = false;
+			}
+		});
+		i++;
+	}
+	for (auto &worker : workers)
+		worker.join();
+	for (auto &error : errors)
+		if (error)
+			std::rethrow_exception(error);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <sqlitepp/sqlitepp.h>
+#include <string>
+
+//Builds the deferred indexes (libbtcparser/DeferredIndexes.h) db lacks.
+//SQLite only lets one connection write to a file at a time, so indexes on
+//tables in the same file are built one by one, each sorting with worker
+//threads (pragma threads). With the split layout (libbtcparser/SplitLayout.h)
+//every file is handled by a thread and a connection of its own, and the
+//worker threads are shared out among them.
+//Stopping the process abandons the indexes being built; the ones already
+//finished are kept.
+void build_deferred_indexes(sqlite3pp::DB &db, const std::string &db_path);
@@ -4,7 +4,7 @@
 #include <common/misc.h>
 #include <thread>
 
-ParallelBlockProcessor::ParallelBlockProcessor(const char *task_name, const Paths &paths, bool testnet)
+ParallelBlockProcessor::ParallelBlockProcessor(const char *task_name, const char *metrics_phase, const Paths &paths, bool testnet)
 		: paths(paths)
 		, testnet(testnet){
 	u64 bytes;
@@ -12,7 +12,7 @@ ParallelBlockProcessor::ParallelBlockProcessor(const char *task_name, const Path
 	{
 		std::stringstream stream;
 		stream << task_name << " (" << SizeFormatter(bytes) << ")...";
-		this->progress = TaskProgress(stream.str());
+		this->progress = TaskProgress(stream.str(), metrics_phase);
 		this->progress.set_total(bytes);
 	}
 }
@@ -48,6 +48,9 @@ protected:
 		return this->path;
 	}
 	void on_block(std::unique_ptr<Block> &&block) override{
+		auto metrics = this->pbp->get_metrics();
+		if (metrics)
+			metrics->add_block(*block);
 		this->pbp->on_block(std::move(block), this->tls);
 	}
 	void report_progress(u64 p) override{
@@ -70,6 +73,7 @@ bool ParallelBlockProcessor::internal_continue_running(){
 
 void ParallelBlockProcessor::thread_func(){
 	auto tls = this->get_threadlocal_data();
+	auto metrics = this->get_metrics();
 	std::string path;
 	try{
 		while (this->internal_continue_running()){
@@ -81,10 +85,19 @@ void ParallelBlockProcessor::thread_func(){
 				path = std::move(this->queue.front());
 				this->queue.pop_front();
 				buffer = load_file(path);
+				if (metrics){
+					metrics->add_bytes_read(buffer.size());
+					metrics->set_queue_depth("files_pending", this->queue.size());
+					metrics->set_queue_depth("files_in_progress", ++this->files_in_progress);
+				}
 			}
 
 			ParallelBlockParser pbp(this->testnet, std::move(buffer), path, *this, tls.get());
 			pbp.parse();
+			if (metrics){
+				LOCK_MUTEX(this->queue_mutex);
+				metrics->set_queue_depth("files_in_progress", --this->files_in_progress);
+			}
 		}
 		this->on_thread_returning(tls.get());
 	}catch (std::exception &e){
@@ -10,6 +10,7 @@ class ParallelBlockProcessor{
 	std::atomic<bool> run;
 	std::deque<std::string> queue;
 	std::mutex queue_mutex;
+	s64 files_in_progress = 0;
 	TaskProgress progress;
 	bool testnet;
 
@@ -18,6 +19,11 @@ class ParallelBlockProcessor{
 protected:
 	Paths paths;
 
+	//Null if metrics aren't being collected.
+	SyncMetrics *get_metrics(){
+		return this->progress.get_metrics();
+	}
+
 	friend class ParallelBlockParser;
 	virtual bool continue_running(){
 		return true;
@@ -31,7 +37,8 @@ protected:
 	}
 	virtual void on_thread_returning(void *tls){}
 public:
-	ParallelBlockProcessor(const char *task_name, const Paths &paths, bool testnet);
+	//metrics_phase is passed to TaskProgress.
+	ParallelBlockProcessor(const char *task_name, const char *metrics_phase, const Paths &paths, bool testnet);
 	virtual ~ParallelBlockProcessor(){}
 	virtual void process(int concurrency_limit = 0);
 };
@@ -15,6 +15,9 @@ struct Paths{
 	}
 };
 
+//Creates a DB with the schema blockchain_parser fills. If split is set, it
+//uses the layout of libbtcparser/SplitLayout.h.
+void initialize_db(const std::string &db_path, bool split = false);
 u64 load_tx_count(const Paths &);
 void save_tx_count(const Paths &, u64);
 int load_state(const Paths &);
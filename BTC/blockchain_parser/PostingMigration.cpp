@@ -0,0 +1,22 @@
+#include "PostingMigration.h"
+#include "ProgressDisplay.h"
+#include <libbtcparser/PostingLists.h>
+
+void migrate_posting_lists(sqlite3pp::DB &db){
+	using namespace sqlite3pp;
+	if (!PostingLists::needs_migration(db))
+		return;
+
+	u64 addresses;
+	db << "select coalesce(max(id), 0) from addresses;" << Step() >> addresses;
+	TaskProgress progress("Migrating to posting lists...", "migrate_postings");
+	//Each kind of list goes through the addresses once.
+	progress.start((double)addresses * 2);
+	u64 done = 0;
+	Transaction t(db);
+	PostingLists::migrate(db, [&](PostingKind kind, u64 address){
+		auto position = address + (kind == PostingKind::Txs ? addresses : 0);
+		progress.report_progress((double)(position - done));
+		done = position;
+	});
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <sqlitepp/sqlitepp.h>
+
+//Migrates a DB made by an older version to posting lists (see
+//PostingLists::migrate()), in one transaction. Does nothing for other DBs.
+//Since the parse appends to the lists, this must be done first. It can't be
+//interrupted.
+void migrate_posting_lists(sqlite3pp::DB &db);
@@ -1,5 +1,6 @@
 #pragma once
 #include "globals.h"
+#include "SyncMetrics.h"
 #include <common/misc.h>
 #include <mutex>
 #include <string>
@@ -18,6 +19,7 @@ class TaskProgress{
 	boost::optional<time_t> started;
 	boost::optional<time_t> last_update;
 	int state = 0;
+	std::unique_ptr<SyncMetrics> metrics;
 
 	std::mutex mutex;
 	static const std::chrono::steady_clock::rep ns_per_sec = 1'000'000'000;
@@ -81,18 +83,29 @@ public:
 		this->total = other.total;
 		this->started = std::move(other.started);
 		this->last_update = std::move(other.last_update);
+		this->metrics = std::move(other.metrics);
 		return *this;
 	}
-	TaskProgress(const std::string &name): task_name(name){
+	//If metrics_phase is given and there's a metrics sink, throughput
+	//snapshots for the task are written to the sink under that phase name.
+	TaskProgress(const std::string &name, const char *metrics_phase = nullptr): task_name(name){
 		mstdout << current_time_string() << " - " << name << std::endl;
+		if (metrics_phase && metrics_sink)
+			this->metrics.reset(new SyncMetrics(*metrics_sink, metrics_phase));
 	}
 	~TaskProgress(){
 		if (this->started.has_value()){
 			char line[128];
 			write_line(line, this->state, 100, {0, 0, 0}, true);
 			mstdout << line;
+			if (this->metrics)
+				this->metrics->write_summary(this->progress, this->total);
 		}
 	}
+	//Null if metrics aren't being collected.
+	SyncMetrics *get_metrics(){
+		return this->metrics.get();
+	}
 	void set_total(double total){
 		this->total = total;
 	}
@@ -114,6 +127,7 @@ public:
 		int percentage = -1;
 		estimate e = {-1, -1, -1};
 		int state;
+		double progress, total;
 		{
 			LOCK_MUTEX(this->mutex);
 			if (added_progress >= 0)
@@ -127,9 +141,13 @@ public:
 				e = this->estimate_remaining((double)(now - *this->started).count() / ns_per_sec, this->total, this->progress);
 			state = this->state++;
 			this->state %= 20;
+			progress = this->progress;
+			total = this->total;
 		}
 		char line[128];
 		write_line(line, state, percentage, e, false);
 		mstdout << line;
+		if (this->metrics)
+			this->metrics->write_snapshot(progress, total);
 	}
 };
@@ -0,0 +1,95 @@
+#include "RadixSort.h"
+#include <algorithm>
+#include <array>
+#include <thread>
+
+namespace{
+
+typedef std::array<size_t, 256> Histogram;
+
+//Byte 0 is the least significant byte of second, byte 15 the most
+//significant byte of first.
+inline unsigned get_byte(const IdPair &pair, unsigned byte){
+	auto value = byte < 8 ? pair.second : pair.first;
+	return (value >> (byte % 8 * 8)) & 0xFF;
+}
+
+template <typename F>
+void run_parallel(unsigned threads, const F &f){
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < threads; i++)
+		workers.emplace_back(f, i);
+	f(0);
+	for (auto &worker : workers)
+		worker.join();
+}
+
+}
+
+void parallel_radix_sort(std::vector<IdPair> &pairs, unsigned threads){
+	const size_t n = pairs.size();
+	if (n < 2)
+		return;
+	if (!threads)
+		threads = std::max(std::thread::hardware_concurrency(), 1U);
+	//Small inputs aren't worth the threads.
+	threads = (unsigned)std::min<size_t>(threads, n / 65536 + 1);
+	std::vector<size_t> bounds(threads + 1);
+	for (unsigned i = 0; i <= threads; i++)
+		bounds[i] = n * i / threads;
+
+	//A byte can be skipped if every pair has the same value in it. The OR and
+	//AND of every pair tell which bits vary.
+	std::vector<IdPair> ors(threads, { 0, 0 }), ands(threads, { ~(u64)0, ~(u64)0 });
+	run_parallel(threads, [&](unsigned t){
+		for (auto i = bounds[t]; i < bounds[t + 1]; i++){
+			ors[t].first |= pairs[i].first;
+			ors[t].second |= pairs[i].second;
+			ands[t].first &= pairs[i].first;
+			ands[t].second &= pairs[i].second;
+		}
+	});
+	IdPair any = { 0, 0 }, all = { ~(u64)0, ~(u64)0 };
+	for (unsigned t = 0; t < threads; t++){
+		any.first |= ors[t].first;
+		any.second |= ors[t].second;
+		all.first &= ands[t].first;
+		all.second &= ands[t].second;
+	}
+	IdPair varying = { any.first & ~all.first, any.second & ~all.second };
+
+	std::vector<IdPair> buffer(n);
+	auto *src = &pairs;
+	auto *dst = &buffer;
+	std::vector<Histogram> histograms(threads);
+	for (unsigned byte = 0; byte < 16; byte++){
+		if (!get_byte(varying, byte))
+			continue;
+		run_parallel(threads, [&](unsigned t){
+			auto &histogram = histograms[t];
+			histogram.fill(0);
+			for (auto i = bounds[t]; i < bounds[t + 1]; i++)
+				histogram[get_byte((*src)[i], byte)]++;
+		});
+		//Each thread writes its pairs of every digit after those of the
+		//threads before it, which keeps the sort stable.
+		size_t offset = 0;
+		for (unsigned digit = 0; digit < 256; digit++){
+			for (unsigned t = 0; t < threads; t++){
+				auto count = histograms[t][digit];
+				histograms[t][digit] = offset;
+				offset += count;
+			}
+		}
+		run_parallel(threads, [&](unsigned t){
+			auto &positions = histograms[t];
+			for (auto i = bounds[t]; i < bounds[t + 1]; i++){
+				auto &pair = (*src)[i];
+				(*dst)[positions[get_byte(pair, byte)]++] = pair;
+			}
+		});
+		std::swap(src, dst);
+	}
+	if (src != &pairs)
+		pairs.swap(buffer);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <common/types.h>
+#include <vector>
+
+//A pair of ids, ordered by the first and then by the second.
+struct IdPair{
+	u64 first;
+	u64 second;
+
+	bool operator<(const IdPair &other) const{
+		if (this->first != other.first)
+			return this->first < other.first;
+		return this->second < other.second;
+	}
+	bool operator==(const IdPair &other) const{
+		return this->first == other.first && this->second == other.second;
+	}
+};
+
+//Sorts with an LSD radix sort on bytes, splitting every pass among threads
+//(one per core by default). Bytes that are the same in every pair are
+//skipped, so ids far below 2^64 only take a few passes.
+void parallel_radix_sort(std::vector<IdPair> &pairs, unsigned threads = 0);
@@ -0,0 +1,323 @@
+#include "ShardedIngest.h"
+#include "BlockRange.h"
+#include "ProgressDisplay.h"
+#include "SyncMetrics.h"
+#include <libbtcparser/InsertState.h>
+#include <libbtcparser/PostingLists.h>
+#include <libbtcparser/SplitLayout.h>
+#include <boost/filesystem.hpp>
+#include <exception>
+#include <set>
+#include <sstream>
+#include <thread>
+
+using namespace sqlite3pp;
+
+namespace{
+
+struct Shard{
+	std::string path;
+	std::string schema;
+	//Range of heights.
+	u64 begin;
+	u64 end;
+	u64 first_block_id;
+	u64 first_transaction_id;
+	//Of the last block in the range.
+	std::string last_block_hash;
+};
+
+//Splits the chain so that every shard gets about as many txs. Blocks are
+//parsed in height order after the ones already in the blocks table, so the
+//ids of a shard's first block and tx are prefix sums over the chain.
+std::vector<Shard> plan_shards(DB &db, Blockchain &blockchain, const std::vector<BlockLocation> &blocks, const Paths &paths, unsigned shard_count){
+	u64 total = 0;
+	for (auto &block : blocks)
+		total += block.transaction_count;
+	u64 first_block_id;
+	db << "select coalesce(max(id), 0) + 1 from blocks;" << Step() >> first_block_id;
+
+	std::vector<Shard> ret;
+	u64 height = 0;
+	u64 txs = 0;
+	for (unsigned i = 0; i < shard_count && height < blocks.size(); i++){
+		Shard shard;
+		shard.path = paths.output_path + "/shard" + std::to_string(i) + ".sqlite";
+		shard.schema = "shard" + std::to_string(i);
+		shard.begin = height;
+		shard.first_block_id = first_block_id + height;
+		shard.first_transaction_id = txs + 1;
+		auto target = total * (i + 1) / shard_count;
+		if (i + 1 == shard_count)
+			height = blocks.size();
+		else{
+			do
+				txs += blocks[height++].transaction_count;
+			while (height < blocks.size() && txs < target);
+		}
+		shard.end = height;
+		shard.last_block_hash = (std::string)blockchain.get_block_by_height(height - 1)->hash;
+		ret.push_back(shard);
+	}
+	return ret;
+}
+
+//A shard that has been filled records its range in the shard_range table.
+//It can be merged by a later run if the range is the same and its last block
+//is still in the chain, which means all the others are too.
+bool shard_is_filled(const Shard &shard){
+	if (!boost::filesystem::exists(shard.path))
+		return false;
+	DB db(shard.path.c_str());
+	if (!db.table_exists("shard_range"))
+		return false;
+	auto stmt = db << "select count(*) from shard_range inner join blocks on blocks.id = ?3 + ?2 - ?1 - 1 where shard_range.begin_height = ?1 and shard_range.end_height = ?2 and shard_range.first_block_id = ?3 and shard_range.first_transaction_id = ?4 and blocks.hash = ?5;";
+	stmt << shard.begin << shard.end << shard.first_block_id << shard.first_transaction_id << shard.last_block_hash << Step();
+	u64 count;
+	stmt >> count;
+	return count > 0;
+}
+
+void fill_shard(const Shard &shard, const std::vector<BlockLocation> &blocks, const Paths &paths, bool testnet, TaskProgress &progress){
+	if (shard_is_filled(shard)){
+		progress.report_progress((double)(shard.end - shard.begin));
+		return;
+	}
+	boost::filesystem::remove(shard.path);
+	initialize_db(shard.path);
+	DB db(shard.path.c_str());
+	InsertState nis(db);
+	nis.begin_shard(shard.first_block_id, shard.first_transaction_id);
+	insert_blocks(db, nis, blocks, shard.begin, shard.end, paths, testnet, progress);
+	u64 inserted;
+	db << "select count(*) from blocks;" << Step() >> inserted;
+	if (inserted < shard.end - shard.begin)
+		return;
+	db.exec("create table shard_range (begin_height integer, end_height integer, first_block_id integer, first_transaction_id integer);");
+	db << "insert into shard_range (begin_height, end_height, first_block_id, first_transaction_id) values (?, ?, ?, ?);"
+		<< shard.begin << shard.end << shard.first_block_id << shard.first_transaction_id << Step();
+}
+
+//Tables are named without schema. Unqualified names are looked up in the main
+//DB first and then in attached DBs in the order they were attached, so they
+//always resolve to the main DB or to its split files, never to a shard.
+class ShardMerger{
+	DB &db;
+	Statement find_tx;
+	Statement find_output;
+	Statement complete_input;
+	Statement spend_output;
+	Statement select_output_addresses;
+	Statement insert_tx_address;
+	u64 input_offset = 0;
+	u64 output_offset = 0;
+
+	void copy_rows(const Shard &);
+	void map_addresses(const Shard &);
+	void resolve_inputs(const Shard &);
+	u64 resolve_input(u64 input_id, const std::string &previous_tx_hash, u32 txo_index);
+	static DB &create_tx_addresses_table(DB &db);
+public:
+	ShardMerger(DB &db);
+	void merge(const Shard &);
+	//Must be called once every shard has been merged.
+	void build_posting_lists();
+};
+
+ShardMerger::ShardMerger(DB &db)
+	: db(db)
+	, find_tx(db << "select id from txs where hash = ?;")
+	, find_output(db << "select id from outputs where txs_id = ? and txo_index = ?;")
+	, complete_input(db << "update inputs set previous_tx_id = ?, outputs_id = ? where id = ?;")
+	, spend_output(db << "update outputs set spent_by = ? where id = ?;")
+	, select_output_addresses(db << "select addresses_id from addresses_outputs where outputs_id = ?;")
+	, insert_tx_address((create_tx_addresses_table(db) << "insert into temp.tx_addresses (addresses_id, txs_id) values (?, ?);")){
+	this->db.exec("create temp table if not exists shard_addresses (local integer primary key, global integer);");
+}
+
+//The main DB has no table for the relations between addresses and txs; they
+//only go to the posting lists (see build_posting_lists()).
+DB &ShardMerger::create_tx_addresses_table(DB &db){
+	db.exec("create temp table if not exists tx_addresses (addresses_id integer, txs_id integer);");
+	return db;
+}
+
+void ShardMerger::merge(const Shard &shard){
+	this->copy_rows(shard);
+	this->map_addresses(shard);
+	this->resolve_inputs(shard);
+	u64 inputs, outputs;
+	this->db << ("select coalesce(max(id), 0) from " + shard.schema + ".inputs;").c_str() << Step() >> inputs;
+	this->db << ("select coalesce(max(id), 0) from " + shard.schema + ".outputs;").c_str() << Step() >> outputs;
+	this->input_offset += inputs;
+	this->output_offset += outputs;
+}
+
+void ShardMerger::copy_rows(const Shard &shard){
+	auto &s = shard.schema;
+	this->db.exec(("insert into blocks (id, hash, previous_hash, timestamp, first_transaction_id, transaction_count, file_name, file_offset, size_in_file) select id, hash, previous_hash, timestamp, first_transaction_id, transaction_count, file_name, file_offset, size_in_file from " + s + ".blocks;").c_str());
+	this->db.exec(("insert into txs (id, hash, whash, locktime, blocks_id, index_in_block, input_count, output_count) select id, hash, whash, locktime, blocks_id, index_in_block, input_count, output_count from " + s + ".txs;").c_str());
+	this->db.exec(("insert into tx_locations (txs_id, file_offset, size_in_file) select txs_id, file_offset, size_in_file from " + s + ".tx_locations;").c_str());
+	this->db << ("insert into outputs (id, txs_id, txo_index, value, required_spenders, script, spent_by) select id + ?, txs_id, txo_index, value, required_spenders, script, spent_by + ? from " + s + ".outputs;").c_str()
+		<< this->output_offset << this->input_offset << Step();
+	this->db << ("insert into inputs (id, previous_tx_id, txo_index, outputs_id, txs_id, txi_index) select id + ?, previous_tx_id, txo_index, outputs_id + ?, txs_id, txi_index from " + s + ".inputs;").c_str()
+		<< this->input_offset << this->output_offset << Step();
+}
+
+//Addresses new to the main DB are added in the order the shard first saw
+//them, so they get the same ids a sequential parse would give them.
+void ShardMerger::map_addresses(const Shard &shard){
+	auto &s = shard.schema;
+	this->db.exec(("insert into addresses (address) select address from " + s + ".addresses a where not exists (select * from addresses m where m.address = a.address) order by id;").c_str());
+	this->db.exec("delete from temp.shard_addresses;");
+	this->db.exec(("insert into temp.shard_addresses (local, global) select a.id, m.id from " + s + ".addresses a join addresses m on m.address = a.address;").c_str());
+	this->db << ("insert into addresses_outputs (addresses_id, outputs_id) select m.global, r.outputs_id + ? from " + s + ".addresses_outputs r join temp.shard_addresses m on m.local = r.addresses_id;").c_str()
+		<< this->output_offset << Step();
+	this->db.exec(("insert into temp.tx_addresses (addresses_id, txs_id) select m.global, r.txs_id from " + s + ".addresses_txs r join temp.shard_addresses m on m.local = r.addresses_id;").c_str());
+}
+
+void ShardMerger::build_posting_lists(){
+	PostingLists postings(this->db);
+	postings.build_from_relations("select addresses_id, outputs_id from addresses_outputs order by addresses_id, outputs_id;", PostingKind::Outputs);
+	postings.build_from_relations("select addresses_id, txs_id from temp.tx_addresses order by addresses_id, txs_id;", PostingKind::Txs);
+}
+
+u64 ShardMerger::resolve_input(u64 input_id, const std::string &previous_tx_hash, u32 txo_index){
+	this->find_tx << Reset() << previous_tx_hash;
+	if (this->find_tx.step() != SQLITE_ROW){
+		std::stringstream stream;
+		stream << "Input " << input_id << " references unknown tx " << previous_tx_hash;
+		throw std::runtime_error(stream.str());
+	}
+	u64 tx_id;
+	this->find_tx >> tx_id;
+	this->find_output << Reset() << tx_id << txo_index;
+	if (this->find_output.step() != SQLITE_ROW){
+		std::stringstream stream;
+		stream << "Input " << input_id << " references unknown txo " << previous_tx_hash << ", " << txo_index;
+		throw std::runtime_error(stream.str());
+	}
+	u64 output_id;
+	this->find_output >> output_id;
+	this->complete_input << Reset() << tx_id << output_id << input_id << Step();
+	this->spend_output << Reset() << input_id << output_id << Step();
+	return output_id;
+}
+
+//Walks the unresolved inputs and the deferred address relations together,
+//both sorted by tx, and writes each tx's relations once all of its inputs
+//are known.
+void ShardMerger::resolve_inputs(const Shard &shard){
+	auto &s = shard.schema;
+	auto inputs = this->db << ("select txs_id, inputs_id, previous_tx_hash, txo_index from " + s + ".unresolved_inputs order by txs_id, inputs_id;").c_str();
+	auto relations = this->db << ("select r.txs_id, m.global from " + s + ".deferred_tx_addresses r join temp.shard_addresses m on m.local = r.addresses_id order by r.txs_id;").c_str();
+
+	struct{
+		u64 tx;
+		u64 input;
+		std::string previous_tx_hash;
+		u32 txo_index;
+	} input;
+	struct{
+		u64 tx;
+		u64 address;
+	} relation;
+	auto next_input = [&](){
+		if (inputs.step() != SQLITE_ROW)
+			return false;
+		inputs >> input.tx >> input.input >> input.previous_tx_hash >> input.txo_index;
+		input.input += this->input_offset;
+		return true;
+	};
+	auto next_relation = [&](){
+		if (relations.step() != SQLITE_ROW)
+			return false;
+		relations >> relation.tx >> relation.address;
+		return true;
+	};
+
+	bool more_inputs = next_input();
+	bool more_relations = next_relation();
+	std::set<u64> addresses;
+	while (more_inputs){
+		auto tx = input.tx;
+		addresses.clear();
+		for (; more_inputs && input.tx == tx; more_inputs = next_input()){
+			auto output = this->resolve_input(input.input, input.previous_tx_hash, input.txo_index);
+			this->select_output_addresses << Reset() << output;
+			while (this->select_output_addresses.step() == SQLITE_ROW){
+				u64 address;
+				this->select_output_addresses >> address;
+				addresses.insert(address);
+			}
+		}
+		for (; more_relations && relation.tx <= tx; more_relations = next_relation())
+			if (relation.tx == tx)
+				addresses.insert(relation.address);
+		for (auto address : addresses)
+			this->insert_tx_address << Reset() << address << tx << Step();
+	}
+}
+
+}
+
+void sharded_ingest(DB &db, Blockchain &blockchain, const Paths &paths, bool testnet, unsigned shard_count){
+	u64 txs;
+	db << "select count(*) from (select * from txs limit 1);" << Step() >> txs;
+	if (txs)
+		throw std::runtime_error("Sharded ingest needs a DB without txs.");
+	//The files of a split DB are attached too.
+	auto shard_limit = max_shards - (unsigned)get_split_schemas(db).size();
+	if (shard_count > shard_limit)
+		throw std::runtime_error("Too many shards. The maximum is " + std::to_string(shard_limit) + ".");
+
+	auto blocks = locate_blocks(db, blockchain);
+	auto shards = plan_shards(db, blockchain, blocks, paths, shard_count);
+	{
+		std::stringstream stream;
+		stream << "Parsing blocks in " << shards.size() << " shards...";
+		TaskProgress progress(stream.str(), "parse_blocks");
+		progress.start(blocks.size());
+		std::vector<std::exception_ptr> errors(shards.size());
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < shards.size(); i++){
+			threads.emplace_back([&, i](){
+				try{
+					fill_shard(shards[i], blocks, paths, testnet, progress);
+				}catch (std::exception &){
+					errors[i] = std::current_exception();
+					continue_running = false;
+				}
+			});
+		}
+		for (auto &thread : threads)
+			thread.join();
+		for (auto &error : errors)
+			if (error)
+				std::rethrow_exception(error);
+	}
+	if (!continue_running)
+		return;
+
+	TaskProgress progress("Merging shards...", "merge_shards");
+	auto metrics = progress.get_metrics();
+	if (metrics)
+		metrics->observe_commits(db);
+	progress.start(shards.size());
+	//Attaching isn't allowed inside a transaction.
+	for (auto &shard : shards)
+		db << ("attach database ? as " + shard.schema + ";").c_str() << shard.path << Step();
+	{
+		sqlite3pp::Transaction t(db);
+		ShardMerger merger(db);
+		for (auto &shard : shards){
+			merger.merge(shard);
+			progress.report_progress(1);
+		}
+		merger.build_posting_lists();
+	}
+	for (auto &shard : shards){
+		db.exec(("detach database " + shard.schema + ";").c_str());
+		boost::filesystem::remove(shard.path);
+	}
+}
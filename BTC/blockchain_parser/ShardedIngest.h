@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Paths.h"
+#include <libbtcparser/Blockchain.h>
+#include <sqlitepp/sqlitepp.h>
+
+//SQLite can't attach more DBs than this by default, and the merge attaches
+//every shard at once.
+const unsigned max_shards = 10;
+
+//Parses the whole chain in parallel and writes it to db, which must not have
+//any txs yet.
+//
+//The chain is split into shard_count ranges of consecutive heights with about
+//as many txs each, and each range is inserted by its own thread into a DB of
+//its own (output_dir/shard<n>.sqlite). Since the blocks table already holds
+//the tx count of every block, the ids of each range's blocks and txs are
+//known beforehand (by prefix sums) and are the same a sequential parse would
+//give them. Inputs and outputs are numbered within their shard and offset
+//during the merge by the counts of the shards before them.
+//
+//Inputs that spend outputs from earlier shards can't be resolved by their
+//shard. After the shards are copied into db, in a single transaction, those
+//inputs are looked up by tx hash and completed, along with the address
+//relations of their txs. The posting lists are built last, from the
+//relations of every shard. If the process is stopped before the merge
+//finishes, db is left as it was. The shards that were filled are kept, and
+//the next run only fills the others again, as long as it plans the same
+//ranges and the chain still has their blocks. The shards are deleted once
+//they've been merged.
+void sharded_ingest(sqlite3pp::DB &db, Blockchain &blockchain, const Paths &paths, bool testnet, unsigned shard_count);
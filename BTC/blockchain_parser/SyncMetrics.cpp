@@ -0,0 +1,163 @@
+#include "SyncMetrics.h"
+#include <libbtcparser/Block.h>
+#include <common/misc.h>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#ifdef _WIN32
+#include <io.h>
+#define fdopen _fdopen
+#endif
+
+MetricsSink::MetricsSink(const std::string &destination, double interval): interval(interval){
+	if (destination.compare(0, 3, "fd:") == 0){
+		this->file = fdopen(std::stoi(destination.substr(3)), "w");
+		this->owned = false;
+	}else{
+		this->file = fopen(destination.c_str(), "a");
+		this->owned = true;
+	}
+	if (!this->file)
+		throw std::runtime_error("Can't open metrics destination " + destination);
+}
+
+MetricsSink::~MetricsSink(){
+	if (this->owned)
+		fclose(this->file);
+	else
+		fflush(this->file);
+}
+
+void MetricsSink::write_line(const std::string &line){
+	LOCK_MUTEX(this->mutex);
+	fputs(line.c_str(), this->file);
+	fputc('\n', this->file);
+	fflush(this->file);
+}
+
+void SyncMetrics::CommitStats::add(u64 nanoseconds){
+	this->count++;
+	this->total += nanoseconds;
+	this->max = std::max(this->max, nanoseconds);
+}
+
+SyncMetrics::SyncMetrics(MetricsSink &sink, const std::string &phase)
+		: sink(sink)
+		, phase(phase)
+		, blocks(0)
+		, txs(0)
+		, inputs(0)
+		, outputs(0)
+		, bytes_read(0)
+		, height(-1)
+		, started(Clock::now())
+		, last_snapshot(started){}
+
+SyncMetrics::~SyncMetrics(){
+	if (this->db)
+		this->db->remove_observer(this);
+}
+
+void SyncMetrics::observe_commits(sqlite3pp::DB &db){
+	this->db = &db;
+	db.add_observer(this);
+}
+
+void SyncMetrics::add_block(const Block &block){
+	u64 inputs = 0;
+	u64 outputs = 0;
+	auto &txs = block.get_transactions();
+	for (auto &tx : txs){
+		inputs += tx.get_inputs().size();
+		outputs += tx.get_outputs().size();
+	}
+	this->blocks++;
+	this->txs += txs.size();
+	this->inputs += inputs;
+	this->outputs += outputs;
+}
+
+void SyncMetrics::set_queue_depth(const std::string &stage, s64 depth){
+	LOCK_MUTEX(this->mutex);
+	this->queue_depths[stage] = depth;
+}
+
+SyncMetrics::Counters SyncMetrics::get_counters() const{
+	Counters ret;
+	ret.blocks = this->blocks;
+	ret.txs = this->txs;
+	ret.inputs = this->inputs;
+	ret.outputs = this->outputs;
+	ret.bytes_read = this->bytes_read;
+	return ret;
+}
+
+//Counters are reported as totals, and as rates over the time since base.
+std::string SyncMetrics::format_record(const char *type, double progress, double total, const Counters &counters, const Counters &base, double seconds, const CommitStats &commits){
+	auto rate = [seconds](u64 n){
+		return seconds > 0 ? n / seconds : 0;
+	};
+	nlohmann::json ret;
+	ret["type"] = type;
+	ret["phase"] = this->phase;
+	ret["time"] = current_time_string();
+	ret["elapsed_s"] = std::chrono::duration<double>(Clock::now() - this->started).count();
+	ret["progress"] = progress;
+	ret["total"] = total;
+	ret["height"] = (s64)this->height;
+	ret["blocks"] = counters.blocks;
+	ret["txs"] = counters.txs;
+	ret["inputs"] = counters.inputs;
+	ret["outputs"] = counters.outputs;
+	ret["bytes_read"] = counters.bytes_read;
+	ret["blocks_per_s"] = rate(counters.blocks - base.blocks);
+	ret["txs_per_s"] = rate(counters.txs - base.txs);
+	ret["inputs_per_s"] = rate(counters.inputs - base.inputs);
+	ret["outputs_per_s"] = rate(counters.outputs - base.outputs);
+	ret["mb_read_per_s"] = rate(counters.bytes_read - base.bytes_read) / 1e6;
+	ret["commits"] = commits.count;
+	ret["commit_ms_mean"] = commits.count ? commits.total / 1e6 / commits.count : 0;
+	ret["commit_ms_max"] = commits.max / 1e6;
+	ret["queue_depths"] = nlohmann::json::object();
+	for (auto &kv : this->queue_depths)
+		ret["queue_depths"][kv.first] = kv.second;
+	//Names that aren't valid UTF-8 shouldn't cost the sync its metrics.
+	return ret.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
+void SyncMetrics::write_snapshot(double progress, double total){
+	std::string line;
+	{
+		LOCK_MUTEX(this->mutex);
+		auto now = Clock::now();
+		auto seconds = std::chrono::duration<double>(now - this->last_snapshot).count();
+		if (seconds < this->sink.get_interval())
+			return;
+		auto counters = this->get_counters();
+		line = this->format_record("snapshot", progress, total, counters, this->counters_at_last_snapshot, seconds, this->interval_commits);
+		this->last_snapshot = now;
+		this->counters_at_last_snapshot = counters;
+		this->interval_commits = CommitStats();
+	}
+	this->sink.write_line(line);
+}
+
+void SyncMetrics::write_summary(double progress, double total){
+	std::string line;
+	{
+		LOCK_MUTEX(this->mutex);
+		auto seconds = std::chrono::duration<double>(Clock::now() - this->started).count();
+		line = this->format_record("summary", progress, total, this->get_counters(), Counters(), seconds, this->total_commits);
+	}
+	this->sink.write_line(line);
+}
+
+void SyncMetrics::before_commit(){
+	this->commit_started = Clock::now();
+}
+
+void SyncMetrics::after_commit(){
+	auto nanoseconds = (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - this->commit_started).count();
+	LOCK_MUTEX(this->mutex);
+	this->interval_commits.add(nanoseconds);
+	this->total_commits.add(nanoseconds);
+}
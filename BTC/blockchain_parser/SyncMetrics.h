@@ -0,0 +1,107 @@
+#pragma once
+
+#include <common/types.h>
+#include <sqlitepp/sqlitepp.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+
+class Block;
+
+//Destination of sync metrics: a file, or a file descriptor that's already
+//open, given as fd:<n>. Each record is written as a line containing a JSON
+//object, and flushed right away so that the file can be followed while the
+//sync runs.
+class MetricsSink{
+	FILE *file;
+	bool owned;
+	double interval;
+	std::mutex mutex;
+public:
+	//interval is the minimum time in seconds between two snapshots of the
+	//same phase.
+	MetricsSink(const std::string &destination, double interval = 1);
+	~MetricsSink();
+	MetricsSink(const MetricsSink &) = delete;
+	const MetricsSink &operator=(const MetricsSink &) = delete;
+	double get_interval() const{
+		return this->interval;
+	}
+	void write_line(const std::string &line);
+};
+
+//Throughput counters for a phase of the sync. Counters can be updated from
+//any thread. Snapshots report the rates since the previous snapshot, so that
+//throughput can be charted over the chain; the summary reports the averages
+//over the whole phase.
+class SyncMetrics : public sqlite3pp::TransactionObserver{
+	typedef std::chrono::steady_clock Clock;
+
+	struct Counters{
+		u64 blocks = 0;
+		u64 txs = 0;
+		u64 inputs = 0;
+		u64 outputs = 0;
+		u64 bytes_read = 0;
+	};
+
+	struct CommitStats{
+		u64 count = 0;
+		u64 total = 0;
+		u64 max = 0;
+
+		void add(u64 nanoseconds);
+	};
+
+	MetricsSink &sink;
+	std::string phase;
+	sqlite3pp::DB *db = nullptr;
+	std::atomic<u64> blocks;
+	std::atomic<u64> txs;
+	std::atomic<u64> inputs;
+	std::atomic<u64> outputs;
+	std::atomic<u64> bytes_read;
+	std::atomic<s64> height;
+
+	std::mutex mutex;
+	std::map<std::string, s64> queue_depths;
+	Clock::time_point started;
+	Clock::time_point last_snapshot;
+	Counters counters_at_last_snapshot;
+	CommitStats interval_commits;
+	CommitStats total_commits;
+	Clock::time_point commit_started;
+
+	Counters get_counters() const;
+	std::string format_record(const char *type, double progress, double total, const Counters &counters, const Counters &base, double seconds, const CommitStats &commits);
+public:
+	SyncMetrics(MetricsSink &sink, const std::string &phase);
+	~SyncMetrics();
+	SyncMetrics(const SyncMetrics &) = delete;
+	const SyncMetrics &operator=(const SyncMetrics &) = delete;
+
+	//Records the time taken by every commit on db. The connection must outlive
+	//this object.
+	void observe_commits(sqlite3pp::DB &db);
+	//Counts the block and its txs, inputs and outputs.
+	void add_block(const Block &block);
+	void add_bytes_read(u64 bytes){
+		this->bytes_read += bytes;
+	}
+	void set_height(u64 height){
+		this->height = (s64)height;
+	}
+	//Reports the number of items waiting in a stage of the phase.
+	void set_queue_depth(const std::string &stage, s64 depth);
+	//Writes a snapshot, unless one was written less than the sink's interval
+	//ago.
+	void write_snapshot(double progress, double total);
+	void write_summary(double progress, double total);
+
+	void before_commit() override;
+	void after_commit() override;
+	void after_rollback() override{}
+};
@@ -4,7 +4,7 @@
 using namespace sqlite3pp;
 
 BlockAdder::BlockAdder(sqlite3pp::DB &db, const Paths &paths, bool testnet):
-	ParallelBlockProcessor("Adding all blocks", paths, testnet),
+	ParallelBlockProcessor("Adding all blocks", "add_blocks", paths, testnet),
 	db(&db),
 	insert(db << "insert into blocks (hash, previous_hash, timestamp, transaction_count, file_name, file_offset, size_in_file) values (?, ?, ?, ?, ?, ?, ?);"){
 }
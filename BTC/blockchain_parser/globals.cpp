@@ -1,7 +1,9 @@
 #include "globals.h"
+#include "SyncMetrics.h"
 #include <iostream>
 
 std::atomic<bool> continue_running;
 std::mutex output_mutex;
 OutputSequencer mstdout(std::cout, output_mutex);
 OutputSequencer mstderr(std::cerr, output_mutex);
+std::unique_ptr<MetricsSink> metrics_sink;
@@ -1,7 +1,12 @@
 #pragma once
 #include <atomic>
 #include <common/misc.h>
+#include <memory>
+
+class MetricsSink;
 
 extern std::atomic<bool> continue_running;
 extern OutputSequencer mstdout;
 extern OutputSequencer mstderr;
+//Null unless a metrics destination was given on the command line.
+extern std::unique_ptr<MetricsSink> metrics_sink;
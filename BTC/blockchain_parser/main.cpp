@@ -1,17 +1,44 @@
 #include "Paths.h"
 #include "add_all_blocks.h"
+#include <libbtcparser/AddressFormat.h>
 #include <libbtcparser/Block.h>
 #include <libbtcparser/Blockchain.h>
+#include <libbtcparser/ColumnStore.h>
+#include <libbtcparser/HistoryPruner.h>
+#include <libbtcparser/SplitLayout.h>
 #include <sqlitepp/sqlitepp.h>
 #include <common/serialization.h>
 #include <csignal>
+#include <cstring>
 #include <fstream>
+#include <sstream>
 #include <boost/filesystem.hpp>
 #include "ProgressDisplay.h"
+#include "SyncMetrics.h"
+#include "ShardedIngest.h"
+#include "BulkIngest.h"
+#include "BlockRange.h"
+#include "IndexBuild.h"
+#include "HistoryPrune.h"
+#include "PostingMigration.h"
 
 void find_longest_chain(const Paths &paths);
 
-void initialize_db(const Paths &paths){
+//Puts the table or index a create statement makes in the schema of its table.
+static std::string qualify_create(sqlite3pp::DB &db, const std::string &command){
+	std::stringstream stream(command);
+	std::string create, kind, name, on, table;
+	stream >> create >> kind >> name;
+	name = name.substr(0, name.find('('));
+	if (kind == "index")
+		stream >> on >> table;
+	else
+		table = name;
+	auto position = command.find(name, create.size() + kind.size());
+	return command.substr(0, position) + get_table_schema(db, table) + "." + command.substr(position);
+}
+
+void initialize_db(const std::string &db_path, bool split){
 	using namespace sqlite3pp;
 	static const char * const commands[] = {
 		"create table blocks(\n"
@@ -43,6 +70,12 @@ void initialize_db(const Paths &paths){
 		"create index txs_by_hash on txs (hash);",
 		"create index txs_by_blocks_id on txs (blocks_id);",
 
+		"create table tx_locations (\n"
+		"    txs_id integer primary key,\n"
+		"    file_offset integer,\n"
+		"    size_in_file integer\n"
+		");",
+
 		"create table inputs(\n"
 		"    id integer primary key,\n"
 		"    previous_tx_id integer,\n"
@@ -52,9 +85,7 @@ void initialize_db(const Paths &paths){
 		"    txi_index integer\n"
 		");",
 
-		//"create index inputs_by_previous_tx_id on inputs(previous_tx_id);",
-		//"create index inputs_by_txs_id on inputs(txs_id);",
-		//"create index inputs_by_outputs_id on inputs(outputs_id);",
+		//Indexes on inputs are deferred. See libbtcparser/DeferredIndexes.h.
 
 		"create table outputs(\n"
 		"    id integer primary key,\n"
@@ -85,30 +116,68 @@ void initialize_db(const Paths &paths){
 		"    outputs_id integer\n"
 		");",
 
-		//"create index addresses_outputs_by_addresses_id on addresses_outputs (addresses_id);",
 		"create index addresses_outputs_by_outputs_id on addresses_outputs (outputs_id);",
 
-		"create table addresses_txs(\n"
+		"create table address_postings (\n"
 		"    addresses_id integer,\n"
-		"    txs_id integer\n"
-		");",
-
-		//"create index addresses_txs_by_addresses_id on addresses_txs (addresses_id);",
-		//"create index addresses_txs_by_txs_id on addresses_txs (txs_id);",
+		"    kind integer,\n"
+		"    first_id integer,\n"
+		"    last_id integer,\n"
+		"    count integer,\n"
+		"    data blob,\n"
+		"    primary key (addresses_id, kind, first_id)\n"
+		") without rowid;",
+
+		"create table address_postings_pruned (\n"
+		"    addresses_id integer,\n"
+		"    kind integer,\n"
+		"    first_id integer,\n"
+		"    last_id integer,\n"
+		"    count integer,\n"
+		"    primary key (addresses_id, kind)\n"
+		") without rowid;",
 
 		"create table blockchain_head (hash string);",
 
 		"create table cached_balances (id integer primary key, balance integer);",
 
-		"create table block_fees (id integer primary key, average_fee_per_kb integer);",
+		"create table block_fee_rates (id integer primary key, quantiles blob);",
+		"create table block_undo (id integer primary key, data blob);",
 	};
 
-	DB db(paths.db_path.c_str());
+	DB db(db_path.c_str());
+	if (split)
+		create_split_layout(db, db_path);
 	for (auto &cmd : commands)
-		db.exec(cmd);
+		db.exec(qualify_create(db, cmd).c_str());
+}
+
+//Tells libbtcindex where to read raw txs from (see libbtcindex/RawTxReader.h).
+static void record_block_files_path(sqlite3pp::DB &db, const Paths &paths){
+	using namespace sqlite3pp;
+	sqlite3pp::Transaction t(db);
+	db.exec("create table if not exists block_files (path text);");
+	db.exec("delete from block_files;");
+	db << "insert into block_files (path) values (?);" << boost::filesystem::absolute(paths.config_path + "/blocks").string() << Step();
+}
+
+static u64 chain_length(const HeadCandidate *head){
+	u64 ret = 0;
+	for (; head; head = head->previous)
+		ret++;
+	return ret;
 }
 
 size_t head_selector(const std::vector<const HeadCandidate *> &heads){
+	//Stale blocks are heads too. If one chain is longer than the rest, it's
+	//the one that was followed.
+	std::vector<u64> lengths;
+	for (auto head : heads)
+		lengths.push_back(chain_length(head));
+	auto longest = std::max_element(lengths.begin(), lengths.end()) - lengths.begin();
+	if (std::count(lengths.begin(), lengths.end(), lengths[longest]) == 1)
+		return longest;
+
 	size_t ret;
 	do{
 		std::cout << "Multiple possible heads. Please select one:\n";
@@ -160,6 +229,9 @@ size_t find_next_processing_block(sqlite3pp::DB &db, Blockchain &blockchain){
 	db << "select blocks_id from txs where id = (select max(id) from txs);" << Step() >> last_block_id;
 	bool found = false;
 	auto n = blockchain.get_height() + 1;
+	//Every block has been parsed.
+	if (blockchain.get_block_by_height(n - 1)->db_id == last_block_id)
+		return n;
 	for (size_t i = 0; i < n; i++){
 		if (blockchain.get_block_by_height(i)->previous_block_id == last_block_id){
 			found = true;
@@ -175,13 +247,31 @@ int main(int argc, char **argv){
 
 	if (argc < 3){
 		mstderr <<
-			"Usage: blockchain_parser <config dir> <output dir> [<testnet>]\n"
+			"Usage: blockchain_parser <config dir> <output dir> [<testnet> [<columnar> [<metrics> [<shards> [<bulk> [<split> [<prune>]]]]]]]\n"
 			"\n"
-			"The testnet argument must be a 0 or a 1. If not provided, it defaults to 0.\n";
+			"The testnet argument must be a 0 or a 1. If not provided, it defaults to 0.\n"
+			"If columnar is 1, the database is set up to use the column store (see\n"
+			"libbtcparser/ColumnStore.h). Once enabled it's always used.\n"
+			"If metrics is given, throughput snapshots are appended to it as JSON lines.\n"
+			"It's either a file path or fd:<n> to write to an open file descriptor, or -\n"
+			"for none.\n"
+			"If shards is greater than 1, a DB without txs is filled by that many threads\n"
+			"in parallel (see blockchain_parser/ShardedIngest.h).\n"
+			"If bulk is 1, a DB without txs is filled in two phases, resolving spends\n"
+			"with sorts instead of lookups (see blockchain_parser/BulkIngest.h).\n"
+			"If split is 1, a new DB keeps its chain, UTXO and address tables in files of\n"
+			"their own (see libbtcparser/SplitLayout.h).\n"
+			"If prune is greater than 0, only the history of that many blocks at the tip is\n"
+			"kept (see libbtcparser/HistoryPruner.h). Once enabled it's always used.\n";
 		return -1;
 	}
 
 	const bool testnet = argc >= 4 && atoi(argv[3]);
+	const bool columnar = argc >= 5 && atoi(argv[4]);
+	const unsigned shard_count = argc >= 7 ? (unsigned)atoi(argv[6]) : 1;
+	const bool bulk = argc >= 8 && atoi(argv[7]);
+	const bool split = argc >= 9 && atoi(argv[8]);
+	const u64 keep_blocks = argc >= 10 ? strtoull(argv[9], nullptr, 10) : 0;
 
 	if (testnet)
 		mstdout << "Using testnet.\n";
@@ -190,40 +280,60 @@ int main(int argc, char **argv){
 	signal(SIGINT, [](auto){ continue_running = false; });
 	signal(SIGTERM, [](auto){ continue_running = false; });
 	try{
+		if (argc >= 6 && strcmp(argv[5], "-"))
+			metrics_sink.reset(new MetricsSink(argv[5]));
 		Paths paths(argv);
 		if (!boost::filesystem::exists(paths.db_path))
-			initialize_db(paths);
+			initialize_db(paths.db_path, split);
 
 		DB db(paths.db_path.c_str());
+		attach_split_files(db, paths.db_path);
+		InsertState::initialize_locations_table(db);
+		record_block_files_path(db, paths);
+		migrate_posting_lists(db);
+		check_address_format(db);
+		initialize_address_format(db);
+		if (columnar)
+			ColumnStore::enable(db);
+		if (keep_blocks)
+			HistoryPruner::enable(db, keep_blocks);
 
 		auto blockchain = initialize_blockchain(db, paths, testnet);
 		auto next_processing_block = find_next_processing_block(db, *blockchain);
 
-		InsertState nis(db);
-		auto stmt = db << "select file_name, file_offset, size_in_file from blocks where id = ?;";
-		TaskProgress task("Parsing blocks...");
-		auto n = blockchain->get_height() + 1;
-		task.start(n - next_processing_block);
-		for (auto i = next_processing_block; continue_running && i < n;){
-			sqlite3pp::Transaction t(db);
-			for (int j = 100; j-- && continue_running && i < n; i++){
-				task.report_progress(1);
-				std::string filename;
-				u64 file_offset, size;
-				auto blockchain_block = *blockchain->get_block_by_height(i);
-				stmt << Reset() << blockchain_block.db_id << Step() >> filename >> file_offset >> size;
-				auto path = paths.config_path + "/blocks/" + filename;
-				std::ifstream file(path, std::ios::binary);
-				if (!file)
-					throw std::runtime_error("File not found: " + path);
-				file.seekg(file_offset);
-				std::unique_ptr<u8[]> buffer(new u8[size]);
-				file.read((char *)buffer.get(), size);
-				SerializedBuffer sb(buffer.get(), size);
-				::Block block(sb, testnet);
-				block.insert(nis);
+		auto column_store = ColumnStore::open(db, paths.db_path);
+		bool parsed = false;
+		if (bulk_ingest_pending(db)){
+			mstdout << "Resuming a bulk parse.\n";
+			bulk_ingest(db, *blockchain, paths, testnet);
+			parsed = true;
+		}else if (shard_count > 1 || bulk){
+			if (column_store)
+				mstdout << "The column store can only be filled by a sequential parse. Parsing sequentially.\n";
+			else if (next_processing_block)
+				mstdout << "Resuming a sequential parse.\n";
+			else{
+				if (shard_count > 1)
+					sharded_ingest(db, *blockchain, paths, testnet, shard_count);
+				else
+					bulk_ingest(db, *blockchain, paths, testnet);
+				parsed = true;
 			}
 		}
+		if (!parsed){
+			InsertState nis(db, column_store.get());
+			auto blocks = locate_blocks(db, *blockchain);
+			TaskProgress task("Parsing blocks...", "parse_blocks");
+			auto metrics = task.get_metrics();
+			if (metrics)
+				metrics->observe_commits(db);
+			task.start(blocks.size() - next_processing_block);
+			insert_blocks(db, nis, blocks, next_processing_block, blocks.size(), paths, testnet, task);
+		}
+		if (continue_running)
+			build_deferred_indexes(db, paths.db_path);
+		if (continue_running)
+			prune_history(db, *blockchain);
 
 	}catch (std::exception &e){
 		mstderr << e.what() << std::endl;
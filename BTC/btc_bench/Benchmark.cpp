@@ -0,0 +1,85 @@
+#include "Benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+static volatile u64 sink;
+
+void do_not_optimize(u64 x){
+	sink = sink + x;
+}
+
+double BenchmarkRunner::time_sample(const Benchmark &benchmark, u64 iterations){
+	if (benchmark.setup)
+		benchmark.setup(iterations);
+	auto start = std::chrono::steady_clock::now();
+	benchmark.body(iterations);
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+void BenchmarkRunner::run(const Benchmark &benchmark){
+	if (benchmark.name.find(this->filter) == benchmark.name.npos)
+		return;
+	std::cerr << benchmark.name << std::endl;
+	u64 iterations = 1;
+	while (this->time_sample(benchmark, iterations) < this->min_sample_time)
+		iterations *= 2;
+
+	BenchmarkResult result;
+	result.name = benchmark.name;
+	result.iterations = iterations;
+	result.items_per_iteration = benchmark.items_per_iteration;
+	result.bytes_per_iteration = benchmark.bytes_per_iteration;
+	auto items = (double)iterations * benchmark.items_per_iteration;
+	for (unsigned i = 0; i < this->sample_count; i++)
+		result.samples.push_back(this->time_sample(benchmark, iterations) * 1e9 / items);
+	this->results.push_back(std::move(result));
+}
+
+nlohmann::json BenchmarkResult::to_json() const{
+	auto sorted = this->samples;
+	std::sort(sorted.begin(), sorted.end());
+	auto n = sorted.size();
+	auto median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+	double mean = 0;
+	for (auto x : sorted)
+		mean += x;
+	mean /= n;
+	double variance = 0;
+	std::vector<double> deviations;
+	for (auto x : sorted){
+		variance += (x - mean) * (x - mean);
+		deviations.push_back(std::abs(x - median));
+	}
+	variance /= n > 1 ? n - 1 : 1;
+	std::sort(deviations.begin(), deviations.end());
+
+	nlohmann::json ret;
+	ret["name"] = this->name;
+	ret["samples"] = n;
+	ret["iterations_per_sample"] = this->iterations;
+	ret["items_per_iteration"] = this->items_per_iteration;
+	ret["ns_per_item"] = {
+		{ "min", sorted.front() },
+		{ "median", median },
+		{ "mean", mean },
+		{ "max", sorted.back() },
+		{ "stddev", std::sqrt(variance) },
+		//Median absolute deviation. Unlike stddev, it isn't thrown off by
+		//the odd sample that got preempted.
+		{ "mad", deviations[n / 2] },
+	};
+	ret["items_per_second"] = 1e9 / median;
+	if (this->bytes_per_iteration)
+		ret["bytes_per_second"] = 1e9 / median * this->bytes_per_iteration / this->items_per_iteration;
+	return ret;
+}
+
+nlohmann::json BenchmarkRunner::to_json() const{
+	auto ret = nlohmann::json::array();
+	for (auto &result : this->results)
+		ret.push_back(result.to_json());
+	return ret;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <common/types.h>
+#include <nlohmann/json.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct Benchmark{
+	std::string name;
+	//Work done by a single iteration, used to report per-item times and
+	//throughput.
+	u64 items_per_iteration = 1;
+	u64 bytes_per_iteration = 0;
+	//Called before each sample with the number of iterations it will run.
+	//Not timed.
+	std::function<void(u64)> setup;
+	std::function<void(u64)> body;
+};
+
+struct BenchmarkResult{
+	std::string name;
+	u64 iterations;
+	u64 items_per_iteration;
+	u64 bytes_per_iteration;
+	//Nanoseconds per item, over all samples.
+	std::vector<double> samples;
+
+	nlohmann::json to_json() const;
+};
+
+//Runs each benchmark for a fixed number of samples. The number of iterations
+//per sample is found by doubling it until a sample takes at least
+//min_sample_time, which also warms up caches and branch predictors.
+class BenchmarkRunner{
+	std::string filter;
+	unsigned sample_count;
+	double min_sample_time;
+	std::vector<BenchmarkResult> results;
+
+	double time_sample(const Benchmark &, u64 iterations);
+public:
+	BenchmarkRunner(const std::string &filter, unsigned sample_count = 15, double min_sample_time = 0.02)
+		: filter(filter)
+		, sample_count(sample_count)
+		, min_sample_time(min_sample_time){}
+	//Benchmarks whose name doesn't contain the filter are skipped.
+	void run(const Benchmark &);
+	nlohmann::json to_json() const;
+};
+
+//Keeps the compiler from optimizing away the computation of x.
+void do_not_optimize(u64 x);
@@ -0,0 +1,210 @@
+#include "Corpus.h"
+#include <fstream>
+#include <stdexcept>
+
+static int hex_value(char c){
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	throw std::runtime_error("Invalid hex digit in corpus.");
+}
+
+std::vector<CorpusEntry> load_corpus(const std::string &path){
+	std::ifstream file(path);
+	if (!file)
+		throw std::runtime_error("Can't open corpus " + path);
+	std::vector<CorpusEntry> ret;
+	std::string line;
+	while (std::getline(file, line)){
+		if (line.size() && line.back() == '\r')
+			line.pop_back();
+		if (!line.size() || line[0] == '#')
+			continue;
+		auto space = line.find(' ');
+		if (space == line.npos || (line.size() - space - 1) % 2)
+			throw std::runtime_error("Invalid line in corpus " + path);
+		CorpusEntry entry;
+		entry.label = line.substr(0, space);
+		for (auto i = space + 1; i < line.size(); i += 2)
+			entry.data.push_back((u8)(hex_value(line[i]) << 4 | hex_value(line[i + 1])));
+		ret.push_back(std::move(entry));
+	}
+	return ret;
+}
+
+const char *to_string(ScriptKind kind){
+	switch (kind){
+		case ScriptKind::P2pkh:
+			return "p2pkh";
+		case ScriptKind::P2pk:
+			return "p2pk";
+		case ScriptKind::P2sh:
+			return "p2sh";
+		case ScriptKind::P2wpkh:
+			return "p2wpkh";
+		case ScriptKind::P2wsh:
+			return "p2wsh";
+		case ScriptKind::Multisig:
+			return "multisig";
+		case ScriptKind::OpReturn:
+			return "op_return";
+		default:
+			return "mixed";
+	}
+}
+
+//Expands the seed with splitmix64, since xorshift needs a non-zero state.
+static xorshift128_state make_seed(u64 seed){
+	xorshift128_state ret;
+	for (auto &i : ret.data){
+		seed += 0x9e3779b97f4a7c15ULL;
+		auto z = seed;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		i = (std::uint32_t)(z ^ (z >> 31));
+	}
+	return ret;
+}
+
+SyntheticGenerator::SyntheticGenerator(u64 seed): rng(make_seed(seed)){}
+
+void SyntheticGenerator::bytes(std::vector<u8> &dst, size_t n){
+	for (size_t i = 0; i < n; i++)
+		dst.push_back((u8)this->rng());
+}
+
+void SyntheticGenerator::push(std::vector<u8> &dst, size_t n){
+	dst.push_back((u8)n);
+	this->bytes(dst, n);
+}
+
+static void write_varint(std::vector<u8> &dst, u64 n){
+	if (n < 0xFD){
+		dst.push_back((u8)n);
+		return;
+	}
+	int size;
+	if (n <= 0xFFFF){
+		dst.push_back(0xFD);
+		size = 2;
+	}else if (n <= 0xFFFFFFFF){
+		dst.push_back(0xFE);
+		size = 4;
+	}else{
+		dst.push_back(0xFF);
+		size = 8;
+	}
+	for (int i = 0; i < size; i++)
+		dst.push_back((u8)(n >> (i * 8)));
+}
+
+static void write_int(std::vector<u8> &dst, u64 n, int size){
+	for (int i = 0; i < size; i++)
+		dst.push_back((u8)(n >> (i * 8)));
+}
+
+std::vector<u8> SyntheticGenerator::script(ScriptKind kind){
+	std::vector<u8> ret;
+	switch (kind){
+		case ScriptKind::P2pkh:
+			ret = { 0x76, 0xA9 };
+			this->push(ret, 20);
+			ret.push_back(0x88);
+			ret.push_back(0xAC);
+			break;
+		case ScriptKind::P2pk:
+			ret.push_back(33);
+			ret.push_back((u8)(2 + this->below(2)));
+			this->bytes(ret, 32);
+			ret.push_back(0xAC);
+			break;
+		case ScriptKind::P2sh:
+			ret = { 0xA9 };
+			this->push(ret, 20);
+			ret.push_back(0x87);
+			break;
+		case ScriptKind::P2wpkh:
+			ret = { 0x00 };
+			this->push(ret, 20);
+			break;
+		case ScriptKind::P2wsh:
+			ret = { 0x00 };
+			this->push(ret, 32);
+			break;
+		case ScriptKind::Multisig:
+			ret = { 0x51 };
+			for (int i = 0; i < 2; i++){
+				ret.push_back(33);
+				ret.push_back((u8)(2 + this->below(2)));
+				this->bytes(ret, 32);
+			}
+			ret.push_back(0x52);
+			ret.push_back(0xAE);
+			break;
+		case ScriptKind::OpReturn:
+			ret = { 0x6A };
+			this->push(ret, 1 + this->below(75));
+			break;
+		default:
+			return this->script((ScriptKind)this->below((u64)ScriptKind::Count));
+	}
+	return ret;
+}
+
+std::vector<u8> SyntheticGenerator::transaction(size_t inputs, size_t outputs, ScriptKind kind, bool segwit){
+	std::vector<u8> ret;
+	write_int(ret, segwit ? 2 : 1, 4);
+	if (segwit){
+		ret.push_back(0);
+		ret.push_back(1);
+	}
+	write_varint(ret, inputs);
+	for (size_t i = 0; i < inputs; i++){
+		this->bytes(ret, 32);
+		write_int(ret, this->below(4), 4);
+		if (segwit)
+			ret.push_back(0);
+		else{
+			//Signature and compressed public key.
+			ret.push_back(71 + 1 + 33 + 1);
+			this->push(ret, 71);
+			this->push(ret, 33);
+		}
+		write_int(ret, 0xFFFFFFFE, 4);
+	}
+	write_varint(ret, outputs);
+	for (size_t i = 0; i < outputs; i++){
+		write_int(ret, this->below(100000000), 8);
+		auto script = this->script(kind);
+		write_varint(ret, script.size());
+		ret.insert(ret.end(), script.begin(), script.end());
+	}
+	if (segwit){
+		for (size_t i = 0; i < inputs; i++){
+			ret.push_back(2);
+			this->push(ret, 72);
+			this->push(ret, 33);
+		}
+	}
+	write_int(ret, 0, 4);
+	return ret;
+}
+
+std::vector<u64> SyntheticGenerator::varint_values(size_t n){
+	std::vector<u64> ret;
+	ret.reserve(n);
+	for (size_t i = 0; i < n; i++){
+		//Mostly small counts and indices, some amounts, a few large ids.
+		auto r = this->below(100);
+		if (r < 60)
+			ret.push_back(this->below(0xFD));
+		else if (r < 85)
+			ret.push_back(this->below(100000000));
+		else
+			ret.push_back(this->rng() >> this->below(64));
+	}
+	return ret;
+}
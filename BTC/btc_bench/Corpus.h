@@ -0,0 +1,50 @@
+#pragma once
+
+#include <common/types.h>
+#include <common/XorShift128.h>
+#include <string>
+#include <vector>
+
+struct CorpusEntry{
+	std::string label;
+	std::vector<u8> data;
+};
+
+//Reads a file of raw transactions, one per line as a label followed by the
+//transaction in hex. Empty lines and lines starting with # are ignored.
+std::vector<CorpusEntry> load_corpus(const std::string &path);
+
+enum class ScriptKind{
+	P2pkh,
+	P2pk,
+	P2sh,
+	P2wpkh,
+	P2wsh,
+	Multisig,
+	OpReturn,
+	Count,
+};
+
+const char *to_string(ScriptKind);
+
+//Produces random but well-formed transactions and scripts. The output
+//depends only on the seed.
+class SyntheticGenerator{
+	XorShift128_64 rng;
+
+	u64 below(u64 n){
+		return this->rng() % n;
+	}
+	void bytes(std::vector<u8> &dst, size_t n);
+	void push(std::vector<u8> &dst, size_t n);
+public:
+	SyntheticGenerator(u64 seed);
+	std::vector<u8> script(ScriptKind);
+	//If kind is ScriptKind::Count, the kind of each output is random.
+	std::vector<u8> transaction(size_t inputs, size_t outputs, ScriptKind kind = ScriptKind::Count, bool segwit = false);
+	//Varints with sizes spread like those in real transactions.
+	std::vector<u64> varint_values(size_t n);
+	u64 next(){
+		return this->rng();
+	}
+};
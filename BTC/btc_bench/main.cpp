@@ -0,0 +1,344 @@
+#include "Benchmark.h"
+#include "Corpus.h"
+#include <libbtcparser/Transaction.h>
+#include <libbtcindex/TimestampIndex.h>
+#include <common/serialization.h>
+#include <common/base58.h>
+#include <common/misc.h>
+#include <common/bech32/segwit_addr.h>
+#include <sqlitepp/sqlitepp.h>
+#include <iostream>
+#include <memory>
+#include <algorithm>
+
+static void add_buffer_benchmarks(BenchmarkRunner &runner, SyntheticGenerator &generator){
+	auto values = generator.varint_values(4096);
+	auto compact = std::make_shared<std::vector<u8>>();
+	for (auto n : values){
+		//Bitcoin's compact size encoding, as read by SerializedBuffer.
+		if (n < 0xFD)
+			compact->push_back((u8)n);
+		else{
+			int size = n <= 0xFFFF ? 2 : n <= 0xFFFFFFFF ? 4 : 8;
+			compact->push_back(size == 2 ? 0xFD : size == 4 ? 0xFE : 0xFF);
+			for (int i = 0; i < size; i++)
+				compact->push_back((u8)(n >> (i * 8)));
+		}
+	}
+	Benchmark b;
+	b.name = "serialized_buffer/read_varint";
+	b.items_per_iteration = values.size();
+	b.bytes_per_iteration = compact->size();
+	b.body = [compact, n = values.size()](u64 iterations){
+		for (u64 i = 0; i < iterations; i++){
+			SerializedBuffer buffer(compact->data(), compact->size());
+			u64 sum = 0;
+			for (size_t j = 0; j < n; j++)
+				sum += buffer.read_varint();
+			do_not_optimize(sum);
+		}
+	};
+	runner.run(b);
+
+	auto fixed = std::make_shared<std::vector<u8>>();
+	for (size_t i = 0; i < 4096 * 12; i++)
+		fixed->push_back((u8)generator.next());
+	b.name = "serialized_buffer/read_u32_u64";
+	b.items_per_iteration = 4096 * 2;
+	b.bytes_per_iteration = fixed->size();
+	b.body = [fixed](u64 iterations){
+		for (u64 i = 0; i < iterations; i++){
+			SerializedBuffer buffer(fixed->data(), fixed->size());
+			u64 sum = 0;
+			for (size_t j = 0; j < 4096; j++){
+				sum += buffer.read_u32();
+				sum += buffer.read_u64();
+			}
+			do_not_optimize(sum);
+		}
+	};
+	runner.run(b);
+}
+
+static void add_transaction_benchmark(BenchmarkRunner &runner, const std::string &name, std::vector<std::vector<u8>> txs){
+	auto shared = std::make_shared<std::vector<std::vector<u8>>>(std::move(txs));
+	Benchmark b;
+	b.name = "transaction/parse/" + name;
+	b.items_per_iteration = shared->size();
+	for (auto &tx : *shared)
+		b.bytes_per_iteration += tx.size();
+	b.body = [shared](u64 iterations){
+		for (u64 i = 0; i < iterations; i++){
+			for (auto &data : *shared){
+				SerializedBuffer buffer(data.data(), data.size());
+				Transaction tx(buffer, false);
+				do_not_optimize(tx.get_hash().to_array()[0]);
+			}
+		}
+	};
+	runner.run(b);
+}
+
+static void add_transaction_benchmarks(BenchmarkRunner &runner, SyntheticGenerator &generator, const std::vector<CorpusEntry> &corpus){
+	std::vector<std::vector<u8>> all;
+	for (auto &entry : corpus){
+		add_transaction_benchmark(runner, "corpus/" + entry.label, { entry.data });
+		all.push_back(entry.data);
+	}
+	add_transaction_benchmark(runner, "corpus", all);
+	std::vector<std::vector<u8>> synthetic;
+	for (int i = 0; i < 256; i++)
+		synthetic.push_back(generator.transaction(1 + generator.next() % 3, 1 + generator.next() % 4, ScriptKind::Count, i % 2 == 0));
+	add_transaction_benchmark(runner, "synthetic", synthetic);
+}
+
+static void add_address_benchmarks(BenchmarkRunner &runner, SyntheticGenerator &generator){
+	const size_t outputs_per_tx = 64;
+	for (int k = 0; k <= (int)ScriptKind::Count; k++){
+		auto kind = (ScriptKind)k;
+		struct State{
+			std::vector<u8> data;
+			std::unique_ptr<Transaction> tx;
+			std::vector<TxOutput> outputs;
+		};
+		auto state = std::make_shared<State>();
+		state->data = generator.transaction(1, outputs_per_tx, kind);
+		SerializedBuffer buffer(state->data.data(), state->data.size());
+		state->tx.reset(new Transaction(buffer, false));
+
+		Benchmark b;
+		b.name = (std::string)"output_addresses/" + to_string(kind);
+		//compute_output_addresses() appends to the output, so every
+		//iteration gets a fresh copy.
+		b.setup = [state, outputs_per_tx](u64 iterations){
+			state->outputs.clear();
+			auto &prototypes = state->tx->get_outputs();
+			for (u64 i = 0; i < iterations; i++)
+				state->outputs.push_back(prototypes[i % outputs_per_tx]);
+		};
+		b.body = [state](u64 iterations){
+			for (u64 i = 0; i < iterations; i++){
+				state->outputs[i].compute_output_addresses();
+				do_not_optimize(state->outputs[i].get_addresses().size());
+			}
+		};
+		runner.run(b);
+	}
+}
+
+static void add_hash_benchmarks(BenchmarkRunner &runner, SyntheticGenerator &generator){
+	using namespace Hashes::Algorithms;
+	auto data = std::make_shared<std::vector<u8>>();
+	for (int i = 0; i < 1024; i++)
+		data->push_back((u8)generator.next());
+	for (size_t size : { 32, 64, 1024 }){
+		Benchmark b;
+		b.name = "hash/sha256/" + std::to_string(size);
+		b.bytes_per_iteration = size;
+		b.body = [data, size](u64 iterations){
+			for (u64 i = 0; i < iterations; i++)
+				do_not_optimize(SHA256::compute(data->data(), size).to_array()[0]);
+		};
+		runner.run(b);
+
+		b.name = "hash/sha256d/" + std::to_string(size);
+		b.body = [data, size](u64 iterations){
+			for (u64 i = 0; i < iterations; i++)
+				do_not_optimize(SHA256::compute(data->data(), size, 2).to_array()[0]);
+		};
+		runner.run(b);
+
+		b.name = "hash/ripemd160/" + std::to_string(size);
+		b.body = [data, size](u64 iterations){
+			for (u64 i = 0; i < iterations; i++)
+				do_not_optimize(RIPEMD160::compute(data->data(), size).to_array()[0]);
+		};
+		runner.run(b);
+	}
+}
+
+static void add_codec_benchmarks(BenchmarkRunner &runner, SyntheticGenerator &generator){
+	const size_t n = 256;
+	auto payloads = std::make_shared<std::vector<std::vector<u8>>>();
+	auto base58 = std::make_shared<std::vector<std::string>>();
+	auto bech32_20 = std::make_shared<std::vector<std::string>>();
+	auto bech32_32 = std::make_shared<std::vector<std::string>>();
+	for (size_t i = 0; i < n; i++){
+		std::vector<u8> payload;
+		for (int j = 0; j < 32; j++)
+			payload.push_back((u8)generator.next());
+		bech32_32->push_back(segwit_addr::encode(payload));
+		payload.resize(20);
+		bech32_20->push_back(segwit_addr::encode(payload));
+		payload.insert(payload.begin(), 0);
+		base58->push_back(binary_to_base58_check(payload));
+		payloads->push_back(std::move(payload));
+	}
+
+	Benchmark b;
+	b.items_per_iteration = n;
+	b.name = "base58/encode_check/p2pkh";
+	b.body = [payloads](u64 iterations){
+		for (u64 i = 0; i < iterations; i++)
+			for (auto &payload : *payloads)
+				do_not_optimize(binary_to_base58_check(payload).size());
+	};
+	runner.run(b);
+
+	b.name = "base58/decode_check/p2pkh";
+	b.body = [base58](u64 iterations){
+		for (u64 i = 0; i < iterations; i++)
+			for (auto &s : *base58)
+				do_not_optimize(base58_to_binary_check(s)->size());
+	};
+	runner.run(b);
+
+	for (auto strings : { bech32_20, bech32_32 }){
+		auto suffix = strings == bech32_20 ? "p2wpkh" : "p2wsh";
+		auto programs = std::make_shared<std::vector<std::vector<u8>>>();
+		for (auto &s : *strings)
+			programs->push_back(segwit_addr::decode("bc", s).second);
+
+		b.name = (std::string)"bech32/encode/" + suffix;
+		b.body = [programs](u64 iterations){
+			for (u64 i = 0; i < iterations; i++)
+				for (auto &program : *programs)
+					do_not_optimize(segwit_addr::encode(program).size());
+		};
+		runner.run(b);
+
+		b.name = (std::string)"bech32/decode/" + suffix;
+		b.body = [strings](u64 iterations){
+			for (u64 i = 0; i < iterations; i++)
+				for (auto &s : *strings)
+					do_not_optimize(segwit_addr::decode("bc", s).second.size());
+		};
+		runner.run(b);
+	}
+}
+
+static void add_varint_benchmarks(BenchmarkRunner &runner, SyntheticGenerator &generator){
+	auto values = std::make_shared<std::vector<u64>>(generator.varint_values(4096));
+	auto encoded = std::make_shared<std::vector<u8>>();
+	for (auto n : *values)
+		serialize(*encoded, n);
+
+	Benchmark b;
+	b.name = "varint/serialize";
+	b.items_per_iteration = values->size();
+	b.bytes_per_iteration = encoded->size();
+	b.body = [values, size = encoded->size()](u64 iterations){
+		std::vector<u8> buffer;
+		buffer.reserve(size);
+		for (u64 i = 0; i < iterations; i++){
+			buffer.clear();
+			for (auto n : *values)
+				serialize(buffer, n);
+			do_not_optimize(buffer.size());
+		}
+	};
+	runner.run(b);
+
+	b.name = "varint/deserialize";
+	b.body = [encoded, n = values->size()](u64 iterations){
+		for (u64 i = 0; i < iterations; i++){
+			size_t offset = 0;
+			u64 sum = 0;
+			for (size_t j = 0; j < n; j++)
+				sum += deserialize<u64>(*encoded, offset);
+			do_not_optimize(sum);
+		}
+	};
+	runner.run(b);
+}
+
+static void add_timestamp_index_benchmarks(BenchmarkRunner &runner, SyntheticGenerator &generator){
+	//About as many blocks and txs as mainnet.
+	const u64 blocks = 600000;
+	struct State{
+		sqlite3pp::DB db;
+		std::unique_ptr<TimestampIndex> index;
+		std::vector<u64> lookups;
+		State(): db(":memory:"){}
+	};
+	auto state = std::make_shared<State>();
+	state->db.exec("create table blocks (first_transaction_id integer, transaction_count integer, timestamp integer);");
+	state->index.reset(new TimestampIndex(state->db));
+	u64 next_tx = 1;
+	for (u64 i = 0; i < blocks; i++){
+		auto count = 1 + generator.next() % (i * 4000 / blocks + 1);
+		state->index->add_block(next_tx, count, 1231006505 + i * 600);
+		next_tx += count;
+	}
+	for (int i = 0; i < 4096; i++)
+		state->lookups.push_back(1 + generator.next() % (next_tx - 1));
+
+	Benchmark b;
+	b.name = "timestamp_index/get_timestamp";
+	b.items_per_iteration = state->lookups.size();
+	b.body = [state](u64 iterations){
+		for (u64 i = 0; i < iterations; i++){
+			u64 sum = 0;
+			for (auto id : state->lookups)
+				sum += state->index->get_timestamp(id).block_timestamp;
+			do_not_optimize(sum);
+		}
+	};
+	runner.run(b);
+
+	auto sorted = std::make_shared<std::vector<u64>>(state->lookups);
+	std::sort(sorted->begin(), sorted->end());
+	b.name = "timestamp_index/get_timestamps";
+	b.body = [state, sorted](u64 iterations){
+		for (u64 i = 0; i < iterations; i++){
+			u64 sum = 0;
+			for (auto &order : state->index->get_timestamps(*sorted))
+				sum += order.block_timestamp;
+			do_not_optimize(sum);
+		}
+	};
+	runner.run(b);
+}
+
+int main(int argc, char **argv){
+	if (argc < 2){
+		std::cerr <<
+			"Usage: btc_bench <corpus> [<filter> [<seed>]]\n"
+			"\n"
+			"corpus is a file like btc_bench/corpus/transactions.txt. Only the\n"
+			"benchmarks whose names contain filter are run. seed selects the\n"
+			"synthetic inputs; it defaults to 1 so that runs can be compared.\n"
+			"Results are written to stdout as JSON.\n";
+		return -1;
+	}
+	try{
+		auto corpus = load_corpus(argv[1]);
+		std::string filter = argc >= 3 ? argv[2] : "";
+		u64 seed = argc >= 4 ? std::stoull(argv[3]) : 1;
+
+		BenchmarkRunner runner(filter);
+		//Each group gets its own generator, so that its inputs don't change
+		//when another group is filtered out.
+		SyntheticGenerator g1(seed), g2(seed + 1), g3(seed + 2), g4(seed + 3), g5(seed + 4), g6(seed + 5), g7(seed + 6);
+		add_buffer_benchmarks(runner, g1);
+		add_transaction_benchmarks(runner, g2, corpus);
+		add_address_benchmarks(runner, g3);
+		add_hash_benchmarks(runner, g4);
+		add_codec_benchmarks(runner, g5);
+		add_varint_benchmarks(runner, g6);
+		//Building the index takes a while, so it's skipped unless one of its
+		//benchmarks will run.
+		if (std::string("timestamp_index/get_timestamp").find(filter) != std::string::npos || std::string("timestamp_index/get_timestamps").find(filter) != std::string::npos)
+			add_timestamp_index_benchmarks(runner, g7);
+
+		nlohmann::json ret;
+		ret["seed"] = seed;
+		ret["corpus"] = argv[1];
+		ret["benchmarks"] = runner.to_json();
+		std::cout << ret.dump(1, '\t') << std::endl;
+	}catch (std::exception &e){
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+	return 0;
+}
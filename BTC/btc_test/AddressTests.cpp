@@ -0,0 +1,55 @@
+#include "Test.h"
+#include <libbtcparser/Transaction.h>
+#include <common/misc.h>
+#include <common/serialization.h>
+#include <cstring>
+
+//Programs and addresses from the BIP173 and BIP350 test vectors.
+
+static std::string encode(AddressType type, const char *program, bool testnet){
+	auto buffer = hex_string_to_buffer(program);
+	return Address(type, buffer.data(), testnet);
+}
+
+//Parses a tx with a single output with the given script and computes its
+//addresses.
+static std::vector<Address> get_output_addresses(const char *script, bool testnet){
+	std::string hex =
+		"01000000"
+		"01" "0000000000000000000000000000000000000000000000000000000000000000" "ffffffff" "00" "ffffffff"
+		"01" "e803000000000000";
+	auto script_size = strlen(script) / 2;
+	hex += hex_digits[script_size / 16];
+	hex += hex_digits[script_size % 16];
+	hex += script;
+	hex += "00000000";
+	auto data = hex_string_to_buffer(hex.c_str());
+	SerializedBuffer buffer(data.data(), data.size());
+	Transaction tx(buffer, testnet);
+	auto &output = tx.get_outputs().at(0);
+	output.compute_output_addresses();
+	return output.get_addresses();
+}
+
+void add_address_tests(TestRunner &runner){
+	runner.run("address/segwit_hrp", [](){
+		CHECK(encode(AddressType::P2wpkh20, "751e76e8199196d454941c45d1b3a323f1433bd6", false) == "bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4");
+		CHECK(encode(AddressType::P2wpkh32, "1863143c14c5166804bd19203356da136c985678cd4d27a1b8c6329604903262", true) == "tb1qrp33g0q5c5txsp9arysrx4k6zdkfs4nce4xj0gdcccefvpysxf3q0sl5k7");
+		CHECK(encode(AddressType::P2tr, "79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798", false) == "bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0");
+		CHECK(encode(AddressType::P2tr, "000000c4a5cad46221b2a187905e5266362b99d5e91c6ce24d165dab93e86433", true) == "tb1pqqqqp399et2xygdj5xreqhjjvcmzhxw4aywxecjdzew6hylgvsesf3hn0c");
+	});
+	runner.run("address/p2tr_output", [](){
+		auto addresses = get_output_addresses("512079be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798", false);
+		CHECK(addresses.size() == 1);
+		CHECK(addresses[0].type == AddressType::P2tr);
+		CHECK((std::string)addresses[0] == "bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0");
+
+		addresses = get_output_addresses("5120000000c4a5cad46221b2a187905e5266362b99d5e91c6ce24d165dab93e86433", true);
+		CHECK(addresses.size() == 1);
+		CHECK((std::string)addresses[0] == "tb1pqqqqp399et2xygdj5xreqhjjvcmzhxw4aywxecjdzew6hylgvsesf3hn0c");
+
+		//Other witness versions and program sizes still have no address.
+		CHECK(get_output_addresses("5210751e76e8199196d454941c45d1b3a323", false).empty());
+		CHECK(get_output_addresses("5114751e76e8199196d454941c45d1b3a323f1433bd6", false).empty());
+	});
+}
@@ -0,0 +1,151 @@
+#include "Test.h"
+#include <common/bech32/bech32.h>
+#include <common/bech32/segwit_addr.h>
+#include <common/misc.h>
+#include <algorithm>
+#include <cctype>
+
+//Test vectors from BIP173 and BIP350.
+
+static const char * const valid_bech32[] = {
+	"A12UEL5L",
+	"a12uel5l",
+	"an83characterlonghumanreadablepartthatcontainsthenumber1andtheexcludedcharactersbio1tt5tgs",
+	"abcdef1qpzry9x8gf2tvdw0s3jn54khce6mua7lmqqqxw",
+	"11qqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqc8247j",
+	"split1checkupstagehandshakeupstreamerranterredcaperred2y9e3w",
+	"?1ezyfcl",
+};
+
+static const char * const valid_bech32m[] = {
+	"A1LQFN3A",
+	"a1lqfn3a",
+	"an83characterlonghumanreadablepartthatcontainsthetheexcludedcharactersbioandnumber11sg7hg6",
+	"abcdef1l7aum6echk45nj3s0wdvt2fg8x9yrzpqzd3ryx",
+	"11llllllllllllllllllllllllllllllllllllllllllllllllllllllllllllllllllllllllllllllllllludsr8",
+	"split1checkupstagehandshakeupstreamerranterredcaperredlc445v",
+	"?1v759aa",
+};
+
+static const char * const invalid_bech32m[] = {
+	//HRP character out of range.
+	"\x20" "1xj0phk",
+	"\x7f" "1g6xzxy",
+	"\x80" "1vctc34",
+	//Overall max length exceeded.
+	"an84characterslonghumanreadablepartthatcontainsthetheexcludedcharactersbioandnumber11d6pts4",
+	//No separator.
+	"qyrz8wqd2c9m",
+	//Empty HRP.
+	"1qyrz8wqd2c9m",
+	//Invalid data character.
+	"y1b0jsk6g",
+	"lt1igcx5c0",
+	//Too short checksum.
+	"in1muywd",
+	//Invalid character in checksum.
+	"mm1crxm3i",
+	"au1s5cgom",
+	//Checksum calculated with the uppercase form of the HRP.
+	"M1VUXWEZ",
+	//Empty HRP.
+	"16plkw9",
+	"1p2gdwpf",
+};
+
+struct AddressVector{
+	const char *address;
+	const char *script;
+};
+
+static const AddressVector valid_addresses[] = {
+	{ "BC1QW508D6QEJXTDG4Y5R3ZARVARY0C5XW7KV8F3T4", "0014751e76e8199196d454941c45d1b3a323f1433bd6" },
+	{ "tb1qrp33g0q5c5txsp9arysrx4k6zdkfs4nce4xj0gdcccefvpysxf3q0sl5k7", "00201863143c14c5166804bd19203356da136c985678cd4d27a1b8c6329604903262" },
+	{ "bc1pw508d6qejxtdg4y5r3zarvary0c5xw7kw508d6qejxtdg4y5r3zarvary0c5xw7kt5nd6y", "5128751e76e8199196d454941c45d1b3a323f1433bd6751e76e8199196d454941c45d1b3a323f1433bd6" },
+	{ "BC1SW50QGDZ25J", "6002751e" },
+	{ "bc1zw508d6qejxtdg4y5r3zarvaryvaxxpcs", "5210751e76e8199196d454941c45d1b3a323" },
+	{ "tb1qqqqqp399et2xygdj5xreqhjjvcmzhxw4aywxecjdzew6hylgvsesrxh6hy", "0020000000c4a5cad46221b2a187905e5266362b99d5e91c6ce24d165dab93e86433" },
+	{ "tb1pqqqqp399et2xygdj5xreqhjjvcmzhxw4aywxecjdzew6hylgvsesf3hn0c", "5120000000c4a5cad46221b2a187905e5266362b99d5e91c6ce24d165dab93e86433" },
+	{ "bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0", "512079be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798" },
+};
+
+static const char * const invalid_addresses[] = {
+	//Invalid HRP.
+	"tc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vq5zuyut",
+	//Bech32 instead of Bech32m.
+	"bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqh2y7hd",
+	"tb1z0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqglt7rf",
+	"BC1S0XLXVLHEMJA6C4DQV22UAPCTQUPFHLXM9H8Z3K2E72Q4K9HCZ7VQ54WELL",
+	//Bech32m instead of Bech32.
+	"bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kemeawh",
+	"tb1q0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vq24jc47",
+	//Invalid character in checksum.
+	"bc1p38j9r5y49hruaue7wxjce0updqjuyyx0kh56v8s25huc6995vvpql3jow4",
+	//Invalid witness version.
+	"BC130XLXVLHEMJA6C4DQV22UAPCTQUPFHLXM9H8Z3K2E72Q4K9HCZ7VQ7ZWS8R",
+	//Invalid program length (1 byte, then 41 bytes).
+	"bc1pw5dgrnzv",
+	"bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7v8n0nx0muaewav253zgeav",
+	//Invalid program length for witness version 0.
+	"BC1QR508D6QEJXTDG4Y5R3ZARVARYV98GJ9P",
+	//Mixed case.
+	"tb1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vq47Zagq",
+	//More than 4 bits of zero padding.
+	"bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7v07qwwzcrf",
+	//Non-zero padding in the 8-to-5 conversion.
+	"tb1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vpggkg4j",
+	//Empty data section.
+	"bc1gmk9yu",
+};
+
+static std::string to_lower(std::string s){
+	std::transform(s.begin(), s.end(), s.begin(), [](char c){ return (char)tolower(c); });
+	return s;
+}
+
+static void check_valid_strings(const char * const *begin, const char * const *end, bech32::Encoding expected){
+	for (auto p = begin; p != end; ++p){
+		bech32::Encoding encoding = bech32::Encoding::Invalid;
+		auto decoded = bech32::decode(*p, &encoding);
+		CHECK(decoded.first.size());
+		CHECK(encoding == expected);
+		CHECK(bech32::encode(decoded.first.c_str(), decoded.second, expected) == to_lower(*p));
+		//The other checksum doesn't match.
+		auto other = expected == bech32::Encoding::Bech32 ? bech32::Encoding::Bech32m : bech32::Encoding::Bech32;
+		CHECK(bech32::encode(decoded.first.c_str(), decoded.second, other) != to_lower(*p));
+	}
+}
+
+void add_bech32_tests(TestRunner &runner){
+	runner.run("bech32/valid_bech32", [](){
+		check_valid_strings(std::begin(valid_bech32), std::end(valid_bech32), bech32::Encoding::Bech32);
+	});
+	runner.run("bech32/valid_bech32m", [](){
+		check_valid_strings(std::begin(valid_bech32m), std::end(valid_bech32m), bech32::Encoding::Bech32m);
+	});
+	runner.run("bech32/invalid_bech32m", [](){
+		for (auto s : invalid_bech32m)
+			CHECK(!bech32::decode(s).first.size());
+	});
+	runner.run("bech32/valid_addresses", [](){
+		for (auto &v : valid_addresses){
+			auto address = to_lower(v.address);
+			auto hrp = address.substr(0, 2);
+			auto decoded = segwit_addr::decode(hrp, v.address);
+			CHECK(decoded.first >= 0);
+			//The script is OP_n <program>.
+			std::vector<u8> script;
+			script.push_back((u8)(decoded.first ? decoded.first + 0x50 : 0));
+			script.push_back((u8)decoded.second.size());
+			script.insert(script.end(), decoded.second.begin(), decoded.second.end());
+			CHECK(script == hex_string_to_buffer(v.script));
+			CHECK(segwit_addr::encode(hrp.c_str(), decoded.first, decoded.second) == address);
+		}
+	});
+	runner.run("bech32/invalid_addresses", [](){
+		for (auto s : invalid_addresses){
+			CHECK(segwit_addr::decode("bc", s).first == -1);
+			CHECK(segwit_addr::decode("tb", s).first == -1);
+		}
+	});
+}
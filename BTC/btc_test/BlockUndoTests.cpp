@@ -0,0 +1,152 @@
+#include "Test.h"
+#include <libbtcindex/BlockUndo.h>
+#include <limits>
+#include <random>
+
+static void check_equal(const BlockUndo &a, const BlockUndo &b){
+	CHECK(a.txs_begin == b.txs_begin);
+	CHECK(a.txs_end == b.txs_end);
+	CHECK(a.inputs_begin == b.inputs_begin);
+	CHECK(a.inputs_end == b.inputs_end);
+	CHECK(a.outputs_begin == b.outputs_begin);
+	CHECK(a.outputs_end == b.outputs_end);
+	CHECK(a.spent_outputs == b.spent_outputs);
+	CHECK(a.balance_deltas == b.balance_deltas);
+}
+
+static void check_round_trip(const BlockUndo &undo){
+	check_equal(BlockUndo(undo.serialize()), undo);
+}
+
+static BlockUndo make_undo(std::mt19937_64 &rng, size_t spent, size_t deltas){
+	BlockUndo ret;
+	ret.txs_begin = rng() % 1000000000;
+	ret.txs_end = ret.txs_begin + rng() % 5000;
+	ret.inputs_begin = rng() % 1000000000;
+	ret.inputs_end = ret.inputs_begin + rng() % 20000;
+	ret.outputs_begin = rng() % 1000000000;
+	ret.outputs_end = ret.outputs_begin + rng() % 20000;
+	u64 id = rng() % 1000;
+	for (size_t i = 0; i < spent; i++){
+		ret.spent_outputs.push_back(id);
+		id += 1 + rng() % 100000;
+	}
+	id = rng() % 1000;
+	for (size_t i = 0; i < deltas; i++){
+		auto delta = (s64)(rng() % 2000000000) - 1000000000;
+		ret.balance_deltas.emplace_back(id, delta ? delta : 1);
+		id += 1 + rng() % 100000;
+	}
+	return ret;
+}
+
+void add_block_undo_tests(TestRunner &runner){
+	runner.run("block_undo/round_trip", [](){
+		std::mt19937_64 rng(1);
+		check_round_trip(BlockUndo());
+		check_round_trip(make_undo(rng, 1, 1));
+		for (int i = 0; i < 20; i++)
+			check_round_trip(make_undo(rng, rng() % 3000, rng() % 3000));
+
+		//Deltas at the edges of the zigzag encoding, and ids whose deltas
+		//from the previous one use every bit.
+		BlockUndo extremes;
+		extremes.txs_begin = 0;
+		extremes.txs_end = std::numeric_limits<u64>::max();
+		extremes.spent_outputs = { 0, 1, std::numeric_limits<u64>::max() };
+		const s64 values[] = {
+			1, -1, 63, -64, 64, -65,
+			std::numeric_limits<int>::max(),
+			std::numeric_limits<int>::min(),
+			std::numeric_limits<s64>::max(),
+			std::numeric_limits<s64>::min(),
+			std::numeric_limits<s64>::max() - 1,
+			std::numeric_limits<s64>::min() + 1,
+		};
+		u64 address = 0;
+		for (auto value : values)
+			extremes.balance_deltas.emplace_back(address++, value);
+		extremes.balance_deltas.emplace_back(std::numeric_limits<u64>::max(), -1);
+		check_round_trip(extremes);
+	});
+	runner.run("block_undo/zigzag_size", [](){
+		//Zigzag encoding maps values close to zero, of either sign, to short
+		//varints: [-64, 63] take one byte and [-8192, 8191] take two.
+		auto empty_size = BlockUndo().serialize().size();
+		auto size = [empty_size](s64 delta){
+			BlockUndo undo;
+			undo.balance_deltas.emplace_back(1, delta);
+			//The address delta takes one byte.
+			return undo.serialize().size() - empty_size - 1;
+		};
+		CHECK(size(1) == 1);
+		CHECK(size(-1) == 1);
+		CHECK(size(63) == 1);
+		CHECK(size(-64) == 1);
+		CHECK(size(64) == 2);
+		CHECK(size(-65) == 2);
+		CHECK(size(8191) == 2);
+		CHECK(size(-8192) == 2);
+		CHECK(size(8192) == 3);
+		CHECK(size(-8193) == 3);
+		CHECK(size(std::numeric_limits<s64>::min()) == 10);
+	});
+	runner.run("block_undo/delta_size", [](){
+		//Sorted ids are stored as differences, so nearby ids take one byte
+		//each no matter how large they are.
+		BlockUndo undo;
+		for (u64 i = 0; i < 100; i++){
+			undo.spent_outputs.push_back((1ULL << 60) + i * 100);
+			undo.balance_deltas.emplace_back((1ULL << 60) + i * 100, -1);
+		}
+		auto empty_size = BlockUndo().serialize().size();
+		//The first id of each costs 9 bytes.
+		CHECK(undo.serialize().size() == empty_size + (9 + 99) + (9 + 99) + 100);
+		check_round_trip(undo);
+	});
+	runner.run("block_undo/truncated", [](){
+		std::mt19937_64 rng(2);
+		auto serialized = make_undo(rng, 10, 10).serialize();
+		for (size_t n = 0; n < serialized.size(); n++){
+			std::vector<u8> truncated(serialized.begin(), serialized.begin() + n);
+			bool threw = false;
+			try{
+				BlockUndo undo(truncated);
+			}catch (std::out_of_range &){
+				threw = true;
+			}
+			CHECK(threw);
+		}
+	});
+	runner.run("block_undo/set_changes", [](){
+		BlockInsertInfo info;
+		info.spent_outputs = { 30, 10, 20 };
+		info.balance_deltas[7] = -5;
+		info.balance_deltas[3] = 0;
+		info.balance_deltas[1] = 8;
+		BlockUndo undo;
+		undo.set_changes(info);
+		CHECK((undo.spent_outputs == std::vector<u64>{ 10, 20, 30 }));
+		//Addresses whose balance didn't change are left out.
+		CHECK((undo.balance_deltas == std::vector<std::pair<u64, s64>>{ { 1, 8 }, { 7, -5 } }));
+		check_round_trip(undo);
+	});
+	runner.run("block_undo/undo_log", [](){
+		std::mt19937_64 rng(3);
+		sqlite3pp::DB db(":memory:");
+		UndoLog log(db);
+		CHECK(!log.get_block(1));
+		auto a = make_undo(rng, 100, 100);
+		auto b = make_undo(rng, 5, 5);
+		log.add_block(1, a);
+		log.add_block(2, b);
+		check_equal(*log.get_block(1), a);
+		check_equal(*log.get_block(2), b);
+		//A block id that's reused replaces the old record.
+		log.add_block(1, b);
+		check_equal(*log.get_block(1), b);
+		log.delete_block(1);
+		CHECK(!log.get_block(1));
+		check_equal(*log.get_block(2), b);
+	});
+}
@@ -0,0 +1,266 @@
+#include "Test.h"
+#include <libbtcparser/PostingLists.h>
+#include <algorithm>
+#include <iterator>
+#include <random>
+
+static const size_t block_size = PostingLists::block_size;
+
+//Returns n sorted ids starting at first, separated by gaps taken from gaps.
+static std::vector<u64> make_ids(std::mt19937_64 &rng, u64 first, size_t n, const std::vector<u64> &gaps){
+	std::vector<u64> ret;
+	auto id = first;
+	for (size_t i = 0; i < n; i++){
+		ret.push_back(id);
+		id += gaps[rng() % gaps.size()];
+	}
+	return ret;
+}
+
+//Appends ids in chunks of random sizes, so that appends both fill the tail
+//block and start new ones.
+static void append_in_chunks(std::mt19937_64 &rng, PostingLists &lists, u64 address, PostingKind kind, const std::vector<u64> &ids){
+	for (size_t i = 0; i < ids.size();){
+		auto n = std::min<size_t>(1 + rng() % (block_size + block_size / 2), ids.size() - i);
+		lists.append(address, kind, std::vector<u64>(ids.begin() + i, ids.begin() + i + n));
+		i += n;
+	}
+}
+
+//Checks read(), the summary (for lists that weren't pruned) and a walk with
+//a cursor against expected.
+static void check_list(PostingLists &lists, u64 address, PostingKind kind, const std::vector<u64> &expected){
+	CHECK(lists.read(address, kind) == expected);
+	auto summary = lists.summarize(address, kind);
+	CHECK(!!summary == !expected.empty());
+	if (summary){
+		CHECK(summary->count == expected.size());
+		CHECK(summary->first == expected.front());
+		CHECK(summary->last == expected.back());
+	}
+	std::vector<u64> walked;
+	for (PostingLists::Cursor cursor(lists, address, kind); cursor.valid(); cursor.next())
+		walked.push_back(cursor.get());
+	CHECK(std::equal(walked.rbegin(), walked.rend(), expected.begin(), expected.end()));
+}
+
+static std::vector<u64> remove(const std::vector<u64> &ids, const std::vector<u64> &removed){
+	std::vector<u64> ret;
+	std::set_difference(ids.begin(), ids.end(), removed.begin(), removed.end(), std::back_inserter(ret));
+	return ret;
+}
+
+void add_posting_lists_tests(TestRunner &runner){
+	runner.run("posting_lists/round_trip", [](){
+		std::mt19937_64 rng(1);
+		sqlite3pp::DB db(":memory:");
+		PostingLists lists(db);
+		//Deltas on both sides of the lengths at which their varints grow.
+		const std::vector<std::vector<u64>> gaps = {
+			{ 1 },
+			{ 127, 128, 129 },
+			{ 16383, 16384 },
+			{ 1, 2097151, 2097152, 1ULL << 32 },
+			{ (1ULL << 42) - 1, 1ULL << 42, (1ULL << 49) - 1, 1ULL << 49 },
+		};
+		const size_t sizes[] = { 1, block_size - 1, block_size, block_size + 1, 2 * block_size, 2 * block_size + 1, 1000 };
+		u64 address = 1;
+		for (auto &g : gaps){
+			for (auto n : sizes){
+				auto ids = make_ids(rng, 1 + rng() % 1000, n, g);
+				append_in_chunks(rng, lists, address, PostingKind::Outputs, ids);
+				//The other kind and the neighbouring addresses are separate lists.
+				lists.append(address, PostingKind::Txs, { 5 });
+				check_list(lists, address, PostingKind::Outputs, ids);
+				check_list(lists, address, PostingKind::Txs, { 5 });
+				address++;
+			}
+		}
+		check_list(lists, address, PostingKind::Outputs, {});
+		//Ids are bound as signed integers, so the largest is 2^63 - 1. Its
+		//delta takes 9 bytes.
+		std::vector<u64> large = { 0, 1, 1ULL << 56, 1ULL << 62, (u64)std::numeric_limits<s64>::max() };
+		lists.append(++address, PostingKind::Outputs, large);
+		check_list(lists, address, PostingKind::Outputs, large);
+	});
+	runner.run("posting_lists/append_order", [](){
+		sqlite3pp::DB db(":memory:");
+		PostingLists lists(db);
+		auto throws = [&](u64 address, const std::vector<u64> &ids){
+			try{
+				lists.append(address, PostingKind::Txs, ids);
+			}catch (std::runtime_error &){
+				return true;
+			}
+			return false;
+		};
+		std::vector<u64> ids;
+		for (u64 i = 1; i <= block_size; i++)
+			ids.push_back(i * 10);
+		//The tail block has room.
+		lists.append(1, PostingKind::Txs, std::vector<u64>(ids.begin(), ids.end() - 1));
+		CHECK(throws(1, { ids[block_size - 2] }));
+		CHECK(throws(1, { 5 }));
+		//The tail block is full.
+		lists.append(1, PostingKind::Txs, { ids.back() });
+		CHECK(throws(1, { ids.back() }));
+		CHECK(throws(1, { ids.back() - 1, ids.back() + 10 }));
+		//ids itself isn't strictly increasing.
+		CHECK(throws(1, { ids.back() + 20, ids.back() + 10 }));
+		CHECK(throws(1, { ids.back() + 10, ids.back() + 10 }));
+		CHECK(throws(2, { 2, 1 }));
+		check_list(lists, 1, PostingKind::Txs, ids);
+		check_list(lists, 2, PostingKind::Txs, {});
+		lists.append(1, PostingKind::Txs, {});
+		lists.append(1, PostingKind::Txs, { ids.back() + 1 });
+		ids.push_back(ids.back() + 1);
+		check_list(lists, 1, PostingKind::Txs, ids);
+	});
+	runner.run("posting_lists/cursor_seek", [](){
+		std::mt19937_64 rng(2);
+		sqlite3pp::DB db(":memory:");
+		PostingLists lists(db);
+		auto ids = make_ids(rng, 100, 10 * block_size + 17, { 1, 2, 3, 50, 1000 });
+		append_in_chunks(rng, lists, 1, PostingKind::Outputs, ids);
+		//Targets on and around every block boundary and at random.
+		std::vector<u64> targets = { 0, 99, 100, ids.back(), ids.back() + 1, std::numeric_limits<u64>::max() };
+		for (size_t i = 0; i < ids.size(); i += block_size){
+			for (size_t j = std::max<size_t>(i, 2) - 2; j < std::min(i + 2, ids.size()); j++){
+				targets.push_back(ids[j] - 1);
+				targets.push_back(ids[j]);
+				targets.push_back(ids[j] + 1);
+			}
+		}
+		for (int i = 0; i < 2000; i++)
+			targets.push_back(ids.front() + rng() % (ids.back() - ids.front() + 2));
+		auto expected_position = [&](u64 max){
+			return std::upper_bound(ids.begin(), ids.end(), max) - ids.begin() - 1;
+		};
+		for (auto max : targets){
+			//From positions at, within and across blocks above the target.
+			for (size_t skip : { (size_t)0, (size_t)1, (size_t)(rng() % ids.size()) }){
+				PostingLists::Cursor cursor(lists, 1, PostingKind::Outputs);
+				for (size_t i = 0; i < skip; i++)
+					cursor.next();
+				auto start = (ptrdiff_t)ids.size() - 1 - (ptrdiff_t)skip;
+				cursor.seek(max);
+				//seek() never moves up.
+				auto expected = std::min(expected_position(max), start);
+				CHECK(cursor.valid() == (expected >= 0));
+				if (expected >= 0)
+					CHECK(cursor.get() == ids[expected]);
+			}
+		}
+		//A descending sequence of seeks, as the history queries make.
+		PostingLists::Cursor cursor(lists, 1, PostingKind::Outputs);
+		std::sort(targets.begin(), targets.end(), std::greater<u64>());
+		for (auto max : targets){
+			cursor.seek(max);
+			auto expected = expected_position(max);
+			CHECK(cursor.valid() == (expected >= 0));
+			if (expected >= 0)
+				CHECK(cursor.get() == ids[expected]);
+		}
+	});
+	runner.run("posting_lists/truncate", [](){
+		std::mt19937_64 rng(3);
+		const size_t n = 3 * block_size + 5;
+		const size_t cuts[] = { 0, 1, block_size - 1, block_size, block_size + 1, 2 * block_size, n - 1, n };
+		u64 address = 1;
+		for (auto cut : cuts){
+			sqlite3pp::DB db(":memory:");
+			PostingLists lists(db);
+			auto ids = make_ids(rng, 10, n, { 1, 7 });
+			append_in_chunks(rng, lists, address, PostingKind::Txs, ids);
+			auto first = cut < n ? ids[cut] : ids.back() + 1;
+			lists.truncate(address, PostingKind::Txs, first);
+			std::vector<u64> kept(ids.begin(), ids.begin() + cut);
+			check_list(lists, address, PostingKind::Txs, kept);
+			//Truncating between ids removes the same ones.
+			if (cut){
+				lists.truncate(address, PostingKind::Txs, kept.back() + 1);
+				check_list(lists, address, PostingKind::Txs, kept);
+			}
+			//The list can grow again from where it was cut, refilling the
+			//partial tail block.
+			auto more = make_ids(rng, (kept.size() ? kept.back() : 0) + 1, block_size + 3, { 1, 300 });
+			append_in_chunks(rng, lists, address, PostingKind::Txs, more);
+			kept.insert(kept.end(), more.begin(), more.end());
+			check_list(lists, address, PostingKind::Txs, kept);
+			address++;
+		}
+	});
+	runner.run("posting_lists/prune", [](){
+		std::mt19937_64 rng(4);
+		const size_t n = 3 * block_size + 5;
+		const size_t ends[] = { 0, 1, block_size - 1, block_size, block_size + 1, 2 * block_size, n - 1, n };
+		for (auto end : ends){
+			sqlite3pp::DB db(":memory:");
+			PostingLists lists(db);
+			auto ids = make_ids(rng, 10, n, { 1, 7 });
+			append_in_chunks(rng, lists, 1, PostingKind::Txs, ids);
+			lists.prune(1, PostingKind::Txs, end < n ? ids[end] : ids.back() + 1);
+			std::vector<u64> kept(ids.begin() + end, ids.end());
+			CHECK(lists.read(1, PostingKind::Txs) == kept);
+			//Pruned ids are still counted.
+			auto summary = lists.summarize(1, PostingKind::Txs);
+			CHECK(summary && summary->count == n && summary->first == ids.front() && summary->last == ids.back());
+			//Pruning again, further on, adds to the count of pruned ids.
+			auto end2 = std::min(n, end + block_size + 1);
+			lists.prune(1, PostingKind::Txs, end2 < n ? ids[end2] : ids.back() + 1);
+			kept.assign(ids.begin() + end2, ids.end());
+			CHECK(lists.read(1, PostingKind::Txs) == kept);
+			summary = lists.summarize(1, PostingKind::Txs);
+			CHECK(summary && summary->count == n && summary->first == ids.front() && summary->last == ids.back());
+			//Appends go after the pruned ids.
+			lists.append(1, PostingKind::Txs, { ids.back() + 1 });
+			kept.push_back(ids.back() + 1);
+			CHECK(lists.read(1, PostingKind::Txs) == kept);
+			summary = lists.summarize(1, PostingKind::Txs);
+			CHECK(summary && summary->count == n + 1 && summary->last == ids.back() + 1);
+		}
+	});
+	runner.run("posting_lists/erase", [](){
+		std::mt19937_64 rng(5);
+		const size_t n = 3 * block_size + 5;
+		auto ids = make_ids(rng, 10, n, { 2, 9 });
+		auto range = [&](size_t begin, size_t end){
+			return std::vector<u64>(ids.begin() + begin, ids.begin() + end);
+		};
+		std::vector<std::vector<u64>> erasures = {
+			//Whole blocks.
+			range(0, block_size),
+			range(block_size, 2 * block_size),
+			range(0, n),
+			//Across block boundaries.
+			range(block_size - 2, block_size + 2),
+			range(block_size - 1, 2 * block_size + 1),
+			//The first and last ids of blocks.
+			{ ids[0], ids[block_size - 1], ids[block_size], ids[n - 1] },
+			//Ids that aren't in the list, mixed with ones that are.
+			{ 0, ids[0] + 1, ids[block_size], ids[block_size] + 1, ids[n - 1] + 1 },
+		};
+		for (int i = 0; i < 10; i++){
+			std::vector<u64> sample;
+			for (auto id : ids)
+				if (rng() % 4 == 0)
+					sample.push_back(id);
+			erasures.push_back(sample);
+		}
+		for (auto &erased : erasures){
+			sqlite3pp::DB db(":memory:");
+			PostingLists lists(db);
+			append_in_chunks(rng, lists, 1, PostingKind::Outputs, ids);
+			lists.erase(1, PostingKind::Outputs, erased);
+			auto kept = remove(ids, erased);
+			check_list(lists, 1, PostingKind::Outputs, kept);
+			//Erasing leaves short blocks behind; appends still go after the
+			//last id.
+			auto next = kept.size() ? kept.back() + 1 : 1;
+			append_in_chunks(rng, lists, 1, PostingKind::Outputs, { next, next + 1 });
+			kept.push_back(next);
+			kept.push_back(next + 1);
+			check_list(lists, 1, PostingKind::Outputs, kept);
+		}
+	});
+}
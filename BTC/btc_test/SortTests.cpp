@@ -0,0 +1,147 @@
+#include "Test.h"
+#include <blockchain_parser/ExternalSort.h>
+#include <blockchain_parser/RadixSort.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <random>
+
+//Pairs whose ids only use the bits in mask, so that some of the radix sort's
+//passes have every pair in the same bucket and are skipped.
+static std::vector<IdPair> make_pairs(std::mt19937_64 &rng, size_t n, u64 first_mask, u64 second_mask){
+	std::vector<IdPair> ret(n);
+	for (auto &pair : ret){
+		pair.first = rng() & first_mask;
+		pair.second = rng() & second_mask;
+	}
+	return ret;
+}
+
+static std::string temp_prefix(){
+	auto path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("btc_test_%%%%%%%%_");
+	return path.string();
+}
+
+static bool file_exists(const std::string &path){
+	return boost::filesystem::exists(path);
+}
+
+template <typename T, typename Less>
+static std::vector<T> read_all(ExternalSorter<T, Less> &sorter){
+	std::vector<T> ret;
+	T record;
+	while (sorter.next(record))
+		ret.push_back(record);
+	return ret;
+}
+
+void add_sort_tests(TestRunner &runner){
+	runner.run("sort/parallel_radix_sort", [](){
+		std::mt19937_64 rng(1);
+		const size_t sizes[] = { 0, 1, 2, 255, 256, 257, 10000, 100000 };
+		const std::pair<u64, u64> masks[] = {
+			{ 0xFF, 0xFF },
+			{ 0xFFFFFF, 0xFFFFFFFF },
+			//Only the high bytes vary.
+			{ 0xFF00000000000000, 0xFFFF000000000000 },
+			//Bytes that vary separated by some that don't.
+			{ 0xFF0000FF00FF, 0xF00F },
+			{ ~0ULL, ~0ULL },
+			//Mostly duplicates.
+			{ 3, 1 },
+		};
+		for (auto n : sizes){
+			for (auto &mask : masks){
+				auto pairs = make_pairs(rng, n, mask.first, mask.second);
+				auto expected = pairs;
+				std::sort(expected.begin(), expected.end());
+				for (unsigned threads : { 1, 2, 3, 8 }){
+					auto sorted = pairs;
+					parallel_radix_sort(sorted, threads);
+					CHECK(sorted == expected);
+				}
+			}
+		}
+	});
+	runner.run("sort/external_sorter", [](){
+		std::mt19937_64 rng(2);
+		const size_t run_records = 1000;
+		//No runs, one run with and without a partial one after it, and many.
+		const size_t sizes[] = { 0, 1, run_records - 1, run_records, run_records + 1, 2 * run_records, 25 * run_records + 7 };
+		for (auto n : sizes){
+			auto pairs = make_pairs(rng, n, 0xFFFFF, 0xFF);
+			auto expected = pairs;
+			std::sort(expected.begin(), expected.end());
+			//With the default run sort and with the radix sort the parser uses.
+			for (int radix = 0; radix < 2; radix++){
+				auto prefix = temp_prefix();
+				{
+					ExternalSorter<IdPair>::RunSort sort;
+					if (radix)
+						sort = [](std::vector<IdPair> &run){ parallel_radix_sort(run, 2); };
+					ExternalSorter<IdPair> sorter(prefix, sort, run_records * sizeof(IdPair));
+					for (auto &pair : pairs)
+						sorter.add(pair);
+					CHECK(sorter.size() == n);
+					sorter.finish();
+					CHECK(read_all(sorter) == expected);
+					//Everything fits in memory when there's at most one run.
+					CHECK(file_exists(prefix + "0") == (n >= run_records));
+				}
+				//Runs that weren't saved are deleted.
+				CHECK(!file_exists(prefix + "0"));
+			}
+		}
+	});
+	runner.run("sort/external_sorter_order", [](){
+		std::mt19937_64 rng(3);
+		std::vector<u64> values(5000);
+		for (auto &value : values)
+			value = rng() % 1000;
+		auto prefix = temp_prefix();
+		ExternalSorter<u64, std::greater<u64>> sorter(prefix, nullptr, 64 * sizeof(u64));
+		for (auto value : values)
+			sorter.add(value);
+		bool threw = false;
+		u64 value;
+		try{
+			sorter.next(value);
+		}catch (std::runtime_error &){
+			threw = true;
+		}
+		CHECK(threw);
+		sorter.finish();
+		std::sort(values.begin(), values.end(), std::greater<u64>());
+		CHECK(read_all(sorter) == values);
+	});
+	runner.run("sort/external_sorter_save", [](){
+		std::mt19937_64 rng(4);
+		const size_t run_records = 100;
+		for (size_t n : { (size_t)0, (size_t)10, 10 * run_records + 3 }){
+			auto pairs = make_pairs(rng, n, 0xFFFF, 0xFFFF);
+			auto expected = pairs;
+			std::sort(expected.begin(), expected.end());
+			auto prefix = temp_prefix();
+			{
+				ExternalSorter<IdPair> sorter(prefix, nullptr, run_records * sizeof(IdPair));
+				for (auto &pair : pairs)
+					sorter.add(pair);
+				sorter.save();
+			}
+			//There's always a run, even if it's empty, and they're kept.
+			CHECK(file_exists(prefix + "0"));
+			for (int i = 0; i < 2; i++){
+				//As a restarted process would, possibly more than once.
+				ExternalSorter<IdPair> sorter(prefix, nullptr, run_records * sizeof(IdPair));
+				CHECK(sorter.open());
+				CHECK(sorter.size() == n);
+				sorter.finish();
+				CHECK(read_all(sorter) == expected);
+			}
+			CHECK(file_exists(prefix + "0"));
+			ExternalSorter<IdPair>::remove_runs(prefix);
+			CHECK(!file_exists(prefix + "0"));
+			ExternalSorter<IdPair> sorter(prefix);
+			CHECK(!sorter.open());
+		}
+	});
+}
@@ -0,0 +1,20 @@
+#include "Test.h"
+#include <iostream>
+
+void check(bool ok, const char *expression, const char *file, int line){
+	if (!ok)
+		throw TestFailure(std::string(file) + ":" + std::to_string(line) + ": CHECK(" + expression + ") failed.");
+}
+
+void TestRunner::run(const std::string &name, const std::function<void()> &test){
+	if (name.find(this->filter) == name.npos)
+		return;
+	this->run_count++;
+	try{
+		test();
+		std::cerr << name << ": OK" << std::endl;
+	}catch (std::exception &e){
+		this->failure_count++;
+		std::cerr << name << ": FAILED\n    " << e.what() << std::endl;
+	}
+}
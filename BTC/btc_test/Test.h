@@ -0,0 +1,40 @@
+#pragma once
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+class TestFailure : public std::runtime_error{
+public:
+	TestFailure(const std::string &what): std::runtime_error(what){}
+};
+
+//Throws a TestFailure naming the expression and where it is.
+void check(bool ok, const char *expression, const char *file, int line);
+
+#define CHECK(x) check(!!(x), #x, __FILE__, __LINE__)
+
+//Runs each test and reports it to stderr. Whatever a test throws fails only
+//that test, so that one failure doesn't hide the others.
+class TestRunner{
+	std::string filter;
+	unsigned run_count = 0;
+	unsigned failure_count = 0;
+public:
+	TestRunner(const std::string &filter): filter(filter){}
+	//Tests whose name doesn't contain the filter are skipped.
+	void run(const std::string &name, const std::function<void()> &test);
+	unsigned get_run_count() const{
+		return this->run_count;
+	}
+	unsigned get_failure_count() const{
+		return this->failure_count;
+	}
+};
+
+//One per file.
+void add_address_tests(TestRunner &);
+void add_bech32_tests(TestRunner &);
+void add_block_undo_tests(TestRunner &);
+void add_posting_lists_tests(TestRunner &);
+void add_sort_tests(TestRunner &);
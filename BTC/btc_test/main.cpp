@@ -0,0 +1,23 @@
+#include "Test.h"
+#include <iostream>
+
+int main(int argc, char **argv){
+	if (argc > 2){
+		std::cerr <<
+			"Usage: btc_test [<filter>]\n"
+			"\n"
+			"Only the tests whose names contain filter are run. The exit code is\n"
+			"0 if they all passed.\n";
+		return -1;
+	}
+	TestRunner runner(argc >= 2 ? argv[1] : "");
+	add_address_tests(runner);
+	add_bech32_tests(runner);
+	add_block_undo_tests(runner);
+	add_posting_lists_tests(runner);
+	add_sort_tests(runner);
+
+	auto failures = runner.get_failure_count();
+	std::cerr << runner.get_run_count() - failures << " of " << runner.get_run_count() << " tests passed." << std::endl;
+	return failures ? 1 : 0;
+}
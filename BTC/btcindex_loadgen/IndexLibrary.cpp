@@ -0,0 +1,111 @@
+#include "IndexLibrary.h"
+#include <stdexcept>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+const char *to_string(CallType type){
+	switch (type){
+		case CallType::Utxo:
+			return "utxo";
+		case CallType::Balances:
+			return "balances";
+		case CallType::History:
+			return "history";
+		case CallType::PushBlock:
+			return "push_block";
+		default:
+			return "?";
+	}
+}
+
+CallType parse_query_type(const std::string &s){
+	for (int i = 0; i < (int)CallType::PushBlock; i++)
+		if (s == to_string((CallType)i))
+			return (CallType)i;
+	throw std::runtime_error("Unknown call type: " + s);
+}
+
+IndexLibrary::IndexLibrary(const std::string &path){
+#ifdef _WIN32
+	this->module = LoadLibraryA(path.c_str());
+#else
+	this->module = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+	if (!this->module)
+		throw std::runtime_error("Failed to load " + path);
+	this->initialize_index = (initialize_index_f)this->find("initialize_index");
+	this->destroy_index = (destroy_index_f)this->find("destroy_index");
+	this->release_result = (release_result_f)this->find("index_release_result");
+	this->get_utxo = (query_f)this->find("index_get_utxo");
+	this->get_balances = (query_f)this->find("index_get_balances");
+	this->get_history = (query_f)this->find("index_get_history");
+	this->push_new_block = (push_new_block_f)this->find("index_push_new_block");
+	this->get_blockchain_height = (get_height_f)this->find("index_get_blockchain_height");
+}
+
+IndexLibrary::~IndexLibrary(){
+#ifdef _WIN32
+	FreeLibrary((HMODULE)this->module);
+#else
+	dlclose(this->module);
+#endif
+}
+
+void *IndexLibrary::find(const char *name){
+#ifdef _WIN32
+	auto ret = (void *)GetProcAddress((HMODULE)this->module, name);
+#else
+	auto ret = dlsym(this->module, name);
+#endif
+	if (!ret)
+		throw std::runtime_error(std::string("Library doesn't export ") + name);
+	return ret;
+}
+
+void *IndexLibrary::open(const std::string &db_path, bool testnet){
+	auto ret = this->initialize_index(db_path.c_str(), testnet);
+	if (!ret)
+		throw std::runtime_error("Failed to open index " + db_path);
+	return ret;
+}
+
+void IndexLibrary::close(void *index){
+	this->destroy_index(index);
+}
+
+bool IndexLibrary::query(void *index, CallType type, const std::string &argument){
+	query_f f;
+	switch (type){
+		case CallType::Utxo:
+			f = this->get_utxo;
+			break;
+		case CallType::Balances:
+			f = this->get_balances;
+			break;
+		case CallType::History:
+			f = this->get_history;
+			break;
+		default:
+			throw std::runtime_error("Not a query.");
+	}
+	auto result = f(index, argument.c_str());
+	if (!result)
+		return false;
+	this->release_result(result);
+	return true;
+}
+
+bool IndexLibrary::push_block(void *index, const std::vector<u8> &block){
+	auto result = this->push_new_block(index, block.data(), block.size());
+	if (!result)
+		return false;
+	this->release_result(result);
+	return true;
+}
+
+s64 IndexLibrary::get_height(void *index){
+	return this->get_blockchain_height(index);
+}
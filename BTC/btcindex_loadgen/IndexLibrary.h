@@ -0,0 +1,53 @@
+#pragma once
+
+#include <common/types.h>
+#include <string>
+#include <vector>
+
+enum class CallType{
+	Utxo,
+	Balances,
+	History,
+	PushBlock,
+	Count,
+};
+
+const char *to_string(CallType);
+//Throws if the name isn't that of a query (push_block isn't one).
+CallType parse_query_type(const std::string &);
+
+//Loads libbtcindex at run time and calls it through its C API, the same way
+//NktBtcIndex does, so that what's measured is exactly what clients see.
+class IndexLibrary{
+	typedef void *(*initialize_index_f)(const char *, bool);
+	typedef void (*destroy_index_f)(void *);
+	typedef void (*release_result_f)(void *);
+	typedef void *(*query_f)(void *, const char *);
+	typedef void *(*push_new_block_f)(void *, const void *, size_t);
+	typedef s64 (*get_height_f)(void *);
+
+	void *module;
+	initialize_index_f initialize_index;
+	destroy_index_f destroy_index;
+	release_result_f release_result;
+	query_f get_utxo;
+	query_f get_balances;
+	query_f get_history;
+	push_new_block_f push_new_block;
+	get_height_f get_blockchain_height;
+
+	void *find(const char *name);
+public:
+	IndexLibrary(const std::string &path);
+	~IndexLibrary();
+	IndexLibrary(const IndexLibrary &) = delete;
+	const IndexLibrary &operator=(const IndexLibrary &) = delete;
+
+	void *open(const std::string &db_path, bool testnet);
+	void close(void *index);
+	//argument is the JSON string the function takes. Returns false if the
+	//call failed.
+	bool query(void *index, CallType, const std::string &argument);
+	bool push_block(void *index, const std::vector<u8> &block);
+	s64 get_height(void *index);
+};
@@ -0,0 +1,118 @@
+#include "Workload.h"
+#include <common/XorShift128.h>
+#include <common/misc.h>
+#include <libbtcparser/SplitLayout.h>
+#include <sqlitepp/sqlitepp.h>
+#include <nlohmann/json.hpp>
+#include <fstream>
+#include <stdexcept>
+
+template <typename F>
+static void read_lines(const std::string &path, const F &f){
+	std::ifstream file(path);
+	if (!file)
+		throw std::runtime_error("Can't open " + path);
+	std::string line;
+	size_t line_number = 0;
+	while (std::getline(file, line)){
+		line_number++;
+		if (line.size() && line.back() == '\r')
+			line.pop_back();
+		if (!line.size() || line[0] == '#')
+			continue;
+		try{
+			f(line);
+		}catch (std::exception &e){
+			throw std::runtime_error(path + ":" + std::to_string(line_number) + ": " + e.what());
+		}
+	}
+}
+
+std::vector<Request> load_workload(const std::string &path){
+	std::vector<Request> ret;
+	read_lines(path, [&ret](const std::string &line){
+		auto space = line.find(' ');
+		if (space == line.npos)
+			throw std::runtime_error("Expected a call type and an argument.");
+		Request request;
+		request.type = parse_query_type(line.substr(0, space));
+		request.argument = line.substr(space + 1);
+		//Catch malformed arguments here rather than as failed calls.
+		nlohmann::json::parse(request.argument);
+		ret.push_back(std::move(request));
+	});
+	if (!ret.size())
+		throw std::runtime_error(path + " contains no requests.");
+	return ret;
+}
+
+//Expands the seed with splitmix64, since xorshift needs a non-zero state.
+static xorshift128_state make_seed(u64 seed){
+	xorshift128_state ret;
+	for (auto &i : ret.data){
+		seed += 0x9e3779b97f4a7c15ULL;
+		auto z = seed;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		i = (std::uint32_t)(z ^ (z >> 31));
+	}
+	return ret;
+}
+
+std::vector<Request> synthesize_workload(const std::string &db_path, size_t size, size_t max_addresses, u64 seed){
+	using namespace sqlite3pp;
+	DB db(db_path.c_str());
+	attach_split_files(db, db_path);
+	u64 max_id;
+	db << "select coalesce(max(id), 0) from addresses;" << Step() >> max_id;
+	if (!max_id)
+		throw std::runtime_error("The index contains no addresses.");
+	auto select = db << "select address from addresses where id = ?;";
+
+	XorShift128_64 rng(make_seed(seed));
+	auto random_address = [&](){
+		//Ids can have gaps if blocks were reverted.
+		while (true){
+			select << Reset() << rng() % max_id + 1;
+			if (select.step() != SQLITE_ROW)
+				continue;
+			std::string ret;
+			select >> ret;
+			return ret;
+		}
+	};
+
+	std::vector<Request> ret;
+	ret.reserve(size);
+	for (size_t i = 0; i < size; i++){
+		auto addresses = nlohmann::json::array();
+		auto n = rng() % max_addresses + 1;
+		for (u64 j = 0; j < n; j++)
+			addresses.push_back(random_address());
+		Request request;
+		auto kind = rng() % 10;
+		if (kind < 4){
+			request.type = CallType::Utxo;
+			request.argument = addresses.dump();
+		}else if (kind < 8){
+			request.type = CallType::Balances;
+			request.argument = addresses.dump();
+		}else{
+			request.type = CallType::History;
+			nlohmann::json params;
+			params["addresses"] = addresses;
+			params["max_txs"] = 100;
+			request.argument = params.dump();
+		}
+		ret.push_back(std::move(request));
+	}
+	return ret;
+}
+
+std::vector<std::vector<u8>> load_blocks(const std::string &path){
+	std::vector<std::vector<u8>> ret;
+	read_lines(path, [&ret](const std::string &line){
+		ret.push_back(hex_string_to_buffer(line.c_str()));
+	});
+	return ret;
+}
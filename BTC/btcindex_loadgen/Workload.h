@@ -0,0 +1,29 @@
+#pragma once
+
+#include "IndexLibrary.h"
+#include <common/types.h>
+#include <string>
+#include <vector>
+
+struct Request{
+	CallType type;
+	//The JSON argument of the call, as it would be passed to the C API.
+	std::string argument;
+};
+
+//Reads a recorded request mix, one request per line as the call type (utxo,
+//balances or history) followed by its argument, e.g.
+//    utxo ["1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa"]
+//    history {"addresses":["1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa"],"max_txs":100}
+//Empty lines and lines starting with # are ignored.
+std::vector<Request> load_workload(const std::string &path);
+
+//Builds a request mix of the given size from addresses picked at random from
+//the index. Weights are 4:4:2 for utxo, balances and history, and each
+//request asks for 1 to max_addresses addresses. The result depends only on
+//the seed and the contents of the database.
+std::vector<Request> synthesize_workload(const std::string &db_path, size_t size, size_t max_addresses, u64 seed);
+
+//Reads blocks to push, one per line in hex, with the same rules as
+//load_workload(). The blocks must follow the tip of the index in order.
+std::vector<std::vector<u8>> load_blocks(const std::string &path);
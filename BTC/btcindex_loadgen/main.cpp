@@ -0,0 +1,237 @@
+#include "IndexLibrary.h"
+#include "Workload.h"
+#include <libbtcindex/LatencyHistogram.h>
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+typedef std::chrono::steady_clock Clock;
+
+static u64 nanoseconds_between(Clock::time_point a, Clock::time_point b){
+	if (b < a)
+		return 0;
+	return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count();
+}
+
+struct CallStats{
+	LatencyHistogram latency;
+	u64 errors = 0;
+
+	void merge(const CallStats &other){
+		this->latency.merge(other.latency);
+		this->errors += other.errors;
+	}
+};
+
+struct PhaseResult{
+	std::string name;
+	double seconds = 0;
+	CallStats calls[(size_t)CallType::Count];
+	s64 start_height = -1;
+	s64 end_height = -1;
+
+	nlohmann::json to_json() const{
+		nlohmann::json ret;
+		ret["name"] = this->name;
+		ret["seconds"] = this->seconds;
+		ret["start_height"] = this->start_height;
+		ret["end_height"] = this->end_height;
+		u64 queries = 0;
+		auto calls = nlohmann::json::object();
+		for (size_t i = 0; i < (size_t)CallType::Count; i++){
+			auto &stats = this->calls[i];
+			if (!stats.latency.count())
+				continue;
+			if (i != (size_t)CallType::PushBlock)
+				queries += stats.latency.count();
+			auto json = stats.latency.to_json();
+			json["errors"] = stats.errors;
+			calls[to_string((CallType)i)] = json;
+		}
+		ret["queries"] = queries;
+		ret["qps"] = this->seconds ? queries / this->seconds : 0;
+		ret["calls"] = calls;
+		return ret;
+	}
+};
+
+struct LoadSettings{
+	unsigned threads;
+	//0 means that each thread sends its next request as soon as the previous
+	//one completes.
+	double qps;
+	double seconds;
+};
+
+//Runs the workload for the given time, starting from request next_request
+//and leaving it at the first request that wasn't sent.
+//
+//Requests are sent on a fixed schedule when a rate is given: request k is due
+//k / qps seconds after the start, and its latency is measured from that time
+//rather than from when a thread got to send it. Otherwise, a slow call would
+//delay the requests queued behind it without that delay being counted.
+//
+//If blocks are given, they're pushed from another thread, evenly spread over
+//the phase, while the queries run.
+static PhaseResult run_phase(
+		const std::string &name,
+		IndexLibrary &library,
+		void *index,
+		const std::vector<Request> &workload,
+		size_t &next_request,
+		const LoadSettings &settings,
+		const std::vector<std::vector<u8>> &blocks,
+		size_t &next_block){
+
+	PhaseResult ret;
+	ret.name = name;
+	ret.start_height = library.get_height(index);
+	std::cerr << "Running phase " << name << "..." << std::endl;
+
+	std::atomic<u64> counter(0);
+	std::vector<PhaseResult> thread_results(settings.threads);
+	auto duration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(settings.seconds));
+	auto start = Clock::now();
+	auto end = start + duration;
+	auto first_request = next_request;
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < settings.threads; i++){
+		threads.emplace_back([&, i](){
+			auto &result = thread_results[i];
+			while (true){
+				auto k = counter++;
+				auto due = Clock::now();
+				if (settings.qps){
+					due = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(k / settings.qps));
+					if (due >= end)
+						break;
+					std::this_thread::sleep_until(due);
+				}else if (due >= end)
+					break;
+				auto &request = workload[(first_request + k) % workload.size()];
+				bool ok;
+				try{
+					ok = library.query(index, request.type, request.argument);
+				}catch (std::exception &){
+					ok = false;
+				}
+				auto &stats = result.calls[(size_t)request.type];
+				stats.latency.record(nanoseconds_between(due, Clock::now()));
+				if (!ok)
+					stats.errors++;
+			}
+		});
+	}
+
+	CallStats push_stats;
+	if (next_block < blocks.size()){
+		threads.emplace_back([&](){
+			auto count = blocks.size() - next_block;
+			auto interval = duration / count;
+			for (size_t i = 0; i < count; i++){
+				auto due = start + interval * i;
+				std::this_thread::sleep_until(due);
+				auto t0 = Clock::now();
+				bool ok = library.push_block(index, blocks[next_block]);
+				push_stats.latency.record(nanoseconds_between(t0, Clock::now()));
+				if (!ok){
+					//Every block after this one would fail as well.
+					push_stats.errors++;
+					break;
+				}
+				next_block++;
+			}
+		});
+	}
+
+	for (auto &t : threads)
+		t.join();
+	ret.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	for (auto &result : thread_results)
+		for (size_t i = 0; i < (size_t)CallType::Count; i++)
+			ret.calls[i].merge(result.calls[i]);
+	ret.calls[(size_t)CallType::PushBlock].merge(push_stats);
+	//Threads that saw that their request was past the end also incremented
+	//the counter.
+	u64 sent = 0;
+	for (size_t i = 0; i < (size_t)CallType::Count; i++)
+		if (i != (size_t)CallType::PushBlock)
+			sent += ret.calls[i].latency.count();
+	next_request = (first_request + sent) % workload.size();
+	ret.end_height = library.get_height(index);
+	return ret;
+}
+
+int main(int argc, char **argv){
+	if (argc < 4){
+		std::cerr <<
+			"Usage: btcindex_loadgen <library> <db> <workload> [<threads> [<qps> [<seconds> [<blocks> [<testnet>]]]]]\n"
+			"\n"
+			"library is the path to libbtcindex. workload is a request mix in the\n"
+			"format described in btcindex_loadgen/Workload.h, or - to build one from\n"
+			"addresses picked at random from the index.\n"
+			"\n"
+			"The workload is replayed from the given number of threads (by default,\n"
+			"one per core) for the given number of seconds (by default, 10). If qps is\n"
+			"given and not 0, requests are sent at that rate in total; otherwise each\n"
+			"thread sends requests back to back.\n"
+			"\n"
+			"If blocks is given, it must be a file with one block per line in hex,\n"
+			"following the tip of the index. After the first run, the workload is run\n"
+			"again while those blocks are pushed. Pushing modifies the index, so this\n"
+			"should be done on a copy.\n"
+			"\n"
+			"The testnet argument must be a 0 or a 1. If not provided, it defaults to 0.\n"
+			"Results are written to stdout as JSON.\n";
+		return -1;
+	}
+	try{
+		std::string library_path = argv[1];
+		std::string db_path = argv[2];
+		std::string workload_path = argv[3];
+		LoadSettings settings;
+		settings.threads = argc >= 5 ? (unsigned)std::stoul(argv[4]) : std::max(std::thread::hardware_concurrency(), 1U);
+		settings.qps = argc >= 6 ? std::stod(argv[5]) : 0;
+		settings.seconds = argc >= 7 ? std::stod(argv[6]) : 10;
+		std::string blocks_path = argc >= 8 ? argv[7] : "";
+		const bool testnet = argc >= 9 && atoi(argv[8]);
+		if (!settings.threads || settings.seconds <= 0 || settings.qps < 0)
+			throw std::runtime_error("Invalid load settings.");
+
+		std::vector<Request> workload;
+		if (workload_path == "-")
+			workload = synthesize_workload(db_path, 10000, 4, 1);
+		else
+			workload = load_workload(workload_path);
+		std::vector<std::vector<u8>> blocks;
+		if (blocks_path.size())
+			blocks = load_blocks(blocks_path);
+
+		IndexLibrary library(library_path);
+		auto index = library.open(db_path, testnet);
+		size_t next_request = 0;
+		size_t next_block = 0;
+		auto phases = nlohmann::json::array();
+		phases.push_back(run_phase("queries", library, index, workload, next_request, settings, {}, next_block).to_json());
+		if (blocks.size())
+			phases.push_back(run_phase("queries_while_pushing", library, index, workload, next_request, settings, blocks, next_block).to_json());
+		library.close(index);
+
+		nlohmann::json ret;
+		ret["library"] = library_path;
+		ret["db"] = db_path;
+		ret["workload"] = workload_path;
+		ret["workload_size"] = workload.size();
+		ret["threads"] = settings.threads;
+		ret["target_qps"] = settings.qps;
+		ret["phases"] = phases;
+		std::cout << ret.dump(1, '\t') << std::endl;
+	}catch (std::exception &e){
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+	return 0;
+}
@@ -83,16 +83,24 @@ data expand_hrp(const char *hrp, size_t n = 0) {
     return ret;
 }
 
+/** The constant the checksum of each encoding must xor to. */
+uint32_t encoding_constant(bech32::Encoding encoding) {
+    return encoding == bech32::Encoding::Bech32m ? 0x2bc830a3 : 1;
+}
+
 /** Verify a checksum. */
-bool verify_checksum(const char *hrp, const data& values) {
-    return polymod(cat(expand_hrp(hrp), values)) == 1;
+bech32::Encoding verify_checksum(const char *hrp, const data& values) {
+    uint32_t check = polymod(cat(expand_hrp(hrp), values));
+    if (check == encoding_constant(bech32::Encoding::Bech32)) return bech32::Encoding::Bech32;
+    if (check == encoding_constant(bech32::Encoding::Bech32m)) return bech32::Encoding::Bech32m;
+    return bech32::Encoding::Invalid;
 }
 
 /** Create a checksum. */
-data create_checksum(const char *hrp, const data& values) {
+data create_checksum(const char *hrp, const data& values, bech32::Encoding encoding) {
     data enc = cat(expand_hrp(hrp), values);
     enc.resize(enc.size() + 6);
-    uint32_t mod = polymod(enc) ^ 1;
+    uint32_t mod = polymod(enc) ^ encoding_constant(encoding);
     data ret;
     ret.resize(6);
     for (size_t i = 0; i < 6; ++i) {
@@ -106,9 +114,9 @@ data create_checksum(const char *hrp, const data& values) {
 namespace bech32
 {
 
-/** Encode a Bech32 string. */
-std::string encode(const char *hrp, const data &values) {
-    data checksum = create_checksum(hrp, values);
+/** Encode a Bech32 or Bech32m string. */
+std::string encode(const char *hrp, const data &values, Encoding encoding) {
+    data checksum = create_checksum(hrp, values, encoding);
     data combined = cat(values, checksum);
 	std::string ret = hrp;
 	ret += '1';
@@ -119,8 +127,8 @@ std::string encode(const char *hrp, const data &values) {
     return ret;
 }
 
-/** Decode a Bech32 string. */
-std::pair<std::string, data> decode(const std::string &str) {
+/** Decode a Bech32 or Bech32m string. */
+std::pair<std::string, data> decode(const std::string &str, Encoding *encoding) {
     bool lower = false, upper = false;
     bool ok = true;
     for (size_t i = 0; ok && i < str.size(); ++i) {
@@ -144,7 +152,9 @@ std::pair<std::string, data> decode(const std::string &str) {
             for (size_t i = 0; i < pos; ++i) {
                 hrp += lc(str[i]);
             }
-            if (verify_checksum(hrp.c_str(), values)) {
+            Encoding found = verify_checksum(hrp.c_str(), values);
+            if (found != Encoding::Invalid) {
+                if (encoding) *encoding = found;
                 return std::make_pair(hrp, data(values.begin(), values.end() - 6));
             }
         }
@@ -27,10 +27,18 @@
 namespace bech32
 {
 
-/** Encode a Bech32 string. Returns the empty string in case of failure. */
-LIBMISC_API std::string encode(const char *hrp, const std::vector<uint8_t> &values);
+/** The checksum variants. Bech32m (BIP350) is used by witness versions 1 and up. */
+enum class Encoding{
+    Invalid,
+    Bech32,
+    Bech32m,
+};
 
-/** Decode a Bech32 string. Returns (hrp, data). Empty hrp means failure. */
-LIBMISC_API std::pair<std::string, std::vector<uint8_t> > decode(const std::string& str);
+/** Encode a Bech32 or Bech32m string. Returns the empty string in case of failure. */
+LIBMISC_API std::string encode(const char *hrp, const std::vector<uint8_t> &values, Encoding encoding = Encoding::Bech32);
+
+/** Decode a Bech32 or Bech32m string. Returns (hrp, data). Empty hrp means failure.
+ *  If encoding isn't null, it receives the variant of the checksum. */
+LIBMISC_API std::pair<std::string, std::vector<uint8_t> > decode(const std::string& str, Encoding *encoding = nullptr);
 
 }
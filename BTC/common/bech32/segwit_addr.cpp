@@ -64,8 +64,11 @@ namespace segwit_addr
 
 /** Decode a SegWit address. */
 std::pair<int, data> decode(const std::string& hrp, const std::string& addr) {
-    std::pair<std::string, data> dec = bech32::decode(addr);
+    bech32::Encoding encoding;
+    std::pair<std::string, data> dec = bech32::decode(addr, &encoding);
     if (dec.first != hrp || dec.second.size() < 1) return std::make_pair(-1, data());
+    /* BIP350: version 0 uses Bech32, every later version uses Bech32m. */
+    if (encoding != (dec.second[0] == 0 ? bech32::Encoding::Bech32 : bech32::Encoding::Bech32m)) return std::make_pair(-1, data());
     data conv;
     if (!convertbits<5, 8, false>(conv, data(dec.second.begin() + 1, dec.second.end())) ||
         conv.size() < 2 || conv.size() > 40 || dec.second[0] > 16 || (dec.second[0] == 0 &&
@@ -80,7 +83,7 @@ std::string encode(const char *hrp, int witver, const void *witprog, size_t witp
     data enc;
     enc.push_back(witver);
     convertbits<8, 5, true>(enc, witprog, witprog_size);
-    std::string ret = bech32::encode(hrp, enc);
+    std::string ret = bech32::encode(hrp, enc, witver == 0 ? bech32::Encoding::Bech32 : bech32::Encoding::Bech32m);
     if (decode(hrp, ret).first == -1)
 		return {};
     return ret;
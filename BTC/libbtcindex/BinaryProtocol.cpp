@@ -0,0 +1,160 @@
+#include "BinaryProtocol.h"
+#include <libbtcparser/Address.h>
+#include <common/serialization.h>
+#include <common/base58.h>
+#include <common/bech32/segwit_addr.h>
+
+template <typename T>
+static void write_uint(std::string &dst, T n){
+	for (size_t i = 0; i < sizeof(T); i++){
+		dst.push_back((char)(n & 0xFF));
+		n >>= 8;
+	}
+}
+
+BinaryWriter &BinaryWriter::write_u8(u8 n){
+	this->buffer.push_back((char)n);
+	return *this;
+}
+
+BinaryWriter &BinaryWriter::write_u32(u32 n){
+	write_uint(this->buffer, n);
+	return *this;
+}
+
+BinaryWriter &BinaryWriter::write_u64(u64 n){
+	write_uint(this->buffer, n);
+	return *this;
+}
+
+BinaryWriter &BinaryWriter::write_varint(u64 n){
+	if (n < 253)
+		return this->write_u8((u8)n);
+	if (n <= 0xFFFF){
+		this->write_u8(253);
+		write_uint(this->buffer, (u16)n);
+		return *this;
+	}
+	if (n <= 0xFFFFFFFF){
+		this->write_u8(254);
+		return this->write_u32((u32)n);
+	}
+	this->write_u8(255);
+	return this->write_u64(n);
+}
+
+BinaryWriter &BinaryWriter::write_bytes(const void *data, size_t size){
+	this->buffer.append((const char *)data, size);
+	return *this;
+}
+
+BinaryWriter &BinaryWriter::write_hash(const Hashes::Digests::SHA256 &hash){
+	auto &array = hash.to_array();
+	return this->write_bytes(array.data(), array.size());
+}
+
+BinaryWriter &BinaryWriter::write_hash(const std::string &hex){
+	return this->write_hash(Hashes::Digests::SHA256(hex));
+}
+
+static bool decode_segwit_address(BinaryWriter &dst, const std::string &address, bool testnet){
+	auto decoded = segwit_addr::decode(testnet ? "tb" : "bc", address);
+	auto &program = decoded.second;
+	if (decoded.first == 0 && program.size() == 20)
+		dst.write_u8((u8)BinaryAddressKind::P2wpkh);
+	else if (decoded.first == 0 && program.size() == 32)
+		dst.write_u8((u8)BinaryAddressKind::P2wsh);
+	else if (decoded.first == 1 && program.size() == 32)
+		dst.write_u8((u8)BinaryAddressKind::P2tr);
+	else
+		return false;
+	dst.write_bytes(program.data(), program.size());
+	return true;
+}
+
+static bool decode_base58_address(BinaryWriter &dst, const std::string &address){
+	auto decoded = base58_to_binary_check(address);
+	if (!decoded || decoded->size() != 1 + Hashes::Digests::RIPEMD160::size)
+		return false;
+	switch ((*decoded)[0]){
+		case 0:
+		case 111:
+			dst.write_u8((u8)BinaryAddressKind::P2pkh);
+			break;
+		case 5:
+		case 196:
+			dst.write_u8((u8)BinaryAddressKind::P2sh);
+			break;
+		default:
+			return false;
+	}
+	dst.write_bytes(decoded->data() + 1, decoded->size() - 1);
+	return true;
+}
+
+BinaryWriter &BinaryWriter::write_address(const std::string &address, bool testnet){
+	if (decode_segwit_address(*this, address, testnet) || decode_base58_address(*this, address))
+		return *this;
+	this->write_u8((u8)BinaryAddressKind::Text);
+	this->write_varint(address.size());
+	return this->write_bytes(address.data(), address.size());
+}
+
+BinaryWriter &BinaryWriter::write_addresses(const std::vector<std::string> &addresses, bool testnet){
+	this->write_varint(addresses.size());
+	for (auto &address : addresses)
+		this->write_address(address, testnet);
+	return *this;
+}
+
+static const u8 *read_bytes(SerializedBuffer &buffer, size_t size){
+	if (buffer.remaining_bytes() < size)
+		throw std::runtime_error("Invalid binary request.");
+	auto ret = (const u8 *)buffer.get_buffer();
+	buffer.set_offset(buffer.get_offset() + size);
+	return ret;
+}
+
+std::string read_binary_address(SerializedBuffer &buffer, bool testnet){
+	AddressType type;
+	size_t size = Hashes::Digests::RIPEMD160::size;
+	switch ((BinaryAddressKind)buffer.read_u8()){
+		case BinaryAddressKind::P2pkh:
+			type = AddressType::P2pkh;
+			break;
+		case BinaryAddressKind::P2sh:
+			type = AddressType::P2sh;
+			break;
+		case BinaryAddressKind::P2wpkh:
+			type = AddressType::P2wpkh20;
+			break;
+		case BinaryAddressKind::P2wsh:
+			type = AddressType::P2wpkh32;
+			size = 32;
+			break;
+		case BinaryAddressKind::P2tr:
+			type = AddressType::P2tr;
+			size = 32;
+			break;
+		case BinaryAddressKind::Text:
+			{
+				auto n = buffer.read_varint();
+				auto p = read_bytes(buffer, (size_t)n);
+				return std::string((const char *)p, (size_t)n);
+			}
+		default:
+			throw std::runtime_error("Invalid binary request: unknown address kind.");
+	}
+	return Address(type, read_bytes(buffer, size), testnet);
+}
+
+std::vector<std::string> read_binary_addresses(SerializedBuffer &buffer, bool testnet){
+	auto n = buffer.read_varint();
+	if (n > buffer.remaining_bytes())
+		throw std::runtime_error("Invalid binary request.");
+	std::vector<std::string> ret;
+	ret.reserve((size_t)n);
+	while (n--)
+		ret.emplace_back(read_binary_address(buffer, testnet));
+	return ret;
+}
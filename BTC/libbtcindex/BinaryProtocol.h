@@ -0,0 +1,83 @@
+#pragma once
+
+#include <common/types.h>
+#include <libhash/hash.h>
+#include <string>
+#include <vector>
+
+class SerializedBuffer;
+
+/*
+Compact binary encoding used by the index_*_bin functions, as an alternative
+to JSON. All integers are little endian. varint is Bitcoin's compact size
+encoding. Hashes are sent as 32 raw bytes in internal byte order (i.e.
+reversed with respect to their hex representation).
+
+Addresses are a kind byte followed by a fixed-size payload:
+	0x00 P2PKH            20 bytes
+	0x01 P2SH             20 bytes
+	0x02 P2WPKH           20 bytes
+	0x03 P2WSH            32 bytes
+	0x04 P2TR             32 bytes
+	0xFF text             varint length + UTF-8 bytes
+The text form is only used for addresses that can't be decoded, including
+segwit addresses with the HRP of the other network.
+
+Address list:     varint count, address[count]
+
+Requests:
+	utxo/balances/
+	address usage:    address list
+	history:          u64 max_txs, address list
+	raw txs:          varint count, {hash txid}
+
+Responses:
+	utxo:             varint address count, {address, varint utxo count,
+	                  {hash txid, u32 output_index, u64 value, u32 min_sigs}}
+	balances:         varint count, {address, u64 balance}
+	address usage:    varint count, {u8 used, [u64 tx_count,
+	                  u64 first_seen_height, u64 last_seen_height]}, in
+	                  the order of the request
+	raw txs:          varint count, {u8 found, [varint size, bytes]}, in the
+	                  order of the request, with the bytes as they are in
+	                  the block files
+	history:          varint tx count, {tx}, followed in pruned DBs by
+	                  u8 truncated, u64 history_begin_height (see
+	                  Indexer::get_history())
+	tx:               hash, u8 has_whash, [hash whash], u32 locktime,
+	                  hash block_hash, u64 block_height, u32 block_index,
+	                  u64 timestamp, varint input count, {input},
+	                  varint output count, {output}
+	input:            u32 txi_index, u64 value, address list
+	output:           u32 txo_index, u64 value, u32 required_spenders,
+	                  u8 is_spent, [u64 spent_by], address list
+*/
+
+enum class BinaryAddressKind : u8{
+	P2pkh = 0,
+	P2sh = 1,
+	P2wpkh = 2,
+	P2wsh = 3,
+	P2tr = 4,
+	Text = 0xFF,
+};
+
+class BinaryWriter{
+	std::string buffer;
+public:
+	BinaryWriter &write_u8(u8);
+	BinaryWriter &write_u32(u32);
+	BinaryWriter &write_u64(u64);
+	BinaryWriter &write_varint(u64);
+	BinaryWriter &write_bytes(const void *, size_t);
+	BinaryWriter &write_hash(const Hashes::Digests::SHA256 &);
+	BinaryWriter &write_hash(const std::string &hex);
+	BinaryWriter &write_address(const std::string &, bool testnet);
+	BinaryWriter &write_addresses(const std::vector<std::string> &, bool testnet);
+	std::string release(){
+		return std::move(this->buffer);
+	}
+};
+
+std::string read_binary_address(SerializedBuffer &, bool testnet);
+std::vector<std::string> read_binary_addresses(SerializedBuffer &, bool testnet);
@@ -0,0 +1,107 @@
+#include "BlockUndo.h"
+#include <common/misc.h>
+#include <algorithm>
+
+static u64 zigzag_encode(s64 n){
+	return ((u64)n << 1) ^ (u64)(n >> 63);
+}
+
+static s64 zigzag_decode(u64 n){
+	return (s64)(n >> 1) ^ -(s64)(n & 1);
+}
+
+BlockUndo::BlockUndo(const std::vector<u8> &serialized){
+	size_t offset = 0;
+	auto read_range = [&serialized, &offset](u64 &begin, u64 &end){
+		begin = deserialize<u64>(serialized, offset);
+		end = begin + deserialize<u64>(serialized, offset);
+	};
+	read_range(this->txs_begin, this->txs_end);
+	read_range(this->inputs_begin, this->inputs_end);
+	read_range(this->outputs_begin, this->outputs_end);
+
+	auto n = deserialize<u64>(serialized, offset);
+	this->spent_outputs.reserve(n);
+	u64 last = 0;
+	while (n--){
+		last += deserialize<u64>(serialized, offset);
+		this->spent_outputs.push_back(last);
+	}
+
+	n = deserialize<u64>(serialized, offset);
+	this->balance_deltas.reserve(n);
+	last = 0;
+	while (n--){
+		last += deserialize<u64>(serialized, offset);
+		this->balance_deltas.emplace_back(last, zigzag_decode(deserialize<u64>(serialized, offset)));
+	}
+}
+
+void BlockUndo::set_changes(BlockInsertInfo &info){
+	this->spent_outputs = std::move(info.spent_outputs);
+	std::sort(this->spent_outputs.begin(), this->spent_outputs.end());
+	this->balance_deltas.clear();
+	this->balance_deltas.reserve(info.balance_deltas.size());
+	for (auto &kv : info.balance_deltas)
+		if (kv.second)
+			this->balance_deltas.emplace_back(kv.first, kv.second);
+}
+
+std::vector<u8> BlockUndo::serialize() const{
+	std::vector<u8> ret;
+	ret.reserve(32 + this->spent_outputs.size() * 3 + this->balance_deltas.size() * 6);
+	::serialize(ret, this->txs_begin);
+	::serialize(ret, this->txs_end - this->txs_begin);
+	::serialize(ret, this->inputs_begin);
+	::serialize(ret, this->inputs_end - this->inputs_begin);
+	::serialize(ret, this->outputs_begin);
+	::serialize(ret, this->outputs_end - this->outputs_begin);
+
+	::serialize(ret, (u64)this->spent_outputs.size());
+	u64 last = 0;
+	for (auto id : this->spent_outputs){
+		::serialize(ret, id - last);
+		last = id;
+	}
+
+	::serialize(ret, (u64)this->balance_deltas.size());
+	last = 0;
+	for (auto &kv : this->balance_deltas){
+		::serialize(ret, kv.first - last);
+		::serialize(ret, zigzag_encode(kv.second));
+		last = kv.first;
+	}
+	return ret;
+}
+
+UndoLog::UndoLog(sqlite3pp::DB &db)
+	: set_undo_stmt(initialize_table(db) << "insert into block_undo (id, data) values (?1, ?2) on conflict (id) do update set data = ?2 where id = ?1;")
+	, get_undo_stmt(db << "select data from block_undo where id = ?;")
+	, delete_undo_stmt(db << "delete from block_undo where id = ?;")
+{}
+
+sqlite3pp::DB &UndoLog::initialize_table(sqlite3pp::DB &db){
+	//Databases created by older versions don't have this table.
+	db.exec("create table if not exists block_undo (id integer primary key, data blob);");
+	return db;
+}
+
+void UndoLog::add_block(u64 block_id, const BlockUndo &undo){
+	using namespace sqlite3pp;
+	this->set_undo_stmt << Reset() << block_id << undo.serialize() << Step();
+}
+
+boost::optional<BlockUndo> UndoLog::get_block(u64 block_id){
+	using namespace sqlite3pp;
+	this->get_undo_stmt << Reset() << block_id;
+	if (this->get_undo_stmt.step() != SQLITE_ROW)
+		return {};
+	std::vector<u8> data;
+	this->get_undo_stmt >> data;
+	return BlockUndo(data);
+}
+
+void UndoLog::delete_block(u64 block_id){
+	using namespace sqlite3pp;
+	this->delete_undo_stmt << Reset() << block_id << Step();
+}
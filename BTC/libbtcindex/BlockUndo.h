@@ -0,0 +1,43 @@
+#pragma once
+
+#include <libbtcparser/Block.h>
+#include <sqlitepp/sqlitepp.h>
+#include <common/types.h>
+#include <boost/optional.hpp>
+#include <vector>
+#include <utility>
+
+//Everything needed to remove a block from the DB without searching for what
+//it added. The rows a block creates in txs, inputs, and outputs are always
+//contiguous, so they are stored as half-open id ranges.
+struct BlockUndo{
+	u64 txs_begin = 0, txs_end = 0;
+	u64 inputs_begin = 0, inputs_end = 0;
+	u64 outputs_begin = 0, outputs_end = 0;
+	//Sorted.
+	std::vector<u64> spent_outputs;
+	//Sorted by address id.
+	std::vector<std::pair<u64, s64>> balance_deltas;
+
+	BlockUndo() = default;
+	BlockUndo(const std::vector<u8> &serialized);
+	void set_changes(BlockInsertInfo &info);
+	std::vector<u8> serialize() const;
+};
+
+class UndoLog{
+	sqlite3pp::Statement set_undo_stmt;
+	sqlite3pp::Statement get_undo_stmt;
+	sqlite3pp::Statement delete_undo_stmt;
+
+	static sqlite3pp::DB &initialize_table(sqlite3pp::DB &);
+public:
+	//Blocks buried deeper than this don't keep their undo records. Reverting
+	//them is still possible, only slower.
+	static const u64 max_depth = 288;
+
+	UndoLog(sqlite3pp::DB &db);
+	void add_block(u64 block_id, const BlockUndo &);
+	boost::optional<BlockUndo> get_block(u64 block_id);
+	void delete_block(u64 block_id);
+};
@@ -0,0 +1,110 @@
+#include "FeeEstimator.h"
+#include <common/misc.h>
+#include <algorithm>
+
+FeeEstimator::FeeEstimator(sqlite3pp::DB &db, const Blockchain &blockchain, size_t capacity)
+	: set_quantiles_stmt(initialize_table(db) << "insert into block_fee_rates (id, quantiles) values (?1, ?2) on conflict (id) do update set quantiles = ?2 where id = ?1;")
+	, get_quantiles_stmt(db << "select quantiles from block_fee_rates where id = ?;")
+	, delete_quantiles_stmt(db << "delete from block_fee_rates where id = ?;")
+	, capacity(capacity){
+
+	this->reload_data(blockchain);
+}
+
+sqlite3pp::DB &FeeEstimator::initialize_table(sqlite3pp::DB &db){
+	//Databases created by older versions don't have this table.
+	db.exec("create table if not exists block_fee_rates (id integer primary key, quantiles blob);");
+	return db;
+}
+
+void FeeEstimator::reload_data(const Blockchain &blockchain){
+	using namespace sqlite3pp;
+	this->blocks.clear();
+	//get_height() wraps around to 0 on an empty blockchain.
+	auto count = blockchain.get_height() + 1;
+	u64 first = 0;
+	if (count > this->capacity)
+		first = count - this->capacity;
+	for (u64 i = first; i < count; i++){
+		auto block = blockchain.get_block_by_height(i);
+		if (!block)
+			continue;
+		this->get_quantiles_stmt << Reset() << block->db_id;
+		if (this->get_quantiles_stmt.step() != SQLITE_ROW)
+			continue;
+		std::vector<u8> blob;
+		this->get_quantiles_stmt >> blob;
+		quantiles_t quantiles;
+		size_t offset = 0;
+		for (auto &q : quantiles)
+			q = deserialize<u64>(blob, offset);
+		this->push(block->db_id, quantiles);
+	}
+}
+
+FeeEstimator::quantiles_t FeeEstimator::compute_quantiles(std::vector<TxFeeRate> &fee_rates){
+	static const u64 percentiles[quantile_count] = { 10, 25, 50, 75, 90 };
+
+	std::sort(fee_rates.begin(), fee_rates.end(), [](const TxFeeRate &a, const TxFeeRate &b){ return a.fee_rate < b.fee_rate; });
+	u64 total_size = 0;
+	for (auto &r : fee_rates)
+		total_size += r.vsize;
+
+	quantiles_t ret;
+	size_t i = 0;
+	u64 accumulated = 0;
+	for (size_t q = 0; q < quantile_count; q++){
+		auto threshold = total_size * percentiles[q] / 100;
+		while (i + 1 < fee_rates.size() && accumulated + fee_rates[i].vsize <= threshold)
+			accumulated += fee_rates[i++].vsize;
+		ret[q] = fee_rates[i].fee_rate;
+	}
+	return ret;
+}
+
+void FeeEstimator::push(u64 block_id, const quantiles_t &quantiles){
+	this->blocks.emplace_back(block_id, quantiles);
+	while (this->blocks.size() > this->capacity)
+		this->blocks.pop_front();
+}
+
+void FeeEstimator::add_block(u64 block_id, std::vector<TxFeeRate> &fee_rates){
+	using namespace sqlite3pp;
+	if (!fee_rates.size())
+		return;
+	auto quantiles = compute_quantiles(fee_rates);
+	std::vector<u8> blob;
+	for (auto q : quantiles)
+		serialize(blob, q);
+	this->set_quantiles_stmt << Reset() << block_id << blob << Step();
+	this->push(block_id, quantiles);
+}
+
+void FeeEstimator::revert_block(u64 block_id){
+	using namespace sqlite3pp;
+	this->delete_quantiles_stmt << Reset() << block_id << Step();
+	auto it = std::find_if(this->blocks.begin(), this->blocks.end(), [block_id](const std::pair<u64, quantiles_t> &p){ return p.first == block_id; });
+	if (it != this->blocks.end())
+		this->blocks.erase(it);
+}
+
+FeeEstimator::Estimate FeeEstimator::get_estimate() const{
+	//Each estimate is the median across blocks of one of the per-block
+	//percentiles, which keeps a single odd block from skewing the result.
+	auto median = [this](size_t q){
+		if (!this->blocks.size())
+			return (u64)0;
+		std::vector<u64> values;
+		values.reserve(this->blocks.size());
+		for (auto &b : this->blocks)
+			values.push_back(b.second[q]);
+		auto middle = values.begin() + values.size() / 2;
+		std::nth_element(values.begin(), middle, values.end());
+		return *middle;
+	};
+	Estimate ret;
+	ret.low = median(1);
+	ret.normal = median(2);
+	ret.high = median(4);
+	return ret;
+}
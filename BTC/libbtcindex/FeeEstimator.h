@@ -0,0 +1,45 @@
+#pragma once
+
+#include <libbtcparser/Block.h>
+#include <libbtcparser/Blockchain.h>
+#include <sqlitepp/sqlitepp.h>
+#include <common/types.h>
+#include <array>
+#include <deque>
+#include <vector>
+
+//Keeps a small summary of the fee rate distribution of the last few blocks
+//of the main chain. Summaries are computed while blocks are inserted and are
+//persisted in block_fee_rates, so estimates never need to scan the outputs
+//table.
+class FeeEstimator{
+public:
+	//10th, 25th, 50th, 75th, and 90th percentiles, in satoshis per 1000
+	//virtual bytes, weighted by transaction size.
+	static const size_t quantile_count = 5;
+	typedef std::array<u64, quantile_count> quantiles_t;
+
+	struct Estimate{
+		u64 low, normal, high;
+	};
+private:
+	sqlite3pp::Statement set_quantiles_stmt;
+	sqlite3pp::Statement get_quantiles_stmt;
+	sqlite3pp::Statement delete_quantiles_stmt;
+	size_t capacity;
+	//Ordered by height, oldest first. Blocks without non-coinbase transactions
+	//are not included.
+	std::deque<std::pair<u64, quantiles_t>> blocks;
+
+	static sqlite3pp::DB &initialize_table(sqlite3pp::DB &);
+	static quantiles_t compute_quantiles(std::vector<TxFeeRate> &);
+	void push(u64 block_id, const quantiles_t &);
+public:
+	FeeEstimator(sqlite3pp::DB &db, const Blockchain &blockchain, size_t capacity = 50);
+	void reload_data(const Blockchain &blockchain);
+	//Must be called inside the transaction that inserts the block.
+	void add_block(u64 block_id, std::vector<TxFeeRate> &fee_rates);
+	//Must be called inside the transaction that reverts the block.
+	void revert_block(u64 block_id);
+	Estimate get_estimate() const;
+};
@@ -1,13 +1,34 @@
 #include "Indexer.h"
+#include <libbtcparser/AddressFormat.h>
+#include <libbtcparser/DeferredIndexes.h>
+#include <libbtcparser/SplitLayout.h>
 #include <common/serialization.h>
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <thread>
 
-//In main.cpp there's a call to sqlite3_config() that you should uncomment if you implement
-//reader-writer locks!
-#define LOCK_READER LOCK_MUTEX(this->mutex)
-#define LOCK_WRITER LOCK_MUTEX(this->mutex)
+//Calls that only read, and only through a connection of their own borrowed
+//from this->readers, share the lock. Every other call takes it exclusively,
+//including the reads that still use this->db's statements or update state of
+//their own (the balance cache, RawTxReader's mapped files).
+#define LOCK_SHARED_READER boost::shared_lock<boost::shared_mutex> shared_reader_lock(this->mutex)
+#define LOCK_READER boost::unique_lock<boost::shared_mutex> reader_lock(this->mutex)
+#define LOCK_WRITER boost::unique_lock<boost::shared_mutex> writer_lock(this->mutex)
+//Takes the lock and records the call in this->stats, including the time it
+//took to get the lock.
+#define TIMED_LOCK(lock, call) \
+	auto call_start_time = IndexerStats::Clock::now(); \
+	lock; \
+	IndexerStats::CallScope call_scope(this->stats, call, call_start_time)
 
 using namespace sqlite3pp;
 
+static_assert(HistoryPruner::min_keep_blocks >= UndoLog::max_depth, "Pruned DBs must be able to revert every block in the undo log.");
+
+//Txs pruned per transaction. The writer lock is held for the whole batch.
+static const u64 prune_batch_txs = 1000;
+
 template <typename T>
 void set_union(std::set<T> &dst, const std::set<T> &src){
 	dst.insert(src.begin(), src.end());
@@ -23,29 +44,36 @@ static void get_id_list(std::vector<u64> &dst, Statement &stmt, u64 input){
 	}
 }
 
-static void get_id_list(std::set<u64> &dst, Statement &stmt, u64 input){
-	dst.clear();
-	stmt << Reset() << input;
-	while (stmt.step() == SQLITE_ROW){
-		u64 id;
-		stmt >> id;
-		dst.insert(id);
-	}
-}
-
 static void use_id_list(Statement &stmt, std::vector<u64> &ids){
 	for (auto id : ids)
 		stmt << Reset() << id << Step();
 }
 
+static const char * const get_address_id_sql = "select id from addresses where address = ?;";
+
+//Readers never run at the same time as a writer, since they hold the
+//Indexer's lock shared, so the journal mode is left alone.
+static ConnectionPool::Options get_reader_options(const std::string &db_path, IndexerStats &stats){
+	ConnectionPool::Options ret;
+	ret.writer = false;
+	ret.max_readers = std::max<size_t>(std::thread::hardware_concurrency(), ret.max_readers);
+	ret.initialize = [db_path, &stats](DB &db){
+		attach_split_files(db, db_path);
+		db.set_step_observer(&stats);
+	};
+	return ret;
+}
+
 Indexer::Indexer(const char *db_path, bool testnet)
 	: testnet(testnet)
 	, db_path(db_path)
 	, db(this->db_path.c_str())
-	, is(this->db)
-	, get_address_id_stmt(this->db << "select id from addresses where address = ?;")
-	, read_outputs_stmt(this->db << "select outputs_id from addresses_outputs where addresses_id = ?;")
-	, read_txs_stmt(this->db << "select txs_id from addresses_txs where addresses_id = ?;")
+	, stats(attach_split_files(this->db, this->db_path))
+	, readers(this->db_path.c_str(), get_reader_options(this->db_path, this->stats))
+	, column_store(ColumnStore::open(this->db, this->db_path))
+	, is(this->db, this->column_store.get())
+	, postings(this->db)
+	, get_address_id_stmt(this->db << get_address_id_sql)
 	, read_utxo_stmt(this->db << "select txs_id, txo_index, value, required_spenders from outputs where outputs.id = ? and outputs.spent_by is null;")
 	, get_tx_hash(this->db << "select hash from txs where id = ?;")
 	, get_block_transactions(this->db << "select first_transaction_id, transaction_count from blocks where id = ?;")
@@ -56,38 +84,64 @@ Indexer::Indexer(const char *db_path, bool testnet)
 	, get_spent_outputs_from_tx(this->db << "select outputs_id from inputs where txs_id = ?;")
 	, delete_inputs_from_tx(this->db << "delete from inputs where txs_id = ?;")
 	, unspend_output(this->db << "update outputs set spent_by = null where id = ?;")
-	, delete_tx_relations(this->db << "delete from addresses_txs where txs_id = ?;")
 	, delete_txs_from_block(this->db << "delete from txs where blocks_id = ?;")
 	, delete_block(this->db << "delete from blocks where id = ?;")
 	, get_cached_balance_stmt(this->db << "select balance from cached_balances where id = ?;")
 	, set_cached_balance_stmt(this->db << "update cached_balances set balance = ? where id = ?;")
 	, delete_cached_balance_stmt(this->db << "delete from cached_balances where id = ?;")
-	, get_outputs_total_for_block_stmt(this->db << "select sum(outputs.value) from txs inner join outputs on outputs.txs_id = txs.id where txs.blocks_id = ? and txs.index_in_block > 0;")
-	, get_inputs_total_for_block_stmt(this->db << "select sum(outputs.value) from txs inner join inputs on inputs.txs_id = txs.id inner join outputs on outputs.id = inputs.outputs_id where txs.blocks_id = ? and txs.index_in_block > 0;")
-	, set_fee_for_block_stmt(this->db << "insert into block_fees (id, average_fee_per_kb) values (?1, ?2) on conflict (id) do update set average_fee_per_kb = ?2 where id = ?1;")
-	, get_average_fee_for_block_stmt(this-> db << "select average_fee_per_kb from block_fees where id = ?;")
+	, adjust_cached_balance_stmt(this->db << "update cached_balances set balance = balance + ? where id = ?;")
+	, get_max_input_id(this->db << "select coalesce(max(id), 0) from inputs;")
+	, get_max_output_id(this->db << "select coalesce(max(id), 0) from outputs;")
+	, delete_outputs_relations_range(this->db << "delete from addresses_outputs where outputs_id >= ? and outputs_id < ?;")
+	, delete_outputs_range(this->db << "delete from outputs where id >= ? and id < ?;")
+	, delete_inputs_range(this->db << "delete from inputs where id >= ? and id < ?;")
+	, delete_txs_range(this->db << "delete from txs where id >= ? and id < ?;")
+	, delete_tx_locations_range(this->db << "delete from tx_locations where txs_id >= ? and txs_id < ?;")
+	, get_addresses_from_output(this->db << "select distinct addresses_id from addresses_outputs where outputs_id >= ?;")
+	, get_addresses_from_spent_output(this->db << "select addresses_id from addresses_outputs where outputs_id = ?;")
+	, get_addresses_from_inputs(this->db << "select distinct addresses_outputs.addresses_id from inputs inner join addresses_outputs on addresses_outputs.outputs_id = inputs.outputs_id where inputs.txs_id >= ?;")
+	, get_first_output_from_tx(this->db << "select min(id) from outputs where txs_id >= ?;")
 	, timestamp_index(this->db)
 	, blockchain(this->db)
-	, tx_fetcher(this->db, this->blockchain)
-{}
-
-std::set<u64> Indexer::read_outputs(u64 address_id){
-	std::set<u64> ret;
-	get_id_list(ret, this->read_outputs_stmt, address_id);
-	return ret;
+	, tx_fetcher(this->blockchain, this->column_store.get())
+	, fee_estimator(this->db, this->blockchain)
+	, undo_log(this->db)
+	, raw_tx_reader(this->db)
+{
+	if (PostingLists::needs_migration(this->db))
+		throw std::runtime_error("The DB was made by an older version of blockchain_parser. Run blockchain_parser on it to migrate it.");
+	check_address_format(this->db);
+	auto missing = get_missing_deferred_indexes(this->db);
+	if (missing.size()){
+		std::string message = "The DB is missing indexes that blockchain_parser builds at the end of the initial sync:";
+		for (auto &index : missing){
+			message += ' ';
+			message += index.name;
+		}
+		message += ". Run blockchain_parser again to finish building them.";
+		throw std::runtime_error(message);
+	}
+	this->pruner = HistoryPruner::open(this->db, this->postings);
+	if (this->pruner){
+		this->pruner->update_horizon(this->blockchain);
+		this->prune_thread = std::thread([this](){ this->run_pruner(); });
+		this->request_pruning();
+	}
 }
 
-std::vector<u64> Indexer::read_txs(u64 address){
-	this->read_txs_stmt << Reset() << address;
-	std::vector<u64> ret;
-	ret.reserve(1024);
-	while (this->read_txs_stmt.step() == SQLITE_ROW){
-		u64 txid;
-		this->read_txs_stmt >> txid;
-		ret.push_back(txid);
+Indexer::~Indexer(){
+	if (!this->prune_thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(this->prune_mutex);
+		this->stopping = true;
 	}
-	std::sort(ret.begin(), ret.end());
-	return ret;
+	this->prune_signal.notify_one();
+	this->prune_thread.join();
+}
+
+std::vector<u64> Indexer::read_outputs(u64 address_id){
+	return this->postings.read(address_id, PostingKind::Outputs);
 }
 
 nlohmann::json Indexer::read_utxo(u64 id){
@@ -124,64 +178,76 @@ boost::optional<u64> map_address(Statement &stmt, const T &x){
 	return ret;
 }
 
-template <typename T>
-std::map<std::string, u64> map_addresses(Statement &stmt, const T &xs){
+static std::vector<std::string> parse_addresses(const nlohmann::json &json){
+	return json.get<std::vector<std::string>>();
+}
+
+std::map<std::string, u64> Indexer::map_addresses(Statement &get_address_id, const std::vector<std::string> &addresses){
+	IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::AddressResolution);
 	std::map<std::string, u64> ret;
-	for (auto &x : xs){
-		auto s = x.template get<std::string>();
-		auto id = map_address(stmt, s);
-		if (!id)
+	auto &filter = this->is.get_address_filter();
+	//Looking the addresses up in order walks the index on addresses
+	//sequentially instead of jumping around it.
+	std::vector<const std::string *> sorted;
+	sorted.reserve(addresses.size());
+	for (auto &s : addresses)
+		sorted.push_back(&s);
+	std::sort(sorted.begin(), sorted.end(), [](auto a, auto b){ return *a < *b; });
+	sorted.erase(std::unique(sorted.begin(), sorted.end(), [](auto a, auto b){ return *a == *b; }), sorted.end());
+	for (auto p : sorted){
+		auto &s = *p;
+		this->address_lookups++;
+		if (!filter.may_contain(s)){
+			this->address_lookups_filtered++;
 			continue;
+		}
+		auto id = map_address(get_address_id, no_copy(s));
+		if (!id){
+			this->address_false_positives++;
+			continue;
+		}
 		ret[s] = *id;
 	}
 	return ret;
 }
 
+std::string Indexer::get_tx_hash_string(u64 tx_id){
+	this->get_tx_hash << Reset() << tx_id;
+	if (this->get_tx_hash.step() != SQLITE_ROW){
+		//The DB is probably corrupted if we reach here.
+		assert(false);
+		return {};
+	}
+	std::string hash;
+	this->get_tx_hash >> hash;
+	return hash;
+}
+
 std::set<Indexer::Utxo> Indexer::get_utxo_internal_single_address(u64 id){
 	std::set<Utxo> set;
 	this->enumerate_utxo_internal_single_address(id, [&set](const Utxo &utxo){ set.insert(utxo); });
 	return set;
 }
 
-std::map<std::string, std::set<Indexer::Utxo>> Indexer::get_utxo_internal(const char *addresses_string){
-	auto addresses = map_addresses(this->get_address_id_stmt, nlohmann::json::parse(addresses_string));
-
-	std::map<std::string, std::set<u64>> outputs_by_address;
-	for (auto &address : addresses)
-		outputs_by_address[address.first] = this->read_outputs(address.second);
-	
+std::map<std::string, std::set<Indexer::Utxo>> Indexer::get_utxo_internal(const std::vector<std::string> &addresses){
 	std::map<std::string, std::set<Utxo>> ret;
-	for (auto &kv : outputs_by_address){
-		std::set<Utxo> set;
-		for (auto outputs_id : kv.second){
-			this->read_utxo_stmt << Reset() << outputs_id;
-			if (this->read_utxo_stmt.step() != SQLITE_ROW)
-				continue;
-			Utxo utxo;
-			this->read_utxo_stmt >> utxo.tx_id >> utxo.output_index >> utxo.value >> utxo.required_spenders;
-			set.insert(utxo);
-		}
-		ret[kv.first] = std::move(set);
-	}
+	for (auto &address : this->map_addresses(this->get_address_id_stmt, addresses))
+		ret[address.first] = this->get_utxo_internal_single_address(address.second);
 	return ret;
 }
 
-const char *Indexer::get_utxo(const char *addresses){
-	LOCK_READER;
-	auto utxos_by_address = this->get_utxo_internal(addresses);
+std::string Indexer::get_utxo(const char *addresses){
+	TIMED_LOCK(LOCK_READER, IndexerCall::GetUtxo);
+	auto utxos_by_address = this->get_utxo_internal(parse_addresses(nlohmann::json::parse(addresses)));
 	
+	IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::Serialization);
 	nlohmann::json ret = nlohmann::json::object_t();
 	for (auto &kv : utxos_by_address){
 		auto addr = nlohmann::json::array();
 		for (auto &utxo : kv.second){
-			this->get_tx_hash << Reset() << utxo.tx_id;
-			if (this->get_tx_hash.step() != SQLITE_ROW){
-				//The DB is probably corrupted if we reach here.
-				assert(false);
+			auto hash = this->get_tx_hash_string(utxo.tx_id);
+			if (!hash.size())
 				continue;
-			}
-			std::string hash;
-			this->get_tx_hash >> hash;
 			nlohmann::json utxo_json;
 			utxo_json["value"] = std::to_string(utxo.value);
 			utxo_json["txid"] = hash;
@@ -191,26 +257,52 @@ const char *Indexer::get_utxo(const char *addresses){
 		}
 		ret[kv.first] = std::move(addr);
 	}
-	return this->return_string(ret.dump());
+	return ret.dump();
 }
 
-const char *Indexer::get_utxo_insight(const char *addresses){
-	LOCK_READER;
+std::string Indexer::get_utxo_binary(const void *request, size_t size){
+	SerializedBuffer buffer(request, size);
+	auto addresses = read_binary_addresses(buffer, this->testnet);
+	TIMED_LOCK(LOCK_READER, IndexerCall::GetUtxoBinary);
 	auto utxos_by_address = this->get_utxo_internal(addresses);
+
+	IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::Serialization);
+	BinaryWriter ret;
+	ret.write_varint(utxos_by_address.size());
+	for (auto &kv : utxos_by_address){
+		std::vector<std::pair<std::string, const Utxo *>> utxos;
+		utxos.reserve(kv.second.size());
+		for (auto &utxo : kv.second){
+			auto hash = this->get_tx_hash_string(utxo.tx_id);
+			if (hash.size())
+				utxos.emplace_back(std::move(hash), &utxo);
+		}
+		ret.write_address(kv.first, this->testnet);
+		ret.write_varint(utxos.size());
+		for (auto &utxo : utxos){
+			ret
+				.write_hash(utxo.first)
+				.write_u32(utxo.second->output_index)
+				.write_u64(utxo.second->value)
+				.write_u32(utxo.second->required_spenders);
+		}
+	}
+	return ret.release();
+}
+
+std::string Indexer::get_utxo_insight(const char *addresses){
+	TIMED_LOCK(LOCK_READER, IndexerCall::GetUtxoInsight);
+	auto utxos_by_address = this->get_utxo_internal(parse_addresses(nlohmann::json::parse(addresses)));
 	
+	IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::Serialization);
 	auto ret = nlohmann::json::array();
 	for (auto &kv : utxos_by_address){
 		for (auto &utxo : kv.second){
 			if (utxo.required_spenders > 1)
 				continue;
-			this->get_tx_hash << Reset() << utxo.tx_id;
-			if (this->get_tx_hash.step() != SQLITE_ROW){
-				//The DB is probably corrupted if we reach here.
-				assert(false);
+			auto hash = this->get_tx_hash_string(utxo.tx_id);
+			if (!hash.size())
 				continue;
-			}
-			std::string hash;
-			this->get_tx_hash >> hash;
 			nlohmann::json utxo_json;
 			utxo_json["address"] = kv.first;
 			utxo_json["satoshis"] = std::to_string(utxo.value);
@@ -219,7 +311,7 @@ const char *Indexer::get_utxo_insight(const char *addresses){
 			ret.emplace_back(std::move(utxo_json));
 		}
 	}
-	return this->return_string(ret.dump());
+	return ret.dump();
 }
 
 u64 Indexer::get_balance(u64 id){
@@ -236,25 +328,45 @@ u64 Indexer::get_balance(u64 id){
 	return ret;
 }
 
-const char *Indexer::get_balance(const char *addresses){
-	LOCK_READER;
-	auto mapped = map_addresses(this->get_address_id_stmt, nlohmann::json::parse(addresses));
+std::map<std::string, u64> Indexer::get_balances_internal(const std::vector<std::string> &addresses){
+	auto ret = this->map_addresses(this->get_address_id_stmt, addresses);
+	for (auto &kv : ret)
+		kv.second = this->get_balance(kv.second);
+	return ret;
+}
+
+std::string Indexer::get_balance(const char *addresses){
+	TIMED_LOCK(LOCK_READER, IndexerCall::GetBalance);
 	u64 sum = 0;
-	for (auto &kv : mapped)
-		sum += this->get_balance(kv.second);
+	for (auto &kv : this->get_balances_internal(parse_addresses(nlohmann::json::parse(addresses))))
+		sum += kv.second;
 	std::string ret(1, '"');
 	ret += std::to_string(sum);
 	ret += '\"';
-	return this->return_string(std::move(ret));
+	return ret;
 }
 
-const char *Indexer::get_balances(const char *addresses){
-	LOCK_READER;
-	auto mapped = map_addresses(this->get_address_id_stmt, nlohmann::json::parse(addresses));
+std::string Indexer::get_balances(const char *addresses){
+	TIMED_LOCK(LOCK_READER, IndexerCall::GetBalances);
+	auto balances = this->get_balances_internal(parse_addresses(nlohmann::json::parse(addresses)));
+	IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::Serialization);
 	nlohmann::json ret = nlohmann::json::object_t();
-	for (auto &kv : mapped)
-		ret[kv.first] = std::to_string(this->get_balance(kv.second));
-	return this->return_string(ret.dump());
+	for (auto &kv : balances)
+		ret[kv.first] = std::to_string(kv.second);
+	return ret.dump();
+}
+
+std::string Indexer::get_balances_binary(const void *request, size_t size){
+	SerializedBuffer buffer(request, size);
+	auto addresses = read_binary_addresses(buffer, this->testnet);
+	TIMED_LOCK(LOCK_READER, IndexerCall::GetBalancesBinary);
+	auto balances = this->get_balances_internal(addresses);
+	IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::Serialization);
+	BinaryWriter ret;
+	ret.write_varint(balances.size());
+	for (auto &kv : balances)
+		ret.write_address(kv.first, this->testnet).write_u64(kv.second);
+	return ret.release();
 }
 
 template <typename T>
@@ -264,67 +376,297 @@ void check_limit(double &l, T c){
 		throw std::runtime_error("Request exceeds memory limit.");
 }
 
-const char *Indexer::get_history(const char *params_string){
-	LOCK_READER;
-	auto params = nlohmann::json::parse(params_string);
-	auto addresses = map_addresses(this->get_address_id_stmt, params["addresses"]);
-	auto max_txs = params["max_txs"].get<u64>();
+std::vector<TxRecord> Indexer::get_history_internal(StatementCache &statements, const std::vector<std::string> &addresses, u64 max_txs, bool &truncated){
+	//The tx lists of all addresses are merged from the highest id down,
+	//keeping the max_txs newest txs seen so far. Block timestamps aren't
+	//monotonic, but once no block at or before the current tx is newer than
+	//the oldest tx kept, nothing further down can make it into the result, so
+	//the rest of the lists is never read.
+	//In a pruned DB the merge stops at the horizon.
+	u64 history_begin = this->pruner ? this->pruner->get_history_begin() : 0;
+	bool pruned = false;
+	PostingLists::Reader postings(statements);
+	std::vector<PostingLists::Cursor> cursors;
+	auto get_address_id = statements << get_address_id_sql;
+	for (auto &kv : this->map_addresses(*get_address_id, addresses)){
+		if (this->pruner){
+			auto summary = postings.summarize(kv.second, PostingKind::Txs);
+			if (summary && summary->first < history_begin)
+				pruned = true;
+		}
+		cursors.emplace_back(postings, kv.second, PostingKind::Txs);
+		if (!cursors.back().valid())
+			cursors.pop_back();
+	}
+	auto cursor_cmp = [](const PostingLists::Cursor *a, const PostingLists::Cursor *b){ return a->get() < b->get(); };
+	std::vector<PostingLists::Cursor *> heap;
+	for (auto &cursor : cursors)
+		heap.push_back(&cursor);
+	std::make_heap(heap.begin(), heap.end(), cursor_cmp);
 
-	std::vector<u64> txs;
-	for (auto &kv : addresses)
-		txs = set_union(txs, this->read_txs(kv.second));
-	
-	std::vector<std::pair<u64, TransactionOrder>> txs_timestamps;
-	txs_timestamps.reserve(txs.size());
-	for (auto id : txs)
-		txs_timestamps.emplace_back(id, this->timestamp_index.get_timestamp(id));
+	typedef std::pair<u64, TransactionOrder> tx_t;
+	//Ties are broken by id so that the result doesn't depend on the order in
+	//which txs are found.
+	auto newer = [](const tx_t &a, const tx_t &b){
+		if (b.second < a.second)
+			return true;
+		if (a.second < b.second)
+			return false;
+		return b.first < a.first;
+	};
+	//Min-heap on the order, so the oldest tx kept is at the front.
+	std::vector<tx_t> txs_timestamps;
+	while (max_txs && heap.size()){
+		auto id = heap.front()->get();
+		if (id < history_begin)
+			break;
+		if (txs_timestamps.size() == max_txs){
+			IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::TimestampLookups);
+			if (this->timestamp_index.get_max_timestamp(id) < txs_timestamps.front().second.block_timestamp)
+				break;
+		}
+		while (heap.size() && heap.front()->get() == id){
+			std::pop_heap(heap.begin(), heap.end(), cursor_cmp);
+			auto cursor = heap.back();
+			heap.pop_back();
+			cursor->seek(id - 1);
+			if (cursor->valid() && cursor->get() < id){
+				heap.push_back(cursor);
+				std::push_heap(heap.begin(), heap.end(), cursor_cmp);
+			}
+		}
+		tx_t tx;
+		{
+			IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::TimestampLookups);
+			tx = tx_t(id, this->timestamp_index.get_timestamp(id));
+		}
+		if (txs_timestamps.size() < max_txs){
+			txs_timestamps.push_back(tx);
+			std::push_heap(txs_timestamps.begin(), txs_timestamps.end(), newer);
+		}else if (newer(tx, txs_timestamps.front())){
+			std::pop_heap(txs_timestamps.begin(), txs_timestamps.end(), newer);
+			txs_timestamps.back() = tx;
+			std::push_heap(txs_timestamps.begin(), txs_timestamps.end(), newer);
+		}
+	}
 
-	std::sort(txs_timestamps.begin(), txs_timestamps.end(), [](auto &a, auto &b){ return b.second < a.second; });
+	truncated = pruned && max_txs;
+	if (truncated && txs_timestamps.size() == max_txs && history_begin > 1){
+		IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::TimestampLookups);
+		truncated = this->timestamp_index.get_max_timestamp(history_begin - 1) >= txs_timestamps.front().second.block_timestamp;
+	}
 
-	if (txs_timestamps.size() > max_txs)
-		txs_timestamps.resize((size_t)max_txs);
+	std::sort(txs_timestamps.begin(), txs_timestamps.end(), newer);
 
 	double memory_limit = 1024 * 1024 * 1024; // 1 GiB
-	auto ret = nlohmann::json::array();
+	std::vector<TxRecord> ret;
+	ret.reserve(txs_timestamps.size());
 	for (auto &tx : txs_timestamps){
 		check_limit(memory_limit, (9 + 8 * 2) + 8);
-		auto json_tx = this->tx_fetcher.get_tx(tx.first, memory_limit);
-		json_tx["timestamp"] = tx.second.block_timestamp;
-		ret.emplace_back(std::move(json_tx));
+		auto record = this->tx_fetcher.get_tx(statements, tx.first, memory_limit);
+		if (!record)
+			continue;
+		record->timestamp = tx.second.block_timestamp;
+		ret.emplace_back(std::move(*record));
 	}
+	return ret;
+}
 
-	return this->return_string(ret.dump());
+//Height of the first block whose txs have a complete history.
+u64 Indexer::get_history_begin_height(StatementCache &statements){
+	auto history_begin = this->pruner->get_history_begin();
+	if (history_begin == 1)
+		return 0;
+	return this->get_tx_height(statements, history_begin);
 }
 
-u64 Indexer::get_blockchain_height() const{
-	LOCK_READER;
-	return this->blockchain.get_height();
+//The result is an array of txs. In a pruned DB it's an object instead:
+//{"txs": [...], "truncated": bool, "history_begin_height": n}, where truncated
+//tells whether older txs than history_begin_height could have been part of
+//the result if they hadn't been pruned.
+std::string Indexer::get_history(const char *params_string){
+	TIMED_LOCK(LOCK_SHARED_READER, IndexerCall::GetHistory);
+	auto connection = this->readers.get(ConnectionRole::ReadOnly);
+	auto params = nlohmann::json::parse(params_string);
+	bool truncated;
+	auto history = this->get_history_internal(connection.statements(), parse_addresses(params["addresses"]), params["max_txs"].get<u64>(), truncated);
+	IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::Serialization);
+	auto txs = nlohmann::json::array();
+	for (auto &tx : history)
+		txs.emplace_back(tx.to_json());
+	if (!this->pruner)
+		return txs.dump();
+	nlohmann::json ret;
+	ret["txs"] = std::move(txs);
+	ret["truncated"] = truncated;
+	ret["history_begin_height"] = this->get_history_begin_height(connection.statements());
+	return ret.dump();
 }
 
-u64 Indexer::get_outputs_total_for_block(u64 block_id){
-	u64 ret;
-	this->get_outputs_total_for_block_stmt << Reset() << block_id << Step() >> ret;
-	return ret;
+std::string Indexer::get_history_binary(const void *request, size_t size){
+	SerializedBuffer buffer(request, size);
+	auto max_txs = buffer.read_u64();
+	auto addresses = read_binary_addresses(buffer, this->testnet);
+	TIMED_LOCK(LOCK_SHARED_READER, IndexerCall::GetHistoryBinary);
+	auto connection = this->readers.get(ConnectionRole::ReadOnly);
+	bool truncated;
+	auto history = this->get_history_internal(connection.statements(), addresses, max_txs, truncated);
+	IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::Serialization);
+	BinaryWriter ret;
+	ret.write_varint(history.size());
+	for (auto &tx : history)
+		tx.write(ret, this->testnet);
+	if (this->pruner)
+		ret.write_u8(truncated).write_u64(this->get_history_begin_height(connection.statements()));
+	return ret.release();
 }
 
-u64 Indexer::get_inputs_total_for_block(u64 block_id){
-	u64 ret;
-	this->get_inputs_total_for_block_stmt << Reset() << block_id << Step() >> ret;
+u64 Indexer::get_tx_height(StatementCache &statements, u64 tx_id){
+	//hash points into whichever statement found it, so both are kept until
+	//the end.
+	BlobView hash;
+	auto get_tx_block_hash = statements << "select blocks.hash from txs inner join blocks on blocks.id = txs.blocks_id where txs.id = ?;";
+	auto get_pruned_tx_block_hash = statements << "select hash from blocks where first_transaction_id <= ? order by first_transaction_id desc limit 1;";
+	get_tx_block_hash << tx_id;
+	if (get_tx_block_hash.step() == SQLITE_ROW)
+		get_tx_block_hash >> hash;
+	else{
+		//The tx was pruned. Its block is the last one that starts before it.
+		get_pruned_tx_block_hash << tx_id << Step() >> hash;
+	}
+	auto block = this->blockchain.get_block_by_hash(Hashes::Digests::SHA256((const char *)hash.data, hash.size));
+	if (!block)
+		throw std::runtime_error("Internal error (implementation bug?): TX " + std::to_string(tx_id) + " belongs to a block that is not part of the blockchain.");
+	return block->height;
+}
+
+//Returns an element for each address, in the same order, which is none if the
+//address has never been used.
+std::vector<boost::optional<Indexer::AddressUsage>> Indexer::get_address_usage_internal(StatementCache &statements, const std::vector<std::string> &addresses){
+	std::map<std::string, u64> ids;
+	{
+		auto get_address_id = statements << get_address_id_sql;
+		ids = this->map_addresses(*get_address_id, addresses);
+	}
+	PostingLists::Reader postings(statements);
+	std::vector<boost::optional<AddressUsage>> ret;
+	ret.reserve(addresses.size());
+	for (auto &address : addresses){
+		ret.emplace_back();
+		auto it = ids.find(address);
+		if (it == ids.end())
+			continue;
+		auto summary = postings.summarize(it->second, PostingKind::Txs);
+		if (!summary)
+			continue;
+		AddressUsage usage;
+		usage.tx_count = summary->count;
+		usage.first_seen_height = this->get_tx_height(statements, summary->first);
+		usage.last_seen_height = this->get_tx_height(statements, summary->last);
+		ret.back() = usage;
+	}
 	return ret;
 }
 
-void Indexer::set_fee_for_block(u64 block_id, u64 tx_size){
-	//Yes, we do need to go to the DB to get the total fees. No, we can't just use the information
-	//we parsed from the block.
-	auto total_fees = this->get_inputs_total_for_block(block_id) - this->get_outputs_total_for_block(block_id);
-	auto average = (total_fees && tx_size) ? (total_fees / tx_size) : 0;
-	this->set_fee_for_block_stmt << Reset() << block_id << average << Step();
+//The result is an array with an element for each requested address: null if
+//the address has never been used, otherwise
+//[tx_count, first_seen_height, last_seen_height].
+std::string Indexer::get_address_usage(const char *addresses){
+	TIMED_LOCK(LOCK_SHARED_READER, IndexerCall::GetAddressUsage);
+	auto connection = this->readers.get(ConnectionRole::ReadOnly);
+	auto usage = this->get_address_usage_internal(connection.statements(), parse_addresses(nlohmann::json::parse(addresses)));
+	IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::Serialization);
+	auto ret = nlohmann::json::array();
+	for (auto &u : usage){
+		if (u)
+			ret.push_back({ u->tx_count, u->first_seen_height, u->last_seen_height });
+		else
+			ret.push_back(nullptr);
+	}
+	return ret.dump();
+}
+
+std::string Indexer::get_address_usage_binary(const void *request, size_t size){
+	SerializedBuffer buffer(request, size);
+	auto addresses = read_binary_addresses(buffer, this->testnet);
+	TIMED_LOCK(LOCK_SHARED_READER, IndexerCall::GetAddressUsageBinary);
+	auto connection = this->readers.get(ConnectionRole::ReadOnly);
+	auto usage = this->get_address_usage_internal(connection.statements(), addresses);
+	IndexerStats::PhaseTimer timer(this->stats, IndexerPhase::Serialization);
+	BinaryWriter ret;
+	ret.write_varint(usage.size());
+	for (auto &u : usage){
+		ret.write_u8(!!u);
+		if (u)
+			ret.write_u64(u->tx_count).write_u64(u->first_seen_height).write_u64(u->last_seen_height);
+	}
+	return ret.release();
+}
+
+//The result is an array with an element for each requested txid: the tx as it
+//is in the block files, in hex, or null if it can't be read from them (see
+//RawTxReader.h).
+std::string Indexer::get_raw_transactions(const char *txids_string){
+	std::vector<SHA256> txids;
+	for (auto &txid : nlohmann::json::parse(txids_string))
+		txids.emplace_back(txid.get<std::string>());
+	TIMED_LOCK(LOCK_READER, IndexerCall::GetRawTransactions);
+	auto ret = nlohmann::json::array();
+	std::string hex;
+	for (auto &txid : txids){
+		auto tx = this->raw_tx_reader.get(txid);
+		if (tx.empty()){
+			ret.push_back(nullptr);
+			continue;
+		}
+		hex.clear();
+		hex.reserve(tx.size() * 2);
+		for (u8 c : tx){
+			hex.push_back(hex_digits[c >> 4]);
+			hex.push_back(hex_digits[c & 0x0F]);
+		}
+		ret.push_back(hex);
+	}
+	return ret.dump();
+}
+
+std::string Indexer::get_raw_transactions_binary(const void *request, size_t size){
+	SerializedBuffer buffer(request, size);
+	std::vector<SHA256> txids(buffer.read_varint());
+	for (auto &txid : txids)
+		txid = buffer.read_sha256();
+	TIMED_LOCK(LOCK_READER, IndexerCall::GetRawTransactionsBinary);
+	BinaryWriter ret;
+	ret.write_varint(txids.size());
+	for (auto &txid : txids){
+		//Each view is only valid until the next lookup, so it's copied right
+		//away.
+		auto tx = this->raw_tx_reader.get(txid);
+		ret.write_u8(!tx.empty());
+		if (!tx.empty())
+			ret.write_varint(tx.size()).write_bytes(tx.data(), tx.size());
+	}
+	return ret.release();
+}
+
+u64 Indexer::get_blockchain_height() const{
+	LOCK_SHARED_READER;
+	return this->blockchain.get_height();
 }
 
-Indexer::NewBlock Indexer::insert_new_block(Block &block, const std::vector<ChainReorganizationBlock> &blocks_to_revert, std::set<u64> &updated_balances){
+Indexer::NewBlock Indexer::insert_new_block(Block &block, const std::vector<ChainReorganizationBlock> &blocks_to_revert, std::set<u64> &updated_balances, bool &balance_cache_valid){
+	if (this->pruner && blocks_to_revert.size()){
+		//Blocks are reverted from the last one back to the first.
+		u64 first_transaction_id, transaction_count;
+		this->get_block_transactions << Reset() << blocks_to_revert.front().db_id << Step() >> first_transaction_id >> transaction_count;
+		if (first_transaction_id < this->pruner->get_history_begin())
+			throw std::runtime_error("Can't revert the chain to height " + std::to_string(blocks_to_revert.front().height) + ": the history of the blocks there has been pruned.");
+	}
 	sqlite3pp::Transaction transaction(this->db);
+	balance_cache_valid = true;
 	for (size_t i = blocks_to_revert.size(); i--;){
-		this->revert_block(blocks_to_revert[i].db_id);
+		if (!this->revert_block(blocks_to_revert[i].db_id))
+			balance_cache_valid = false;
 		auto result = this->blockchain.revert_block(blocks_to_revert[i].hash);
 		switch (result){
 			case RevertBlockResult::Success:
@@ -336,54 +678,216 @@ Indexer::NewBlock Indexer::insert_new_block(Block &block, const std::vector<Chai
 		}
 	}
 	NewBlock ret;
-	ret.block_id = block.insert(this->is, updated_balances);
-	this->set_fee_for_block(ret.block_id, block.get_average_transaction_size());
+	BlockUndo undo;
+	this->get_max_input_id << Reset() << Step() >> undo.inputs_begin;
+	this->get_max_output_id << Reset() << Step() >> undo.outputs_begin;
+	BlockInsertInfo info;
+	ret.block_id = block.insert(this->is, updated_balances, &info);
+	this->fee_estimator.add_block(ret.block_id, info.fee_rates);
 	this->get_block_transactions_and_timestamp << Reset() << ret.block_id << Step()
 		>> ret.first_transaction_id
 		>> ret.transaction_count
 		>> ret.timestamp;
+
+	undo.txs_begin = ret.first_transaction_id;
+	undo.txs_end = ret.first_transaction_id + ret.transaction_count;
+	undo.inputs_begin++;
+	this->get_max_input_id << Reset() << Step() >> undo.inputs_end;
+	undo.inputs_end++;
+	undo.outputs_begin++;
+	this->get_max_output_id << Reset() << Step() >> undo.outputs_end;
+	undo.outputs_end++;
+	undo.set_changes(info);
+	this->undo_log.add_block(ret.block_id, undo);
+
+	//The new block will be at height get_height() + 1.
+	auto new_height = this->blockchain.get_height() + 1;
+	if (new_height >= UndoLog::max_depth){
+		auto old_block = this->blockchain.get_block_by_height(new_height - UndoLog::max_depth);
+		if (old_block)
+			this->undo_log.delete_block(old_block->db_id);
+	}
 	return ret;
 }
 
-const char *Indexer::push_new_block(const void *data, size_t size){
-	SerializedBuffer buffer(data, size);
-	Block block(buffer, this->testnet, BlockFromRpc());
-	LOCK_WRITER;
+nlohmann::json Indexer::add_block(Block &block, std::set<u64> &updated_balances, bool &balance_cache_valid){
 	auto reorg = this->blockchain.try_add_new_block(block.get_previous_hash());
 	nlohmann::json ret = nlohmann::json::object_t();
 	if (reorg.block_required.has_value()){
 		ret["block_required"] = (std::string)*reorg.block_required;
-	}else{
-		std::set<u64> updated_balances;
-		auto new_block = this->insert_new_block(block, reorg.blocks_to_revert, updated_balances);
-		auto new_height = this->blockchain.add_new_block(block.get_hash(), block.get_previous_hash(), new_block.block_id);
-		if (reorg.blocks_to_revert.size()){
-			this->db.exec("delete from cached_balances;");
-			this->timestamp_index.reload_data(this->db);
-		}else{
-			this->timestamp_index.add_block(new_block.first_transaction_id, new_block.transaction_count, new_block.timestamp);
-			for (auto id : updated_balances)
-				this->invalidate_balance_cache(id);
+		return ret;
+	}
+	bool valid;
+	auto new_block = this->insert_new_block(block, reorg.blocks_to_revert, updated_balances, valid);
+	if (!valid)
+		balance_cache_valid = false;
+	auto new_height = this->blockchain.add_new_block(block.get_hash(), block.get_previous_hash(), new_block.block_id);
+	this->timestamp_index.add_block(new_block.first_transaction_id, new_block.transaction_count, new_block.timestamp);
+	if (this->pruner)
+		this->pruner->update_horizon(this->blockchain);
+
+	if (reorg.blocks_to_revert.size())
+		ret["blocks_reverted"] = reorg.blocks_to_revert.size();
+	ret["db_id"] = new_block.block_id;
+	ret["new_height"] = new_height;
+	return ret;
+}
+
+//Brings everything kept in memory back in line with the DB after a rollback.
+void Indexer::reload_state(){
+	this->is.reload();
+	this->blockchain.reload();
+	this->timestamp_index.reload_data(this->db);
+	this->fee_estimator.reload_data(this->blockchain);
+	if (this->pruner)
+		this->pruner->reload();
+}
+
+void Indexer::invalidate_balance_caches(std::set<u64> &updated_balances, bool &balance_cache_valid){
+	if (!balance_cache_valid)
+		this->db.exec("delete from cached_balances;");
+	else{
+		for (auto id : updated_balances)
+			this->invalidate_balance_cache(id);
+	}
+	updated_balances.clear();
+	balance_cache_valid = true;
+}
+
+std::string Indexer::push_new_block(const void *data, size_t size){
+	SerializedBuffer buffer(data, size);
+	Block block(buffer, this->testnet, BlockFromRpc());
+	TIMED_LOCK(LOCK_WRITER, IndexerCall::PushNewBlock);
+	std::set<u64> updated_balances;
+	bool balance_cache_valid = true;
+	nlohmann::json ret;
+	try{
+		ret = this->add_block(block, updated_balances, balance_cache_valid);
+	}catch (...){
+		//If insert_new_block() failed, its transaction is still open.
+		this->db.rollback();
+		this->reload_state();
+		throw;
+	}
+	this->invalidate_balance_caches(updated_balances, balance_cache_valid);
+	this->request_pruning();
+	return ret.dump();
+}
+
+std::string Indexer::push_new_blocks(const void *const *data, const size_t *sizes, size_t count){
+	//Same as blockchain_parser.
+	const size_t max_blocks_per_transaction = 100;
+
+	std::vector<std::unique_ptr<Block>> blocks(count);
+	std::vector<std::string> errors(count);
+	{
+		auto thread_count = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1U), count);
+		std::vector<std::thread> threads;
+		threads.reserve(thread_count);
+		for (size_t i = 0; i < thread_count; i++){
+			threads.emplace_back([&, i](){
+				for (auto j = i; j < count; j += thread_count){
+					try{
+						SerializedBuffer buffer(data[j], sizes[j]);
+						blocks[j].reset(new Block(buffer, this->testnet, BlockFromRpc()));
+					}catch (std::exception &e){
+						errors[j] = e.what();
+					}
+				}
+			});
 		}
+		for (auto &t : threads)
+			t.join();
+	}
 
-		if (reorg.blocks_to_revert.size())
-			ret["blocks_reverted"] = reorg.blocks_to_revert.size();
-		ret["db_id"] = new_block.block_id;
-		ret["new_height"] = new_height;
+	TIMED_LOCK(LOCK_WRITER, IndexerCall::PushNewBlocks);
+	//Processing stops at the first block that can't be added, since every
+	//block after it would fail as well. The result is an array with one
+	//element for each block that was processed.
+	auto ret = nlohmann::json::array();
+	//Number of elements of ret whose blocks have been committed.
+	size_t committed = 0;
+	std::set<u64> updated_balances;
+	bool balance_cache_valid = true;
+	sqlite3pp::Transaction transaction(this->db);
+	this->blockchain.begin_deferred_update();
+	try{
+		size_t blocks_in_transaction = 0;
+		for (size_t i = 0; i < count; i++){
+			if (!blocks[i]){
+				nlohmann::json error = nlohmann::json::object_t();
+				error["error"] = errors[i];
+				ret.push_back(std::move(error));
+				break;
+			}
+			auto result = this->add_block(*blocks[i], updated_balances, balance_cache_valid);
+			blocks[i].reset();
+			bool stop = result.find("block_required") != result.end();
+			ret.push_back(std::move(result));
+			if (stop)
+				break;
+			if (++blocks_in_transaction == max_blocks_per_transaction){
+				this->blockchain.end_deferred_update();
+				this->invalidate_balance_caches(updated_balances, balance_cache_valid);
+				transaction.commit();
+				committed = ret.size();
+				this->blockchain.begin_deferred_update();
+				blocks_in_transaction = 0;
+			}
+		}
+		this->blockchain.end_deferred_update();
+		this->invalidate_balance_caches(updated_balances, balance_cache_valid);
+	}catch (std::exception &e){
+		//The blocks added since the last commit are undone along with the one
+		//that failed, so the error takes the place of the first of them.
+		transaction.rollback();
+		this->reload_state();
+		ret.erase(ret.begin() + committed, ret.end());
+		nlohmann::json error = nlohmann::json::object_t();
+		error["error"] = e.what();
+		ret.push_back(std::move(error));
 	}
-	this->low_fee.reset();
-	this->normal_fee.reset();
-	this->high_fee.reset();
-	return this->return_string(ret.dump());
+	this->request_pruning();
+	return ret.dump();
 }
 
-void Indexer::revert_block(u64 block_id){
+bool Indexer::revert_block(u64 block_id){
 	u64 first_transaction_id, transaction_count;
 	this->get_block_transactions << Reset() << block_id << Step() >> first_transaction_id >> transaction_count;
+	this->timestamp_index.revert_block(first_transaction_id);
+	this->fee_estimator.revert_block(block_id);
+
+	auto undo = this->undo_log.get_block(block_id);
+	if (!undo){
+		this->revert_block_without_undo(block_id, first_transaction_id, transaction_count);
+		return false;
+	}
+
+	this->revert_postings(undo->txs_begin, undo->outputs_begin, &undo->spent_outputs);
+	this->delete_outputs_relations_range << Reset() << undo->outputs_begin << undo->outputs_end << Step();
+	this->delete_outputs_range << Reset() << undo->outputs_begin << undo->outputs_end << Step();
+	this->delete_inputs_range << Reset() << undo->inputs_begin << undo->inputs_end << Step();
+	this->delete_txs_range << Reset() << undo->txs_begin << undo->txs_end << Step();
+	this->delete_tx_locations_range << Reset() << undo->txs_begin << undo->txs_end << Step();
+	for (auto id : undo->spent_outputs)
+		if (id < undo->outputs_begin)
+			this->unspend(id);
+	for (auto &kv : undo->balance_deltas)
+		this->adjust_cached_balance_stmt << Reset() << -kv.second << kv.first << Step();
+	this->delete_block << Reset() << block_id << Step();
+	this->undo_log.delete_block(block_id);
+	return true;
+}
+
+void Indexer::revert_block_without_undo(u64 block_id, u64 first_transaction_id, u64 transaction_count){
+	boost::optional<u64> first_output;
+	this->get_first_output_from_tx << Reset() << first_transaction_id << Step() >> first_output;
+	this->revert_postings(first_transaction_id, first_output, nullptr);
 	std::vector<u64> ids;
 	for (auto txid = first_transaction_id + transaction_count; txid-- > first_transaction_id;)
 		this->revert_tx(txid, ids);
 	this->delete_txs_from_block << Reset() << block_id << Step();
+	this->delete_tx_locations_range << Reset() << first_transaction_id << first_transaction_id + transaction_count << Step();
 	this->delete_block << Reset() << block_id << Step();
 }
 
@@ -394,16 +898,85 @@ void Indexer::revert_tx(u64 txid, std::vector<u64> &ids){
 
 	get_id_list(ids, this->get_spent_outputs_from_tx, txid);
 	this->delete_inputs_from_tx << Reset() << txid << Step();
-	use_id_list(this->unspend_output, ids);
+	for (auto id : ids)
+		this->unspend(id);
+}
+
+//The block being reverted is the newest one, so its outputs and txs are at
+//the end of every posting list they appear in. A tx is in the lists of the
+//addresses of its outputs and of the outputs it spends. The latter come from
+//the undo record if there is one (spent_outputs), or from the inputs. Either
+//way this must be done before the block's rows are deleted.
+void Indexer::revert_postings(u64 first_tx, const boost::optional<u64> &first_output, const std::vector<u64> *spent_outputs){
+	std::vector<u64> addresses;
+	std::set<u64> tx_addresses;
+	if (first_output){
+		get_id_list(addresses, this->get_addresses_from_output, *first_output);
+		for (auto address : addresses)
+			this->postings.truncate(address, PostingKind::Outputs, *first_output);
+		tx_addresses.insert(addresses.begin(), addresses.end());
+	}
+	if (spent_outputs){
+		for (auto output : *spent_outputs){
+			get_id_list(addresses, this->get_addresses_from_spent_output, output);
+			tx_addresses.insert(addresses.begin(), addresses.end());
+		}
+	}else{
+		get_id_list(addresses, this->get_addresses_from_inputs, first_tx);
+		tx_addresses.insert(addresses.begin(), addresses.end());
+	}
+	for (auto address : tx_addresses)
+		this->postings.truncate(address, PostingKind::Txs, first_tx);
+}
+
+void Indexer::unspend(u64 output_id){
+	this->unspend_output << Reset() << output_id << Step();
+	if (this->column_store)
+		this->column_store->set_spent_by(output_id, {});
+}
+
+void Indexer::request_pruning(){
+	if (!this->pruner)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(this->prune_mutex);
+		this->prune_requested = true;
+	}
+	this->prune_signal.notify_one();
+}
 
-	this->delete_tx_relations << Reset() << txid << Step();
+//Runs on prune_thread. The lock is taken for one batch at a time, so calls
+//into the index wait for at most a batch.
+void Indexer::run_pruner(){
+	while (true){
+		{
+			std::unique_lock<std::mutex> lock(this->prune_mutex);
+			this->prune_signal.wait(lock, [this](){ return this->prune_requested || this->stopping; });
+			if (this->stopping)
+				return;
+			this->prune_requested = false;
+		}
+		try{
+			while (this->prune_batch()){
+				std::lock_guard<std::mutex> lock(this->prune_mutex);
+				if (this->stopping)
+					return;
+			}
+		}catch (std::exception &e){
+			std::cerr << "Pruning failed: " << e.what() << std::endl;
+		}
+	}
 }
 
-const char *Indexer::return_string(std::string &&s){
-	LOCK_WRITER;
-	auto tid = std::this_thread::get_id();
-	auto &s2 = this->returned_strings[tid] = std::move(s);
-	return s2.c_str();
+bool Indexer::prune_batch(){
+	TIMED_LOCK(LOCK_WRITER, IndexerCall::PruneBatch);
+	sqlite3pp::Transaction transaction(this->db);
+	try{
+		return this->pruner->prune_batch(prune_batch_txs);
+	}catch (...){
+		transaction.rollback();
+		throw;
+	}
 }
 
 boost::optional<u64> Indexer::get_cached_balance(u64 id){
@@ -423,80 +996,135 @@ void Indexer::invalidate_balance_cache(u64 id){
 	this->delete_cached_balance_stmt << Reset() << id << Step();
 }
 
-const char *Indexer::get_fees(){
-	LOCK_READER;
+std::string Indexer::get_fees(){
+	TIMED_LOCK(LOCK_READER, IndexerCall::GetFees);
 	nlohmann::json ret;
-	if (!this->low_fee.has_value()){
-		u64 first = 0;
-		auto height = this->blockchain.get_height();
-		if (height > 50)
-			first = height - 50;
-		
-		u64 sum = 0;
-		u64 count = 0;
-		for (u64 i = first; i <= height; i++){
-			auto block = this->blockchain.get_block_by_height(i);
-			if (!block)
-				continue;
-			auto id = block->db_id;
-			auto fee = this->get_average_fee_for_block(id);
-			if (!fee)
-				continue;
-			sum += *fee;
-			count++;
-		}
+	auto estimate = this->fee_estimator.get_estimate();
+	ret["low"] = std::to_string(estimate.low);
+	ret["normal"] = std::to_string(estimate.normal);
+	ret["high"] = std::to_string(estimate.high);
+	return ret.dump();
+}
 
-		u64 normal = count ? sum / count : 0;
-		this->low_fee = normal * 8 / 10;
-		this->normal_fee = normal;
-		this->high_fee = normal * 12 / 10;
-	}
-	ret["low"] = std::to_string(*this->low_fee);
-	ret["normal"] = std::to_string(*this->normal_fee);
-	ret["high"] = std::to_string(*this->high_fee);
-	return this->return_string(ret.dump());
+std::string Indexer::get_address_filter_stats(){
+	LOCK_READER;
+	auto &filter = this->is.get_address_filter();
+	nlohmann::json ret;
+	ret["addresses"] = filter.size();
+	ret["memory_size"] = filter.memory_size();
+	ret["expected_false_positive_rate"] = filter.false_positive_rate();
+	ret["lookups"] = this->address_lookups.load();
+	ret["lookups_filtered"] = this->address_lookups_filtered.load();
+	ret["false_positives"] = this->address_false_positives.load();
+	return ret.dump();
 }
 
-boost::optional<u64> Indexer::get_average_fee_for_block(u64 block_id){
-	auto &stmt = this->get_average_fee_for_block_stmt;
-	stmt << Reset() << block_id;
-	if (stmt.step() != SQLITE_ROW)
-		return {};
-	u64 ret;
-	stmt >> ret;
-	return ret;
+std::string Indexer::get_stats(const char *format){
+	LOCK_READER;
+	std::string f = format ? format : "json";
+	if (f == "json")
+		return this->stats.to_json();
+	if (f == "prometheus")
+		return this->stats.to_prometheus();
+	throw std::runtime_error("Unknown stats format: " + f);
 }
 
-TxFetcher::TxFetcher(DB &db, Blockchain &blockchain)
-	: db(db)
-	, blockchain(blockchain)
-	, get_tx_by_id(db << "select txs.hash, txs.whash, txs.locktime, blocks.hash, txs.index_in_block, txs.input_count, txs.output_count from txs inner join blocks on blocks.id = txs.blocks_id where txs.id = ?;")
-	, get_inputs_by_tx(db << "select inputs.outputs_id, inputs.txi_index, outputs.value from inputs inner join outputs on outputs.id = inputs.outputs_id where inputs.txs_id = ?;")
-	, get_outputs_by_tx(db << "select id, txo_index, value, required_spenders, spent_by from outputs where txs_id = ?;")
-	, get_addresses_by_output(db << "select addresses.address from addresses inner join addresses_outputs on addresses_outputs.addresses_id = addresses.id where addresses_outputs.outputs_id = ?;")
+TxFetcher::TxFetcher(const Blockchain &blockchain, const ColumnStore *column_store)
+	: blockchain(blockchain)
+	, column_store(column_store)
 {}
 
-nlohmann::json TxFetcher::get_tx(u64 id, double &memory_limit){
-	auto &stmt = this->get_tx_by_id;
-	stmt << Reset() << id;
+nlohmann::json TxRecord::to_json() const{
 	nlohmann::json ret;
+	ret["hash"] = this->hash;
+	ret["whash"] = this->whash;
+	ret["locktime"] = this->locktime;
+	ret["block_hash"] = this->block_hash;
+	ret["block_height"] = this->block_height;
+	ret["block_index"] = this->block_index;
+	ret["timestamp"] = this->timestamp;
+
+	auto inputs = nlohmann::json::array();
+	for (auto &input : this->inputs){
+		nlohmann::json json;
+		json["txi_index"] = input.txi_index;
+		json["value"] = std::to_string(input.value);
+		json["addresses"] = input.addresses;
+		inputs.emplace_back(std::move(json));
+	}
+	ret["inputs"] = std::move(inputs);
+
+	auto outputs = nlohmann::json::array();
+	for (auto &output : this->outputs){
+		nlohmann::json json;
+		json["txo_index"] = output.txo_index;
+		json["value"] = std::to_string(output.value);
+		json["required_spenders"] = output.required_spenders;
+		if (output.spent_by.has_value())
+			json["spent_by"] = std::to_string(*output.spent_by);
+		else
+			json["spent_by"] = {};
+		json["addresses"] = output.addresses;
+		outputs.emplace_back(std::move(json));
+	}
+	ret["outputs"] = std::move(outputs);
+	return ret;
+}
+
+void TxRecord::write(BinaryWriter &dst, bool testnet) const{
+	dst.write_hash(this->hash);
+	dst.write_u8(!!this->whash.size());
+	if (this->whash.size())
+		dst.write_hash(this->whash);
+	dst
+		.write_u32(this->locktime)
+		.write_hash(this->block_hash)
+		.write_u64(this->block_height)
+		.write_u32(this->block_index)
+		.write_u64(this->timestamp);
+
+	dst.write_varint(this->inputs.size());
+	for (auto &input : this->inputs){
+		dst
+			.write_u32(input.txi_index)
+			.write_u64(input.value)
+			.write_addresses(input.addresses, testnet);
+	}
+
+	dst.write_varint(this->outputs.size());
+	for (auto &output : this->outputs){
+		dst
+			.write_u32(output.txo_index)
+			.write_u64(output.value)
+			.write_u32(output.required_spenders)
+			.write_u8(output.spent_by.has_value());
+		if (output.spent_by.has_value())
+			dst.write_u64(*output.spent_by);
+		dst.write_addresses(output.addresses, testnet);
+	}
+}
+
+boost::optional<TxRecord> TxFetcher::get_tx(StatementCache &statements, u64 id, double &memory_limit) const{
+	auto stmt = statements << "select txs.hash, txs.whash, txs.locktime, blocks.hash, txs.index_in_block, txs.input_count, txs.output_count from txs inner join blocks on blocks.id = txs.blocks_id where txs.id = ?;";
+	stmt << id;
 	if (stmt.step() != SQLITE_ROW)
-		return ret;
+		return {};
 
-	std::string hash, whash;
-	u32 locktime;
-	std::string block_hash;
-	u32 block_index;
+	TxRecord ret;
+	boost::string_view hash, whash, block_hash;
 	size_t input_count;
 	size_t output_count;
-	stmt >> hash >> whash >> locktime >> block_hash >> block_index >> input_count >> output_count;
+	stmt >> hash >> whash >> ret.locktime >> block_hash >> ret.block_index >> input_count >> output_count;
+	ret.hash.assign(hash.data(), hash.size());
+	ret.whash.assign(whash.data(), whash.size());
+	ret.block_hash.assign(block_hash.data(), block_hash.size());
 
-	auto block = this->blockchain.get_block_by_hash(block_hash);
+	auto block = this->blockchain.get_block_by_hash(Hashes::Digests::SHA256(block_hash.data(), block_hash.size()));
 	if (!block){
 		std::stringstream stream;
 		stream
-			<< "Internal error (implementation bug?): TX " << hash << " (ID " << id
-			<< ") reports that it belongs to block " << block_hash
+			<< "Internal error (implementation bug?): TX " << ret.hash << " (ID " << id
+			<< ") reports that it belongs to block " << ret.block_hash
 			<< ", but this block is not part of the blockchain.";
 		throw std::runtime_error(stream.str());
 	}
@@ -509,119 +1137,100 @@ nlohmann::json TxFetcher::get_tx(u64 id, double &memory_limit){
 		((12 + 8 * 2) + 8) +
 		((11 + 8 * 2) + 4)
 	);
-	ret["hash"] = hash;
-	ret["whash"] = whash;
-	ret["locktime"] = locktime;
-	ret["block_hash"] = block_hash;
-	ret["block_height"] =  block->height;
-	ret["block_index"] = block_index;
+	ret.block_height = block->height;
 
 	check_limit(memory_limit, 6 + 8 * 2);
-	ret["inputs"] = this->get_inputs(id, memory_limit);
+	ret.inputs = this->get_inputs(statements, id, memory_limit, input_count);
 	check_limit(memory_limit, 7 + 8 * 2);
-	ret["outputs"] = this->get_outputs(id, memory_limit);
+	ret.outputs = this->get_outputs(statements, id, memory_limit, output_count);
 
 	return ret;
 }
 
-nlohmann::json TxFetcher::get_inputs(u64 txid, double &memory_limit, size_t reserve){
-	struct Input{
-		u64 output_id;
-		u32 txi_index;
-		u64 value;
-		std::vector<std::string> addresses;
-		nlohmann::json to_json(double &memory_limit) const{
-			check_limit(memory_limit,
-				((9 + 8 * 2) + 4) +
-				((5 + 8 * 2) + (19 + 8 * 2)) +
-				((9 + 8 * 2) + this->addresses.size() * (64 + 8 * 2))
-			);
-
-			nlohmann::json ret;
-			ret["txi_index"] = this->txi_index;
-			ret["value"] = std::to_string(this->value);
-			ret["addresses"] = this->addresses;
-			return ret;
-		}
-	};
-
-	std::vector<Input> inputs;
+std::vector<TxInputRecord> TxFetcher::get_inputs(StatementCache &statements, u64 txid, double &memory_limit, size_t reserve) const{
+	std::vector<std::pair<u64, TxInputRecord>> inputs;
 	inputs.reserve(reserve);
 	{
-		auto &stmt = this->get_inputs_by_tx;
-		stmt << Reset() << txid;
+		auto stmt = statements << (this->column_store
+			? "select outputs_id, txi_index from inputs where txs_id = ? and outputs_id is not null;"
+			: "select inputs.outputs_id, inputs.txi_index, outputs.value from inputs inner join outputs on outputs.id = inputs.outputs_id where inputs.txs_id = ?;");
+		stmt << txid;
 		while (stmt.step() == SQLITE_ROW){
-			Input input;
-			stmt >> input.output_id >> input.txi_index >> input.value;
-			inputs.push_back(input);
+			std::pair<u64, TxInputRecord> input;
+			stmt >> input.first >> input.second.txi_index;
+			if (this->column_store)
+				input.second.value = this->column_store->get_output_value(input.first);
+			else
+				stmt >> input.second.value;
+			inputs.emplace_back(std::move(input));
 		}
 	}
-	auto ret = nlohmann::json::array();
+	std::vector<TxInputRecord> ret;
+	ret.reserve(inputs.size());
 	for (auto &input : inputs){
-		input.addresses = this->get_addresses_for_output(input.output_id);
-		ret.emplace_back(input.to_json(memory_limit));
+		input.second.addresses = this->get_addresses_for_output(statements, input.first);
+		check_limit(memory_limit,
+			((9 + 8 * 2) + 4) +
+			((5 + 8 * 2) + (19 + 8 * 2)) +
+			((9 + 8 * 2) + input.second.addresses.size() * (64 + 8 * 2))
+		);
+		ret.emplace_back(std::move(input.second));
 	}
 	return ret;
 }
 
-nlohmann::json TxFetcher::get_outputs(u64 txid, double &memory_limit, size_t reserve){
-	struct Output{
-		u64 id;
-		u32 txo_index;
-		u64 value;
-		u32 required_spenders;
-		boost::optional<u64> spent_by;
-		std::vector<std::string> addresses;
-		nlohmann::json to_json(double &memory_limit) const{
-			check_limit(memory_limit,
-				(( 9 + 8 * 2) + 4) +
-				(( 5 + 8 * 2) + (19 + 8 * 2)) +
-				((17 + 8 * 2) + 4) +
-				(( 8 + 8 * 2) + (19 + 8 * 2)) +
-				(( 9 + 8 * 2) + this->addresses.size() * (64 + 8 * 2))
-			);
-
-			nlohmann::json ret;
-			ret["txo_index"] = this->txo_index;
-			ret["value"] = std::to_string(this->value);
-			ret["required_spenders"] = this->required_spenders;
-			if (this->spent_by.has_value())
-				ret["spent_by"] = std::to_string(*this->spent_by);
-			else
-				ret["spent_by"] = {};
-			ret["addresses"] = this->addresses;
-			return ret;
-		}
-	};
-
-	std::vector<Output> outputs;
+std::vector<TxOutputRecord> TxFetcher::get_outputs(StatementCache &statements, u64 txid, double &memory_limit, size_t reserve) const{
+	std::vector<std::pair<u64, TxOutputRecord>> outputs;
 	outputs.reserve(reserve);
-	{
-		auto &stmt = this->get_outputs_by_tx;
-		stmt << Reset() << txid;
+	if (this->column_store){
+		auto first = this->column_store->get_first_output(txid);
+		auto count = this->column_store->get_output_count(txid);
+		for (u64 id = first; id < first + count; id++){
+			auto columns = this->column_store->get_output(id);
+			std::pair<u64, TxOutputRecord> output;
+			auto &record = output.second;
+			output.first = id;
+			record.txo_index = columns.txo_index;
+			record.value = columns.value;
+			record.required_spenders = columns.required_spenders;
+			record.spent_by = columns.spent_by;
+			outputs.emplace_back(std::move(output));
+		}
+	}else{
+		auto stmt = statements << "select id, txo_index, value, required_spenders, spent_by from outputs where txs_id = ?;";
+		stmt << txid;
 		while (stmt.step() == SQLITE_ROW){
-			Output output;
-			stmt >> output.id >> output.txo_index >> output.value >> output.required_spenders >> output.spent_by;
-			outputs.push_back(output);
+			std::pair<u64, TxOutputRecord> output;
+			auto &record = output.second;
+			stmt >> output.first >> record.txo_index >> record.value >> record.required_spenders >> record.spent_by;
+			outputs.emplace_back(std::move(output));
 		}
 	}
-	auto ret = nlohmann::json::array();
+	std::vector<TxOutputRecord> ret;
+	ret.reserve(outputs.size());
 	for (auto &output : outputs){
-		output.addresses = this->get_addresses_for_output(output.id);
-		ret.emplace_back(output.to_json(memory_limit));
+		output.second.addresses = this->get_addresses_for_output(statements, output.first);
+		check_limit(memory_limit,
+			(( 9 + 8 * 2) + 4) +
+			(( 5 + 8 * 2) + (19 + 8 * 2)) +
+			((17 + 8 * 2) + 4) +
+			(( 8 + 8 * 2) + (19 + 8 * 2)) +
+			(( 9 + 8 * 2) + output.second.addresses.size() * (64 + 8 * 2))
+		);
+		ret.emplace_back(std::move(output.second));
 	}
 	return ret;
 }
 
-std::vector<std::string> TxFetcher::get_addresses_for_output(u64 output_id){
+std::vector<std::string> TxFetcher::get_addresses_for_output(StatementCache &statements, u64 output_id) const{
 	std::vector<std::string> ret;
-	auto &stmt = this->get_addresses_by_output;
-	stmt << Reset() << output_id;
+	auto stmt = statements << "select addresses.address from addresses inner join addresses_outputs on addresses_outputs.addresses_id = addresses.id where addresses_outputs.outputs_id = ?;";
+	stmt << output_id;
 	ret.reserve(32);
 	while (stmt.step() == SQLITE_ROW){
-		std::string address;
+		boost::string_view address;
 		stmt >> address;
-		ret.emplace_back(std::move(address));
+		ret.emplace_back(address.data(), address.size());
 	}
 	return ret;
 }
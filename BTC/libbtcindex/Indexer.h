@@ -1,34 +1,72 @@
 #pragma once
 
 #include "TimestampIndex.h"
+#include "FeeEstimator.h"
+#include "BlockUndo.h"
+#include "BinaryProtocol.h"
+#include "IndexerStats.h"
+#include "RawTxReader.h"
 #include <libbtcparser/Block.h>
 #include <libbtcparser/Blockchain.h>
+#include <libbtcparser/ColumnStore.h>
+#include <libbtcparser/HistoryPruner.h>
 #include <sqlitepp/sqlitepp.h>
+#include <boost/thread/shared_mutex.hpp>
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
-#include <thread>
 #include <set>
+#include <thread>
 #include <nlohmann/json.hpp>
 
+struct TxInputRecord{
+	u32 txi_index;
+	u64 value;
+	std::vector<std::string> addresses;
+};
+
+struct TxOutputRecord{
+	u32 txo_index;
+	u64 value;
+	u32 required_spenders;
+	boost::optional<u64> spent_by;
+	std::vector<std::string> addresses;
+};
+
+struct TxRecord{
+	std::string hash;
+	std::string whash;
+	u32 locktime;
+	std::string block_hash;
+	u64 block_height;
+	u32 block_index;
+	u64 timestamp = 0;
+	std::vector<TxInputRecord> inputs;
+	std::vector<TxOutputRecord> outputs;
+
+	nlohmann::json to_json() const;
+	void write(BinaryWriter &, bool testnet) const;
+};
+
+//Reads txs through the statement cache of whatever connection the caller has
+//borrowed, so any number of threads can use it at once as long as each one
+//has a connection of its own and the blockchain isn't being changed.
 class TxFetcher{
-	using DB = sqlite3pp::DB;
-	using Statement = sqlite3pp::Statement;
-	DB &db;
-	Blockchain &blockchain;
-	Statement get_tx_by_id;
-	Statement get_inputs_by_tx;
-	Statement get_outputs_by_tx;
-	Statement get_addresses_by_output;
-	nlohmann::json get_inputs(u64 txid, double &memory_limit, size_t reserve = 0);
-	nlohmann::json get_outputs(u64 txid, double &memory_limit, size_t reserve = 0);
-	std::vector<std::string> get_addresses_for_output(u64 output_id);
+	using StatementCache = sqlite3pp::StatementCache;
+	const Blockchain &blockchain;
+	const ColumnStore *column_store;
+	std::vector<TxInputRecord> get_inputs(StatementCache &, u64 txid, double &memory_limit, size_t reserve = 0) const;
+	std::vector<TxOutputRecord> get_outputs(StatementCache &, u64 txid, double &memory_limit, size_t reserve = 0) const;
+	std::vector<std::string> get_addresses_for_output(StatementCache &, u64 output_id) const;
 public:
-	TxFetcher(DB &, Blockchain &);
+	//column_store may be null.
+	TxFetcher(const Blockchain &, const ColumnStore *column_store = nullptr);
 	TxFetcher(const TxFetcher &) = delete;
 	TxFetcher(TxFetcher &&) = delete;
 	const TxFetcher &operator=(const TxFetcher &) = delete;
 	const TxFetcher &operator=(TxFetcher &&) = delete;
 
-	nlohmann::json get_tx(u64 id, double &memory_limit);
+	boost::optional<TxRecord> get_tx(StatementCache &, u64 id, double &memory_limit) const;
 };
 
 class Indexer{
@@ -37,10 +75,14 @@ class Indexer{
 	bool testnet;
 	std::string db_path;
 	DB db;
+	IndexerStats stats;
+	//Read-only connections for the calls that don't use db (see
+	//LOCK_SHARED_READER in Indexer.cpp).
+	sqlite3pp::ConnectionPool readers;
+	std::unique_ptr<ColumnStore> column_store;
 	InsertState is;
+	PostingLists postings;
 	Statement get_address_id_stmt;
-	Statement read_outputs_stmt;
-	Statement read_txs_stmt;
 	Statement read_utxo_stmt;
 	Statement get_tx_hash;
 	Statement read_utxo_value_stmt;
@@ -52,23 +94,43 @@ class Indexer{
 	Statement get_spent_outputs_from_tx;
 	Statement delete_inputs_from_tx;
 	Statement unspend_output;
-	Statement delete_tx_relations;
 	Statement delete_txs_from_block;
 	Statement delete_block;
 	Statement get_cached_balance_stmt;
 	Statement set_cached_balance_stmt;
 	Statement delete_cached_balance_stmt;
-	Statement get_outputs_total_for_block_stmt;
-	Statement get_inputs_total_for_block_stmt;
-	Statement set_fee_for_block_stmt;
-	Statement get_average_fee_for_block_stmt;
-	std::map<std::thread::id, std::string> returned_strings;
+	Statement adjust_cached_balance_stmt;
+	Statement get_max_input_id;
+	Statement get_max_output_id;
+	Statement delete_outputs_relations_range;
+	Statement delete_outputs_range;
+	Statement delete_inputs_range;
+	Statement delete_txs_range;
+	Statement delete_tx_locations_range;
+	Statement get_addresses_from_output;
+	Statement get_addresses_from_spent_output;
+	Statement get_addresses_from_inputs;
+	Statement get_first_output_from_tx;
 	TimestampIndex timestamp_index;
 	Blockchain blockchain;
 	TxFetcher tx_fetcher;
-	mutable std::recursive_mutex mutex;
-
-	boost::optional<u64> low_fee, normal_fee, high_fee;
+	FeeEstimator fee_estimator;
+	UndoLog undo_log;
+	RawTxReader raw_tx_reader;
+	mutable boost::shared_mutex mutex;
+	//Address lookups, lookups answered by the address filter alone, and
+	//lookups the filter passed that found nothing.
+	std::atomic<u64> address_lookups{0};
+	std::atomic<u64> address_lookups_filtered{0};
+	std::atomic<u64> address_false_positives{0};
+	//Null unless the DB uses the pruned profile. Its batches are run by
+	//prune_thread, which waits on prune_signal for new blocks.
+	std::unique_ptr<HistoryPruner> pruner;
+	std::thread prune_thread;
+	std::mutex prune_mutex;
+	std::condition_variable prune_signal;
+	bool prune_requested = false;
+	bool stopping = false;
 
 	using SHA256 = Hashes::Digests::SHA256;
 
@@ -100,18 +162,51 @@ class Indexer{
 		}
 	};
 
-	std::set<u64> read_outputs(u64 address_id);
-	std::vector<u64> read_txs(u64 address);
+	struct AddressUsage{
+		u64 tx_count;
+		u64 first_seen_height;
+		u64 last_seen_height;
+	};
+
+	std::vector<u64> read_outputs(u64 address_id);
 	nlohmann::json read_utxo(u64 id);
-	NewBlock insert_new_block(Block &block, const std::vector<ChainReorganizationBlock> &, std::set<u64> &updated_balances);
-	const char *return_string(std::string &&);
-	void revert_block(u64 id);
+	NewBlock insert_new_block(Block &block, const std::vector<ChainReorganizationBlock> &, std::set<u64> &updated_balances, bool &balance_cache_valid);
+	nlohmann::json add_block(Block &block, std::set<u64> &updated_balances, bool &balance_cache_valid);
+	void invalidate_balance_caches(std::set<u64> &updated_balances, bool &balance_cache_valid);
+	void reload_state();
+	bool revert_block(u64 id);
+	void revert_block_without_undo(u64 id, u64 first_transaction_id, u64 transaction_count);
 	void revert_tx(u64 id, std::vector<u64> &ids);
-	std::map<std::string, std::set<Utxo>> get_utxo_internal(const char *addresses_string);
+	void unspend(u64 output_id);
+	void revert_postings(u64 first_tx, const boost::optional<u64> &first_output, const std::vector<u64> *spent_outputs);
+	//get_address_id is a statement made from get_address_id_sql, on db or on a
+	//reader.
+	std::map<std::string, u64> map_addresses(Statement &get_address_id, const std::vector<std::string> &addresses);
+	std::string get_tx_hash_string(u64 tx_id);
+	std::map<std::string, std::set<Utxo>> get_utxo_internal(const std::vector<std::string> &addresses);
+	std::map<std::string, u64> get_balances_internal(const std::vector<std::string> &addresses);
+	//truncated is set if the history of any of the addresses goes back past
+	//what a pruned DB keeps, and txs from there could have been in the result.
+	std::vector<TxRecord> get_history_internal(sqlite3pp::StatementCache &, const std::vector<std::string> &addresses, u64 max_txs, bool &truncated);
+	u64 get_history_begin_height(sqlite3pp::StatementCache &);
+	u64 get_tx_height(sqlite3pp::StatementCache &, u64 tx_id);
+	std::vector<boost::optional<AddressUsage>> get_address_usage_internal(sqlite3pp::StatementCache &, const std::vector<std::string> &addresses);
 	template <typename F>
 	void enumerate_utxo_internal_single_address(u64 id, const F &f){
 		auto outputs = this->read_outputs(id);
 		for (auto outputs_id : outputs){
+			if (this->column_store){
+				auto columns = this->column_store->get_output(outputs_id);
+				if (columns.spent_by)
+					continue;
+				Utxo utxo;
+				utxo.tx_id = columns.txs_id;
+				utxo.output_index = columns.txo_index;
+				utxo.value = columns.value;
+				utxo.required_spenders = columns.required_spenders;
+				f(std::move(utxo));
+				continue;
+			}
 			this->read_utxo_stmt << sqlite3pp::Reset() << outputs_id;
 			if (this->read_utxo_stmt.step() != SQLITE_ROW)
 				continue;
@@ -125,18 +220,29 @@ class Indexer{
 	boost::optional<u64> get_cached_balance(u64 id);
 	void set_cached_balance(u64 id, u64 balance);
 	void invalidate_balance_cache(u64 id);
-	u64 get_outputs_total_for_block(u64 block_id);
-	u64 get_inputs_total_for_block(u64 block_id);
-	void set_fee_for_block(u64 block_id, u64 tx_size);
-	boost::optional<u64> get_average_fee_for_block(u64 block_id);
+	void request_pruning();
+	void run_pruner();
+	bool prune_batch();
 public:
 	Indexer(const char *db_path, bool testnet);
-	const char *get_utxo(const char *addresses);
-	const char *get_utxo_insight(const char *addresses);
-	const char *get_balance(const char *addresses);
-	const char *get_balances(const char *addresses);
-	const char *get_history(const char *addresses);
-	const char *get_fees();
+	~Indexer();
+	std::string get_utxo(const char *addresses);
+	std::string get_utxo_insight(const char *addresses);
+	std::string get_balance(const char *addresses);
+	std::string get_balances(const char *addresses);
+	std::string get_history(const char *addresses);
+	std::string get_utxo_binary(const void *request, size_t size);
+	std::string get_balances_binary(const void *request, size_t size);
+	std::string get_history_binary(const void *request, size_t size);
+	std::string get_address_usage(const char *addresses);
+	std::string get_address_usage_binary(const void *request, size_t size);
+	std::string get_raw_transactions(const char *txids);
+	std::string get_raw_transactions_binary(const void *request, size_t size);
+	std::string get_fees();
+	std::string get_address_filter_stats();
+	//format is "json" or "prometheus".
+	std::string get_stats(const char *format);
 	u64 get_blockchain_height() const;
-	const char *push_new_block(const void *data, size_t size);
+	std::string push_new_block(const void *data, size_t size);
+	std::string push_new_blocks(const void *const *data, const size_t *sizes, size_t count);
 };
@@ -0,0 +1,311 @@
+#include "IndexerStats.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <exception>
+#include <sstream>
+#include <vector>
+
+const char *to_string(IndexerCall call){
+	switch (call){
+		case IndexerCall::GetUtxo:
+			return "get_utxo";
+		case IndexerCall::GetUtxoInsight:
+			return "get_utxo_insight";
+		case IndexerCall::GetBalance:
+			return "get_balance";
+		case IndexerCall::GetBalances:
+			return "get_balances";
+		case IndexerCall::GetHistory:
+			return "get_history";
+		case IndexerCall::GetUtxoBinary:
+			return "get_utxo_bin";
+		case IndexerCall::GetBalancesBinary:
+			return "get_balances_bin";
+		case IndexerCall::GetHistoryBinary:
+			return "get_history_bin";
+		case IndexerCall::GetAddressUsage:
+			return "get_address_usage";
+		case IndexerCall::GetAddressUsageBinary:
+			return "get_address_usage_bin";
+		case IndexerCall::GetRawTransactions:
+			return "get_raw_transactions";
+		case IndexerCall::GetRawTransactionsBinary:
+			return "get_raw_transactions_bin";
+		case IndexerCall::GetFees:
+			return "get_fees";
+		case IndexerCall::PushNewBlock:
+			return "push_new_block";
+		case IndexerCall::PushNewBlocks:
+			return "push_new_blocks";
+		case IndexerCall::PruneBatch:
+			return "prune_batch";
+		default:
+			return "?";
+	}
+}
+
+const char *to_string(IndexerPhase phase){
+	switch (phase){
+		case IndexerPhase::AddressResolution:
+			return "address_resolution";
+		case IndexerPhase::TimestampLookups:
+			return "timestamp_lookups";
+		case IndexerPhase::Serialization:
+			return "serialization";
+		case IndexerPhase::Sqlite:
+			return "sqlite";
+		default:
+			return "?";
+	}
+}
+
+//The call in progress on each thread. stats tells which IndexerStats it
+//belongs to.
+static thread_local struct{
+	const IndexerStats *stats;
+	CallStats *call;
+} current_call = { nullptr, nullptr };
+
+static u64 nanoseconds_since(IndexerStats::Clock::time_point start){
+	return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(IndexerStats::Clock::now() - start).count();
+}
+
+void StatementRow::add_status(sqlite3_stmt *stmt){
+	this->runs += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_RUN, false);
+	this->vm_steps += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, false);
+	this->fullscan_steps += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, false);
+	this->sorts += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, false);
+	this->autoindexes += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, false);
+}
+
+IndexerStats::IndexerStats(sqlite3pp::DB &db)
+		: db(db)
+		, start_time(Clock::now()){
+	this->db.set_step_observer(this);
+}
+
+IndexerStats::~IndexerStats(){
+	this->db.set_step_observer(nullptr);
+}
+
+CallStats *IndexerStats::get_current() const{
+	return current_call.stats == this ? current_call.call : nullptr;
+}
+
+void IndexerStats::add_phase_time(IndexerPhase phase, u64 nanoseconds){
+	auto current = this->get_current();
+	if (current)
+		current->phase_time[(size_t)phase] += nanoseconds;
+}
+
+void IndexerStats::after_step(sqlite3_stmt *stmt, std::uint64_t nanoseconds){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto &stats = this->statements[stmt];
+	stats.steps++;
+	stats.time += nanoseconds;
+	this->add_phase_time(IndexerPhase::Sqlite, nanoseconds);
+}
+
+void IndexerStats::before_finalize(sqlite3_stmt *stmt){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto it = this->statements.find(stmt);
+	if (it == this->statements.end())
+		return;
+	std::string sql = sqlite3_sql(stmt);
+	auto &row = this->finalized_statements[sql];
+	row.sql = sql;
+	row.stats.steps += it->second.steps;
+	row.stats.time += it->second.time;
+	row.add_status(stmt);
+	this->statements.erase(it);
+}
+
+IndexerStats::CallScope::CallScope(IndexerStats &stats, IndexerCall call, Clock::time_point start)
+		: stats(stats)
+		, call(stats.calls[(size_t)call])
+		, start(start){
+	auto wait = nanoseconds_since(start);
+	{
+		std::lock_guard<std::mutex> lock(this->stats.mutex);
+		this->call.lock_wait.record(wait);
+	}
+	current_call = { &this->stats, &this->call };
+}
+
+IndexerStats::CallScope::~CallScope(){
+	auto latency = nanoseconds_since(this->start);
+	current_call = { nullptr, nullptr };
+	std::lock_guard<std::mutex> lock(this->stats.mutex);
+	this->call.calls++;
+	if (std::uncaught_exception())
+		this->call.errors++;
+	this->call.latency.record(latency);
+}
+
+IndexerStats::PhaseTimer::~PhaseTimer(){
+	if (!this->active)
+		return;
+	auto time = nanoseconds_since(this->start);
+	std::lock_guard<std::mutex> lock(this->stats.mutex);
+	this->stats.add_phase_time(this->phase, time);
+}
+
+//Calls f with the stats of each statement that has been run at least once,
+//from the one that has taken the most time to the one that has taken the
+//least.
+template <typename F>
+void IndexerStats::for_each_statement(const F &f) const{
+	auto rows = this->finalized_statements;
+	for (auto &kv : this->statements){
+		std::string sql = sqlite3_sql(kv.first);
+		auto &row = rows[sql];
+		row.sql = sql;
+		row.stats.steps += kv.second.steps;
+		row.stats.time += kv.second.time;
+		row.add_status(kv.first);
+	}
+	std::vector<const StatementRow *> sorted;
+	for (auto &kv : rows)
+		sorted.push_back(&kv.second);
+	std::stable_sort(sorted.begin(), sorted.end(), [](auto a, auto b){ return a->stats.time > b->stats.time; });
+	for (auto row : sorted)
+		f(*row);
+}
+
+//Percentiles are upper bounds of histogram buckets, so they're only accurate
+//to within about 3%.
+std::string IndexerStats::to_json() const{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	nlohmann::json ret;
+	ret["uptime_seconds"] = std::chrono::duration<double>(Clock::now() - this->start_time).count();
+	auto calls = nlohmann::json::object();
+	for (size_t i = 0; i < (size_t)IndexerCall::Count; i++){
+		auto &stats = this->calls[i];
+		if (!stats.calls)
+			continue;
+		nlohmann::json call;
+		call["calls"] = stats.calls;
+		call["errors"] = stats.errors;
+		call["latency"] = stats.latency.to_json();
+		call["lock_wait"] = stats.lock_wait.to_json();
+		nlohmann::json phases;
+		for (size_t j = 0; j < (size_t)IndexerPhase::Count; j++)
+			phases[to_string((IndexerPhase)j)] = stats.phase_time[j] / 1000.0;
+		call["phase_time_us"] = phases;
+		calls[to_string((IndexerCall)i)] = call;
+	}
+	ret["calls"] = calls;
+	auto statements = nlohmann::json::array();
+	this->for_each_statement([&statements](const StatementRow &row){
+		nlohmann::json statement;
+		statement["sql"] = row.sql;
+		statement["steps"] = row.stats.steps;
+		statement["runs"] = row.runs;
+		statement["time_us"] = row.stats.time / 1000.0;
+		statement["vm_steps"] = row.vm_steps;
+		statement["fullscan_steps"] = row.fullscan_steps;
+		statement["sorts"] = row.sorts;
+		statement["autoindexes"] = row.autoindexes;
+		statements.push_back(statement);
+	});
+	ret["statements"] = statements;
+	return ret.dump();
+}
+
+static std::string escape_label(const std::string &s){
+	std::string ret;
+	ret.reserve(s.size());
+	for (auto c : s){
+		switch (c){
+			case '\\':
+				ret += "\\\\";
+				break;
+			case '"':
+				ret += "\\\"";
+				break;
+			case '\n':
+				ret += "\\n";
+				break;
+			default:
+				ret += c;
+		}
+	}
+	return ret;
+}
+
+static void write_metric_header(std::ostream &stream, const char *name, const char *type, const char *help){
+	stream << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+}
+
+//The histograms are exported with power-of-two bounds, from about 1 us to about
+//69 s, at which LatencyHistogram's counts are exact.
+static const int first_bound_bits = 10;
+static const int last_bound_bits = 36;
+
+static void write_histogram(std::ostream &stream, const char *name, const std::string &labels, const LatencyHistogram &h){
+	for (int i = first_bound_bits; i <= last_bound_bits; i++){
+		auto bound = (u64)1 << i;
+		stream << name << "_bucket{" << labels << ",le=\"" << bound / 1e9 << "\"} " << h.count_below(bound) << '\n';
+	}
+	stream << name << "_bucket{" << labels << ",le=\"+Inf\"} " << h.count() << '\n';
+	stream << name << "_sum{" << labels << "} " << h.get_sum() / 1e9 << '\n';
+	stream << name << "_count{" << labels << "} " << h.count() << '\n';
+}
+
+std::string IndexerStats::to_prometheus() const{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	std::ostringstream stream;
+	stream.precision(9);
+
+	write_metric_header(stream, "btcindex_uptime_seconds", "gauge", "Time since the index was opened.");
+	stream << "btcindex_uptime_seconds " << std::chrono::duration<double>(Clock::now() - this->start_time).count() << '\n';
+
+	std::vector<std::pair<std::string, const CallStats *>> calls;
+	for (size_t i = 0; i < (size_t)IndexerCall::Count; i++)
+		if (this->calls[i].calls)
+			calls.emplace_back(std::string("call=\"") + to_string((IndexerCall)i) + "\"", &this->calls[i]);
+
+	write_metric_header(stream, "btcindex_calls_total", "counter", "Calls into the index.");
+	for (auto &call : calls)
+		stream << "btcindex_calls_total{" << call.first << "} " << call.second->calls << '\n';
+	write_metric_header(stream, "btcindex_call_errors_total", "counter", "Calls into the index that failed.");
+	for (auto &call : calls)
+		stream << "btcindex_call_errors_total{" << call.first << "} " << call.second->errors << '\n';
+	write_metric_header(stream, "btcindex_call_duration_seconds", "histogram", "Duration of calls into the index, including the wait for the lock.");
+	for (auto &call : calls)
+		write_histogram(stream, "btcindex_call_duration_seconds", call.first, call.second->latency);
+	write_metric_header(stream, "btcindex_lock_wait_seconds", "histogram", "Time calls into the index spent waiting for the lock.");
+	for (auto &call : calls)
+		write_histogram(stream, "btcindex_lock_wait_seconds", call.first, call.second->lock_wait);
+	write_metric_header(stream, "btcindex_call_phase_seconds_total", "counter", "Time spent in each phase of calls into the index. Phases can overlap.");
+	for (auto &call : calls)
+		for (size_t j = 0; j < (size_t)IndexerPhase::Count; j++)
+			stream << "btcindex_call_phase_seconds_total{" << call.first << ",phase=\"" << to_string((IndexerPhase)j) << "\"} " << call.second->phase_time[j] / 1e9 << '\n';
+
+	std::vector<std::pair<std::string, StatementRow>> statements;
+	this->for_each_statement([&statements](const StatementRow &row){
+		statements.emplace_back("sql=\"" + escape_label(row.sql) + "\"", row);
+	});
+	write_metric_header(stream, "btcindex_statement_steps_total", "counter", "Calls to sqlite3_step() for each SQL statement.");
+	for (auto &s : statements)
+		stream << "btcindex_statement_steps_total{" << s.first << "} " << s.second.stats.steps << '\n';
+	write_metric_header(stream, "btcindex_statement_runs_total", "counter", "Runs of each SQL statement.");
+	for (auto &s : statements)
+		stream << "btcindex_statement_runs_total{" << s.first << "} " << s.second.runs << '\n';
+	write_metric_header(stream, "btcindex_statement_seconds_total", "counter", "Time spent in sqlite3_step() for each SQL statement.");
+	for (auto &s : statements)
+		stream << "btcindex_statement_seconds_total{" << s.first << "} " << s.second.stats.time / 1e9 << '\n';
+	write_metric_header(stream, "btcindex_statement_vm_steps_total", "counter", "Virtual machine steps run by each SQL statement.");
+	for (auto &s : statements)
+		stream << "btcindex_statement_vm_steps_total{" << s.first << "} " << s.second.vm_steps << '\n';
+	write_metric_header(stream, "btcindex_statement_fullscan_steps_total", "counter", "Full table scan steps run by each SQL statement.");
+	for (auto &s : statements)
+		stream << "btcindex_statement_fullscan_steps_total{" << s.first << "} " << s.second.fullscan_steps << '\n';
+	write_metric_header(stream, "btcindex_statement_sorts_total", "counter", "Sorts run by each SQL statement.");
+	for (auto &s : statements)
+		stream << "btcindex_statement_sorts_total{" << s.first << "} " << s.second.sorts << '\n';
+	write_metric_header(stream, "btcindex_statement_autoindexes_total", "counter", "Rows inserted into automatic indices by each SQL statement.");
+	for (auto &s : statements)
+		stream << "btcindex_statement_autoindexes_total{" << s.first << "} " << s.second.autoindexes << '\n';
+	return stream.str();
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+#include <common/types.h>
+#include <sqlitepp/sqlitepp.h>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+enum class IndexerCall{
+	GetUtxo,
+	GetUtxoInsight,
+	GetBalance,
+	GetBalances,
+	GetHistory,
+	GetUtxoBinary,
+	GetBalancesBinary,
+	GetHistoryBinary,
+	GetAddressUsage,
+	GetAddressUsageBinary,
+	GetRawTransactions,
+	GetRawTransactionsBinary,
+	GetFees,
+	PushNewBlock,
+	PushNewBlocks,
+	//A batch of deletions made by the pruner's thread.
+	PruneBatch,
+	Count,
+};
+
+//Parts of a call that are timed separately. They can overlap: Sqlite covers
+//every statement run during the call, including those run while resolving
+//addresses or building the result.
+enum class IndexerPhase{
+	AddressResolution,
+	TimestampLookups,
+	Serialization,
+	Sqlite,
+	Count,
+};
+
+const char *to_string(IndexerCall);
+const char *to_string(IndexerPhase);
+
+struct CallStats{
+	u64 calls = 0;
+	//Calls that threw.
+	u64 errors = 0;
+	//From the time the lock was requested to the end of the call.
+	LatencyHistogram latency;
+	LatencyHistogram lock_wait;
+	u64 phase_time[(size_t)IndexerPhase::Count] = {};
+};
+
+struct StatementStats{
+	u64 steps = 0;
+	u64 time = 0;
+};
+
+//Totals for one SQL text, over every statement prepared with it.
+struct StatementRow{
+	std::string sql;
+	StatementStats stats;
+	u64 runs = 0;
+	u64 vm_steps = 0;
+	u64 fullscan_steps = 0;
+	u64 sorts = 0;
+	u64 autoindexes = 0;
+
+	//Adds the counters sqlite3_stmt_status() keeps for the statement.
+	void add_status(sqlite3_stmt *);
+};
+
+//Counters and timings for the calls into the Indexer and for the SQL
+//statements they run. Calls that share the Indexer's lock update the stats at
+//the same time, so updates take a mutex of their own; the cost of a call is a
+//few clock reads and uncontended locks. The call in progress is tracked per
+//thread.
+//
+//Statement times are measured around each sqlite3_step() made through
+//sqlitepp, since SQLite's own profiling (sqlite3_trace_v2()) only reports a
+//statement when it's reset, and the Indexer leaves statements pending until
+//their next use. Steps are recorded by statement handle; the SQL text is only
+//looked up when the stats are exported, or when a statement is finalized and
+//its totals are moved to finalized_statements. Runs, VM steps, full scan
+//steps, sorts and automatic indices come from sqlite3_stmt_status() at those
+//same two points, so the stats must only be exported while no statement is
+//being stepped. The stats must be the step observer of every connection whose
+//statements are to be counted.
+class IndexerStats : public sqlite3pp::StepObserver{
+public:
+	typedef std::chrono::steady_clock Clock;
+private:
+	sqlite3pp::DB &db;
+	Clock::time_point start_time;
+	mutable std::mutex mutex;
+	CallStats calls[(size_t)IndexerCall::Count];
+	//Statements that are still prepared.
+	std::unordered_map<sqlite3_stmt *, StatementStats> statements;
+	//Keyed by SQL text.
+	std::map<std::string, StatementRow> finalized_statements;
+	//Returns the stats of the call in progress on this thread, if any.
+	CallStats *get_current() const;
+	//Must be called with the mutex held.
+	void add_phase_time(IndexerPhase phase, u64 nanoseconds);
+	template <typename F>
+	void for_each_statement(const F &f) const;
+public:
+	IndexerStats(sqlite3pp::DB &db);
+	~IndexerStats();
+	IndexerStats(const IndexerStats &) = delete;
+	const IndexerStats &operator=(const IndexerStats &) = delete;
+	void after_step(sqlite3_stmt *, std::uint64_t nanoseconds) override;
+	void before_finalize(sqlite3_stmt *) override;
+
+	//Times a call, from start (taken before waiting for the lock) until the
+	//scope is destroyed. Must be constructed right after taking the lock, and
+	//destroyed before releasing it.
+	class CallScope{
+		IndexerStats &stats;
+		CallStats &call;
+		Clock::time_point start;
+	public:
+		CallScope(IndexerStats &stats, IndexerCall call, Clock::time_point start);
+		~CallScope();
+		CallScope(const CallScope &) = delete;
+		const CallScope &operator=(const CallScope &) = delete;
+	};
+
+	//Adds the time until it's destroyed to a phase of the call in progress.
+	//Does nothing outside of a call.
+	class PhaseTimer{
+		IndexerStats &stats;
+		IndexerPhase phase;
+		Clock::time_point start;
+		bool active;
+	public:
+		PhaseTimer(IndexerStats &stats, IndexerPhase phase)
+			: stats(stats)
+			, phase(phase)
+			, active(!!stats.get_current()){
+			if (this->active)
+				this->start = Clock::now();
+		}
+		~PhaseTimer();
+		PhaseTimer(const PhaseTimer &) = delete;
+		const PhaseTimer &operator=(const PhaseTimer &) = delete;
+	};
+
+	std::string to_json() const;
+	//Prometheus text exposition format.
+	std::string to_prometheus() const;
+};
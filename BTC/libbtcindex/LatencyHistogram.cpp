@@ -0,0 +1,88 @@
+#include "LatencyHistogram.h"
+#include <algorithm>
+#include <limits>
+
+const int LatencyHistogram::sub_bucket_bits;
+const u64 LatencyHistogram::sub_bucket_count;
+
+LatencyHistogram::LatencyHistogram()
+	: buckets(bucket_of(std::numeric_limits<u64>::max()) + 1)
+	, total(0)
+	, sum(0)
+	, min(std::numeric_limits<u64>::max())
+	, max(0){}
+
+//Values below sub_bucket_count get a bucket each. Above that, the bucket is
+//given by the position of the highest bit and the sub_bucket_bits below it.
+size_t LatencyHistogram::bucket_of(u64 value){
+	if (value < sub_bucket_count)
+		return (size_t)value;
+	int msb = 0;
+	for (auto x = value; x >>= 1;)
+		msb++;
+	auto shift = msb - sub_bucket_bits;
+	return (size_t)(((u64)(shift + 1) << sub_bucket_bits) + ((value >> shift) & (sub_bucket_count - 1)));
+}
+
+u64 LatencyHistogram::bucket_limit(size_t bucket){
+	if (bucket < sub_bucket_count)
+		return bucket;
+	auto shift = (bucket >> sub_bucket_bits) - 1;
+	auto mantissa = (bucket & (sub_bucket_count - 1)) | sub_bucket_count;
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(u64 nanoseconds){
+	this->buckets[bucket_of(nanoseconds)]++;
+	this->total++;
+	this->sum += nanoseconds;
+	this->min = std::min(this->min, nanoseconds);
+	this->max = std::max(this->max, nanoseconds);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other){
+	for (size_t i = 0; i < this->buckets.size(); i++)
+		this->buckets[i] += other.buckets[i];
+	this->total += other.total;
+	this->sum += other.sum;
+	this->min = std::min(this->min, other.min);
+	this->max = std::max(this->max, other.max);
+}
+
+u64 LatencyHistogram::count_below(u64 limit) const{
+	if (!limit)
+		return 0;
+	u64 ret = 0;
+	auto last = bucket_of(limit - 1);
+	for (size_t i = 0; i <= last; i++)
+		ret += this->buckets[i];
+	return ret;
+}
+
+u64 LatencyHistogram::percentile(double p) const{
+	if (!this->total)
+		return 0;
+	auto rank = std::max<u64>((u64)(p * this->total + 0.5), 1);
+	u64 seen = 0;
+	for (size_t i = 0; i < this->buckets.size(); i++){
+		seen += this->buckets[i];
+		if (seen >= rank)
+			return std::min(bucket_limit(i), this->max);
+	}
+	return this->max;
+}
+
+nlohmann::json LatencyHistogram::to_json() const{
+	nlohmann::json ret;
+	ret["count"] = this->total;
+	if (!this->total)
+		return ret;
+	ret["mean_us"] = (double)this->sum / this->total / 1000;
+	ret["min_us"] = this->min / 1000.0;
+	ret["p50_us"] = this->percentile(0.5) / 1000.0;
+	ret["p90_us"] = this->percentile(0.9) / 1000.0;
+	ret["p99_us"] = this->percentile(0.99) / 1000.0;
+	ret["p999_us"] = this->percentile(0.999) / 1000.0;
+	ret["max_us"] = this->max / 1000.0;
+	return ret;
+}
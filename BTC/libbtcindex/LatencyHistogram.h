@@ -0,0 +1,46 @@
+#pragma once
+
+#include <common/types.h>
+#include <nlohmann/json.hpp>
+#include <vector>
+
+//Log-linear histogram of durations in nanoseconds. Each power of two is split
+//into 2^sub_bucket_bits buckets, so any recorded value is known to within
+//about 3%, whatever its magnitude. Recording is a few arithmetic operations
+//and never allocates. Histograms aren't synchronized; btcindex_loadgen keeps
+//one per thread and merges them at the end, and the index's stats only record
+//while holding the Indexer's lock.
+class LatencyHistogram{
+	static const int sub_bucket_bits = 5;
+	static const u64 sub_bucket_count = 1 << sub_bucket_bits;
+
+	std::vector<u64> buckets;
+	u64 total;
+	u64 sum;
+	u64 min;
+	u64 max;
+
+	static size_t bucket_of(u64 value);
+	//Highest value that falls in the bucket.
+	static u64 bucket_limit(size_t bucket);
+public:
+	LatencyHistogram();
+	void record(u64 nanoseconds);
+	void merge(const LatencyHistogram &);
+	u64 count() const{
+		return this->total;
+	}
+	u64 get_sum() const{
+		return this->sum;
+	}
+	u64 get_max() const{
+		return this->max;
+	}
+	//Number of recorded values below limit. Exact if limit is a power of 2.
+	u64 count_below(u64 limit) const;
+	//Returns the smallest recorded value such that a fraction p of the values
+	//are no greater than it, rounded up to the end of its bucket.
+	u64 percentile(double p) const;
+	//Times are given in microseconds.
+	nlohmann::json to_json() const;
+};
@@ -0,0 +1,70 @@
+#include "RawTxReader.h"
+#include <boost/filesystem/path.hpp>
+#include <boost/interprocess/exceptions.hpp>
+
+using namespace sqlite3pp;
+
+RawTxReader::RawTxReader(DB &db)
+	: db(db)
+	, find_tx(db << "select coalesce(txs.whash, txs.hash), blocks.file_name, tx_locations.file_offset, tx_locations.size_in_file from txs inner join tx_locations on tx_locations.txs_id = txs.id inner join blocks on blocks.id = txs.blocks_id where txs.hash = ?;"){
+	if (db.table_exists("block_files")){
+		auto stmt = db << "select path from block_files;";
+		if (stmt.step() == SQLITE_ROW)
+			stmt >> this->path;
+	}
+}
+
+const RawTxReader::BlockFile *RawTxReader::map_file(const std::string &file_name, u64 end){
+	using namespace boost::interprocess;
+	auto it = this->files.find(file_name);
+	if (it != this->files.end()){
+		if (it->second.region.get_size() >= end){
+			this->lru.splice(this->lru.begin(), this->lru, it->second.lru_position);
+			return &it->second;
+		}
+		this->lru.erase(it->second.lru_position);
+		this->files.erase(it);
+	}
+	mapped_region region;
+	try{
+		auto path = (boost::filesystem::path(this->path) / file_name).string();
+		//The region stays valid after the mapping is destroyed.
+		file_mapping mapping(path.c_str(), read_only);
+		mapped_region(mapping, read_only).swap(region);
+	}catch (interprocess_exception &){
+		//bitcoind may have deleted the file.
+		return nullptr;
+	}
+	if (region.get_size() < end)
+		return nullptr;
+	if (this->files.size() >= max_mapped_files){
+		this->files.erase(this->lru.back());
+		this->lru.pop_back();
+	}
+	this->lru.push_front(file_name);
+	auto &file = this->files[file_name];
+	file.region.swap(region);
+	file.lru_position = this->lru.begin();
+	return &file;
+}
+
+boost::string_view RawTxReader::get(const Hashes::Digests::SHA256 &txid){
+	if (this->path.empty())
+		throw std::runtime_error("The DB doesn't say where the block files are. Run blockchain_parser on it to record it.");
+	std::string hash, file_name;
+	u64 offset, size;
+	this->find_tx << Reset() << (std::string)txid;
+	bool found = this->find_tx.step() == SQLITE_ROW;
+	if (found)
+		this->find_tx >> hash >> file_name >> offset >> size;
+	this->find_tx << Reset();
+	if (!found)
+		return {};
+	auto file = this->map_file(file_name, offset + size);
+	if (!file)
+		return {};
+	auto data = (const char *)file->region.get_address() + offset;
+	if (Hashes::Digests::SHA256(Hashes::Algorithms::SHA256::compute(data, size, 2)) != Hashes::Digests::SHA256(hash))
+		return {};
+	return { data, size };
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <common/types.h>
+#include <libhash/hash.h>
+#include <sqlitepp/sqlitepp.h>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/utility/string_view.hpp>
+#include <list>
+#include <map>
+#include <string>
+
+//Reads raw txs straight from the block files, at the locations
+//blockchain_parser records in tx_locations, so that they can be served
+//without asking bitcoind for them. The files are the ones in the directory
+//blockchain_parser last read (table block_files). They're mapped into memory
+//the first time they're needed and stay mapped until max_mapped_files other
+//files have been used more recently; a file that has grown since then is
+//mapped again. Only the region is kept, not the file_mapping, so a mapped file
+//doesn't hold a file descriptor open.
+//Txs of blocks the indexer got over RPC have no location, and neither do txs
+//deleted by pruning, so callers must still be able to get txs from bitcoind.
+class RawTxReader{
+	static const size_t max_mapped_files = 64;
+	struct BlockFile{
+		boost::interprocess::mapped_region region;
+		std::list<std::string>::iterator lru_position;
+	};
+	sqlite3pp::DB &db;
+	sqlite3pp::Statement find_tx;
+	std::string path;
+	std::map<std::string, BlockFile> files;
+	//Most recently used first.
+	std::list<std::string> lru;
+
+	const BlockFile *map_file(const std::string &file_name, u64 end);
+public:
+	RawTxReader(sqlite3pp::DB &);
+	//Returns an empty view if the tx isn't in the DB, its location isn't
+	//known, or the bytes there aren't the tx (e.g. if the block files have
+	//been replaced). Otherwise the view points into the mapped file and stays
+	//valid until the next call.
+	boost::string_view get(const Hashes::Digests::SHA256 &txid);
+};
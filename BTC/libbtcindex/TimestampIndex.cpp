@@ -1,38 +1,122 @@
 #include "TimestampIndex.h"
-#include <common/misc.h>
+#include <algorithm>
 
 TimestampIndex::TimestampIndex(sqlite3pp::DB &db){
 	this->reload_data(db);
 }
 
 void TimestampIndex::reload_data(sqlite3pp::DB &db){
-	this->data.clear();
+	this->tx_begin.clear();
+	this->tx_count.clear();
+	this->timestamp.clear();
 #if 1 //Disabled during debug. Remember to turn back on!
-	auto stmt = db << "select first_transaction_id, transaction_count, timestamp from blocks;";
+	u64 count;
+	db << "select count(*) from blocks;" << sqlite3pp::Step() >> count;
+	this->tx_begin.reserve((size_t)count);
+	this->tx_count.reserve((size_t)count);
+	this->timestamp.reserve((size_t)count);
+	auto stmt = db << "select first_transaction_id, transaction_count, timestamp from blocks order by first_transaction_id;";
 	while (stmt.step() == SQLITE_ROW){
-		TimestampItem ti;
-		stmt >> ti.tx_begin >> ti.tx_end >> ti.timestamp;
-		ti.tx_end += ti.tx_begin;
-		this->data.push_back(ti);
+		u64 begin, transaction_count, timestamp;
+		stmt >> begin >> transaction_count >> timestamp;
+		this->tx_begin.push_back(begin);
+		this->tx_count.push_back((u32)transaction_count);
+		this->timestamp.push_back((u32)timestamp);
 	}
-	std::sort(this->data.begin(), this->data.end());
 #endif
+	this->update_max_timestamp(0);
 }
 
-TransactionOrder TimestampIndex::get_timestamp(u64 tx_id) const{
-	auto b = this->data.begin();
-	auto e = this->data.end();
-	auto it = find_first_true(b, e, [tx_id](const TimestampItem &ti){ return ti.tx_end > tx_id; });
-	if (it == e || !(it->tx_begin <= tx_id && tx_id < it->tx_end))
+void TimestampIndex::update_max_timestamp(size_t first_block){
+	auto n = this->timestamp.size();
+	this->max_timestamp.resize(n);
+	for (auto i = first_block; i < n; i++)
+		this->max_timestamp[i] = i ? std::max(this->max_timestamp[i - 1], this->timestamp[i]) : this->timestamp[i];
+}
+
+u64 TimestampIndex::get_max_timestamp(u64 tx_id) const{
+	auto block = this->find_block(tx_id);
+	if (block >= this->max_timestamp.size())
+		return 0;
+	return this->max_timestamp[block];
+}
+
+size_t TimestampIndex::find_block(u64 tx_id) const{
+	auto n = this->tx_begin.size();
+	if (!n || tx_id < this->tx_begin[0])
+		return n;
+	//Branchless binary search. The loop always runs ceil(log2(n)) times and
+	//the comparison compiles to a conditional move.
+	const u64 *base = this->tx_begin.data();
+	while (n > 1){
+		auto half = n / 2;
+		base = base[half] <= tx_id ? base + half : base;
+		n -= half;
+	}
+	return base - this->tx_begin.data();
+}
+
+TransactionOrder TimestampIndex::get_order(size_t block, u64 tx_id) const{
+	if (block >= this->tx_begin.size())
+		return { 0, 0 };
+	auto offset = tx_id - this->tx_begin[block];
+	if (offset >= this->tx_count[block])
 		return { 0, 0 };
-	return { it->timestamp, (u32)(tx_id - it->tx_begin) };
+	return { this->timestamp[block], (u32)offset };
+}
+
+TransactionOrder TimestampIndex::get_timestamp(u64 tx_id) const{
+	return this->get_order(this->find_block(tx_id), tx_id);
+}
+
+std::vector<TransactionOrder> TimestampIndex::get_timestamps(const std::vector<u64> &tx_ids) const{
+	std::vector<TransactionOrder> ret;
+	ret.reserve(tx_ids.size());
+	if (!tx_ids.size())
+		return ret;
+	//Merge both sorted sequences, starting from the first relevant block.
+	auto block = this->find_block(tx_ids.front());
+	auto n = this->tx_begin.size();
+	auto begin = this->tx_begin.begin();
+	for (auto id : tx_ids){
+		if (block == n){
+			if (!n || id < this->tx_begin[0]){
+				ret.push_back({ 0, 0 });
+				continue;
+			}
+			block = 0;
+		}
+		//Gallop forward to bracket the block, so that ids far apart don't walk
+		//every block in between.
+		size_t step = 1;
+		while (block + step < n && this->tx_begin[block + step] <= id)
+			step *= 2;
+		block = std::upper_bound(begin + (block + step / 2), begin + std::min(block + step, n), id) - begin - 1;
+		ret.push_back(this->get_order(block, id));
+	}
+	return ret;
 }
 
 void TimestampIndex::add_block(u64 first_transaction_id, u64 transaction_count, u64 timestamp){
-	TimestampItem ti;
-	ti.tx_begin = first_transaction_id;
-	ti.tx_end = first_transaction_id + transaction_count;
-	ti.timestamp = timestamp;
-	this->data.push_back(ti);
-	std::sort(this->data.begin(), this->data.end());
+	auto it = this->tx_begin.end();
+	if (this->tx_begin.size() && first_transaction_id < this->tx_begin.back())
+		it = std::upper_bound(this->tx_begin.begin(), this->tx_begin.end(), first_transaction_id);
+	auto i = it - this->tx_begin.begin();
+	this->tx_begin.insert(it, first_transaction_id);
+	this->tx_count.insert(this->tx_count.begin() + i, (u32)transaction_count);
+	this->timestamp.insert(this->timestamp.begin() + i, (u32)timestamp);
+	this->update_max_timestamp(i);
+}
+
+void TimestampIndex::revert_block(u64 first_transaction_id){
+	//Blocks are reverted from the top, so this is normally the last element.
+	for (auto i = this->tx_begin.size(); i--;){
+		if (this->tx_begin[i] == first_transaction_id){
+			this->tx_begin.erase(this->tx_begin.begin() + i);
+			this->tx_count.erase(this->tx_count.begin() + i);
+			this->timestamp.erase(this->timestamp.begin() + i);
+			this->update_max_timestamp(i);
+			break;
+		}
+	}
 }
@@ -16,18 +16,32 @@ struct TransactionOrder{
 	}
 };
 
+//Maps transaction ids to the timestamp of the block that contains them.
+//Blocks are stored as parallel arrays sorted by first transaction id. Since
+//new blocks always get higher transaction ids than any existing block, adding
+//a block is normally a push_back.
 class TimestampIndex{
-	struct TimestampItem{
-		u64 tx_begin, tx_end;
-		u64 timestamp;
-		bool operator<(const TimestampItem &other) const{
-			return this->tx_end < other.tx_end;
-		}
-	};
-	std::vector<TimestampItem> data;
+	std::vector<u64> tx_begin;
+	std::vector<u32> tx_count;
+	std::vector<u32> timestamp;
+	//max_timestamp[i] is the highest timestamp of blocks 0 to i.
+	std::vector<u32> max_timestamp;
+
+	//Returns the index of the last block whose first transaction is <= tx_id,
+	//or size() if there's no such block.
+	size_t find_block(u64 tx_id) const;
+	TransactionOrder get_order(size_t block, u64 tx_id) const;
+	void update_max_timestamp(size_t first_block);
 public:
 	TimestampIndex(sqlite3pp::DB &db);
 	TransactionOrder get_timestamp(u64 tx_id) const;
+	//Same as calling get_timestamp() for each id, in a single pass over the
+	//blocks. tx_ids must be sorted.
+	std::vector<TransactionOrder> get_timestamps(const std::vector<u64> &tx_ids) const;
+	//Returns the highest timestamp of all the blocks up to the one containing
+	//tx_id.
+	u64 get_max_timestamp(u64 tx_id) const;
 	void reload_data(sqlite3pp::DB &db);
 	void add_block(u64 first_transaction_id, u64 transaction_count, u64 timestamp);
+	void revert_block(u64 first_transaction_id);
 };
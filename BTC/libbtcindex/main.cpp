@@ -1,6 +1,7 @@
 #include "Indexer.h"
 #include <common/types.h>
 #include <common/misc.h>
+#include <cstring>
 #include <exception>
 #include <iostream>
 #include <string>
@@ -11,11 +12,17 @@
 #define API extern "C"
 #endif
 
-API Indexer *initialize_index(const char *db_path, bool testnet){
+//Opaque result handle returned by the index_* functions. The caller owns it
+//and must release it with index_release_result(). The data is always
+//followed by a null terminator that is not counted in the size.
+struct IndexResult{
+	std::string data;
+};
+
+template <typename F>
+static IndexResult *return_result(const F &f){
 	try{
-		//Remember to uncomment this if you ever implement reader-writer locks!
-		//sqlite3_config(SQLITE_CONFIG_SERIALIZED);
-		return new Indexer(db_path, testnet);
+		return new IndexResult{f()};
 	}catch (std::exception &e){
 		std::cerr << e.what() << std::endl;
 	}catch (...){
@@ -23,23 +30,28 @@ API Indexer *initialize_index(const char *db_path, bool testnet){
 	return nullptr;
 }
 
-API void destroy_index(Indexer *index){
-	delete index;
-}
-
-API const char *index_get_utxo(Indexer *index, const char *addresses){
+//Returns the size of the result. The result is only written to dst if it
+//fits, so the caller can retry with a larger buffer. Returns -1 on error.
+template <typename F>
+static s64 write_result(const F &f, void *dst, size_t dst_size){
 	try{
-		return index->get_utxo(addresses);
+		auto result = f();
+		if (result.size() <= dst_size && result.size())
+			memcpy(dst, result.data(), result.size());
+		return (s64)result.size();
 	}catch (std::exception &e){
 		std::cerr << e.what() << std::endl;
 	}catch (...){
 	}
-	return nullptr;
+	return -1;
 }
 
-API const char *index_get_utxo_insight(Indexer *index, const char *addresses){
+API Indexer *initialize_index(const char *db_path, bool testnet){
 	try{
-		return index->get_utxo_insight(addresses);
+		//The calls that share the Indexer's lock each borrow a connection of
+		//their own (see Indexer::readers), so SQLite doesn't need to be
+		//configured for connections shared between threads.
+		return new Indexer(db_path, testnet);
 	}catch (std::exception &e){
 		std::cerr << e.what() << std::endl;
 	}catch (...){
@@ -47,34 +59,119 @@ API const char *index_get_utxo_insight(Indexer *index, const char *addresses){
 	return nullptr;
 }
 
-API const char *index_get_balance(Indexer *index, const char *addresses){
-	try{
-		return index->get_balance(addresses);
-	}catch (std::exception &e){
-		std::cerr << e.what() << std::endl;
-	}catch (...){
-	}
-	return nullptr;
+API void destroy_index(Indexer *index){
+	delete index;
 }
 
-API const char *index_get_balances(Indexer *index, const char *addresses){
-	try{
-		return index->get_balances(addresses);
-	}catch (std::exception &e){
-		std::cerr << e.what() << std::endl;
-	}catch (...){
-	}
-	return nullptr;
+API const void *index_result_data(const IndexResult *result){
+	return result->data.c_str();
 }
 
-API const char *index_get_history(Indexer *index, const char *addresses){
-	try{
-		return index->get_history(addresses);
-	}catch (std::exception &e){
-		std::cerr << e.what() << std::endl;
-	}catch (...){
-	}
-	return nullptr;
+API size_t index_result_size(const IndexResult *result){
+	return result->data.size();
+}
+
+API void index_release_result(IndexResult *result){
+	delete result;
+}
+
+API IndexResult *index_get_utxo(Indexer *index, const char *addresses){
+	return return_result([&](){ return index->get_utxo(addresses); });
+}
+
+API s64 index_get_utxo_into(Indexer *index, const char *addresses, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_utxo(addresses); }, dst, dst_size);
+}
+
+API IndexResult *index_get_utxo_insight(Indexer *index, const char *addresses){
+	return return_result([&](){ return index->get_utxo_insight(addresses); });
+}
+
+API s64 index_get_utxo_insight_into(Indexer *index, const char *addresses, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_utxo_insight(addresses); }, dst, dst_size);
+}
+
+API IndexResult *index_get_balance(Indexer *index, const char *addresses){
+	return return_result([&](){ return index->get_balance(addresses); });
+}
+
+API s64 index_get_balance_into(Indexer *index, const char *addresses, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_balance(addresses); }, dst, dst_size);
+}
+
+API IndexResult *index_get_balances(Indexer *index, const char *addresses){
+	return return_result([&](){ return index->get_balances(addresses); });
+}
+
+API s64 index_get_balances_into(Indexer *index, const char *addresses, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_balances(addresses); }, dst, dst_size);
+}
+
+API IndexResult *index_get_history(Indexer *index, const char *addresses){
+	return return_result([&](){ return index->get_history(addresses); });
+}
+
+API s64 index_get_history_into(Indexer *index, const char *addresses, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_history(addresses); }, dst, dst_size);
+}
+
+API IndexResult *index_get_utxo_bin(Indexer *index, const void *request, size_t size){
+	return return_result([&](){ return index->get_utxo_binary(request, size); });
+}
+
+API s64 index_get_utxo_bin_into(Indexer *index, const void *request, size_t size, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_utxo_binary(request, size); }, dst, dst_size);
+}
+
+API IndexResult *index_get_balances_bin(Indexer *index, const void *request, size_t size){
+	return return_result([&](){ return index->get_balances_binary(request, size); });
+}
+
+API s64 index_get_balances_bin_into(Indexer *index, const void *request, size_t size, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_balances_binary(request, size); }, dst, dst_size);
+}
+
+API IndexResult *index_get_history_bin(Indexer *index, const void *request, size_t size){
+	return return_result([&](){ return index->get_history_binary(request, size); });
+}
+
+API s64 index_get_history_bin_into(Indexer *index, const void *request, size_t size, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_history_binary(request, size); }, dst, dst_size);
+}
+
+API IndexResult *index_get_address_usage(Indexer *index, const char *addresses){
+	return return_result([&](){ return index->get_address_usage(addresses); });
+}
+
+API s64 index_get_address_usage_into(Indexer *index, const char *addresses, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_address_usage(addresses); }, dst, dst_size);
+}
+
+API IndexResult *index_get_address_usage_bin(Indexer *index, const void *request, size_t size){
+	return return_result([&](){ return index->get_address_usage_binary(request, size); });
+}
+
+API s64 index_get_address_usage_bin_into(Indexer *index, const void *request, size_t size, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_address_usage_binary(request, size); }, dst, dst_size);
+}
+
+//txids is a JSON array of txids. Returns a JSON array with each tx as it is in
+//the block files, in hex, or null for txs that can't be served from them,
+//which must be asked to bitcoind.
+API IndexResult *index_get_raw_transactions(Indexer *index, const char *txids){
+	return return_result([&](){ return index->get_raw_transactions(txids); });
+}
+
+API s64 index_get_raw_transactions_into(Indexer *index, const char *txids, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_raw_transactions(txids); }, dst, dst_size);
+}
+
+API IndexResult *index_get_raw_transactions_bin(Indexer *index, const void *request, size_t size){
+	return return_result([&](){ return index->get_raw_transactions_binary(request, size); });
+}
+
+API s64 index_get_raw_transactions_bin_into(Indexer *index, const void *request, size_t size, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_raw_transactions_binary(request, size); }, dst, dst_size);
 }
 
 API s64 index_get_blockchain_height(Indexer *index){
@@ -87,22 +184,40 @@ API s64 index_get_blockchain_height(Indexer *index){
 	return -1;
 }
 
-API const char *index_push_new_block(Indexer *index, const void *data, size_t size){
-	try{
-		return index->push_new_block(data, size);
-	}catch (std::exception &e){
-		std::cerr << e.what() << std::endl;
-	}catch (...){
-	}
-	return nullptr;
+API IndexResult *index_push_new_block(Indexer *index, const void *data, size_t size){
+	return return_result([&](){ return index->push_new_block(data, size); });
 }
 
-API const char *index_get_fees(Indexer *index){
-	try{
-		return index->get_fees();
-	}catch (std::exception &e){
-		std::cerr << e.what() << std::endl;
-	}catch (...){
-	}
-	return nullptr;
+//Pushes several consecutive blocks at once. Returns a JSON array with the
+//result of each block that was processed, in the same format as
+//index_push_new_block(). Processing stops at the first block that can't be
+//added; it's reported as {"error": message}. Blocks are committed in groups,
+//and if one can't be inserted, the blocks of its group that came before it are
+//undone as well, and their results are replaced by the error. Either way the
+//error stands for the first block that wasn't added.
+API IndexResult *index_push_new_blocks(Indexer *index, const void *const *blocks, const size_t *sizes, size_t count){
+	return return_result([&](){ return index->push_new_blocks(blocks, sizes, count); });
+}
+
+API IndexResult *index_get_fees(Indexer *index){
+	return return_result([&](){ return index->get_fees(); });
+}
+
+API s64 index_get_fees_into(Indexer *index, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_fees(); }, dst, dst_size);
+}
+
+API IndexResult *index_get_address_filter_stats(Indexer *index){
+	return return_result([&](){ return index->get_address_filter_stats(); });
+}
+
+//Returns counters and timings of the calls into the index and of the SQL
+//statements they run (see IndexerStats.h). format is "json", or "prometheus"
+//for the Prometheus text exposition format. If null, it defaults to "json".
+API IndexResult *index_get_stats(Indexer *index, const char *format){
+	return return_result([&](){ return index->get_stats(format); });
+}
+
+API s64 index_get_stats_into(Indexer *index, const char *format, void *dst, size_t dst_size){
+	return write_result([&](){ return index->get_stats(format); }, dst, dst_size);
 }
@@ -22,6 +22,7 @@ Address::Address(AddressType type, const void *src, bool testnet)
 			memcpy(this->buffer, src, 20);
 			break;
 		case AddressType::P2wpkh32:
+		case AddressType::P2tr:
 			memcpy(this->buffer, src, 32);
 			break;
 		default:
@@ -31,6 +32,7 @@ Address::Address(AddressType type, const void *src, bool testnet)
 
 Address::operator std::string() const{
 	size_t size;
+	int witness_version = 0;
 
 	auto type = (u8)this->type;
 	if (this->testnet){
@@ -60,10 +62,14 @@ Address::operator std::string() const{
 		case AddressType::P2wpkh32:
 			size = 32;
 			break;
+		case AddressType::P2tr:
+			size = 32;
+			witness_version = 1;
+			break;
 		default:
 			throw std::exception();
 	}
-	return segwit_addr::encode(this->buffer, size);
+	return segwit_addr::encode(this->testnet ? "tb" : "bc", witness_version, this->buffer, size);
 }
 
 size_t Address::size() const{
@@ -73,6 +79,7 @@ size_t Address::size() const{
 		case AddressType::P2wpkh20:
 			return 20;
 		case AddressType::P2wpkh32:
+		case AddressType::P2tr:
 			return 32;
 		default:
 			throw std::exception();
@@ -12,6 +12,8 @@ enum class AddressType{
 	P2sh = 5,
 	P2wpkh20 = 256,
 	P2wpkh32 = 257,
+	//Witness v1, i.e. taproot.
+	P2tr = 258,
 };
 
 struct LIBBTCPARSER_API Address{
@@ -0,0 +1,100 @@
+#include "AddressFilter.h"
+#include <cmath>
+
+using namespace sqlite3pp;
+
+const u64 AddressFilter::bits_per_address;
+
+static const u64 words_per_block = 8;
+static const u64 minimum_capacity = 1 << 16;
+
+//Odd constants from the Parquet split block Bloom filter.
+static const u32 salts[words_per_block] = {
+	0x47b6137bU,
+	0x44974d91U,
+	0x8824ad5bU,
+	0xa2b7289dU,
+	0x705495c7U,
+	0x2df1424bU,
+	0x9efc4947U,
+	0x5c6bfb31U,
+};
+
+AddressFilter::AddressFilter(DB &db): db(db), block_count(0), address_count(0), capacity(0){
+	u64 count;
+	db << "select count(*) from addresses;" << Step() >> count;
+	this->resize(std::max(count * 2, minimum_capacity));
+}
+
+//FNV-1a followed by the splitmix64 finalizer, so that all bits of the result
+//depend on all bytes of the input.
+u64 AddressFilter::hash(const void *data, size_t size){
+	auto p = (const u8 *)data;
+	u64 ret = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++){
+		ret ^= p[i];
+		ret *= 0x100000001b3ULL;
+	}
+	ret ^= ret >> 30;
+	ret *= 0xbf58476d1ce4e5b9ULL;
+	ret ^= ret >> 27;
+	ret *= 0x94d049bb133111ebULL;
+	ret ^= ret >> 31;
+	return ret;
+}
+
+void AddressFilter::resize(u64 capacity){
+	this->capacity = capacity;
+	this->block_count = (capacity * bits_per_address + 255) / 256;
+	this->words.assign(this->block_count * words_per_block, 0);
+	this->address_count = 0;
+	auto stmt = this->db << "select address from addresses;";
+	while (stmt.step() == SQLITE_ROW){
+		boost::string_view address;
+		stmt >> address;
+		this->add_hash(hash(address.data(), address.size()));
+	}
+}
+
+void AddressFilter::add_hash(u64 hash){
+	auto block = &this->words[(hash >> 32) % this->block_count * words_per_block];
+	auto key = (u32)hash;
+	for (u64 i = 0; i < words_per_block; i++)
+		block[i] |= (u32)1 << ((key * salts[i]) >> 27);
+	this->address_count++;
+}
+
+void AddressFilter::add(const std::string &address){
+	if (this->address_count >= this->capacity){
+		//The table already contains the new address.
+		this->resize(this->capacity * 2);
+		return;
+	}
+	this->add_hash(hash(address.data(), address.size()));
+}
+
+bool AddressFilter::may_contain(const std::string &address) const{
+	auto hash = AddressFilter::hash(address.data(), address.size());
+	auto block = &this->words[(hash >> 32) % this->block_count * words_per_block];
+	auto key = (u32)hash;
+	for (u64 i = 0; i < words_per_block; i++)
+		if (!(block[i] & ((u32)1 << ((key * salts[i]) >> 27))))
+			return false;
+	return true;
+}
+
+double AddressFilter::false_positive_rate() const{
+	//The number of addresses in a block is approximately Poisson distributed.
+	//A block holding c addresses gives a false positive when all eight probed
+	//bits are set, each of which is with probability 1 - (31/32)^c.
+	double lambda = (double)this->address_count / this->block_count;
+	double p = std::exp(-lambda);
+	double ret = 0;
+	auto limit = (u64)(lambda + 10 * std::sqrt(lambda) + 20);
+	for (u64 c = 0; c <= limit; c++){
+		if (c)
+			p *= lambda / c;
+		ret += p * std::pow(1 - std::pow(31.0 / 32.0, (double)c), (double)words_per_block);
+	}
+	return ret;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <common/types.h>
+#include <sqlitepp/sqlitepp.h>
+#include <string>
+#include <vector>
+
+//Split block Bloom filter over the addresses in the addresses table. Each
+//address sets one bit in each of the eight 32-bit words of a single 32-byte
+//block, so a lookup touches one cache line. may_contain() never returns
+//false for an address that was added; it returns true for an address that
+//wasn't added with probability false_positive_rate().
+//
+//The filter lives only in memory and is built from the table when it's
+//constructed. When more addresses are added than it was sized for, it's
+//rebuilt from the table at twice the size.
+class AddressFilter{
+public:
+	static const u64 bits_per_address = 12;
+private:
+	sqlite3pp::DB &db;
+	std::vector<u32> words;
+	u64 block_count;
+	u64 address_count;
+	u64 capacity;
+
+	void resize(u64 capacity);
+	void add_hash(u64 hash);
+	static u64 hash(const void *data, size_t size);
+public:
+	AddressFilter(sqlite3pp::DB &db);
+	AddressFilter(const AddressFilter &) = delete;
+	const AddressFilter &operator=(const AddressFilter &) = delete;
+
+	//Must be called after the address has been inserted into the table.
+	void add(const std::string &address);
+	bool may_contain(const std::string &address) const;
+	u64 size() const{
+		return this->address_count;
+	}
+	u64 memory_size() const{
+		return this->words.size() * sizeof(u32);
+	}
+	//Expected rate for the current number of addresses.
+	double false_positive_rate() const;
+};
@@ -0,0 +1,26 @@
+#include "AddressFormat.h"
+
+using namespace sqlite3pp;
+
+void initialize_address_format(DB &db){
+	db.exec("create table if not exists address_format (version integer);");
+	db.exec("delete from address_format;");
+	db << "insert into address_format (version) values (?);" << address_format_version << Step();
+}
+
+void check_address_format(DB &db){
+	u32 version = 0;
+	if (db.table_exists("address_format")){
+		auto stmt = db << "select version from address_format;";
+		if (stmt.step() == SQLITE_ROW)
+			stmt >> version;
+	}
+	if (version == address_format_version)
+		return;
+	if (version > address_format_version)
+		throw std::runtime_error("The DB was made by a newer version of blockchain_parser.");
+	u64 txs;
+	db << "select count(*) from (select * from txs limit 1);" << Step() >> txs;
+	if (txs)
+		throw std::runtime_error("The DB was made by an older version of blockchain_parser, which stored testnet segwit addresses with the bc prefix and didn't index taproot outputs. It can't be migrated. Delete it and parse the chain again.");
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <common/types.h>
+#include <sqlitepp/sqlitepp.h>
+
+//The version of the address strings blockchain_parser stores, recorded in the
+//table address_format. Version 1 encodes testnet segwit addresses with the tb
+//prefix, where older versions used bc as on mainnet, and gives taproot
+//outputs an address, where older versions left them without one. DBs without
+//the table predate both. They can't be migrated, since the output scripts
+//aren't stored; the chain has to be parsed again. Neither blockchain_parser
+//nor the indexer will open them once they have txs.
+const u32 address_format_version = 1;
+
+//Records the current version in a DB that has no txs yet.
+void initialize_address_format(sqlite3pp::DB &db);
+//Throws if db has txs whose addresses were stored in an older format.
+void check_address_format(sqlite3pp::DB &db);
@@ -11,7 +11,7 @@ Block::Block(SerializedBuffer &buffer, bool testnet, const block_filter &f, cons
 	this->parse_file_block(buffer, testnet, f, path);
 }
 
-Block::Block(SerializedBuffer &buffer, bool testnet, const std::string &path){
+Block::Block(SerializedBuffer &buffer, bool testnet, const std::string &path, u64 buffer_offset): buffer_offset(buffer_offset){
 	this->parse_file_block(buffer, testnet, {}, path);
 }
 
@@ -88,15 +88,33 @@ u64 Block::estimate_memory_cost() const{
 	return ret;
 }
 
-u64 Block::insert(InsertState &nis, std::set<u64> &updated_balances){
+u64 Block::insert(InsertState &nis, std::set<u64> &updated_balances, BlockInsertInfo *info){
 	try{
-		auto block_id = nis.insert_block(this->hash, this->previous_block_hash, this->timestamp, (u32)this->transactions.size());
+		//Blocks that come from a block file record where their txs are.
+		BlockFileLocation location;
+		if (this->path.size()){
+			location.file_name = boost::filesystem::path(this->path).leaf().string();
+			location.file_offset = this->buffer_offset + this->proper_offset;
+			location.size = this->proper_length;
+			location.txs.reserve(this->transactions.size());
+			for (auto &tx : this->transactions)
+				location.txs.emplace_back(this->buffer_offset + tx.get_offset(), tx.get_size());
+		}
+		auto block_id = nis.insert_block(this->hash, this->previous_block_hash, this->timestamp, (u32)this->transactions.size(), this->path.size() ? &location : nullptr);
 		u32 tx_index = 0;
+		if (info)
+			info->fee_rates.reserve(info->fee_rates.size() + this->transactions.size());
 		for (auto &tx : this->transactions){
-			tx.insert(block_id, tx_index++, nis, updated_balances);
+			auto fee = tx.insert(block_id, tx_index++, nis, updated_balances, info);
+			if (!info || tx_index == 1)
+				continue;
+			auto vsize = tx.get_vsize();
+			info->fee_rates.push_back({ vsize ? fee * 1000 / vsize : 0, vsize });
 		}
+		nis.flush();
 		return block_id;
 	}catch (std::exception &e){
+		nis.discard();
 		std::stringstream stream;
 		stream << "Error while processing block " << this->hash << ": " << e.what();
 		throw std::runtime_error(stream.str());
@@ -7,8 +7,27 @@
 #include <functional>
 #include <string>
 #include <set>
+#include <map>
 
 class NoMoreBlocks{};
+
+struct TxFeeRate{
+	//Satoshis per 1000 virtual bytes.
+	u64 fee_rate;
+	u64 vsize;
+};
+
+//Information optionally collected while a block is inserted, so that callers
+//don't need to query the DB to learn what the block did.
+struct BlockInsertInfo{
+	//One element per non-coinbase transaction.
+	std::vector<TxFeeRate> fee_rates;
+	//Ids of the outputs spent by the block, in input order.
+	std::vector<u64> spent_outputs;
+	//Net change to the balance of every address the block paid to or spent from.
+	std::map<u64, s64> balance_deltas;
+};
+
 class SerializedBuffer;
 class BlockFromRpc{};
 
@@ -31,6 +50,8 @@ private:
 	std::string path;
 	u64 offset;
 	u64 proper_offset, proper_length;
+	//Offset in the file at path of the buffer the block was parsed from.
+	u64 buffer_offset = 0;
 
 	Hashes::Digests::SHA256 hash;
 	
@@ -42,7 +63,9 @@ private:
 
 public:
 	Block(SerializedBuffer &buffer, bool testnet, const block_filter &, const std::string &path = {});
-	Block(SerializedBuffer &buffer, bool testnet, const std::string &path = {});
+	//buffer_offset is the offset of buffer in the file at path, if buffer only
+	//holds part of the file.
+	Block(SerializedBuffer &buffer, bool testnet, const std::string &path = {}, u64 buffer_offset = 0);
 	Block(SerializedBuffer &buffer, bool testnet, const BlockFromRpc &);
 	const Hashes::Digests::SHA256 &get_hash() const{
 		return this->hash;
@@ -68,7 +91,7 @@ public:
 	u64 get_proper_length() const{
 		return this->proper_length;
 	}
-	u64 insert(InsertState &nis, std::set<u64> &updated_balances);
+	u64 insert(InsertState &nis, std::set<u64> &updated_balances, BlockInsertInfo *info = nullptr);
 	u64 insert(InsertState &nis){
 		std::set<u64> updated_balances;
 		return this->insert(nis, updated_balances);
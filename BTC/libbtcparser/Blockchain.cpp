@@ -81,6 +81,19 @@ std::vector<HeadCandidate> assemble_blockchain(DB &db, const Blockchain::head_se
 }
 
 Blockchain::Blockchain(DB &db, const head_selector_t &head_selector): db(db){
+	this->load(head_selector);
+	this->update_db();
+}
+
+void Blockchain::reload(){
+	this->blockchain.clear();
+	this->block_map.clear();
+	this->db_update_deferred = false;
+	this->db_update_pending = false;
+	this->load({});
+}
+
+void Blockchain::load(const head_selector_t &head_selector){
 	auto blocks = assemble_blockchain(this->db, head_selector);
 	this->blockchain.reserve(blocks.size());
 	for (auto &block : blocks){
@@ -94,10 +107,13 @@ Blockchain::Blockchain(DB &db, const head_selector_t &head_selector): db(db){
 		this->block_map[block2.hash] = height;
 		this->blockchain.push_back(block2);
 	}
-	this->update_db();
 }
 
 void Blockchain::update_db(){
+	if (this->db_update_deferred){
+		this->db_update_pending = true;
+		return;
+	}
 	this->db.exec("delete from blockchain_head;");
 	if (!this->blockchain.size())
 		return;
@@ -165,3 +181,14 @@ RevertBlockResult Blockchain::revert_block(const SHA256 &hash){
 	this->update_db();
 	return RevertBlockResult::Success;
 }
+
+void Blockchain::begin_deferred_update(){
+	this->db_update_deferred = true;
+}
+
+void Blockchain::end_deferred_update(bool flush){
+	this->db_update_deferred = false;
+	if (this->db_update_pending && flush)
+		this->update_db();
+	this->db_update_pending = false;
+}
@@ -49,7 +49,10 @@ private:
 	sqlite3pp::DB &db;
 	std::vector<Block> blockchain;
 	std::map<SHA256, size_t> block_map;
+	bool db_update_deferred = false;
+	bool db_update_pending = false;
 
+	void load(const head_selector_t &head_selector);
 	void update_db();
 public:
 	Blockchain(sqlite3pp::DB &db, const head_selector_t &head_selector = {});
@@ -74,4 +77,11 @@ public:
 		return this->blockchain.size() - 1;
 	}
 	RevertBlockResult revert_block(const SHA256 &hash);
+	//Reads the chain from the DB again, e.g. after a rollback. Any deferred
+	//update is dropped.
+	void reload();
+	//While deferred, changes to the head are only written to the DB when
+	//end_deferred_update() is called with flush = true.
+	void begin_deferred_update();
+	void end_deferred_update(bool flush = true);
 };
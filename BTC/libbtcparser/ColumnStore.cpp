@@ -0,0 +1,295 @@
+#include "ColumnStore.h"
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+static const u64 minimum_file_size = 1 << 16;
+static const u64 journal_header_size = 3 * sizeof(u64);
+
+MappedFile::MappedFile(const std::string &path): path(path){
+	if (!boost::filesystem::exists(path))
+		std::ofstream(path, std::ios::binary);
+	if (boost::filesystem::file_size(path) < minimum_file_size)
+		boost::filesystem::resize_file(path, minimum_file_size);
+	this->map();
+}
+
+void MappedFile::map(){
+	using namespace boost::interprocess;
+	file_mapping(this->path.c_str(), read_write).swap(this->mapping);
+	mapped_region(this->mapping, read_write).swap(this->region);
+}
+
+void MappedFile::reserve(u64 size){
+	using namespace boost::interprocess;
+	if (size <= this->size())
+		return;
+	size = std::max(size, this->size() * 2);
+	//Windows doesn't allow resizing a file while it's mapped.
+	mapped_region().swap(this->region);
+	file_mapping().swap(this->mapping);
+	boost::filesystem::resize_file(this->path, size);
+	this->map();
+}
+
+void MappedFile::flush(){
+	if (!this->region.flush(0, 0, false))
+		throw std::runtime_error("Failed to flush " + this->path);
+}
+
+static std::string create_directory(const std::string &path){
+	boost::filesystem::create_directories(path);
+	return path;
+}
+
+ColumnStore::ColumnStore(sqlite3pp::DB &db, const std::string &directory)
+	: db(db)
+	, directory(create_directory(directory))
+	, output_txs_id(this->directory + "/outputs.txs_id")
+	, output_txo_index(this->directory + "/outputs.txo_index")
+	, output_value(this->directory + "/outputs.value")
+	, output_required_spenders(this->directory + "/outputs.required_spenders")
+	, output_spent_by(this->directory + "/outputs.spent_by")
+	, tx_blocks_id(this->directory + "/txs.blocks_id")
+	, tx_index_in_block(this->directory + "/txs.index_in_block")
+	, tx_locktime(this->directory + "/txs.locktime")
+	, tx_first_output_id(this->directory + "/txs.first_output_id")
+	, tx_output_count(this->directory + "/txs.output_count")
+	, journal(this->directory + "/journal")
+	, generation(0)
+	, committed_outputs_end(0)
+	, committed_txs_end(0){}
+
+ColumnStore::~ColumnStore(){
+	this->db.remove_observer(this);
+}
+
+std::unique_ptr<ColumnStore> ColumnStore::open(sqlite3pp::DB &db, const std::string &db_path){
+	if (!db.table_exists("column_store"))
+		return nullptr;
+	std::unique_ptr<ColumnStore> ret(new ColumnStore(db, db_path + ".columns"));
+	ret->load();
+	return ret;
+}
+
+void ColumnStore::enable(sqlite3pp::DB &db){
+	using namespace sqlite3pp;
+	db.exec("create table if not exists column_store (generation integer, outputs_end integer, txs_end integer);");
+	u64 count;
+	db << "select count(*) from column_store;" << Step() >> count;
+	if (!count)
+		db.exec("insert into column_store (generation, outputs_end, txs_end) values (0, -1, -1);");
+}
+
+u64 ColumnStore::get_table_end(const char *table){
+	using namespace sqlite3pp;
+	std::string query = "select coalesce(max(id), 0) + 1 from ";
+	query += table;
+	query += ';';
+	u64 ret;
+	this->db << query.c_str() << Step() >> ret;
+	return ret;
+}
+
+void ColumnStore::load(){
+	using namespace sqlite3pp;
+	s64 outputs_end = -1;
+	s64 txs_end = -1;
+	{
+		auto stmt = this->db << "select generation, outputs_end, txs_end from column_store;";
+		if (stmt.step() == SQLITE_ROW)
+			stmt >> this->generation >> outputs_end >> txs_end;
+	}
+	this->restore_from_journal();
+	this->committed_outputs_end = this->get_table_end("outputs");
+	this->committed_txs_end = this->get_table_end("txs");
+	//The files are rebuilt if the tables were modified without the store, or
+	//if the files are missing or belong to another database.
+	auto files_generation = ((const u64 *)this->journal.data())[2];
+	bool valid = files_generation == this->generation || files_generation == this->generation + 1;
+	if (!valid || (u64)outputs_end != this->committed_outputs_end || (u64)txs_end != this->committed_txs_end)
+		this->rebuild();
+	this->db.add_observer(this);
+}
+
+void ColumnStore::rebuild(){
+	using namespace sqlite3pp;
+	auto outputs_end = this->committed_outputs_end;
+	auto txs_end = this->committed_txs_end;
+	this->committed_outputs_end = 0;
+	this->committed_txs_end = 0;
+	this->pending_spent_by.clear();
+
+	{
+		auto stmt = this->db << "select id, blocks_id, index_in_block, locktime, output_count from txs;";
+		while (stmt.step() == SQLITE_ROW){
+			u64 id, blocks_id;
+			u32 index_in_block, locktime, output_count;
+			stmt >> id >> blocks_id >> index_in_block >> locktime >> output_count;
+			this->add_tx(id, blocks_id, index_in_block, locktime, output_count);
+		}
+	}
+	{
+		auto stmt = this->db << "select id, txs_id, txo_index, value, required_spenders, spent_by from outputs order by id;";
+		while (stmt.step() == SQLITE_ROW){
+			u64 id, txs_id, value;
+			u32 txo_index, required_spenders;
+			boost::optional<u64> spent_by;
+			stmt >> id >> txs_id >> txo_index >> value >> required_spenders >> spent_by;
+			this->add_output(id, txs_id, txo_index, value, required_spenders);
+			this->set_spent_by(id, spent_by);
+		}
+	}
+	this->flush();
+
+	this->generation++;
+	this->committed_outputs_end = outputs_end;
+	this->committed_txs_end = txs_end;
+	this->set_files_generation(this->generation);
+	Transaction t(this->db);
+	this->db.exec("delete from column_store;");
+	this->db << "insert into column_store (generation, outputs_end, txs_end) values (?, ?, ?);"
+		<< this->generation << outputs_end << txs_end << Step();
+}
+
+//Journal format: generation, entry count, generation of the files, then
+//(output id, spent_by) pairs. The journal applies only if its generation is
+//the one after the database's, meaning that the commit that wrote it didn't
+//complete.
+void ColumnStore::restore_from_journal(){
+	auto header = (u64 *)this->journal.data();
+	if (header[0] != this->generation + 1 || this->journal.size() < journal_header_size + header[1] * 2 * sizeof(u64))
+		return;
+	auto entries = header + 3;
+	for (u64 i = 0; i < header[1]; i++)
+		this->output_spent_by.set(entries[i * 2], entries[i * 2 + 1]);
+	this->output_spent_by.flush();
+	header[0] = 0;
+	header[1] = 0;
+	this->journal.flush();
+}
+
+void ColumnStore::write_journal(){
+	auto n = this->pending_spent_by.size();
+	this->journal.reserve(journal_header_size + n * 2 * sizeof(u64));
+	auto header = (u64 *)this->journal.data();
+	auto entries = header + 3;
+	for (auto &kv : this->pending_spent_by){
+		*(entries++) = kv.first;
+		*(entries++) = kv.second.first;
+	}
+	//The entries must be on disk before the header that makes them valid.
+	this->journal.flush();
+	header[0] = this->generation + 1;
+	header[1] = n;
+	this->journal.flush();
+}
+
+void ColumnStore::set_files_generation(u64 generation){
+	((u64 *)this->journal.data())[2] = generation;
+	this->journal.flush();
+}
+
+void ColumnStore::flush(){
+	this->output_txs_id.flush();
+	this->output_txo_index.flush();
+	this->output_value.flush();
+	this->output_required_spenders.flush();
+	this->output_spent_by.flush();
+	this->tx_blocks_id.flush();
+	this->tx_index_in_block.flush();
+	this->tx_locktime.flush();
+	this->tx_first_output_id.flush();
+	this->tx_output_count.flush();
+}
+
+void ColumnStore::add_tx(u64 id, u64 block_id, u32 index_in_block, u32 locktime, u32 output_count){
+	this->tx_blocks_id.set(id, block_id);
+	this->tx_index_in_block.set(id, index_in_block);
+	this->tx_locktime.set(id, locktime);
+	this->tx_first_output_id.set(id, 0);
+	this->tx_output_count.set(id, output_count);
+}
+
+void ColumnStore::add_output(u64 id, u64 tx_id, u32 txo_index, u64 value, u32 required_spenders){
+	if (!txo_index)
+		this->tx_first_output_id.set(tx_id, id);
+	else if (this->tx_first_output_id.get(tx_id) + txo_index != id)
+		throw std::runtime_error("ColumnStore: outputs of a tx must have consecutive ids.");
+	this->output_txs_id.set(id, tx_id);
+	this->output_txo_index.set(id, txo_index);
+	this->output_value.set(id, value);
+	this->output_required_spenders.set(id, required_spenders);
+	this->output_spent_by.set(id, 0);
+}
+
+boost::optional<u64> ColumnStore::find_output(u64 tx_id, u32 txo_index) const{
+	if (txo_index >= this->tx_output_count.get(tx_id))
+		return {};
+	return this->tx_first_output_id.get(tx_id) + txo_index;
+}
+
+OutputColumns ColumnStore::get_output(u64 id) const{
+	OutputColumns ret;
+	ret.txs_id = this->output_txs_id.get(id);
+	ret.txo_index = this->output_txo_index.get(id);
+	ret.value = this->output_value.get(id);
+	ret.required_spenders = this->output_required_spenders.get(id);
+	ret.spent_by = this->get_spent_by(id);
+	return ret;
+}
+
+boost::optional<u64> ColumnStore::get_spent_by(u64 id) const{
+	u64 ret;
+	auto it = this->pending_spent_by.find(id);
+	if (it != this->pending_spent_by.end())
+		ret = it->second.second;
+	else
+		ret = this->output_spent_by.get(id);
+	if (!ret)
+		return {};
+	return ret;
+}
+
+void ColumnStore::set_spent_by(u64 id, const boost::optional<u64> &input_id){
+	u64 value = input_id ? *input_id : 0;
+	if (id >= this->committed_outputs_end){
+		this->output_spent_by.set(id, value);
+		return;
+	}
+	auto it = this->pending_spent_by.find(id);
+	if (it != this->pending_spent_by.end())
+		it->second.second = value;
+	else
+		this->pending_spent_by[id] = { this->output_spent_by.get(id), value };
+}
+
+void ColumnStore::before_commit(){
+	using namespace sqlite3pp;
+	if (this->pending_spent_by.size()){
+		this->write_journal();
+		for (auto &kv : this->pending_spent_by)
+			this->output_spent_by.set(kv.first, kv.second.second);
+	}
+	this->commit_pending = true;
+	this->flush();
+	this->set_files_generation(this->generation + 1);
+	this->db << "update column_store set generation = ?, outputs_end = ?, txs_end = ?;"
+		<< this->generation + 1 << this->get_table_end("outputs") << this->get_table_end("txs") << Step();
+}
+
+void ColumnStore::after_commit(){
+	this->commit_pending = false;
+	this->generation++;
+	this->committed_outputs_end = this->get_table_end("outputs");
+	this->committed_txs_end = this->get_table_end("txs");
+	this->pending_spent_by.clear();
+}
+
+void ColumnStore::after_rollback(){
+	//If the commit itself failed, the new values were already applied.
+	if (this->commit_pending)
+		for (auto &kv : this->pending_spent_by)
+			this->output_spent_by.set(kv.first, kv.second.first);
+	this->commit_pending = false;
+	this->pending_spent_by.clear();
+}
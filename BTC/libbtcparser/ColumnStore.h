@@ -0,0 +1,140 @@
+#pragma once
+
+#include <common/types.h>
+#include <sqlitepp/sqlitepp.h>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/optional.hpp>
+#include <map>
+#include <memory>
+
+//Read-write memory mapping of a whole file. The file grows as needed and
+//never shrinks.
+class MappedFile{
+	std::string path;
+	boost::interprocess::file_mapping mapping;
+	boost::interprocess::mapped_region region;
+
+	void map();
+public:
+	MappedFile(const std::string &path);
+	MappedFile(const MappedFile &) = delete;
+	const MappedFile &operator=(const MappedFile &) = delete;
+	void *data() const{
+		return this->region.get_address();
+	}
+	u64 size() const{
+		return this->region.get_size();
+	}
+	void reserve(u64 size);
+	//Doesn't return until the data is on disk.
+	void flush();
+};
+
+//Fixed-width column indexed directly by row id.
+template <typename T>
+class MappedColumn{
+	MappedFile file;
+public:
+	MappedColumn(const std::string &path): file(path){}
+	u64 capacity() const{
+		return this->file.size() / sizeof(T);
+	}
+	T get(u64 id) const{
+		if (id >= this->capacity())
+			return 0;
+		return ((const T *)this->file.data())[id];
+	}
+	void set(u64 id, T x){
+		if (id >= this->capacity())
+			this->file.reserve((id + 1) * sizeof(T));
+		((T *)this->file.data())[id] = x;
+	}
+	void flush(){
+		this->file.flush();
+	}
+};
+
+struct OutputColumns{
+	u64 txs_id;
+	u32 txo_index;
+	u64 value;
+	u32 required_spenders;
+	boost::optional<u64> spent_by;
+};
+
+//Optional storage for the fixed-width fields of outputs and txs, kept in
+//memory-mapped files next to the database so that lookups by id are array
+//reads instead of B-tree searches. The txs and outputs tables are still
+//written in full; the store only serves reads.
+//
+//The store is enabled by the presence of the column_store table, which
+//records the generation of the files and the row ranges they cover. All
+//modifications must be made inside a transaction. New rows are written
+//directly, since rows past the end of the tables are ignored; changes to
+//spent_by for existing rows are held in memory until the transaction is
+//committed, and their previous values are journaled first, so that the files
+//can be brought back to the state of the database after a crash.
+class ColumnStore : public sqlite3pp::TransactionObserver{
+	sqlite3pp::DB &db;
+	std::string directory;
+	MappedColumn<u64> output_txs_id;
+	MappedColumn<u32> output_txo_index;
+	MappedColumn<u64> output_value;
+	MappedColumn<u32> output_required_spenders;
+	//Input id, or 0 if unspent.
+	MappedColumn<u64> output_spent_by;
+	MappedColumn<u64> tx_blocks_id;
+	MappedColumn<u32> tx_index_in_block;
+	MappedColumn<u32> tx_locktime;
+	MappedColumn<u64> tx_first_output_id;
+	MappedColumn<u32> tx_output_count;
+	MappedFile journal;
+	u64 generation;
+	//Rows before these were committed. Writes to later rows go straight to
+	//the files.
+	u64 committed_outputs_end;
+	u64 committed_txs_end;
+	//output id -> (committed value, new value)
+	std::map<u64, std::pair<u64, u64>> pending_spent_by;
+	bool commit_pending = false;
+
+	ColumnStore(sqlite3pp::DB &db, const std::string &directory);
+	void load();
+	void rebuild();
+	void restore_from_journal();
+	void write_journal();
+	void set_files_generation(u64);
+	void flush();
+	u64 get_table_end(const char *table);
+public:
+	//Returns null if the store isn't enabled for this database.
+	static std::unique_ptr<ColumnStore> open(sqlite3pp::DB &db, const std::string &db_path);
+	//Enables the store. The files are built from the database the next time
+	//it's opened.
+	static void enable(sqlite3pp::DB &db);
+	~ColumnStore();
+	ColumnStore(const ColumnStore &) = delete;
+	const ColumnStore &operator=(const ColumnStore &) = delete;
+
+	void add_tx(u64 id, u64 block_id, u32 index_in_block, u32 locktime, u32 output_count);
+	//Outputs of a tx must be added in order and have consecutive ids.
+	void add_output(u64 id, u64 tx_id, u32 txo_index, u64 value, u32 required_spenders);
+	boost::optional<u64> find_output(u64 tx_id, u32 txo_index) const;
+	OutputColumns get_output(u64 id) const;
+	u64 get_output_value(u64 id) const{
+		return this->output_value.get(id);
+	}
+	boost::optional<u64> get_spent_by(u64 id) const;
+	void set_spent_by(u64 id, const boost::optional<u64> &input_id);
+	u64 get_first_output(u64 tx_id) const{
+		return this->tx_first_output_id.get(tx_id);
+	}
+	u32 get_output_count(u64 tx_id) const{
+		return this->tx_output_count.get(tx_id);
+	}
+
+	void before_commit() override;
+	void after_commit() override;
+	void after_rollback() override;
+};
@@ -0,0 +1,23 @@
+#include "DeferredIndexes.h"
+#include "SplitLayout.h"
+#include <common/types.h>
+
+using namespace sqlite3pp;
+
+//Indexes on the same table are kept together, so that the table is read
+//while it's still cached.
+const std::vector<DeferredIndex> deferred_indexes = {
+	{ "inputs_by_previous_tx_id", "inputs", "create index inputs_by_previous_tx_id on inputs (previous_tx_id);" },
+	{ "inputs_by_txs_id", "inputs", "create index inputs_by_txs_id on inputs (txs_id);" },
+	{ "inputs_by_outputs_id", "inputs", "create index inputs_by_outputs_id on inputs (outputs_id);" },
+};
+
+std::vector<DeferredIndex> get_missing_deferred_indexes(DB &db){
+	std::vector<DeferredIndex> ret;
+	for (auto &index : deferred_indexes){
+		//Indexes are stored with their tables.
+		if (!db.index_exists(index.name, get_table_schema(db, index.table)))
+			ret.push_back(index);
+	}
+	return ret;
+}
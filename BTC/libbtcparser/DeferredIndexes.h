@@ -0,0 +1,21 @@
+#pragma once
+
+#include <sqlitepp/sqlitepp.h>
+#include <vector>
+
+//Indexes that the initial sync leaves out, since keeping them up to date
+//while the chain is parsed costs more than building them at the end.
+//blockchain_parser builds them in its last phase. Each one is recorded as
+//built by its presence in sqlite_master, so an interrupted build only
+//repeats the indexes that weren't finished. The indexer won't open a DB that
+//lacks any of them.
+struct DeferredIndex{
+	const char *name;
+	const char *table;
+	const char *definition;
+};
+
+extern const std::vector<DeferredIndex> deferred_indexes;
+
+//Returns the deferred indexes db doesn't have yet, in build order.
+std::vector<DeferredIndex> get_missing_deferred_indexes(sqlite3pp::DB &db);
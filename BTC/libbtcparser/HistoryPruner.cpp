@@ -0,0 +1,147 @@
+#include "HistoryPruner.h"
+#include "Blockchain.h"
+#include "SplitLayout.h"
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace sqlite3pp;
+
+HistoryPruner::HistoryPruner(DB &db, PostingLists &postings)
+	: db(db)
+	, postings(postings)
+	, get_first_transaction(db << "select first_transaction_id from blocks where hash = ? and first_transaction_id is not null;")
+	, set_history_begin(db << "update prune_state set history_begin = ?;")
+	, set_pruned_end(db << "update prune_state set pruned_end = ?;")
+	, select_created_addresses(db << "select distinct addresses_outputs.addresses_id from outputs inner join addresses_outputs on addresses_outputs.outputs_id = outputs.id where outputs.txs_id >= ? and outputs.txs_id < ?;")
+	, select_spent_outputs(db << "select inputs.outputs_id, outputs.txs_id from inputs inner join outputs on outputs.id = inputs.outputs_id where inputs.txs_id >= ? and inputs.txs_id < ?;")
+	, select_output_addresses(db << "select addresses_id from addresses_outputs where outputs_id = ?;")
+	, delete_output_relations(db << "delete from addresses_outputs where outputs_id = ?;")
+	, delete_output(db << "delete from outputs where id = ?;")
+	, delete_inputs(db << "delete from inputs where txs_id >= ? and txs_id < ?;")
+	, delete_tx(db << "delete from txs where id = ?1 and not exists (select * from outputs where txs_id = ?1);")
+	, delete_txs(db << "delete from txs where id >= ? and id < ? and not exists (select * from outputs where outputs.txs_id = txs.id);")
+	, delete_tx_location(db << "delete from tx_locations where txs_id = ?1 and not exists (select * from txs where id = ?1);")
+	, delete_tx_locations(db << "delete from tx_locations where txs_id >= ? and txs_id < ? and not exists (select * from txs where txs.id = tx_locations.txs_id);"){
+	this->reload();
+}
+
+void HistoryPruner::reload(){
+	this->db << "select keep_blocks, history_begin, pruned_end from prune_state;" << Step() >> this->keep_blocks >> this->history_begin >> this->pruned_end;
+}
+
+std::unique_ptr<HistoryPruner> HistoryPruner::open(DB &db, PostingLists &postings){
+	if (!db.table_exists("prune_state"))
+		return nullptr;
+	if (db.table_exists("column_store"))
+		throw std::runtime_error("The pruned profile can't be used with the column store.");
+	return std::unique_ptr<HistoryPruner>(new HistoryPruner(db, postings));
+}
+
+void HistoryPruner::enable(DB &db, u64 keep_blocks){
+	if (keep_blocks < min_keep_blocks)
+		throw std::runtime_error("The pruned profile must keep at least " + std::to_string(min_keep_blocks) + " blocks.");
+	if (db.table_exists("column_store"))
+		throw std::runtime_error("The pruned profile can't be used with the column store.");
+	Transaction t(db);
+	//Used to find the blocks of pruned txs.
+	db.exec(("create index if not exists " + get_table_schema(db, "blocks") + ".blocks_by_first_transaction_id on blocks (first_transaction_id);").c_str());
+	db.exec("create table if not exists prune_state (keep_blocks integer, history_begin integer, pruned_end integer);");
+	u64 count;
+	db << "select count(*) from prune_state;" << Step() >> count;
+	if (!count)
+		db << "insert into prune_state (keep_blocks, history_begin, pruned_end) values (?, 1, 1);" << keep_blocks << Step();
+	else
+		db << "update prune_state set keep_blocks = ?;" << keep_blocks << Step();
+}
+
+bool HistoryPruner::update_horizon(const Blockchain &blockchain){
+	auto height = blockchain.get_height();
+	if (height != std::numeric_limits<u64>::max() && height + 1 > this->keep_blocks){
+		auto block = blockchain.get_block_by_height(height + 1 - this->keep_blocks);
+		//blockchain_parser keeps the rows of the blocks it found in the block
+		//files apart from those of the blocks it has parsed, so the block is
+		//looked up by hash. Blocks that haven't been parsed yet have no txs.
+		u64 first_transaction;
+		this->get_first_transaction << Reset() << (std::string)block->hash;
+		bool parsed = this->get_first_transaction.step() == SQLITE_ROW;
+		if (parsed)
+			this->get_first_transaction >> first_transaction;
+		this->get_first_transaction << Reset();
+		if (parsed && first_transaction > this->history_begin){
+			this->set_history_begin << Reset() << first_transaction << Step();
+			this->history_begin = first_transaction;
+		}
+	}
+	return this->pruned_end < this->history_begin;
+}
+
+bool HistoryPruner::prune_batch(u64 max_txs){
+	if (this->pruned_end >= this->history_begin)
+		return false;
+	auto begin = this->pruned_end;
+	auto end = std::min(this->history_begin, begin + max_txs);
+
+	//Addresses of the txs in the batch: those of the outputs they create,
+	//read before any of them is deleted, and those of the outputs they spend
+	//(see below).
+	std::set<u64> tx_addresses;
+	this->select_created_addresses << Reset() << begin << end;
+	while (this->select_created_addresses.step() == SQLITE_ROW){
+		u64 address;
+		this->select_created_addresses >> address;
+		tx_addresses.insert(address);
+	}
+	this->select_created_addresses << Reset();
+
+	//Outputs spent by the inputs about to be deleted. Every output is spent
+	//after it's created, so they all belong to txs before end.
+	std::vector<std::pair<u64, u64>> spent;
+	this->select_spent_outputs << Reset() << begin << end;
+	while (this->select_spent_outputs.step() == SQLITE_ROW){
+		std::pair<u64, u64> output;
+		this->select_spent_outputs >> output.first >> output.second;
+		spent.push_back(output);
+	}
+	this->select_spent_outputs << Reset();
+	std::sort(spent.begin(), spent.end());
+
+	std::map<u64, std::vector<u64>> erased_outputs;
+	std::set<u64> emptied_txs;
+	for (auto &output : spent){
+		this->select_output_addresses << Reset() << output.first;
+		while (this->select_output_addresses.step() == SQLITE_ROW){
+			u64 address;
+			this->select_output_addresses >> address;
+			erased_outputs[address].push_back(output.first);
+		}
+		this->select_output_addresses << Reset();
+		this->delete_output_relations << Reset() << output.first << Step();
+		this->delete_output << Reset() << output.first << Step();
+		if (output.second < begin)
+			emptied_txs.insert(output.second);
+	}
+	for (auto &kv : erased_outputs){
+		this->postings.erase(kv.first, PostingKind::Outputs, kv.second);
+		tx_addresses.insert(kv.first);
+	}
+	this->delete_inputs << Reset() << begin << end << Step();
+
+	for (auto address : tx_addresses)
+		this->postings.prune(address, PostingKind::Txs, end);
+
+	//Txs before the batch lose their row once their last output is spent by
+	//a pruned input.
+	for (auto tx : emptied_txs){
+		this->delete_tx << Reset() << tx << Step();
+		this->delete_tx_location << Reset() << tx << Step();
+	}
+	this->delete_txs << Reset() << begin << end << Step();
+	this->delete_tx_locations << Reset() << begin << end << Step();
+
+	this->set_pruned_end << Reset() << end << Step();
+	this->pruned_end = end;
+	return this->pruned_end < this->history_begin;
+}
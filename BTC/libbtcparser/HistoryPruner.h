@@ -0,0 +1,77 @@
+#pragma once
+
+#include "PostingLists.h"
+#include <common/types.h>
+#include <sqlitepp/sqlitepp.h>
+#include <memory>
+
+class Blockchain;
+
+//Optional pruned profile, for deployments that only need balances, UTXOs and
+//recent history. Only the last keep_blocks blocks of the chain keep their full
+//history. Below the horizon (the first tx of the oldest of those blocks) every
+//input is deleted, along with the outputs they spent, the address relations
+//of both, the ids they held in the posting lists, and the txs left without
+//outputs. What remains of older txs are their unspent outputs, so the UTXO set
+//and the balances stay exact, and the size of the DB follows the size of the
+//UTXO set rather than that of the chain. The tx posting lists keep the count
+//and range of the ids they lose (see PostingLists::prune()), so per-address
+//usage summaries stay exact as well.
+//
+//The profile is enabled by the presence of the prune_state table, which
+//records keep_blocks, the horizon (history_begin) and how far pruning has got
+//(pruned_end). Moving the horizon is cheap; the deletions are made afterwards
+//in batches of txs, each of which should be run in a transaction of its own.
+//The horizon never moves back, so blocks before it can't be reverted. The
+//profile can't be used with the column store.
+class HistoryPruner{
+	sqlite3pp::DB &db;
+	PostingLists &postings;
+	u64 keep_blocks;
+	u64 history_begin;
+	u64 pruned_end;
+	sqlite3pp::Statement get_first_transaction;
+	sqlite3pp::Statement set_history_begin;
+	sqlite3pp::Statement set_pruned_end;
+	sqlite3pp::Statement select_created_addresses;
+	sqlite3pp::Statement select_spent_outputs;
+	sqlite3pp::Statement select_output_addresses;
+	sqlite3pp::Statement delete_output_relations;
+	sqlite3pp::Statement delete_output;
+	sqlite3pp::Statement delete_inputs;
+	sqlite3pp::Statement delete_tx;
+	sqlite3pp::Statement delete_txs;
+	sqlite3pp::Statement delete_tx_location;
+	sqlite3pp::Statement delete_tx_locations;
+
+	HistoryPruner(sqlite3pp::DB &, PostingLists &);
+public:
+	//Blocks that may still be reverted by a reorganization must keep their
+	//history. This is the depth of the indexer's undo log.
+	static const u64 min_keep_blocks = 288;
+
+	//Returns null if the profile isn't enabled.
+	static std::unique_ptr<HistoryPruner> open(sqlite3pp::DB &, PostingLists &);
+	//Enables the profile, or changes keep_blocks if it's already enabled.
+	static void enable(sqlite3pp::DB &, u64 keep_blocks);
+
+	u64 get_keep_blocks() const{
+		return this->keep_blocks;
+	}
+	//Id of the first tx with a complete history.
+	u64 get_history_begin() const{
+		return this->history_begin;
+	}
+	//Number of txs before the horizon that haven't been pruned yet.
+	u64 get_pending() const{
+		return this->history_begin - this->pruned_end;
+	}
+	//Reads the state from the DB again, after a rollback.
+	void reload();
+	//Moves the horizon so that only the last keep_blocks blocks of blockchain
+	//keep their history. Returns whether there's anything to prune.
+	bool update_horizon(const Blockchain &);
+	//Prunes the history of up to max_txs txs. Returns whether there's more to
+	//prune.
+	bool prune_batch(u64 max_txs);
+};
@@ -1,120 +1,293 @@
 #include "InsertState.h"
+#include "ColumnStore.h"
+#include "SplitLayout.h"
 #include <sstream>
 #include <limits>
+#include <algorithm>
 
-InsertState::InsertState(sqlite3pp::DB &db)
+namespace{
+
+//Hex form of a hash in a stack buffer, so that it can be bound without
+//allocating. Must outlive the step() of the statement it's bound to.
+class HashText{
+	char text[Hashes::Digests::SHA256::string_size];
+public:
+	HashText(const Hashes::Digests::SHA256 &hash){
+		hash.write_to_char_array(this->text);
+	}
+	boost::string_view view() const{
+		return { this->text, sizeof(this->text) - 1 };
+	}
+};
+
+void throw_unknown_txo(u32 txi_index, const Hashes::Digests::SHA256 &previous_tx, u32 txo_index){
+	std::stringstream stream;
+	stream << "Error while adding input index " << txi_index << ": input references unknown txo " << previous_tx << ", " << txo_index;
+	throw std::runtime_error(stream.str());
+}
+
+}
+
+InsertState::InsertState(sqlite3pp::DB &db, ColumnStore *column_store)
 	: db(db)
-	, insert_block_stmt(db << "insert into blocks (hash, previous_hash, timestamp, first_transaction_id, transaction_count) values (?, ?, ?, ?, ?);")
-	, insert_tx_stmt(db << "insert into txs (id, hash, whash, locktime, blocks_id, index_in_block, input_count, output_count) values (?, ?, ?, ?, ?, ?, ?, ?);")
+	, column_store(column_store)
+	, insert_block_stmt(db << "insert into blocks (id, hash, previous_hash, timestamp, first_transaction_id, transaction_count, file_name, file_offset, size_in_file) values (?, ?, ?, ?, ?, ?, ?, ?, ?);")
 	, find_tx(db << "select id from txs where hash = ?;")
-	, find_output(db << "select id from outputs where txs_id = ? and txo_index = ?;")
-	, insert_input_stmt(db << "insert into inputs (previous_tx_id, txo_index, outputs_id, txs_id, txi_index) values (?, ?, ?, ?, ?);")
+	, find_output(db << "select id, value from outputs where txs_id = ? and txo_index = ?;")
 	, update_output_stmt(db << "update outputs set spent_by = ? where id = ?;")
-	, insert_output_stmt(db << "insert into outputs (txs_id, txo_index, value, required_spenders, script) values (?, ?, ?, ?, ?);")
 	, select_address_stmt(db << "select id from addresses where address = ?;")
 	, insert_address_stmt(db << "insert into addresses (address) values (?);")
 	, select_output_addresses_stmt(db << "select addresses_id from addresses_outputs where outputs_id = ?;")
-	, insert_relation1_stmt(db << "insert into addresses_outputs (addresses_id, outputs_id) values (?, ?);")
-	, insert_relation2_stmt(db << "insert into addresses_txs (addresses_id, txs_id) values (?, ?);"){
-		
-	using namespace sqlite3pp;
+	, txs(db, "insert into txs (id, hash, whash, locktime, blocks_id, index_in_block, input_count, output_count)")
+	, inputs(db, "insert into inputs (id, previous_tx_id, txo_index, outputs_id, txs_id, txi_index)")
+	, outputs(db, "insert into outputs (id, txs_id, txo_index, value, required_spenders, script, spent_by)")
+	, relations1(db, "insert into addresses_outputs (addresses_id, outputs_id)")
+	, relations2(db, "insert into addresses_txs (addresses_id, txs_id)")
+	, tx_locations(initialize_locations_table(db), "insert into tx_locations (txs_id, file_offset, size_in_file)")
+	, postings(db)
+	, address_filter(db){
 
-	u64 count;
-	this->db << "select count(*) from (select * from txs limit 1);" << Step() >> count;
-	if (!count)
-		this->next_transaction_id = 1;
-	else{
-		this->db << "select max(id) from txs;" << Step() >> this->next_transaction_id;
-		this->next_transaction_id++;
-	}
+	this->reload();
+}
+
+void InsertState::reload(){
+	this->next_transaction_id = this->get_next_id("txs");
+	this->next_input_id = this->get_next_id("inputs");
+	this->next_output_id = this->get_next_id("outputs");
+	this->discard();
+}
+
+sqlite3pp::DB &InsertState::initialize_locations_table(sqlite3pp::DB &db){
+	db.exec((
+		"create table if not exists " + get_table_schema(db, "tx_locations") + ".tx_locations (\n"
+		"    txs_id integer primary key,\n"
+		"    file_offset integer,\n"
+		"    size_in_file integer\n"
+		");"
+	).c_str());
+	return db;
 }
 
-u64 InsertState::insert_block(const std::string &hash, const std::string &prev_hash, u32 timestamp, u32 transaction_count){
+u64 InsertState::get_next_id(const char *table){
 	using namespace sqlite3pp;
-	this->insert_block_stmt << Reset() << hash << prev_hash << timestamp << this->next_transaction_id << transaction_count << Step();
-	return this->db.last_insert_rowid();
+	std::string query = "select coalesce(max(id), 0) from ";
+	query += table;
+	query += ';';
+	u64 ret;
+	this->db << query.c_str() << Step() >> ret;
+	return ret + 1;
 }
 
-u64 InsertState::insert_tx(const std::string &hash, const std::string &whash, u32 locktime, u64 block_id, u32 index_in_block, u32 input_count, u32 output_count){
+u64 InsertState::insert_block(const SHA256 &hash, const SHA256 &prev_hash, u32 timestamp, u32 transaction_count, const BlockFileLocation *location){
 	using namespace sqlite3pp;
-	this->insert_tx_stmt << Reset() << this->next_transaction_id++ << hash;
-	if (whash != hash)
-		this->insert_tx_stmt << whash;
+	HashText hash_text(hash), prev_hash_text(prev_hash);
+	this->insert_block_stmt << Reset();
+	if (this->assign_block_ids)
+		this->insert_block_stmt << this->next_block_id++;
 	else
-		this->insert_tx_stmt << Null();
-	this->insert_tx_stmt << locktime << block_id << index_in_block << input_count << output_count << Step();
+		this->insert_block_stmt << Null();
+	this->insert_block_stmt << hash_text.view() << prev_hash_text.view() << timestamp << this->next_transaction_id << transaction_count;
+	if (location){
+		this->insert_block_stmt << location->file_name << location->file_offset << location->size;
+		auto id = this->next_transaction_id;
+		for (auto &tx : location->txs)
+			this->tx_locations.add(id++, tx.first, tx.second);
+	}else
+		this->insert_block_stmt << Null() << Null() << Null();
+	this->insert_block_stmt << Step();
 	return this->db.last_insert_rowid();
 }
 
-u64 InsertState::insert_input(const std::string &previous_tx, u32 txo_index, u64 current_txs_id, u32 txi_index, u64 &previous_output_id){
+void InsertState::create_deferral_tables(){
+	this->db.exec(
+		"create table if not exists unresolved_inputs (\n"
+		"    inputs_id integer primary key,\n"
+		"    txs_id integer,\n"
+		"    previous_tx_hash text,\n"
+		"    txo_index integer\n"
+		");"
+	);
+	this->unresolved_inputs.reset(new sqlite3pp::BulkInserter<4>(this->db, "insert into unresolved_inputs (inputs_id, txs_id, previous_tx_hash, txo_index)"));
+}
+
+void InsertState::begin_shard(u64 first_block_id, u64 first_transaction_id){
+	if (this->column_store)
+		throw std::runtime_error("Shards can't use the column store.");
+	this->create_deferral_tables();
+	this->db.exec(
+		"create table if not exists addresses_txs (\n"
+		"    addresses_id integer,\n"
+		"    txs_id integer\n"
+		");"
+	);
+	this->db.exec(
+		"create table if not exists deferred_tx_addresses (\n"
+		"    addresses_id integer,\n"
+		"    txs_id integer\n"
+		");"
+	);
+	this->deferred_tx_addresses.reset(new sqlite3pp::BulkInserter<2>(this->db, "insert into deferred_tx_addresses (addresses_id, txs_id)"));
+	this->input_deferral = InputDeferral::Missing;
+	this->assign_block_ids = true;
+	this->next_block_id = first_block_id;
+	this->next_transaction_id = first_transaction_id;
+}
+
+void InsertState::begin_bulk(RelationSink &sink){
+	if (this->column_store)
+		throw std::runtime_error("Bulk syncs can't use the column store.");
+	this->create_deferral_tables();
+	this->input_deferral = InputDeferral::Flushed;
+	this->relation_sink = &sink;
+}
+
+u64 InsertState::insert_tx(const SHA256 &hash, const SHA256 &whash, u32 locktime, u64 block_id, u32 index_in_block, u32 input_count, u32 output_count){
+	using namespace sqlite3pp;
+	HashText hash_text(hash), whash_text(whash);
+	boost::optional<boost::string_view> whash_view;
+	if (whash != hash)
+		whash_view = whash_text.view();
+	auto ret = this->next_transaction_id++;
+	this->txs.add(ret, hash_text.view(), whash_view, locktime, block_id, index_in_block, input_count, output_count);
+	this->pending_txs[hash] = ret;
+	if (this->column_store)
+		this->column_store->add_tx(ret, block_id, index_in_block, locktime, output_count);
+	return ret;
+}
+
+bool InsertState::find_pending_output(u64 tx_id, u32 txo_index, u64 &output_id, u64 &value){
+	auto it = this->pending_tx_outputs.find(tx_id);
+	if (it == this->pending_tx_outputs.end())
+		return false;
+	auto id = it->second + txo_index;
+	auto row = id - this->pending_outputs_begin;
+	if (id >= this->next_output_id || (u64)this->outputs.get_integer(row, 1) != tx_id || (u32)this->outputs.get_integer(row, 2) != txo_index)
+		return false;
+	output_id = id;
+	value = this->outputs.get_integer(row, 3);
+	return true;
+}
+
+u64 InsertState::insert_input(const SHA256 &previous_tx, u32 txo_index, u64 current_txs_id, u32 txi_index, u64 &previous_output_id, u64 &previous_output_value){
 	using namespace sqlite3pp;
 
-	bool all_zeroes = true;
-	for (auto c : previous_tx)
-		if (c != '0')
-			all_zeroes = false;
+	auto &digest = previous_tx.to_array();
+	bool all_zeroes = std::all_of(digest.begin(), digest.end(), [](u8 b){ return !b; });
+
+	auto ret = this->next_input_id++;
 
 	if (all_zeroes){
-		this->insert_input_stmt << Reset() << Null() << Null() << Null() << current_txs_id << txi_index << Step();
+		this->inputs.add(ret, Null(), Null(), Null(), current_txs_id, txi_index);
 		previous_output_id = std::numeric_limits<u64>::max();
-		return this->db.last_insert_rowid();
+		previous_output_value = 0;
+		return ret;
 	}
 
-	this->find_tx << Reset() << previous_tx;
-	if (this->find_tx.step() != SQLITE_ROW){
-		std::stringstream stream;
-		stream << "Error while adding input index " << txi_index << ": input references unknown tx " << previous_tx;
-		throw std::runtime_error(stream.str());
-	}
 	u64 tx_id;
-	this->find_tx >> tx_id;
-
-	this->find_output << Reset() << tx_id << txo_index;
-	if (this->find_output.step() != SQLITE_ROW){
-		std::stringstream stream;
-		stream << "Error while adding input index " << txi_index << ": input references unknown txo " << previous_tx << ", " << txo_index;
-		throw std::runtime_error(stream.str());
+	auto pending_tx = this->pending_txs.find(previous_tx);
+	if (pending_tx != this->pending_txs.end())
+		tx_id = pending_tx->second;
+	else{
+		HashText previous_tx_text(previous_tx);
+		if (this->input_deferral == InputDeferral::Flushed)
+			return this->defer_input(ret, current_txs_id, txi_index, previous_tx_text.view(), txo_index, previous_output_id, previous_output_value);
+		this->find_tx << Reset() << previous_tx_text.view();
+		if (this->find_tx.step() != SQLITE_ROW){
+			if (this->input_deferral == InputDeferral::Missing)
+				return this->defer_input(ret, current_txs_id, txi_index, previous_tx_text.view(), txo_index, previous_output_id, previous_output_value);
+			std::stringstream stream;
+			stream << "Error while adding input index " << txi_index << ": input references unknown tx " << previous_tx;
+			throw std::runtime_error(stream.str());
+		}
+		this->find_tx >> tx_id;
 	}
+
 	u64 txo_id;
-	this->find_output >> txo_id;
+	if (this->column_store){
+		auto id = this->column_store->find_output(tx_id, txo_index);
+		if (!id)
+			throw_unknown_txo(txi_index, previous_tx, txo_index);
+		txo_id = *id;
+		previous_output_value = this->column_store->get_output_value(txo_id);
+		this->column_store->set_spent_by(txo_id, ret);
+		if (txo_id >= this->pending_outputs_begin)
+			this->outputs.set_integer(txo_id - this->pending_outputs_begin, 6, ret);
+		else
+			this->update_output_stmt << Reset() << ret << txo_id << Step();
+	}else if (this->find_pending_output(tx_id, txo_index, txo_id, previous_output_value)){
+		this->outputs.set_integer(txo_id - this->pending_outputs_begin, 6, ret);
+	}else{
+		this->find_output << Reset() << tx_id << txo_index;
+		if (this->find_output.step() != SQLITE_ROW)
+			throw_unknown_txo(txi_index, previous_tx, txo_index);
+		this->find_output >> txo_id >> previous_output_value;
+		this->update_output_stmt << Reset() << ret << txo_id << Step();
+	}
 	previous_output_id = txo_id;
 
-	this->insert_input_stmt << Reset() << tx_id << txo_index << txo_id << current_txs_id << txi_index << Step();
-	u64 ret = this->db.last_insert_rowid();
-
-	this->update_output_stmt << Reset() << ret << txo_id << Step();
+	this->inputs.add(ret, tx_id, txo_index, txo_id, current_txs_id, txi_index);
 
 	return ret;
 }
 
+//The input is stored without previous tx and output, and reported as if it
+//spent nothing.
+u64 InsertState::defer_input(u64 input_id, u64 current_txs_id, u32 txi_index, boost::string_view previous_tx, u32 txo_index, u64 &previous_output_id, u64 &previous_output_value){
+	using namespace sqlite3pp;
+	this->inputs.add(input_id, Null(), txo_index, Null(), current_txs_id, txi_index);
+	this->unresolved_inputs->add(input_id, current_txs_id, previous_tx, txo_index);
+	this->deferred_txs.insert(current_txs_id);
+	previous_output_id = std::numeric_limits<u64>::max();
+	previous_output_value = 0;
+	return input_id;
+}
+
 u64 InsertState::insert_output(u64 tx, u32 txo_index, u64 value, u32 required_spenders, const std::vector<u8> &script){
 	using namespace sqlite3pp;
-	this->insert_output_stmt << Reset() << tx << txo_index << value << required_spenders << script << Step();
-	return this->db.last_insert_rowid();
+	auto ret = this->next_output_id++;
+	if (!txo_index)
+		this->pending_tx_outputs[tx] = ret;
+	this->outputs.add(ret, tx, txo_index, value, required_spenders, script, Null());
+	if (this->column_store)
+		this->column_store->add_output(ret, tx, txo_index, value, required_spenders);
+	this->pending_output_relations.push_back(this->relations1.size());
+	return ret;
 }
 
 u64 InsertState::insert_address_if_it_doesnt_exist(const std::string &address){
 	using namespace sqlite3pp;
-	this->select_address_stmt << Reset() << address;
-	if (this->select_address_stmt.step() == SQLITE_ROW){
-		u64 ret;
-		this->select_address_stmt >> ret;
-		return ret;
+	if (this->address_filter.may_contain(address)){
+		this->select_address_stmt << Reset() << no_copy(address);
+		if (this->select_address_stmt.step() == SQLITE_ROW){
+			u64 ret;
+			this->select_address_stmt >> ret;
+			return ret;
+		}
 	}
-	this->insert_address_stmt << Reset() << address << Step();
-	return this->db.last_insert_rowid();
+	this->insert_address_stmt << Reset() << no_copy(address) << Step();
+	auto ret = this->db.last_insert_rowid();
+	this->address_filter.add(address);
+	return ret;
 }
 
 void InsertState::add_addresses_outputs_relations(u64 output_id, const std::set<u64> &address_ids){
 	using namespace sqlite3pp;
 	for (auto &addr : address_ids)
-		this->insert_relation1_stmt << Reset() << addr << output_id << Step();
+		this->relations1.add(addr, output_id);
 }
 
 std::set<u64> InsertState::get_addresses_for_output(u64 output_id){
 	using namespace sqlite3pp;
-	this->select_output_addresses_stmt << Reset() << output_id;
 	std::set<u64> ret;
+	if (output_id >= this->pending_outputs_begin){
+		auto i = output_id - this->pending_outputs_begin;
+		auto begin = this->pending_output_relations[i];
+		auto end = i + 1 < this->pending_output_relations.size() ? this->pending_output_relations[i + 1] : this->relations1.size();
+		for (auto j = begin; j < end; j++)
+			ret.insert(this->relations1.get_integer(j, 0));
+		return ret;
+	}
+	this->select_output_addresses_stmt << Reset() << output_id;
 	while (this->select_output_addresses_stmt.step() == SQLITE_ROW){
 		u64 id;
 		this->select_output_addresses_stmt >> id;
@@ -125,6 +298,77 @@ std::set<u64> InsertState::get_addresses_for_output(u64 output_id){
 
 void InsertState::add_addresses_tx_relations(u64 tx_id, const std::set<u64> &addresses){
 	using namespace sqlite3pp;
+	auto &relations = this->deferred_tx_addresses && this->deferred_txs.count(tx_id) ? *this->deferred_tx_addresses : this->relations2;
 	for (auto addr : addresses)
-		this->insert_relation2_stmt << Reset() << addr << tx_id << Step();
+		relations.add(addr, tx_id);
+}
+
+void InsertState::flush(){
+	this->txs.flush();
+	this->tx_locations.flush();
+	this->outputs.flush();
+	this->inputs.flush();
+	this->flush_relations(this->relations1, PostingKind::Outputs);
+	this->flush_relations(this->relations2, PostingKind::Txs);
+	if (this->unresolved_inputs)
+		this->unresolved_inputs->flush();
+	if (this->deferred_tx_addresses)
+		this->deferred_tx_addresses->flush();
+	this->clear_pending();
+}
+
+void InsertState::flush_relations(sqlite3pp::BulkInserter<2> &relations, PostingKind kind){
+	if (this->relation_sink){
+		for (size_t i = 0; i < relations.size(); i++){
+			auto address = relations.get_integer(i, 0);
+			auto id = relations.get_integer(i, 1);
+			if (kind == PostingKind::Outputs)
+				this->relation_sink->add_output_address(address, id);
+			else
+				this->relation_sink->add_tx_address(address, id);
+		}
+		relations.clear();
+		return;
+	}
+	//The sort is stable and rows were added in id order, so the ids of each
+	//address come out sorted.
+	auto order = relations.sort_order(0);
+	//See begin_bulk().
+	if (this->input_deferral == InputDeferral::Never){
+		std::vector<u64> ids;
+		for (size_t i = 0; i < order.size();){
+			auto address = relations.get_integer(order[i], 0);
+			ids.clear();
+			for (; i < order.size() && relations.get_integer(order[i], 0) == address; i++)
+				ids.push_back(relations.get_integer(order[i], 1));
+			this->postings.append(address, kind, ids);
+		}
+		if (kind == PostingKind::Txs){
+			relations.clear();
+			return;
+		}
+	}
+	relations.flush(order);
+}
+
+void InsertState::discard(){
+	this->txs.clear();
+	this->tx_locations.clear();
+	this->outputs.clear();
+	this->inputs.clear();
+	this->relations1.clear();
+	this->relations2.clear();
+	if (this->unresolved_inputs)
+		this->unresolved_inputs->clear();
+	if (this->deferred_tx_addresses)
+		this->deferred_tx_addresses->clear();
+	this->clear_pending();
+}
+
+void InsertState::clear_pending(){
+	this->pending_outputs_begin = this->next_output_id;
+	this->pending_txs.clear();
+	this->pending_tx_outputs.clear();
+	this->pending_output_relations.clear();
+	this->deferred_txs.clear();
 }
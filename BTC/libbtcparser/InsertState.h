@@ -1,32 +1,144 @@
 #pragma once
 
 #include <common/types.h>
+#include <libhash/hash.h>
 #include <sqlitepp/sqlitepp.h>
+#include "PostingLists.h"
+#include "AddressFilter.h"
 #include <set>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
+class ColumnStore;
+
+//Receives the address relations of a bulk sync in place of the relation
+//tables. See InsertState::begin_bulk().
+class RelationSink{
+public:
+	virtual ~RelationSink(){}
+	virtual void add_output_address(u64 address_id, u64 output_id) = 0;
+	virtual void add_tx_address(u64 address_id, u64 tx_id) = 0;
+};
+
+//Where a block that was parsed from a block file is stored. Offsets are from
+//the start of the file.
+struct BlockFileLocation{
+	std::string file_name;
+	u64 file_offset;
+	u64 size;
+	//Offset and size of each of the block's txs, in order.
+	std::vector<std::pair<u64, u64>> txs;
+};
+
+//Rows for txs, tx locations, inputs, outputs and address relations are
+//buffered and only written by flush(). Rows that haven't been flushed yet are still
+//visible to the lookups insert_input() and get_addresses_for_output() do.
+//The relations between addresses and txs only go to the posting lists, except
+//in shards (see begin_shard()).
 class InsertState{
+public:
+	using SHA256 = Hashes::Digests::SHA256;
+private:
 	sqlite3pp::DB &db;
+	ColumnStore *column_store;
 	sqlite3pp::Statement insert_block_stmt;
-	sqlite3pp::Statement insert_tx_stmt;
 	sqlite3pp::Statement find_tx;
 	sqlite3pp::Statement find_output;
-	sqlite3pp::Statement insert_input_stmt;
 	sqlite3pp::Statement update_output_stmt;
-	sqlite3pp::Statement insert_output_stmt;
 	sqlite3pp::Statement select_address_stmt;
 	sqlite3pp::Statement insert_address_stmt;
-	sqlite3pp::Statement insert_relation1_stmt;
 	sqlite3pp::Statement select_output_addresses_stmt;
-	sqlite3pp::Statement insert_relation2_stmt;
+	sqlite3pp::BulkInserter<8> txs;
+	sqlite3pp::BulkInserter<6> inputs;
+	sqlite3pp::BulkInserter<7> outputs;
+	sqlite3pp::BulkInserter<2> relations1;
+	sqlite3pp::BulkInserter<2> relations2;
+	sqlite3pp::BulkInserter<3> tx_locations;
+	PostingLists postings;
+	AddressFilter address_filter;
 	u64 next_transaction_id;
+	u64 next_input_id;
+	u64 next_output_id;
+	//Id of the first output in this->outputs.
+	u64 pending_outputs_begin;
+	std::map<SHA256, u64> pending_txs;
+	//Maps unflushed tx ids to the id of their first output.
+	std::map<u64, u64> pending_tx_outputs;
+	//For each output in this->outputs, the first of its rows in this->relations1.
+	std::vector<size_t> pending_output_relations;
+	//See begin_shard() and begin_bulk().
+	enum class InputDeferral{
+		//Every input must spend a known tx.
+		Never,
+		//Inputs that spend txs not in the DB are deferred.
+		Missing,
+		//Inputs that spend txs inserted before the last flush are deferred.
+		Flushed,
+	};
+	InputDeferral input_deferral = InputDeferral::Never;
+	bool assign_block_ids = false;
+	u64 next_block_id = 0;
+	RelationSink *relation_sink = nullptr;
+	std::unique_ptr<sqlite3pp::BulkInserter<4>> unresolved_inputs;
+	std::unique_ptr<sqlite3pp::BulkInserter<2>> deferred_tx_addresses;
+	std::set<u64> deferred_txs;
+
+	u64 get_next_id(const char *table);
+	bool find_pending_output(u64 tx_id, u32 txo_index, u64 &output_id, u64 &value);
+	void clear_pending();
+	void create_deferral_tables();
+	u64 defer_input(u64 input_id, u64 current_txs_id, u32 txi_index, boost::string_view previous_tx, u32 txo_index, u64 &previous_output_id, u64 &previous_output_value);
+	void flush_relations(sqlite3pp::BulkInserter<2> &relations, PostingKind);
 public:
-	InsertState(sqlite3pp::DB &db);
-	u64 insert_block(const std::string &hash, const std::string &prev_hash, u32 timestamp, u32 transaction_count);
-	u64 insert_tx(const std::string &hash, const std::string &whash, u32 locktime, u64 block_id, u32 index_in_block, u32 input_count, u32 output_count);
-	u64 insert_input(const std::string &previous_tx, u32 txo_index, u64 current_txs_id, u32 txi_index, u64 &previous_output_id);
+	//column_store may be null.
+	InsertState(sqlite3pp::DB &db, ColumnStore *column_store = nullptr);
+	//Creates the tx_locations table in DBs made before it existed. Returns db.
+	static sqlite3pp::DB &initialize_locations_table(sqlite3pp::DB &db);
+	//Makes this state fill one shard of a parallel sync, in a DB of its own,
+	//instead of a whole chain. Blocks and txs get consecutive ids starting
+	//from the ones given, rather than following those already in the DB.
+	//Inputs that spend txs not in the DB don't fail; they're stored without
+	//previous tx and output, and recorded in the unresolved_inputs table.
+	//Since the posting lists can't be built yet, the relations between
+	//addresses and txs are kept in the addresses_txs table, which only shards
+	//have. Those of txs with deferred inputs go to deferred_tx_addresses
+	//instead, since they lack the addresses of those inputs.
+	//Can't be used with a column store.
+	void begin_shard(u64 first_block_id, u64 first_transaction_id);
+	//Makes this state fill the first phase of a bulk sync (see
+	//blockchain_parser/BulkIngest.h). Only inputs that spend txs inserted
+	//since the last flush are resolved; every other input is deferred as in
+	//begin_shard(), without looking anything up in the DB. Address relations
+	//are passed to sink when flushed, instead of being written to the
+	//relation tables, and the relations of txs with deferred inputs aren't
+	//told apart.
+	//In both modes the posting lists are left alone, since deferred relations
+	//arrive out of order. They're built once the relations are complete.
+	//Can't be used with a column store.
+	void begin_bulk(RelationSink &sink);
+	//If location is given, it's stored in the block's row, and the location of
+	//each of the txs inserted next in tx_locations, so that libbtcindex can
+	//serve them from the block files (see libbtcindex/RawTxReader.h).
+	u64 insert_block(const SHA256 &hash, const SHA256 &prev_hash, u32 timestamp, u32 transaction_count, const BlockFileLocation *location = nullptr);
+	u64 insert_tx(const SHA256 &hash, const SHA256 &whash, u32 locktime, u64 block_id, u32 index_in_block, u32 input_count, u32 output_count);
+	u64 insert_input(const SHA256 &previous_tx, u32 txo_index, u64 current_txs_id, u32 txi_index, u64 &previous_output_id, u64 &previous_output_value);
 	u64 insert_output(u64 tx, u32 txo_index, u64 value, u32 required_spenders, const std::vector<u8> &script);
 	u64 insert_address_if_it_doesnt_exist(const std::string &address);
+	const AddressFilter &get_address_filter() const{
+		return this->address_filter;
+	}
 	void add_addresses_outputs_relations(u64 output_id, const std::set<u64> &address_ids);
 	std::set<u64> get_addresses_for_output(u64 output_id);
 	void add_addresses_tx_relations(u64 tx_id, const std::set<u64> &addresses);
+	//Writes all buffered rows.
+	void flush();
+	//Drops all buffered rows.
+	void discard();
+	//Drops all buffered rows and reads the next ids from the DB again. Must be
+	//called after rolling back a transaction the state inserted rows in.
+	//Addresses it added stay in the address filter, which only makes them
+	//false positives.
+	void reload();
 };
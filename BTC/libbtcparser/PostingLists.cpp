@@ -0,0 +1,359 @@
+#include "PostingLists.h"
+#include "SplitLayout.h"
+#include <common/misc.h>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+using namespace sqlite3pp;
+
+const size_t PostingLists::block_size;
+
+//Ids are stored as in serialize_set(): the first id of the block goes in the
+//first_id column and the data holds the differences between consecutive ids.
+static void decode_block(std::vector<u64> &dst, u64 first, const BlobView &data){
+	auto p = (const u8 *)data.data;
+	auto end = p + data.size;
+	auto last = first;
+	dst.push_back(last);
+	while (p < end){
+		u64 delta = 0;
+		u8 byte;
+		do{
+			if (p == end)
+				throw std::runtime_error("PostingLists: corrupted block.");
+			byte = *(p++);
+			delta <<= 7;
+			delta |= byte & 0x7F;
+		}while (byte & 0x80);
+		last += delta;
+		dst.push_back(last);
+	}
+}
+
+//The queries PostingLists and PostingLists::Reader share.
+static const char * const select_block_sql = "select first_id, data from address_postings where addresses_id = ? and kind = ? and first_id <= ? order by first_id desc limit 1;";
+static const char * const select_blocks_sql = "select first_id, data from address_postings where addresses_id = ? and kind = ? order by first_id;";
+static const char * const summarize_sql =
+	"select sum(count), min(first_id), max(last_id) from ("
+		"select count, first_id, last_id from address_postings where addresses_id = ?1 and kind = ?2 "
+		"union all "
+		"select count, first_id, last_id from address_postings_pruned where addresses_id = ?1 and kind = ?2"
+	");";
+
+PostingLists::PostingLists(DB &db)
+	: db(db)
+	, select_tail_stmt(initialize_table(db) << "select first_id, last_id, count, data from address_postings where addresses_id = ? and kind = ? order by first_id desc limit 1;")
+	, select_block_stmt(db << select_block_sql)
+	, select_blocks_stmt(db << select_blocks_sql)
+	, insert_block_stmt(db << "insert into address_postings (addresses_id, kind, first_id, last_id, count, data) values (?, ?, ?, ?, ?, ?);")
+	, update_block_stmt(db << "update address_postings set last_id = ?, count = ?, data = ? where addresses_id = ? and kind = ? and first_id = ?;")
+	, delete_blocks_stmt(db << "delete from address_postings where addresses_id = ? and kind = ? and first_id >= ?;")
+	, delete_block_stmt(db << "delete from address_postings where addresses_id = ? and kind = ? and first_id = ?;")
+	, select_blocks_before_stmt(db << "select first_id, data from address_postings where addresses_id = ? and kind = ? and first_id < ? order by first_id;")
+	, delete_blocks_before_stmt(db << "delete from address_postings where addresses_id = ? and kind = ? and first_id < ?;")
+	, insert_pruned_stmt(db << "insert or ignore into address_postings_pruned (addresses_id, kind, first_id, last_id, count) values (?, ?, ?, 0, 0);")
+	, update_pruned_stmt(db << "update address_postings_pruned set last_id = ?, count = count + ? where addresses_id = ? and kind = ?;")
+	, summarize_stmt(db << summarize_sql){
+}
+
+static const char * const obsolete_indexes[] = {
+	"addresses_outputs_by_addresses_id",
+	"addresses_txs_by_addresses_id",
+	"addresses_txs_by_txs_id",
+};
+
+//The tx lists used to be kept in addresses_txs, which every DB had. Now only
+//shards fill it (see InsertState::begin_shard()), so it's gone from the DBs
+//that have been migrated and from those created since.
+bool PostingLists::needs_migration(DB &db){
+	auto schema = get_table_schema(db, "addresses_outputs");
+	if (db.table_exists("addresses_txs", schema))
+		return true;
+	for (auto index : obsolete_indexes)
+		if (db.index_exists(index, schema))
+			return true;
+	return false;
+}
+
+void PostingLists::migrate(DB &db, const std::function<void(PostingKind, u64)> &progress){
+	u64 postings;
+	initialize_table(db) << "select count(*) from (select * from address_postings limit 1);" << Step() >> postings;
+	auto schema = get_table_schema(db, "addresses_outputs");
+	if (!postings){
+		PostingLists lists(db);
+		lists.build_from_relations("select addresses_id, outputs_id from addresses_outputs order by addresses_id, outputs_id;", PostingKind::Outputs, [&](u64 address){ progress(PostingKind::Outputs, address); });
+		if (db.table_exists("addresses_txs", schema))
+			lists.build_from_relations("select addresses_id, txs_id from addresses_txs order by addresses_id, txs_id;", PostingKind::Txs, [&](u64 address){ progress(PostingKind::Txs, address); });
+	}
+	for (auto index : obsolete_indexes)
+		db.exec(("drop index if exists " + schema + "." + index + ";").c_str());
+	db.exec(("drop table if exists " + schema + ".addresses_txs;").c_str());
+}
+
+DB &PostingLists::initialize_table(DB &db){
+	db.exec(
+		"create table if not exists address_postings (\n"
+		"    addresses_id integer,\n"
+		"    kind integer,\n"
+		"    first_id integer,\n"
+		"    last_id integer,\n"
+		"    count integer,\n"
+		"    data blob,\n"
+		"    primary key (addresses_id, kind, first_id)\n"
+		") without rowid;"
+	);
+	db.exec(
+		"create table if not exists address_postings_pruned (\n"
+		"    addresses_id integer,\n"
+		"    kind integer,\n"
+		"    first_id integer,\n"
+		"    last_id integer,\n"
+		"    count integer,\n"
+		"    primary key (addresses_id, kind)\n"
+		") without rowid;"
+	);
+	return db;
+}
+
+void PostingLists::build_from_relations(const char *relation_query, PostingKind kind, const std::function<void(u64)> &progress){
+	auto stmt = this->db << relation_query;
+	std::vector<u64> ids;
+	u64 current = 0;
+	while (stmt.step() == SQLITE_ROW){
+		u64 address, id;
+		stmt >> address >> id;
+		if (address != current && ids.size()){
+			this->append(current, kind, ids);
+			ids.clear();
+			if (progress)
+				progress(current);
+		}
+		current = address;
+		if (!ids.size() || ids.back() != id)
+			ids.push_back(id);
+	}
+	if (ids.size())
+		this->append(current, kind, ids);
+}
+
+void PostingLists::write_block(u64 address, PostingKind kind, const u64 *ids, size_t n, bool update){
+	std::vector<u8> data;
+	for (size_t i = 1; i < n; i++)
+		serialize(data, ids[i] - ids[i - 1]);
+	if (update)
+		this->update_block_stmt << Reset() << ids[n - 1] << n << no_copy(data) << address << (int)kind << ids[0] << Step();
+	else
+		this->insert_block_stmt << Reset() << address << (int)kind << ids[0] << ids[n - 1] << n << no_copy(data) << Step();
+}
+
+void PostingLists::append(u64 address, PostingKind kind, const std::vector<u64> &ids){
+	if (!ids.size())
+		return;
+	//The deltas are unsigned, so ids out of order would corrupt the list.
+	for (size_t i = 1; i < ids.size(); i++)
+		if (ids[i] <= ids[i - 1])
+			throw std::runtime_error("PostingLists: ids must be appended in order.");
+	size_t i = 0;
+	auto &tail = this->select_tail_stmt;
+	tail << Reset() << address << (int)kind;
+	if (tail.step() == SQLITE_ROW){
+		u64 first, last, count;
+		BlobView view;
+		tail >> first >> last >> count >> view;
+		if (ids.front() <= last){
+			tail << Reset();
+			throw std::runtime_error("PostingLists: ids must be appended in order.");
+		}
+		if (count < block_size){
+			std::vector<u8> data((const u8 *)view.data, (const u8 *)view.data + view.size);
+			for (; i < ids.size() && count < block_size; i++, count++){
+				serialize(data, ids[i] - last);
+				last = ids[i];
+			}
+			tail << Reset();
+			this->update_block_stmt << Reset() << last << count << no_copy(data) << address << (int)kind << first << Step();
+		}
+	}
+	tail << Reset();
+	for (; i < ids.size(); i += block_size)
+		this->write_block(address, kind, ids.data() + i, std::min(block_size, ids.size() - i), false);
+}
+
+void PostingLists::truncate(u64 address, PostingKind kind, u64 first){
+	this->delete_blocks_stmt << Reset() << address << (int)kind << first << Step();
+	auto &tail = this->select_tail_stmt;
+	tail << Reset() << address << (int)kind;
+	if (tail.step() != SQLITE_ROW)
+		return;
+	u64 block_first, last, count;
+	BlobView view;
+	tail >> block_first >> last >> count >> view;
+	if (last < first){
+		tail << Reset();
+		return;
+	}
+	std::vector<u64> ids;
+	ids.reserve((size_t)count);
+	decode_block(ids, block_first, view);
+	tail << Reset();
+	ids.erase(std::lower_bound(ids.begin(), ids.end(), first), ids.end());
+	//block_first < first, so the block can't become empty.
+	this->write_block(address, kind, ids.data(), ids.size(), true);
+}
+
+void PostingLists::prune(u64 address, PostingKind kind, u64 end){
+	//Only the last block that starts before end can hold ids that are kept.
+	std::vector<u64> ids;
+	auto &stmt = this->select_blocks_before_stmt;
+	stmt << Reset() << address << (int)kind << end;
+	while (stmt.step() == SQLITE_ROW){
+		u64 first;
+		BlobView data;
+		stmt >> first >> data;
+		decode_block(ids, first, data);
+	}
+	stmt << Reset();
+	auto kept = std::lower_bound(ids.begin(), ids.end(), end);
+	if (kept == ids.begin())
+		return;
+	this->delete_blocks_before_stmt << Reset() << address << (int)kind << end << Step();
+	if (kept != ids.end())
+		this->write_block(address, kind, &*kept, (size_t)(ids.end() - kept), false);
+	this->insert_pruned_stmt << Reset() << address << (int)kind << ids.front() << Step();
+	this->update_pruned_stmt << Reset() << *(kept - 1) << (u64)(kept - ids.begin()) << address << (int)kind << Step();
+}
+
+void PostingLists::erase(u64 address, PostingKind kind, const std::vector<u64> &ids){
+	auto &stmt = this->select_block_stmt;
+	std::vector<u64> block, kept;
+	for (size_t i = 0; i < ids.size();){
+		stmt << Reset() << address << (int)kind << ids[i];
+		if (stmt.step() != SQLITE_ROW){
+			stmt << Reset();
+			i++;
+			continue;
+		}
+		u64 first;
+		BlobView data;
+		stmt >> first >> data;
+		block.clear();
+		decode_block(block, first, data);
+		stmt << Reset();
+		//ids[i] may be past the end of the block if it isn't in the list.
+		size_t end = std::upper_bound(ids.begin() + i, ids.end(), block.back()) - ids.begin();
+		end = std::max(end, i + 1);
+		kept.clear();
+		std::set_difference(block.begin(), block.end(), ids.begin() + i, ids.begin() + end, std::back_inserter(kept));
+		i = end;
+		if (kept.size() == block.size())
+			continue;
+		this->delete_block_stmt << Reset() << address << (int)kind << first << Step();
+		if (kept.size())
+			this->write_block(address, kind, kept.data(), kept.size(), false);
+	}
+}
+
+static std::vector<u64> read_list(Statement &stmt, u64 address, PostingKind kind){
+	std::vector<u64> ret;
+	stmt << Reset() << address << (int)kind;
+	while (stmt.step() == SQLITE_ROW){
+		u64 first;
+		BlobView data;
+		stmt >> first >> data;
+		decode_block(ret, first, data);
+	}
+	stmt << Reset();
+	return ret;
+}
+
+static boost::optional<PostingSummary> summarize_list(Statement &stmt, u64 address, PostingKind kind){
+	boost::optional<u64> count;
+	PostingSummary ret;
+	stmt << Reset() << address << (int)kind << Step() >> count >> ret.first >> ret.last;
+	stmt << Reset();
+	if (!count)
+		return {};
+	ret.count = *count;
+	return ret;
+}
+
+std::vector<u64> PostingLists::read(u64 address, PostingKind kind){
+	return read_list(this->select_blocks_stmt, address, kind);
+}
+
+boost::optional<PostingSummary> PostingLists::summarize(u64 address, PostingKind kind){
+	return summarize_list(this->summarize_stmt, address, kind);
+}
+
+PostingLists::Reader::Reader(StatementCache &statements)
+	: select_block_stmt(statements << select_block_sql)
+	, select_blocks_stmt(statements << select_blocks_sql)
+	, summarize_stmt(statements << summarize_sql){
+}
+
+std::vector<u64> PostingLists::Reader::read(u64 address, PostingKind kind){
+	return read_list(*this->select_blocks_stmt, address, kind);
+}
+
+boost::optional<PostingSummary> PostingLists::Reader::summarize(u64 address, PostingKind kind){
+	return summarize_list(*this->summarize_stmt, address, kind);
+}
+
+PostingLists::Cursor::Cursor(Statement &select_block_stmt, u64 address, PostingKind kind)
+		: select_block_stmt(&select_block_stmt)
+		, address(address)
+		, kind(kind)
+		, position(0){
+	this->load_block(std::numeric_limits<u64>::max());
+}
+
+bool PostingLists::Cursor::load_block(u64 max){
+	this->block.clear();
+	this->position = 0;
+	auto &stmt = *this->select_block_stmt;
+	//Ids are bound as signed integers.
+	stmt << Reset() << this->address << (int)this->kind << std::min(max, (u64)std::numeric_limits<s64>::max());
+	if (stmt.step() != SQLITE_ROW){
+		stmt << Reset();
+		return false;
+	}
+	u64 first;
+	BlobView data;
+	stmt >> first >> data;
+	decode_block(this->block, first, data);
+	stmt << Reset();
+	this->position = std::upper_bound(this->block.begin(), this->block.end(), max) - this->block.begin() - 1;
+	return true;
+}
+
+void PostingLists::Cursor::next(){
+	if (!this->valid())
+		return;
+	if (this->position){
+		this->position--;
+		return;
+	}
+	auto first = this->block.front();
+	if (first)
+		this->load_block(first - 1);
+	else
+		this->block.clear();
+}
+
+void PostingLists::Cursor::seek(u64 max){
+	if (!this->valid() || this->get() <= max)
+		return;
+	if (this->block.front() > max){
+		this->load_block(max);
+		return;
+	}
+	//Gallop down from the current position to bracket the target, then
+	//binary search the bracket.
+	size_t step = 1;
+	while (step <= this->position && this->block[this->position - step] > max)
+		step *= 2;
+	auto begin = this->block.begin() + (this->position - std::min(step, this->position));
+	auto end = this->block.begin() + (this->position - step / 2);
+	this->position = std::upper_bound(begin, end, max) - this->block.begin() - 1;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <common/types.h>
+#include <sqlitepp/sqlitepp.h>
+#include <boost/optional.hpp>
+#include <functional>
+#include <vector>
+
+enum class PostingKind{
+	Outputs = 0,
+	Txs = 1,
+};
+
+struct PostingSummary{
+	u64 count;
+	u64 first;
+	u64 last;
+};
+
+//For each address, the sorted lists of ids of the outputs and txs it
+//appears in. Lists are split into blocks of up to block_size ids; each block
+//is a row keyed by (address, kind, first id) holding the ids as delta-encoded
+//varints, so the primary key doubles as a list of skip pointers.
+//Ids are only ever appended at the end of a list (new outputs and txs always
+//get higher ids) and only removed from the end (when blocks are reverted),
+//except in pruned DBs (see HistoryPruner.h), which also remove them from the
+//front and, for outputs, from anywhere in the list. The ids pruned from the
+//front of a list are still counted by summarize(), through a row of
+//address_postings_pruned that holds their count and range.
+//DBs made by older versions also keep the tx lists in addresses_txs, and may
+//lack the lists altogether. They must be migrated (see migrate()) before the
+//lists are used.
+class PostingLists{
+public:
+	static const size_t block_size = 128;
+private:
+	sqlite3pp::DB &db;
+	sqlite3pp::Statement select_tail_stmt;
+	sqlite3pp::Statement select_block_stmt;
+	sqlite3pp::Statement select_blocks_stmt;
+	sqlite3pp::Statement insert_block_stmt;
+	sqlite3pp::Statement update_block_stmt;
+	sqlite3pp::Statement delete_blocks_stmt;
+	sqlite3pp::Statement delete_block_stmt;
+	sqlite3pp::Statement select_blocks_before_stmt;
+	sqlite3pp::Statement delete_blocks_before_stmt;
+	sqlite3pp::Statement insert_pruned_stmt;
+	sqlite3pp::Statement update_pruned_stmt;
+	sqlite3pp::Statement summarize_stmt;
+
+	static sqlite3pp::DB &initialize_table(sqlite3pp::DB &db);
+	void write_block(u64 address, PostingKind, const u64 *ids, size_t n, bool update);
+public:
+	PostingLists(sqlite3pp::DB &db);
+	PostingLists(const PostingLists &) = delete;
+	const PostingLists &operator=(const PostingLists &) = delete;
+
+	//Returns whether db was made by an older version and must be migrated.
+	static bool needs_migration(sqlite3pp::DB &db);
+	//Builds the lists from the relation tables if there are none, then drops
+	//addresses_txs and the indexes by address, which nothing reads anymore.
+	//progress is called with the kind and address of each list it finishes.
+	//Should be run in a transaction.
+	static void migrate(sqlite3pp::DB &db, const std::function<void(PostingKind, u64)> &progress);
+	//Appends the (address, id) pairs relation_query returns, which must be
+	//sorted, to lists that must be empty. Duplicate pairs are skipped.
+	//progress, if given, is called with the address of each list it finishes.
+	void build_from_relations(const char *relation_query, PostingKind, const std::function<void(u64)> &progress = {});
+	//ids must be sorted and greater than every id already in the list.
+	void append(u64 address, PostingKind, const std::vector<u64> &ids);
+	//Removes every id >= first.
+	void truncate(u64 address, PostingKind, u64 first);
+	//Removes every id < end. summarize() still counts them.
+	void prune(u64 address, PostingKind, u64 end);
+	//Removes the given ids, which must be sorted. Unlike prune(), summarize()
+	//no longer counts them.
+	void erase(u64 address, PostingKind, const std::vector<u64> &ids);
+	//Returns the whole list, sorted.
+	std::vector<u64> read(u64 address, PostingKind);
+	//Returns the length and the first and last ids of a list, without
+	//decoding it, or none if the list is empty. Pruned ids are included.
+	boost::optional<PostingSummary> summarize(u64 address, PostingKind);
+
+	//Reads the lists through statements checked out of the statement cache
+	//of a connection that's only borrowed (see sqlite3pp::ConnectionPool),
+	//so it may be read-only. The tables must already exist. The statements
+	//go back to the cache when the reader is destroyed.
+	class Cursor;
+	class Reader{
+		friend class Cursor;
+		sqlite3pp::CachedStatement select_block_stmt;
+		sqlite3pp::CachedStatement select_blocks_stmt;
+		sqlite3pp::CachedStatement summarize_stmt;
+	public:
+		Reader(sqlite3pp::StatementCache &);
+		//Same as PostingLists::read() and PostingLists::summarize().
+		std::vector<u64> read(u64 address, PostingKind);
+		boost::optional<PostingSummary> summarize(u64 address, PostingKind);
+	};
+
+	//Walks a list from the highest id down.
+	class Cursor{
+		sqlite3pp::Statement *select_block_stmt;
+		u64 address;
+		PostingKind kind;
+		std::vector<u64> block;
+		//Index into block of the current id.
+		size_t position;
+		Cursor(sqlite3pp::Statement &select_block_stmt, u64 address, PostingKind kind);
+		bool load_block(u64 max);
+	public:
+		Cursor(PostingLists &lists, u64 address, PostingKind kind)
+			: Cursor(lists.select_block_stmt, address, kind){}
+		Cursor(Reader &reader, u64 address, PostingKind kind)
+			: Cursor(*reader.select_block_stmt, address, kind){}
+		bool valid() const{
+			return this->position < this->block.size();
+		}
+		u64 get() const{
+			return this->block[this->position];
+		}
+		void next();
+		//Moves to the highest id <= max. Within a block the target is found by
+		//galloping; blocks entirely above max are skipped without decoding.
+		void seek(u64 max);
+	};
+};
@@ -0,0 +1,56 @@
+#include "SplitLayout.h"
+#include <common/types.h>
+#include <algorithm>
+
+using namespace sqlite3pp;
+
+const std::vector<SplitSchema> split_schemas = {
+	{ "chain", { "blocks", "txs", "tx_locations" } },
+	{ "utxo", { "outputs", "inputs" } },
+	{ "addresses", { "addresses", "addresses_outputs" } },
+};
+
+void create_split_layout(DB &db, const std::string &db_path){
+	db.exec("create table split_layout (schema text primary key);");
+	auto insert = db << "insert into split_layout (schema) values (?);";
+	for (auto &schema : split_schemas)
+		insert << Reset() << schema.name << Step();
+	attach_split_files(db, db_path);
+}
+
+DB &attach_split_files(DB &db, const std::string &db_path){
+	for (auto &schema : get_split_schemas(db))
+		db << ("attach database ? as " + schema + ";").c_str() << get_schema_path(db_path, schema) << Step();
+	return db;
+}
+
+std::vector<std::string> get_split_schemas(DB &db){
+	std::vector<std::string> ret;
+	if (!db.table_exists("split_layout"))
+		return ret;
+	auto stmt = db << "select schema from main.split_layout order by rowid;";
+	while (stmt.step() == SQLITE_ROW){
+		std::string schema;
+		stmt >> schema;
+		ret.push_back(schema);
+	}
+	return ret;
+}
+
+std::string get_table_schema(DB &db, const std::string &table){
+	auto split = get_split_schemas(db);
+	for (auto &schema : split_schemas){
+		if (std::find(split.begin(), split.end(), schema.name) == split.end())
+			continue;
+		for (auto name : schema.tables)
+			if (table == name)
+				return schema.name;
+	}
+	return "main";
+}
+
+std::string get_schema_path(const std::string &db_path, const std::string &schema){
+	if (schema == "main")
+		return db_path;
+	return db_path + "." + schema;
+}
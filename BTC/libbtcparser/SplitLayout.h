@@ -0,0 +1,34 @@
+#pragma once
+
+#include <sqlitepp/sqlitepp.h>
+#include <string>
+#include <vector>
+
+//Optional layout where the chain tables, the UTXO tables and the address
+//tables each live in a file of their own, attached to the main DB under a
+//schema of the same name. The files are named after the main DB (e.g.
+//btc.sqlite.utxo) and can be moved to other disks and replaced with links.
+//Each file has its own lock, journal and page cache, so, for example, their
+//indexes can be built concurrently.
+//Queries don't need to name the schemas: SQLite looks unqualified table names
+//up in every attached DB, and each table only exists in one.
+struct SplitSchema{
+	const char *name;
+	std::vector<const char *> tables;
+};
+
+extern const std::vector<SplitSchema> split_schemas;
+
+//Records in db, which must be new, that it uses the split layout, and
+//attaches the files, creating them.
+void create_split_layout(sqlite3pp::DB &db, const std::string &db_path);
+//Attaches the files of a split DB. Does nothing for a DB in a single file.
+//Must be called on every new connection before any table is used, outside
+//of transactions. Returns db.
+sqlite3pp::DB &attach_split_files(sqlite3pp::DB &db, const std::string &db_path);
+//Returns the schemas of the files attach_split_files() attaches.
+std::vector<std::string> get_split_schemas(sqlite3pp::DB &db);
+//Returns the schema that holds table, which is main unless the DB is split.
+std::string get_table_schema(sqlite3pp::DB &db, const std::string &table);
+//Returns the path of the file behind a schema.
+std::string get_schema_path(const std::string &db_path, const std::string &schema);
@@ -16,6 +16,7 @@ Transaction::Transaction(SerializedBuffer &buffer, bool testnet){
 	this->segwit = segwit_check[0] == 0 && segwit_check[1] == 1;
 
 	txid_sha.update(buffer.get_absolute_buffer(first_offset), buffer.get_offset() - first_offset);
+	this->base_size = buffer.get_offset() - first_offset;
 	
 	if (this->segwit)
 		buffer.read_u16(); //ignore segwit marker
@@ -25,6 +26,7 @@ Transaction::Transaction(SerializedBuffer &buffer, bool testnet){
 	buffer.read_sized_vector(this->outputs, this->output_count, *this, testnet);
 
 	txid_sha.update(buffer.get_absolute_buffer(second_offset), buffer.get_offset() - second_offset);
+	this->base_size += buffer.get_offset() - second_offset;
 
 	if (this->segwit)
 		this->read_witness_data(buffer);
@@ -34,11 +36,13 @@ Transaction::Transaction(SerializedBuffer &buffer, bool testnet){
 	this->lock_time = buffer.read_u32();
 
 	txid_sha.update(buffer.get_absolute_buffer(third_offset), buffer.get_offset() - third_offset);
+	this->base_size += buffer.get_offset() - third_offset;
 	
 	auto txid_digest = txid_sha.final();
 
 	this->hash = SHA256::compute(txid_digest);
 	this->size = buffer.get_offset() - first_offset;
+	this->offset = first_offset;
 	this->whash = SHA256::compute(buffer.get_absolute_buffer(first_offset), this->size, 2);
 }
 
@@ -65,28 +69,47 @@ void Transaction::read_witness_data(SerializedBuffer &buffer){
 		input.read_witnesses(buffer);
 }
 
-void Transaction::insert(u64 block_id, u32 tx_index, InsertState &nis, std::set<u64> &updated_balances){
+u64 Transaction::insert(u64 block_id, u32 tx_index, InsertState &nis, std::set<u64> &updated_balances, BlockInsertInfo *info){
 	try{
 		auto tx_id = nis.insert_tx(this->hash, this->whash, this->lock_time, block_id, tx_index, (u32)this->inputs.size(), (u32)this->outputs.size());
 		u32 txi_index = 0;
 		std::set<u64> addresses;
+		u64 input_total = 0;
+		bool coinbase = false;
 		for (auto &in : this->inputs){
-			auto previous_output = in.insert(tx_id, txi_index++, nis);
-			if (previous_output != std::numeric_limits<u64>::max()){
+			u64 value;
+			auto previous_output = in.insert(tx_id, txi_index++, nis, value);
+			input_total += value;
+			if (previous_output == std::numeric_limits<u64>::max())
+				coinbase = true;
+			else{
 				auto temp = nis.get_addresses_for_output(previous_output);
 				for (auto &id : temp)
 					addresses.insert(id);
+				if (info){
+					info->spent_outputs.push_back(previous_output);
+					for (auto &id : temp)
+						info->balance_deltas[id] -= (s64)value;
+				}
 			}
 		}
 		u32 txo_index = 0;
+		u64 output_total = 0;
 		for (auto &out : this->outputs){
 			auto temp = out.insert(tx_id, txo_index++, nis);
 			for (auto &id : temp)
 				addresses.insert(id);
+			output_total += out.get_value();
+			if (info)
+				for (auto &id : temp)
+					info->balance_deltas[id] += (s64)out.get_value();
 		}
 		nis.add_addresses_tx_relations(tx_id, addresses);
 		for (auto id : addresses)
 			updated_balances.insert(id);
+		if (coinbase || input_total < output_total)
+			return 0;
+		return input_total - output_total;
 	}catch (std::exception &e){
 		std::stringstream stream;
 		stream << "Error while processing transaction " << this->hash << ": " << e.what();
@@ -9,6 +9,7 @@
 
 class SerializedBuffer;
 class InsertState;
+struct BlockInsertInfo;
 
 class LIBBTCPARSER_API Transaction{
 	friend class Block;
@@ -24,6 +25,8 @@ class LIBBTCPARSER_API Transaction{
 	Hashes::Digests::SHA256 hash;
 	Hashes::Digests::SHA256 whash;
 	u64 size;
+	u64 base_size;
+	u64 offset;
 
 	void read_witness_data(SerializedBuffer &buffer);
 public:
@@ -34,7 +37,8 @@ public:
 	const Hashes::Digests::SHA256 &get_whash() const{
 		return this->whash;
 	}
-	void insert(u64 block_id, u32 tx_index, InsertState &nis, std::set<u64> &updated_balances);
+	//Returns the fee paid by the transaction, or 0 for coinbases.
+	u64 insert(u64 block_id, u32 tx_index, InsertState &nis, std::set<u64> &updated_balances, BlockInsertInfo *info = nullptr);
 	u64 estimate_memory_cost() const;
 	const std::vector<TxInput> &get_inputs() const{
 		return this->inputs;
@@ -49,4 +53,12 @@ public:
 	u64 get_size() const{
 		return this->size;
 	}
+	//Offset of the tx in the buffer it was parsed from.
+	u64 get_offset() const{
+		return this->offset;
+	}
+	//Virtual size as defined by BIP 141.
+	u64 get_vsize() const{
+		return (this->base_size * 3 + this->size + 3) / 4;
+	}
 };
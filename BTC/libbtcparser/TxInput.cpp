@@ -14,8 +14,8 @@ void TxInput::read_witnesses(SerializedBuffer &buffer){
 		this->witnesses.emplace_back(buffer.read_sized_buffer());
 }
 
-u64 TxInput::insert(u64 txid, u32 txi_index, InsertState &nis) const{
+u64 TxInput::insert(u64 txid, u32 txi_index, InsertState &nis, u64 &previous_output_value) const{
 	u64 ret;
-	nis.insert_input(this->previous_tx, this->transaction_index, txid, txi_index, ret);
+	nis.insert_input(this->previous_tx, this->transaction_index, txid, txi_index, ret, previous_output_value);
 	return ret;
 }
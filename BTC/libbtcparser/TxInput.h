@@ -14,7 +14,7 @@ class LIBBTCPARSER_API TxInput{
 
 public:
 	TxInput(SerializedBuffer &buffer);
-	u64 insert(u64 txid, u32 txi_index, InsertState &nis) const;
+	u64 insert(u64 txid, u32 txi_index, InsertState &nis, u64 &previous_output_value) const;
 	const Hashes::Digests::SHA256 &get_previous_tx() const{
 		return this->previous_tx;
 	}
@@ -345,6 +345,9 @@ static const script_matcher P2SH = { OP_HASH160, MPUSHBYTES(20), OP_EQUAL, EOS }
 static const script_matcher P2WPKH_1 = { OP_FALSE, MPUSHBYTES(20), EOS };
 static const script_matcher P2WPKH_2 = { OP_FALSE, MPUSHBYTES(32), EOS };
 
+//P2TR
+static const script_matcher P2TR = { OP_1, MPUSHBYTES(32), EOS };
+
 //Malformed P2PKH:
 //static const script_matcher invalid = {OP_DUP, OP_HASH160, MPUSHBYTES(20), OP_EQUAL, OP_CHECKSIG, EOS};
 
@@ -439,9 +442,11 @@ void TxOutput::compute_output_addresses(){
 			this->address_type = AddressType::P2wpkh20;
 		} else if (matches(simplified, P2WPKH_2)){
 			this->address_type = AddressType::P2wpkh32;
+		} else if (matches(simplified, P2TR)){
+			this->address_type = AddressType::P2tr;
 		}
 
-		if (this->address_type == AddressType::P2wpkh20 || this->address_type == AddressType::P2wpkh32){
+		if (this->address_type == AddressType::P2wpkh20 || this->address_type == AddressType::P2wpkh32 || this->address_type == AddressType::P2tr){
 			auto &i = simplified[1];
 			this->addresses.emplace_back(this->address_type, i.data, this->testnet);
 			break;
@@ -1,6 +1,8 @@
 #include "sqlite3.h"
 #include "sqlitepp.h"
 #include <cstring>
+#include <algorithm>
+#include <chrono>
 
 namespace sqlite3pp{
 
@@ -98,6 +100,16 @@ DB::DB(const char *path,bool Throw): lock_count(0){
 	}
 }
 
+DB::DB(const char *path, int flags, bool Throw): lock_count(0){
+	int error = sqlite3_open_v2(path, &this->db, flags, nullptr);
+	if (Throw)
+		throw_sqlite_error(error, this->db);
+	else if (error != SQLITE_OK){
+		sqlite3_close(this->db);
+		this->db = nullptr;
+	}
+}
+
 void DB::exec(const char *s){
 	if (!this->good())
 		return;
@@ -109,13 +121,42 @@ sqlite3_int64 DB::last_insert_rowid(){
 	return sqlite3_last_insert_rowid(this->db);
 }
 
+void DB::add_observer(TransactionObserver *observer){
+	this->observers.push_back(observer);
+}
+
+void DB::remove_observer(TransactionObserver *observer){
+	this->observers.erase(std::remove(this->observers.begin(), this->observers.end(), observer), this->observers.end());
+}
+
+void DB::set_busy_timeout(int milliseconds){
+	if (!this->good())
+		return;
+	throw_sqlite_error(sqlite3_busy_timeout(this->db, milliseconds), this->db);
+}
+
+static bool object_exists(DB &db, const char *type, const std::string &name, const std::string &schema){
+	int count;
+	db << ("select count(*) from " + schema + ".sqlite_master where type = ? and name = ?;").c_str() << type << name << Step() >> count;
+	return !!count;
+}
+
+bool DB::table_exists(const std::string &name, const std::string &schema){
+	return object_exists(*this, "table", name, schema);
+}
+
+bool DB::index_exists(const std::string &name, const std::string &schema){
+	return object_exists(*this, "index", name, schema);
+}
+
 
 Statement DB::operator<<(const char *s){
-	return Statement(this->db, s);
+	return Statement(*this, s);
 }
 
-Statement::Statement(sqlite3 *db,const char *s){
+Statement::Statement(const DB &db,const char *s){
 	this->db = db;
+	this->owner = &db;
 	int error = sqlite3_prepare_v2(db, s, -1, &this->statement, nullptr);
 	throw_sqlite_error(error, db);
 	this->reset();
@@ -123,6 +164,7 @@ Statement::Statement(sqlite3 *db,const char *s){
 
 Statement::Statement(Statement &&s){
 	this->db = s.db;
+	this->owner = s.owner;
 	this->statement = s.statement;
 	this->reset();
 	s.statement = nullptr;
@@ -131,6 +173,9 @@ Statement::Statement(Statement &&s){
 void Statement::uninit(bool throws){
 	if (!this->good())
 		return;
+	auto observer = this->owner ? this->owner->get_step_observer() : nullptr;
+	if (observer)
+		observer->before_finalize(this->statement);
 	int error = sqlite3_finalize(this->statement);
 	if (throws)
 		throw_sqlite_error(error, this->db);
@@ -143,6 +188,7 @@ Statement::~Statement(){
 const Statement &Statement::operator=(Statement &&s){
 	this->uninit();
 	this->db = s.db;
+	this->owner = s.owner;
 	this->statement = s.statement;
 	s.statement = nullptr;
 	return *this;
@@ -227,11 +273,40 @@ Statement &Statement::operator<<(const std::vector<unsigned char> &v){
 	return *this;
 }
 
+Statement &Statement::operator<<(const boost::string_view &s){
+	if (!*this)
+		return *this;
+	//Empty views may have a null data pointer, which SQLite would bind as NULL.
+	auto p = s.size() ? s.data() : "";
+	int error = sqlite3_bind_text(this->statement, this->bind_index++, p, (int)s.size(), SQLITE_STATIC);
+	throw_sqlite_error(error, this->db);
+	return *this;
+}
+
+Statement &Statement::operator<<(const BlobView &v){
+	if (!*this)
+		return *this;
+	static const char c = 0;
+	auto p = v.size ? v.data : &c;
+	int error = sqlite3_bind_blob(this->statement, this->bind_index++, p, (int)v.size, SQLITE_STATIC);
+	throw_sqlite_error(error, this->db);
+	return *this;
+}
+
 int Statement::step(){
 	if (!*this)
 		return SQLITE_ERROR;
 	this->get_index = 0;
+	auto observer = this->owner ? this->owner->get_step_observer() : nullptr;
+	if (!observer){
+		int error = sqlite3_step(this->statement);
+		throw_sqlite_error(error, this->db);
+		return error;
+	}
+	auto start = std::chrono::steady_clock::now();
 	int error = sqlite3_step(this->statement);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	observer->after_step(this->statement, (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
 	throw_sqlite_error(error, this->db);
 	return error;
 }
@@ -276,4 +351,240 @@ Statement &Statement::operator>>(std::vector<unsigned char> &v){
 	return *this;
 }
 
+Statement &Statement::operator>>(boost::string_view &s){
+	//sqlite3_column_text() must be called before sqlite3_column_bytes().
+	auto p = (const char *)sqlite3_column_text(this->statement, this->get_index);
+	size_t size = sqlite3_column_bytes(this->statement, this->get_index++);
+	s = boost::string_view(p ? p : "", size);
+	return *this;
+}
+
+Statement &Statement::operator>>(BlobView &v){
+	v.data = sqlite3_column_blob(this->statement, this->get_index);
+	v.size = sqlite3_column_bytes(this->statement, this->get_index++);
+	return *this;
+}
+
+CachedStatement StatementCache::get(const char *sql){
+	auto &bucket = this->idle[sql];
+	std::unique_ptr<Statement> statement;
+	if (bucket.size()){
+		statement = std::move(bucket.back());
+		bucket.pop_back();
+	}else
+		statement.reset(new Statement(this->db << sql));
+	return CachedStatement(bucket, std::move(statement));
+}
+
+CachedStatement StatementCache::operator<<(const char *sql){
+	return this->get(sql);
+}
+
+void CachedStatement::release(){
+	if (!this->statement)
+		return;
+	try{
+		this->statement->reset();
+		this->bucket->push_back(std::move(this->statement));
+	}catch (std::exception &){
+		//A statement that can't be reset is discarded.
+	}
+	this->statement.reset();
+}
+
+ConnectionPool::Connection::Connection(const char *path, int flags, const Options &options)
+		: db(path, flags | SQLITE_OPEN_NOMUTEX)
+		, statements(this->db){
+	this->db.set_busy_timeout(options.busy_timeout_ms);
+	if (options.initialize)
+		options.initialize(this->db);
+}
+
+ConnectionPool::ConnectionPool(const char *path, const Options &options)
+		: path(path)
+		, options(options){
+	if (!options.writer)
+		return;
+	//The writer is opened first so that the journal mode is set before any
+	//reader opens the file.
+	this->writer.reset(new Connection(path, SQLITE_OPEN_READWRITE, options));
+	if (options.wal)
+		this->writer->db.exec("pragma journal_mode = wal;");
+}
+
+PooledConnection ConnectionPool::get(ConnectionRole role){
+	std::unique_lock<std::mutex> lock(this->mutex);
+	if (role == ConnectionRole::ReadWrite){
+		if (!this->options.writer)
+			throw std::runtime_error("The connection pool has no writer.");
+		this->condition.wait(lock, [this](){ return !this->writer_busy; });
+		this->writer_busy = true;
+		return PooledConnection(*this, std::move(this->writer), role);
+	}
+	this->condition.wait(lock, [this](){ return this->idle_readers.size() || this->reader_count < this->options.max_readers; });
+	std::unique_ptr<Connection> connection;
+	if (this->idle_readers.size()){
+		connection = std::move(this->idle_readers.back());
+		this->idle_readers.pop_back();
+		return PooledConnection(*this, std::move(connection), role);
+	}
+	this->reader_count++;
+	lock.unlock();
+	try{
+		connection.reset(new Connection(this->path.c_str(), SQLITE_OPEN_READONLY, this->options));
+	}catch (...){
+		lock.lock();
+		this->reader_count--;
+		this->condition.notify_one();
+		throw;
+	}
+	return PooledConnection(*this, std::move(connection), role);
+}
+
+void ConnectionPool::release(std::unique_ptr<Connection> &&connection, ConnectionRole role){
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (role == ConnectionRole::ReadWrite){
+			this->writer = std::move(connection);
+			this->writer_busy = false;
+		}else
+			this->idle_readers.push_back(std::move(connection));
+	}
+	this->condition.notify_all();
+}
+
+void PooledConnection::release(){
+	if (!this->connection)
+		return;
+	if (this->connection->db.in_transaction()){
+		try{
+			this->connection->db.rollback();
+		}catch (std::exception &){}
+	}
+	this->pool->release(std::move(this->connection), this->role);
+}
+
+BulkInserterBase::BulkInserterBase(DB &db, const char *head, size_t columns)
+		: db(db)
+		, head(head)
+		, columns(columns){
+	const size_t max_rows_per_statement = 1024;
+	auto max_variables = sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+	this->max_rows = std::max<size_t>(std::min<size_t>(max_variables / columns, max_rows_per_statement), 1);
+}
+
+Statement &BulkInserterBase::get_statement(size_t rows){
+	auto it = this->statements.find(rows);
+	if (it != this->statements.end())
+		return it->second;
+	std::string row = "(";
+	for (size_t i = 0; i < this->columns; i++){
+		if (i)
+			row += ", ";
+		row += '?';
+	}
+	row += ')';
+	std::string sql = this->head;
+	sql += " values ";
+	sql.reserve(sql.size() + (row.size() + 2) * rows);
+	for (size_t i = 0; i < rows; i++){
+		if (i)
+			sql += ", ";
+		sql += row;
+	}
+	sql += ';';
+	auto &ret = this->statements[rows];
+	ret = this->db << sql.c_str();
+	return ret;
+}
+
+void BulkInserterBase::push(const Null &){
+	this->values.push_back({ ValueType::Null, 0, 0 });
+}
+
+void BulkInserterBase::push(std::int64_t x){
+	this->values.push_back({ ValueType::Integer, x, 0 });
+}
+
+void BulkInserterBase::push(const boost::string_view &s){
+	this->values.push_back({ ValueType::Text, (std::int64_t)this->arena.size(), s.size() });
+	this->arena.insert(this->arena.end(), s.begin(), s.end());
+}
+
+void BulkInserterBase::push(const BlobView &v){
+	this->values.push_back({ ValueType::Blob, (std::int64_t)this->arena.size(), v.size });
+	auto p = (const char *)v.data;
+	this->arena.insert(this->arena.end(), p, p + v.size);
+}
+
+std::int64_t BulkInserterBase::get_integer(size_t row, size_t column) const{
+	auto &value = this->values[row * this->columns + column];
+	if (value.type != ValueType::Integer)
+		throw std::runtime_error("BulkInserter: value is not an integer.");
+	return value.integer;
+}
+
+void BulkInserterBase::set_integer(size_t row, size_t column, std::int64_t x){
+	this->values[row * this->columns + column] = { ValueType::Integer, x, 0 };
+}
+
+void BulkInserterBase::set_null(size_t row, size_t column){
+	this->values[row * this->columns + column] = { ValueType::Null, 0, 0 };
+}
+
+void BulkInserterBase::bind(Statement &stmt, const Value &value){
+	switch (value.type){
+		case ValueType::Null:
+			stmt << Null();
+			break;
+		case ValueType::Integer:
+			stmt << value.integer;
+			break;
+		case ValueType::Text:
+			stmt << boost::string_view(this->arena.data() + value.integer, value.size);
+			break;
+		case ValueType::Blob:
+			stmt << BlobView{ this->arena.data() + value.integer, value.size };
+			break;
+	}
+}
+
+void BulkInserterBase::flush(const size_t *order){
+	auto rows = this->size();
+	for (size_t i = 0; i < rows;){
+		auto n = std::min(this->max_rows, rows - i);
+		if (n != this->max_rows){
+			size_t power = 1;
+			while (power * 2 <= n)
+				power *= 2;
+			n = power;
+		}
+		auto &stmt = this->get_statement(n);
+		stmt.reset();
+		for (auto j = i; j < i + n; j++){
+			auto row = order ? order[j] : j;
+			for (size_t k = 0; k < this->columns; k++)
+				this->bind(stmt, this->values[row * this->columns + k]);
+		}
+		stmt.step();
+		i += n;
+	}
+	this->clear();
+}
+
+std::vector<size_t> BulkInserterBase::sort_order(size_t column) const{
+	std::vector<size_t> order(this->size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [this, column](size_t a, size_t b){
+		return this->values[a * this->columns + column].integer < this->values[b * this->columns + column].integer;
+	});
+	return order;
+}
+
+void BulkInserterBase::clear(){
+	this->values.clear();
+	this->arena.clear();
+}
+
 }
@@ -7,7 +7,15 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <array>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <map>
+#include <type_traits>
+#include <functional>
 #include <boost/optional.hpp>
+#include <boost/utility/string_view.hpp>
 #include "sqlite3.h"
 
 #ifdef USE_BOOST
@@ -39,11 +47,37 @@ namespace sqlite3pp{
 
 class Statement;
 
+//Lets state kept outside the database follow its transactions.
+class TransactionObserver{
+public:
+	virtual ~TransactionObserver(){}
+	//Called inside the transaction, right before it's committed.
+	virtual void before_commit() = 0;
+	virtual void after_commit() = 0;
+	virtual void after_rollback() = 0;
+};
+
+//Receives the time spent in each call to sqlite3_step() made through a
+//Statement of the connection, and is told when such a Statement is about to be
+//finalized, since its sqlite3_stmt may then be reused for another statement.
+class StepObserver{
+public:
+	virtual ~StepObserver(){}
+	virtual void after_step(sqlite3_stmt *, std::uint64_t nanoseconds) = 0;
+	virtual void before_finalize(sqlite3_stmt *) = 0;
+};
+
 class SQLITEPP_API DB{
 	sqlite3 *db;
 	unsigned lock_count;
+	std::vector<TransactionObserver *> observers;
+	StepObserver *step_observer = nullptr;
 public:
 	DB(const char *path, bool Throw = true);
+	//flags are passed to sqlite3_open_v2().
+	DB(const char *path, int flags, bool Throw = true);
+	DB(const DB &) = delete;
+	const DB &operator=(const DB &) = delete;
 	~DB(){
 		if (this->good())
 			sqlite3_close(this->db);
@@ -57,6 +91,13 @@ public:
 	Statement operator<<(const char *s);
 	void exec(const char *s);
 	sqlite3_int64 last_insert_rowid();
+	void set_busy_timeout(int milliseconds);
+	//Look the object up in the sqlite_master of the given schema.
+	bool table_exists(const std::string &name, const std::string &schema = "main");
+	bool index_exists(const std::string &name, const std::string &schema = "main");
+	bool in_transaction() const{
+		return !!this->lock_count;
+	}
 	void begin_transaction(){
 		if (!this->lock_count)
 			this->exec("begin exclusive transaction;");
@@ -65,15 +106,31 @@ public:
 	void commit(){
 		if (this->lock_count)
 			this->lock_count--;
-		if (!this->lock_count)
+		if (!this->lock_count){
+			for (auto o : this->observers)
+				o->before_commit();
 			this->exec("commit;");
+			for (auto o : this->observers)
+				o->after_commit();
+		}
 	}
 	void rollback(){
 		if (this->lock_count){
 			this->exec("rollback;");
 			this->lock_count=0;
+			for (auto o : this->observers)
+				o->after_rollback();
 		}
 	}
+	void add_observer(TransactionObserver *);
+	void remove_observer(TransactionObserver *);
+	//Only one step observer can be set at a time. Pass null to remove it.
+	void set_step_observer(StepObserver *observer){
+		this->step_observer = observer;
+	}
+	StepObserver *get_step_observer() const{
+		return this->step_observer;
+	}
 };
 
 class SQLITEPP_API Transaction{
@@ -105,14 +162,38 @@ class Step{};
 
 class Reset{};
 
+//Non-owning reference to a blob.
+struct BlobView{
+	const void *data;
+	size_t size;
+};
+
+/*
+	Views are bound with SQLITE_STATIC, so the data they point to is not
+	copied and must stay valid until the statement is reset or rebound.
+	Normally, this means the bound object must outlive the last step().
+
+	Reading a view returns a pointer into SQLite's own buffer, which is only
+	valid until the next step() or reset().
+*/
+
+inline boost::string_view no_copy(const std::string &s){
+	return s;
+}
+
+inline BlobView no_copy(const std::vector<unsigned char> &v){
+	return { v.data(), v.size() };
+}
+
 class SQLITEPP_API Statement{
 	sqlite3 *db = nullptr;
+	const DB *owner = nullptr;
 	sqlite3_stmt *statement = nullptr;
 	unsigned bind_index = 0,
 		get_index = 0;
 
 	friend class DB;
-	Statement(sqlite3 *db,const char *s);
+	Statement(const DB &db,const char *s);
 	void uninit(bool throws = true);
 public:
 	Statement(): statement(nullptr){}
@@ -146,6 +227,12 @@ public:
 	}
 	Statement &operator<<(const std::string &);
 	Statement &operator<<(const std::vector<unsigned char> &);
+	Statement &operator<<(const boost::string_view &);
+	Statement &operator<<(const BlobView &);
+	template <size_t N>
+	Statement &operator<<(const std::array<unsigned char, N> &a){
+		return *this << BlobView{ a.data(), N };
+	}
 	/*
 		How to use:
 		while (stmt.step()==SQLITE_ROW){
@@ -174,6 +261,8 @@ public:
 	Statement &operator>>(double &d);
 	Statement &operator>>(std::string &s);
 	Statement &operator>>(std::vector<unsigned char> &v);
+	Statement &operator>>(boost::string_view &);
+	Statement &operator>>(BlobView &);
 	template <typename T>
 	Statement &operator>>(std::unique_ptr<T> &p){
 		auto type = sqlite3_column_type(this->statement, this->get_index);
@@ -208,5 +297,260 @@ public:
 	}
 };
 
+//Buffers rows for a single table and writes them with multi-row
+//"insert ... values (...), (...), ..." statements, which avoids paying the
+//cost of a full statement step for every row. Nothing is written until
+//flush() is called. Statements are prepared once per batch size; full
+//batches use as many rows as SQLITE_LIMIT_VARIABLE_NUMBER allows and the
+//remainder is written in power-of-two batches.
+class SQLITEPP_API BulkInserterBase{
+	enum class ValueType : unsigned char{
+		Null,
+		Integer,
+		Text,
+		Blob,
+	};
+	struct Value{
+		ValueType type;
+		//For text and blobs, the offset of the data in the arena.
+		std::int64_t integer;
+		size_t size;
+	};
+	DB &db;
+	std::string head;
+	size_t columns;
+	size_t max_rows;
+	std::vector<Value> values;
+	//Text and blob values are copied here, so adding a row never allocates
+	//once the buffers have grown.
+	std::vector<char> arena;
+	std::map<size_t, Statement> statements;
+
+	Statement &get_statement(size_t rows);
+	void bind(Statement &, const Value &);
+	void flush(const size_t *order);
+protected:
+	BulkInserterBase(DB &db, const char *head, size_t columns);
+	void push(const Null &);
+	void push(std::int64_t);
+	void push(const boost::string_view &);
+	void push(const BlobView &);
+	void push(const std::string &s){
+		this->push(boost::string_view(s));
+	}
+	void push(const std::vector<unsigned char> &v){
+		this->push(BlobView{ v.data(), v.size() });
+	}
+	template <typename T>
+	typename std::enable_if<std::is_integral<T>::value>::type push(T x){
+		this->push((std::int64_t)x);
+	}
+	template <typename T>
+	void push(const boost::optional<T> &x){
+		if (x)
+			this->push(*x);
+		else
+			this->push(Null());
+	}
+public:
+	BulkInserterBase(const BulkInserterBase &) = delete;
+	const BulkInserterBase &operator=(const BulkInserterBase &) = delete;
+	size_t size() const{
+		return this->values.size() / this->columns;
+	}
+	std::int64_t get_integer(size_t row, size_t column) const;
+	void set_integer(size_t row, size_t column, std::int64_t);
+	void set_null(size_t row, size_t column);
+	void flush(){
+		this->flush(nullptr);
+	}
+	//order is a permutation of the rows, e.g. from sort_order().
+	void flush(const std::vector<size_t> &order){
+		this->flush(order.data());
+	}
+	//Returns the row indices stably sorted by the integer value in the given
+	//column.
+	std::vector<size_t> sort_order(size_t column) const;
+	//Writes the rows ordered by the integer value in the given column, so
+	//that they reach the indices on that column in order.
+	void flush_sorted(size_t column){
+		this->flush(this->sort_order(column));
+	}
+	void clear();
+};
+
+template <size_t N>
+class BulkInserter : public BulkInserterBase{
+	void push_all(){}
+	template <typename T, typename... Args>
+	void push_all(const T &x, const Args &... args){
+		this->push(x);
+		this->push_all(args...);
+	}
+public:
+	//head is everything up to "values", e.g.
+	//"insert into addresses_txs (addresses_id, txs_id)".
+	BulkInserter(DB &db, const char *head): BulkInserterBase(db, head, N){}
+	//Returns the index of the new row.
+	template <typename... Args>
+	size_t add(const Args &... args){
+		static_assert(sizeof...(Args) == N, "Incorrect number of columns.");
+		auto ret = this->size();
+		this->push_all(args...);
+		return ret;
+	}
+};
+
+class CachedStatement;
+
+//Keeps prepared statements for a single connection, keyed by SQL text, so
+//that code that doesn't own a connection doesn't need to re-prepare its
+//queries every time it gets one. Statements are checked out through
+//CachedStatement and go back to the cache when it's destroyed. The same
+//query may be checked out more than once at the same time; each checkout
+//gets its own statement.
+class SQLITEPP_API StatementCache{
+	friend class CachedStatement;
+	typedef std::vector<std::unique_ptr<Statement>> bucket_t;
+	DB &db;
+	std::unordered_map<std::string, bucket_t> idle;
+public:
+	StatementCache(DB &db): db(db){}
+	StatementCache(const StatementCache &) = delete;
+	const StatementCache &operator=(const StatementCache &) = delete;
+	CachedStatement get(const char *sql);
+	CachedStatement operator<<(const char *sql);
+	void clear(){
+		this->idle.clear();
+	}
+};
+
+class SQLITEPP_API CachedStatement{
+	StatementCache::bucket_t *bucket;
+	std::unique_ptr<Statement> statement;
+	void release();
+public:
+	CachedStatement(StatementCache::bucket_t &bucket, std::unique_ptr<Statement> &&statement)
+		: bucket(&bucket)
+		, statement(std::move(statement)){}
+	CachedStatement(const CachedStatement &) = delete;
+	CachedStatement(CachedStatement &&other)
+		: bucket(other.bucket)
+		, statement(std::move(other.statement)){}
+	~CachedStatement(){
+		this->release();
+	}
+	const CachedStatement &operator=(const CachedStatement &) = delete;
+	const CachedStatement &operator=(CachedStatement &&other){
+		this->release();
+		this->bucket = other.bucket;
+		this->statement = std::move(other.statement);
+		return *this;
+	}
+	Statement &operator*(){
+		return *this->statement;
+	}
+	Statement *operator->(){
+		return this->statement.get();
+	}
+	template <typename T>
+	Statement &operator<<(const T &x){
+		return *this->statement << x;
+	}
+	template <typename T>
+	Statement &operator>>(T &x){
+		return *this->statement >> x;
+	}
+	int step(){
+		return this->statement->step();
+	}
+};
+
+enum class ConnectionRole{
+	ReadOnly,
+	ReadWrite,
+};
+
+class PooledConnection;
+
+//Hands out connections to a single database file to any number of threads.
+//There is a single read-write connection and up to max_readers read-only
+//connections. Each connection has its own StatementCache. get() blocks until
+//a connection of the requested role is available.
+class SQLITEPP_API ConnectionPool{
+public:
+	struct Options{
+		//If false, the pool only has readers, e.g. for an owner that writes
+		//through a connection of its own.
+		bool writer = true;
+		//Put the database in WAL mode, so that readers don't block the writer
+		//or each other. Only done if there's a writer.
+		bool wal = true;
+		int busy_timeout_ms = 5000;
+		size_t max_readers = 4;
+		//Called on every connection right after it's opened, e.g. to attach
+		//databases or to set a step observer.
+		std::function<void(DB &)> initialize;
+	};
+	struct Connection{
+		DB db;
+		StatementCache statements;
+		Connection(const char *path, int flags, const Options &);
+	};
+private:
+	friend class PooledConnection;
+	std::string path;
+	Options options;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::unique_ptr<Connection> writer;
+	bool writer_busy = false;
+	std::vector<std::unique_ptr<Connection>> idle_readers;
+	size_t reader_count = 0;
+
+	void release(std::unique_ptr<Connection> &&, ConnectionRole);
+public:
+	ConnectionPool(const char *path, const Options &options);
+	ConnectionPool(const char *path): ConnectionPool(path, Options()){}
+	ConnectionPool(const ConnectionPool &) = delete;
+	const ConnectionPool &operator=(const ConnectionPool &) = delete;
+	PooledConnection get(ConnectionRole role);
+};
+
+//Returns the connection to its pool when destroyed. Any transaction left open
+//is rolled back.
+class SQLITEPP_API PooledConnection{
+	ConnectionPool *pool;
+	std::unique_ptr<ConnectionPool::Connection> connection;
+	ConnectionRole role;
+	void release();
+public:
+	PooledConnection(ConnectionPool &pool, std::unique_ptr<ConnectionPool::Connection> &&connection, ConnectionRole role)
+		: pool(&pool)
+		, connection(std::move(connection))
+		, role(role){}
+	PooledConnection(const PooledConnection &) = delete;
+	PooledConnection(PooledConnection &&other)
+		: pool(other.pool)
+		, connection(std::move(other.connection))
+		, role(other.role){}
+	~PooledConnection(){
+		this->release();
+	}
+	const PooledConnection &operator=(const PooledConnection &) = delete;
+	DB &db(){
+		return this->connection->db;
+	}
+	StatementCache &statements(){
+		return this->connection->statements;
+	}
+	CachedStatement operator<<(const char *sql){
+		return this->connection->statements.get(sql);
+	}
+	ConnectionRole get_role() const{
+		return this->role;
+	}
+};
+
 }
 #endif
@@ -0,0 +1,136 @@
+#include <blockchain_gen/ChainGenerator.h>
+#include <common/misc.h>
+#include <nlohmann/json.hpp>
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+typedef std::chrono::steady_clock Clock;
+
+//Blocks in the chain at scale 1.
+static const u64 blocks_per_scale = 1000;
+
+static double seconds_since(Clock::time_point start){
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static std::vector<u64> parse_scales(const std::string &s){
+	std::vector<u64> ret;
+	std::stringstream stream(s);
+	std::string item;
+	while (std::getline(stream, item, ','))
+		ret.push_back(std::stoull(item));
+	if (!ret.size())
+		throw std::runtime_error("No scales given.");
+	for (auto scale : ret)
+		if (!scale)
+			throw std::runtime_error("Scales must be positive.");
+	return ret;
+}
+
+//Reads the summaries blockchain_parser wrote at the end of each phase.
+static nlohmann::json read_phases(const std::string &path){
+	std::ifstream file(path);
+	if (!file)
+		throw std::runtime_error("blockchain_parser didn't write metrics to " + path);
+	auto ret = nlohmann::json::array();
+	std::string line;
+	while (std::getline(file, line)){
+		auto record = nlohmann::json::parse(line);
+		if (record["type"] != "summary")
+			continue;
+		nlohmann::json phase;
+		for (auto key : { "phase", "elapsed_s", "blocks", "blocks_per_s", "txs_per_s", "inputs_per_s", "mb_read_per_s", "commits", "commit_ms_mean" })
+			phase[key] = record[key];
+		ret.push_back(phase);
+	}
+	return ret;
+}
+
+static std::string quote(const std::string &s){
+	return "\"" + s + "\"";
+}
+
+static nlohmann::json run_scale(const std::string &parser, const std::string &work_directory, u64 scale, ChainGeneratorSettings settings){
+	using namespace boost::filesystem;
+	auto directory = work_directory + "/scale" + std::to_string(scale);
+	auto output = directory + "/out";
+	auto metrics = directory + "/metrics.jsonl";
+	auto log = directory + "/blockchain_parser.log";
+	remove_all(directory);
+	create_directories(output);
+
+	settings.blocks = blocks_per_scale * scale;
+	auto start = Clock::now();
+	auto generated = ChainGenerator(settings).generate(directory);
+	auto generate_seconds = seconds_since(start);
+
+	std::cerr << current_time_string() << " - Syncing scale " << scale << " (" << SizeFormatter(generated.bytes) << ")...\n";
+	auto command = quote(parser) + " " + quote(directory) + " " + quote(output) + " " + (settings.testnet ? "1" : "0") + " 0 " + quote(metrics) + " > " + quote(log) + " 2>&1";
+#ifdef _WIN32
+	//cmd.exe strips the outer quotes if the command starts with one.
+	command = quote(command);
+#endif
+	start = Clock::now();
+	if (std::system(command.c_str()))
+		throw std::runtime_error("blockchain_parser failed. See " + log);
+	auto sync_seconds = seconds_since(start);
+
+	nlohmann::json ret;
+	ret["scale"] = scale;
+	ret["blocks"] = generated.blocks;
+	ret["orphans"] = generated.orphans;
+	ret["txs"] = generated.txs;
+	ret["inputs"] = generated.inputs;
+	ret["outputs"] = generated.outputs;
+	ret["block_files"] = generated.files;
+	ret["block_bytes"] = generated.bytes;
+	ret["generate_s"] = generate_seconds;
+	ret["sync_s"] = sync_seconds;
+	ret["db_bytes"] = file_size(output + "/btc.sqlite");
+	ret["phases"] = read_phases(metrics);
+	//blockchain_parser reports errors in worker threads but carries on.
+	for (auto &phase : ret["phases"])
+		if (phase["phase"] == "parse_blocks" && phase["blocks"] != generated.blocks)
+			throw std::runtime_error("blockchain_parser didn't parse the whole chain. See " + log);
+	return ret;
+}
+
+int main(int argc, char **argv){
+	if (argc < 3){
+		std::cerr <<
+			"Usage: sync_bench <blockchain_parser> <work dir> [<scales> [<seed> [<txs per block>]]]\n"
+			"\n"
+			"For each scale in the comma-separated list (by default, 1), generates a\n"
+			"synthetic chain of scale * 1000 blocks in <work dir>/scale<n>, runs a full\n"
+			"blockchain_parser sync on it and reports the time taken by each phase as\n"
+			"JSON. Any previous contents of <work dir>/scale<n> are deleted. The chain\n"
+			"depends only on the seed (by default, 1) and txs per block (by default,\n"
+			"100), so runs with the same arguments can be compared.\n";
+		return -1;
+	}
+	try{
+		std::string parser = argv[1];
+		std::string work_directory = argv[2];
+		auto scales = parse_scales(argc >= 4 ? argv[3] : "1");
+		ChainGeneratorSettings settings;
+		if (argc >= 5)
+			settings.seed = std::stoull(argv[4]);
+		if (argc >= 6)
+			settings.transactions_per_block = std::stoull(argv[5]);
+
+		nlohmann::json ret;
+		ret["seed"] = settings.seed;
+		ret["transactions_per_block"] = settings.transactions_per_block;
+		ret["results"] = nlohmann::json::array();
+		for (auto scale : scales)
+			ret["results"].push_back(run_scale(parser, work_directory, scale, settings));
+		std::cout << ret.dump(1, '\t') << std::endl;
+	}catch (std::exception &e){
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+	return 0;
+}